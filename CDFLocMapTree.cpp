@@ -22,7 +22,7 @@
  **
  ** Copyright (C) 2003-2005 B. M. Bolstad
  **
- ** aim: a tree structure to hold mappings between probesets
+ ** aim: a structure to hold mappings between probesets
  **      and locations on the array.
  **
  ** Created on: Apr 17, 2003
@@ -38,290 +38,374 @@
  **                than make a copy (removes a long standing memory leak)
  ** Mar 29, 2005 - adapt structure to hold Probesets which have
  **                differing numbers of PM and MM probes
+ ** Oct 17, 2026 - Replace the AVL tree of LocMapItems with flat arrays of
+ **                the PM and MM locations of every probeset, in order, and
+ **                a hash table from probeset name to index
+ ** Oct 17, 2026 - Attach() arrays held elsewhere, such as those of a memory mapped file
  **
  *********************************************************/
 
 #include <wx/wx.h>
 #include "CDFLocMapTree.h"
-//#include <iostream.h>
 
-wxString  LocMapItem::GetName() const{
-  return ProbesetName;
 
-}
+CDFLocMapTree::CDFLocMapTree() {
 
+  pm_start.push_back(0);
+  mm_start.push_back(0);
+  attached = NULL;
+  release_attached = NULL;
+  Point();
 
-int  LocMapItem::GetMMSize(){
-  return n_mm_probes;
 }
 
-int  LocMapItem::GetPMSize(){
-  return n_pm_probes;
-}
+CDFLocMapTree::~CDFLocMapTree(){
 
-int *LocMapItem::GetPMLocs(){
-  return PMLoc;
-}
+  if (attached != NULL && release_attached != NULL){
+    release_attached(attached);
+  }
 
-int *LocMapItem::GetMMLocs(){
-  return MMLoc;
 }
 
 
+/* Points the arrays in use at the vectors */
 
-CDFLocMapTree::CDFLocMapTree() {
-
-  root = 0;
+void CDFLocMapTree::Point(){
 
+  pm_offsets = &pm_start[0];
+  mm_offsets = &mm_start[0];
+  pm_cells = pm_locs.empty() ? NULL : &pm_locs[0];
+  mm_cells = mm_locs.empty() ? NULL : &mm_locs[0];
 }
 
-CDFLocMapTree::~CDFLocMapTree(){
-
-  delete root;
-
-}
 
+/* Copies attached arrays into the vectors, so they may be changed,
+   and lets the storage go */
 
-bool CDFLocMapTree::isEmpty(){
+void CDFLocMapTree::Own(){
 
-  if (root == 0){
-    return true;
+  int n = (int)names.size();
+  
+  if (!pm_start.empty()){
+    /* the vectors are in use already */
+    return;
   }
-  return false;
-
+  pm_start.assign(pm_offsets, pm_offsets + n + 1);
+  mm_start.assign(mm_offsets, mm_offsets + n + 1);
+  pm_locs.assign(pm_cells, pm_cells + pm_offsets[n]);
+  mm_locs.assign(mm_cells, mm_cells + mm_offsets[n]);
+  if (release_attached != NULL){
+    release_attached(attached);
+  }
+  attached = NULL;
+  release_attached = NULL;
+  Point();
 }
 
 
+/************************************************
+ **
+ ** void CDFLocMapTree::Attach(const wxArrayString &probeset_names, 
+ **                            const int *PM_start, const int *MM_start,
+ **	                       const int *PM, const int *MM, 
+ **                            void *storage, void (*release)(void *storage))
+ **
+ ** Replaces the contents with the probesets probeset_names, 
+ ** whose PM cells are PM[PM_start[i]] to PM[PM_start[i+1]-1] 
+ ** (likewise for MM), using those arrays where they are 
+ ** rather than copying them. They must stay there until 
+ ** release (if not NULL) is called with storage, when the 
+ ** tree is done with them.
+ **
+ ************************************************/
+
+void CDFLocMapTree::Attach(const wxArrayString &probeset_names, const int *PM_start, const int *MM_start,
+			   const int *PM, const int *MM, void *storage, void (*release)(void *storage)){
+
+  int i;
+  int n = (int)probeset_names.GetCount();
+  int n_slots = 16;
 
- void  CDFLocMapTree::avlRotLeft(CDFLocMapNode **ptr)
-{
-  CDFLocMapNode *tmp = *ptr;
+  if (attached != NULL && release_attached != NULL){
+    release_attached(attached);
+  }
+  attached = storage;
+  release_attached = release;
+
+  names.clear();
+  hashes.clear();
+  names.reserve(n);
+  hashes.reserve(n);
+  for (i = 0; i < n; i++){
+    names.push_back(probeset_names[i]);
+    hashes.push_back(HashName(probeset_names[i]));
+  }
+  std::vector<int>().swap(pm_start);
+  std::vector<int>().swap(mm_start);
+  std::vector<int>().swap(pm_locs);
+  std::vector<int>().swap(mm_locs);
+
+  pm_offsets = PM_start;
+  mm_offsets = MM_start;
+  pm_cells = PM;
+  mm_cells = MM;
   
-  *ptr = (*ptr)->Right;
-  tmp->Right = (*ptr)->Left;
-  (*ptr)->Left = tmp;
+  while (n_slots < 2*n){
+    n_slots = 2*n_slots;
+  }
+  Rehash(n_slots);
 }
 
 
+bool CDFLocMapTree::isEmpty(){
 
+  if (names.empty()){
+    return true;
+  }
+  return false;
 
-void  CDFLocMapTree::avlRotRight(CDFLocMapNode **ptr)
-{
-  CDFLocMapNode *tmp = *ptr;
-  
-  *ptr = (*ptr)->Left;
-  tmp->Left = (*ptr)->Right;
-  (*ptr)->Right = tmp;
 }
 
 
+int CDFLocMapTree::GetCount(){
 
+  return (int)names.size();
 
-long CDFLocMapTree::avlLeftGrew(CDFLocMapNode **ptr){
-
-  if ((*ptr)->skew == -1){
-    if ((*ptr)->Left->skew == -1){
-      (*ptr)->skew = (*ptr)->Left->skew = 0;
-      avlRotRight(ptr);
-    } else {
-      if ((*ptr)->Left->Right->skew == -1){
-	(*ptr)->skew = 1;
-	(*ptr)->Left->skew =0;
-      } else if ( (*ptr)->Left->Right->skew == 1){
-	(*ptr)->skew = 0;
-	(*ptr)->Left->skew = -1;
-      } else {
-	(*ptr)->skew = 0;
-	(*ptr)->Left->skew =0;
-      }
-      (*ptr)->Left->Right->skew = 0;
-      avlRotLeft(& (*ptr)->Left);
-      avlRotRight(ptr);
-    }
-    return 0;
-  } else if ((*ptr)->skew == 1){
-    (*ptr)->skew = 0;
-    return 0;
-  } else {
-    (*ptr)->skew = -1;
-    return 1;
-  }
-}
-
-long CDFLocMapTree::avlRightGrew(CDFLocMapNode **ptr){
-
-
-  if ((*ptr)->skew == -1){
-    (*ptr) ->skew = 0;
-    return 0;
-  } else if ((*ptr)->skew == 1){
-    if ((*ptr)->Right->skew == 1) {        
-      (*ptr)->skew = (*ptr)->Right->skew = 0;
-      avlRotLeft(ptr);
-    } else {
-      if ((*ptr)->Right->Left->skew == 1){
-		(*ptr)->skew = -1;
-		(*ptr)->Right->skew = 0;
-      } else if ((*ptr)->Right->Left->skew == -1){
-		(*ptr)->skew = 0;
-		(*ptr)->Right->skew = 1;
-      } else {
-		(*ptr)->skew = 0;
-		(*ptr)->Right->skew = 0;
-      }
-      (*ptr)->Right->Left->skew = 0;
-      avlRotRight(& (*ptr)->Right);
-      avlRotLeft(ptr);
-    }
-    
-    return 0;
-  } else {
-    (*ptr)->skew = 1;
-    return 1;
-  }
 }
 
 
 /************************************************
  **
- ** long CDFLocMapTree::InsertNode(CDFLocMapNode **ptr, const LocMapItem &value)
- **
- **
+ ** void CDFLocMapTree::Reserve(int n_probesets, int n_probes)
  **
- ** return value of 1 when balance needed, 0 when
- ** no such balance needed. 
+ ** Makes room for n_probesets probesets with n_probes 
+ ** PM (and as many MM) probes between them, when it is 
+ ** known how many are to be inserted.
  **
  ************************************************/
 
-long CDFLocMapTree::InsertNode(CDFLocMapNode **ptr, const LocMapItem *value){
-  
-  //wxString CurrentName;
-  //wxString CompareName;
-  
-  long tmp;
-
-  if (*ptr == 0){
-    *ptr = new CDFLocMapNode(value);
-    return 1;
-  } else {
-   // CurrentName = ((*ptr)->data)->GetName();
-   // CompareName = (value->GetName());
-    if (((*ptr)->data)->GetName().Cmp(value->GetName()) < 0){
-      tmp = InsertNode(&((*ptr)->Left),value);
-      if (tmp){
-	return avlLeftGrew(ptr);
-      }
-      return tmp;
-    } else {
-      tmp = InsertNode( &( ( *ptr )->Right ), value );
-      if (tmp){
-	return avlRightGrew(ptr);
-      }
-      return tmp;
+void CDFLocMapTree::Reserve(int n_probesets, int n_probes){
+
+  Own();
+  names.reserve(n_probesets);
+  hashes.reserve(n_probesets);
+  pm_start.reserve(n_probesets + 1);
+  mm_start.reserve(n_probesets + 1);
+  pm_locs.reserve(n_probes);
+  mm_locs.reserve(n_probes);
+  if ((int)slots.size() < 2*n_probesets){
+    int n_slots = 16;
+    while (n_slots < 2*n_probesets){
+      n_slots = 2*n_slots;
     }
-
+    Rehash(n_slots);
   }
-
 }
 
-void CDFLocMapTree::Insert(const LocMapItem *value){
-  InsertNode(&root,value);
-}
 
-CDFLocMapNode::CDFLocMapNode(const LocMapItem *dataitem){
+/* FNV-1a */
 
-  data = (LocMapItem *)dataitem;
-  skew = 0;
-  Left = 0;
-  Right = 0;
-}
+unsigned int CDFLocMapTree::HashName(const wxString &x){
 
-CDFLocMapNode::~CDFLocMapNode(){
-  if (Left != 0){
-    delete Left;
-  }
-  if (Right !=0){
-    delete Right;
+  unsigned int hash = 2166136261U;
+
+  for (const wxChar *c = x.c_str(); *c != 0; c++){
+    hash = (hash ^ (unsigned int)*c)*16777619U;
   }
-  delete data;
+  return hash;
 }
 
-long CDFLocMapNode::getSkew(){
-  return skew;
-}
 
-LocMapItem::LocMapItem(){
+/* Rebuilds the hash table with n_slots (a power of 2) slots. When a
+   name was inserted more than once, Find() gives the first */
 
-  MMLoc =0;
-  PMLoc = 0;
-  
+void CDFLocMapTree::Rehash(int n_slots){
 
+  int i, slot;
+  int mask = n_slots - 1;
 
+  slots.assign(n_slots, -1);
+  for (i = 0; i < (int)names.size(); i++){
+    slot = (int)(hashes[i] & mask);
+    while (slots[slot] >= 0 && (hashes[slots[slot]] != hashes[i] || names[slots[slot]] != names[i])){
+      slot = (slot + 1) & mask;
+    }
+    if (slots[slot] < 0){
+      slots[slot] = i;
+    }
+  }
 }
 
 
+/************************************************
+ **
+ ** int CDFLocMapTree::Insert(const wxString &name, int n_pm_probes, int n_mm_probes, 
+ **                           const int *PM, const int *MM)
+ **
+ ** Adds a probeset, copying its PM and MM locations 
+ ** (either may be NULL if there are none). Returns 
+ ** its index.
+ **
+ ************************************************/
 
-LocMapItem::LocMapItem(wxString name, int n_pm_probes,int n_mm_probes,  int *PM, int *MM){
+int CDFLocMapTree::Insert(const wxString &name, int n_pm_probes, int n_mm_probes, const int *PM, const int *MM){
 
-  this->ProbesetName = name;
-  this->n_pm_probes = n_pm_probes;
-  this->n_mm_probes = n_mm_probes;
-  this->MMLoc = MM;
-  this->PMLoc = PM;
+  int index = (int)names.size();
+  
+  Own();
+  names.push_back(name);
+  hashes.push_back(HashName(name));
+  if (n_pm_probes > 0){
+    pm_locs.insert(pm_locs.end(), PM, PM + n_pm_probes);
+  }
+  if (n_mm_probes > 0){
+    mm_locs.insert(mm_locs.end(), MM, MM + n_mm_probes);
+  }
+  pm_start.push_back((int)pm_locs.size());
+  mm_start.push_back((int)mm_locs.size());
+  Point();
 
+  if (2*(int)names.size() > (int)slots.size()){
+    Rehash(slots.empty() ? 16 : 2*(int)slots.size());
+  } else {
+    int mask = (int)slots.size() - 1;
+    int slot = (int)(hashes[index] & mask);
+    while (slots[slot] >= 0 && (hashes[slots[slot]] != hashes[index] || names[slots[slot]] != name)){
+      slot = (slot + 1) & mask;
+    }
+    if (slots[slot] < 0){
+      slots[slot] = index;
+    }
+  }
+  return index;
 }
 
 
+/************************************************
+ **
+ ** void CDFLocMapTree::Reorder(const wxArrayString &order)
+ **
+ ** Rearranges the probesets so that the one called 
+ ** order[i] has index i, and the probesets can be gone 
+ ** through in that order without looking any up. Any 
+ ** not named in order follow, as they were.
+ **
+ ************************************************/
 
+void CDFLocMapTree::Reorder(const wxArrayString &order){
 
-
-
-LocMapItem::~LocMapItem(){
+  int i, index;
+  int n = (int)order.GetCount();
+  std::vector<char> placed(names.size(), 0);
+  std::vector<int> from;
   
-  if (MMLoc != 0){
-    delete [] MMLoc;
+  for (i = 0; i < n && i < (int)names.size() && names[i] == order[i]; i++);
+  if (i == n){
+    /* already in that order */
+    return;
+  }
+
+  Own();
+  from.reserve(names.size());
+  for (i = 0; i < n; i++){
+    index = Find(order[i]);
+    if (index >= 0){
+      from.push_back(index);
+      placed[index] = 1;
+    }
   }
-  if (PMLoc != 0){
-    delete [] PMLoc;
+  for (i = 0; i < (int)names.size(); i++){
+    if (!placed[i]){
+      from.push_back(i);
+    }
   }
 
-  
+  std::vector<wxString> new_names;
+  std::vector<unsigned int> new_hashes;
+  std::vector<int> new_pm_start, new_mm_start, new_pm_locs, new_mm_locs;
+
+  new_names.reserve(from.size());
+  new_hashes.reserve(from.size());
+  new_pm_start.reserve(from.size() + 1);
+  new_mm_start.reserve(from.size() + 1);
+  new_pm_locs.reserve(pm_locs.size());
+  new_mm_locs.reserve(mm_locs.size());
+  new_pm_start.push_back(0);
+  new_mm_start.push_back(0);
+  for (i = 0; i < (int)from.size(); i++){
+    index = from[i];
+    new_names.push_back(names[index]);
+    new_hashes.push_back(hashes[index]);
+    new_pm_locs.insert(new_pm_locs.end(), pm_locs.begin() + pm_start[index], pm_locs.begin() + pm_start[index + 1]);
+    new_mm_locs.insert(new_mm_locs.end(), mm_locs.begin() + mm_start[index], mm_locs.begin() + mm_start[index + 1]);
+    new_pm_start.push_back((int)new_pm_locs.size());
+    new_mm_start.push_back((int)new_mm_locs.size());
+  }
+
+  names.swap(new_names);
+  hashes.swap(new_hashes);
+  pm_start.swap(new_pm_start);
+  mm_start.swap(new_mm_start);
+  pm_locs.swap(new_pm_locs);
+  mm_locs.swap(new_mm_locs);
+  Point();
+
+  int n_slots = 16;
+  while (n_slots < 2*(int)names.size()){
+    n_slots = 2*n_slots;
+  }
+  Rehash(n_slots);
 }
 
 
+/* The index of the probeset called x, -1 if there is none */
 
-LocMapItem *CDFLocMapTree::Find(const wxString &x){
+int CDFLocMapTree::Find(const wxString &x){
 
-  return FindNode(&root,x);
+  unsigned int hash;
+  int mask, slot;
 
+  if (slots.empty()){
+    return -1;
+  }
+  hash = HashName(x);
+  mask = (int)slots.size() - 1;
+  slot = (int)(hash & mask);
+  while (slots[slot] >= 0){
+    if (hashes[slots[slot]] == hash && names[slots[slot]] == x){
+      return slots[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+  return -1;
 }
 
 
-LocMapItem *CDFLocMapTree::FindNode(CDFLocMapNode **ptr, const wxString &x){
+const wxString &CDFLocMapTree::GetName(int index){
+  return names[index];
+}
 
-  LocMapItem *result;
-  wxString CurrentName;
+int CDFLocMapTree::GetPMSize(int index){
+  return pm_offsets[index + 1] - pm_offsets[index];
+}
 
-  //wxPrintf("Looking for "+ x + "\n");
+int CDFLocMapTree::GetMMSize(int index){
+  return mm_offsets[index + 1] - mm_offsets[index];
+}
 
-  if (*ptr == 0){
-    // Not found in tree should give error
-    result = NULL;
-  } else {
-    CurrentName = ((*ptr)->data)->GetName();
-    if (CurrentName.Cmp(x)   < 0){
-      result = FindNode(&((*ptr)->Left),x);
-    } else if (CurrentName.Cmp(x)   >  0){
-      result = FindNode( &( ( *ptr )->Right ), x);
-    } else {
-      result = ((*ptr)->data);
-    }
-    
-  } 
-  return result;
 
+/* NULL if the probeset has no PM (MM) probes */
 
+const int *CDFLocMapTree::GetPMLocs(int index){
+  if (pm_offsets[index + 1] == pm_offsets[index]){
+    return NULL;
+  }
+  return pm_cells + pm_offsets[index];
 }
 
-
-
+const int *CDFLocMapTree::GetMMLocs(int index){
+  if (mm_offsets[index + 1] == mm_offsets[index]){
+    return NULL;
+  }
+  return mm_cells + mm_offsets[index];
+}
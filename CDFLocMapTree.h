@@ -2,69 +2,60 @@
 #define CDFLocMapTree_H
 
 #include <wx/wx.h>
+#include <vector>
 
-class LocMapItem
-{
-  friend class CDFLocMapNode;
-  
- public:
-  LocMapItem();
-  LocMapItem(wxString name, int n_pm_probes,int n_mm_probes,  int *PM, int *MM);
-  ~LocMapItem();
-  wxString GetName() const;
-  int GetSize();
-  int GetMMSize();
-  int GetPMSize();
-  int *GetPMLocs();
-  int *GetMMLocs();
- private:
-  wxString ProbesetName;
-  
-  int n_pm_probes;
-  int n_mm_probes;
-
-  int *MMLoc;
-  int *PMLoc;
+/* The cells of each probeset, in the order the probesets were inserted.
+   Probeset i is found by its index: its PM cells are GetPMSize(i) ints
+   starting at GetPMLocs(i), and likewise its MM cells. Find() gives the
+   index for a probeset name. (Once an AVL tree, hence the name.) 
 
-
-};
-
-
-class CDFLocMapNode
-{
-  friend class CDFLocMapTree;
-
- public:
-  CDFLocMapNode();
-  CDFLocMapNode(const LocMapItem *);
-  ~CDFLocMapNode();
-  long getSkew();
- private:
-  LocMapItem *data;
-  long skew;
-  CDFLocMapNode *Left;
-  CDFLocMapNode *Right;
-};
+   The arrays may also be ones that lie elsewhere, such as in a memory
+   mapped RME CDF file (Attach()). They are then copied only if the
+   probesets are added to or rearranged. */
 
 class CDFLocMapTree
 {
  public:
   CDFLocMapTree();
   ~CDFLocMapTree();
-  void Insert(const LocMapItem *);
-  LocMapItem *Find(const wxString &x);
+  void Reserve(int n_probesets, int n_probes);
+  int Insert(const wxString &name, int n_pm_probes, int n_mm_probes, const int *PM, const int *MM);
+  void Reorder(const wxArrayString &order);
+  void Attach(const wxArrayString &probeset_names, const int *PM_start, const int *MM_start,
+	      const int *PM, const int *MM, void *storage, void (*release)(void *storage));
+  int Find(const wxString &x);
+  int GetCount();
   bool isEmpty();
- private:
-  long InsertNode(CDFLocMapNode **ptr, const LocMapItem *value);
-  LocMapItem *FindNode(CDFLocMapNode **ptr, const wxString &x);
-  long avlLeftGrew(CDFLocMapNode **ptr);
-  long avlRightGrew(CDFLocMapNode **ptr);
-  void  avlRotLeft(CDFLocMapNode **ptr);
-  void  avlRotRight(CDFLocMapNode **ptr);
 
-  CDFLocMapNode *root;
-  
+  const wxString &GetName(int index);
+  int GetPMSize(int index);
+  int GetMMSize(int index);
+  const int *GetPMLocs(int index);
+  const int *GetMMLocs(int index);
 
+ private:
+  static unsigned int HashName(const wxString &x);
+  void Rehash(int n_slots);
+  void Own();
+  void Point();
+  CDFLocMapTree(const CDFLocMapTree &);             /* not copyable */
+  CDFLocMapTree &operator=(const CDFLocMapTree &);
+
+  std::vector<wxString> names;
+  std::vector<unsigned int> hashes;  /* HashName() of each name */
+  std::vector<int> pm_start;         /* PM cells of probeset i are pm_locs[pm_start[i]] to pm_locs[pm_start[i+1]-1]. Empty while attached */
+  std::vector<int> mm_start;
+  std::vector<int> pm_locs;
+  std::vector<int> mm_locs;
+  std::vector<int> slots;            /* open addressed hash table of indices, -1 for empty */
+
+  /* the arrays in use: either the vectors above or attached ones */
+  const int *pm_offsets;
+  const int *mm_offsets;
+  const int *pm_cells;
+  const int *mm_cells;
+  void *attached;
+  void (*release_attached)(void *storage);
 };
 
 #endif
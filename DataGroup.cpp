@@ -105,6 +105,38 @@
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
  ** Mar 6, 2008 - Refine parsing error detection
  ** May 16, 2009 - Repair binary CDF file parsing
+ ** Oct 17, 2026 - Add GetColumn() for copying out all the intensities of an array at once
+ ** Oct 17, 2026 - Buffer sizes may be chosen from the available memory when reading CEL files
+ ** Oct 17, 2026 - CEL files are parsed in parallel by a pool of threads (ReadCELFiles())
+ ** Oct 17, 2026 - CEL files are parsed straight into their (pinned) columns rather than
+ **                into a temporary array that was then copied
+ ** Oct 17, 2026 - Optionally store only the PM probes, in PMProbeBatch order, so that
+ **                PMProbeBatch can take the intensities over (PMOnly(), GivePMIntensities())
+ ** Oct 17, 2026 - Each CEL file is opened once to find its format and header, the result
+ **                kept (and saved per directory) and used by the checks and the reading
+ **                (describeCelFile(), CELHeaderCache)
+ ** Oct 17, 2026 - Read gzipped CEL files (zlib builds). Each is decompressed whole into
+ **                memory, by a separate thread that keeps a few files ahead of the
+ **                parsing (CELInflater), and parsed from there
+ ** Oct 17, 2026 - A DataGroup holding only PM probes may background adjust each array,
+ **                and add it into the quantile normalization distribution, as soon as it
+ **                is read (stream_steps, StreamedSteps(), GiveQuantileTarget())
+ ** Oct 17, 2026 - Keep the arrays after those steps in a preprocessed cache directory,
+ **                and read them back from there rather than the CEL files. Arrays may
+ **                be added to such a DataGroup (Add()), going through the same steps
+ ** Oct 17, 2026 - cdflocs keeps the probesets in probeset_names order, so they are walked
+ **                by index. FindLocMapItem() removed
+ ** Oct 17, 2026 - WriteBinaryCDF() may write version 4 RME CDF files, laid out to be
+ **                memory mapped
+ ** Oct 17, 2026 - Binary cdf files are mapped into memory and their cells decoded, 
+ **                by several threads, straight into the probeset locations (ReadXDACDF())
+ ** Oct 17, 2026 - Text cdf files are read from memory a byte at a time rather than
+ **                through wxTextInputStream, their cell lines parsed by several threads
+ **                (ReadTextCDF())
+ ** Oct 17, 2026 - CDF files may be kept compiled, as memory mappable RME CDF files, 
+ **                in a directory for them and read from there on later runs
+ ** Oct 17, 2026 - Preprocessed array files are named with a hash of the CEL file's
+ **                full path and the stream_steps, so that they don't collide
  **
  *****************************************************/
 
@@ -119,14 +151,31 @@
 #include <wx/txtstrm.h>
 #include <wx/tokenzr.h>
 #include <wx/datstrm.h>
+#include <wx/thread.h>
+#include <wx/textfile.h>
 #include <math.h>
-
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <new>
+
+#if !defined(_WIN32) || defined(__CYGWIN32__) || defined(__CYGWIN__)
+#include <sys/types.h>
+#include <sys/mman.h>
+#define CDF_TEXT_HAVE_MMAP 1
+#endif
 
 #include "Parsing/read_celfile_generic.h"
 #include "Parsing/read_celfile_xda.h"
 #include "Parsing/read_celfile_text.h"
 #include "Parsing/read_rme_cdf.h"
 #include "Parsing/read_cel_structures.h"
+#include "Parsing/fread_functions.h"
+#include "Preprocess/rma_background3.h"
+#include "Preprocess/qnorm.h"
 #include "version_number.h"
 
 #define BUF_SIZE 1024
@@ -198,6 +247,8 @@ wxString parsingErrorCode(int err_code){
     ErrorString = wxT("cel file does not seem to have dimensions matching those of previously seen files");
   } else if (err_code == CEL_NON_MATCHING_CDFNAMES){
     ErrorString = wxT("cel file does not seem to have same CDF as those of previously seen files");
+  } else if (err_code == CEL_OUT_OF_MEMORY){
+    ErrorString = wxT("not enough memory to read the cel file");
   } else {
 	  ErrorString = wxT("unknown parsing problem ");// + err_code;
   }
@@ -209,88 +260,6 @@ wxString parsingErrorCode(int err_code){
 }
 
 
-/******************************************************
- **
- ** bool StopAtNextOccurance(wxTextInputStream *in_stream, 
- **                          wxString *lineBuffer, 
- **                          wxString searchstring)
- **
- ** wxTextInputStream *in_stream
- ** wxString *lineBuffer
- ** wxString searchstring
- **
- ******************************************************/
-
-bool StopAtNextOccurance(wxTextInputStream *in_stream, wxString *lineBuffer, wxString searchstring, wxFFileInputStream &stream){
-  *lineBuffer = (wxChar *)"";
-  while ((lineBuffer)->Contains(searchstring) == 0){
-    if (stream.Eof()){
-      return false;
-    }
-    *lineBuffer = in_stream->ReadLine();   
-  }
-  
-  return true;
-
-} 
-
-
-/******************************************************
- **
- ** bool parse_CDF_CEL_LINE(wxString LineBuffer, 
- **                         int *xloc,int *yloc, 
- **                         bool *isPM)
- **
- ** wxString LineBuffer
- ** int *xloc,int *yloc
- ** bool *isPM
- **
- **
- ******************************************************/
-
-
-void parse_CDF_CEL_LINE(wxString &LineBuffer, int *xloc,int *yloc, bool *isPM){
-  wxString CurrentToken;
-  wxString Pbase;
-  wxString Tbase;
-
-  wxStringTokenizer tkz(LineBuffer,_T("=\t\n"));
-  
-  long tempbuffer;
-
-  // first element is a Cell* so skip
-  tkz.GetNextToken();
-
-  CurrentToken = tkz.GetNextToken();
-  
-  //CurrentToken.ToLong((long int*)xloc,10);
-  CurrentToken.ToLong(&tempbuffer,10);
-  *xloc = (int)tempbuffer;
-
-  CurrentToken = tkz.GetNextToken();
-  //CurrentToken.ToLong((long int*)yloc,10);
-  CurrentToken.ToLong(&tempbuffer,10);
-  *yloc = (int)tempbuffer;
-  
-  // go to ninth position
-  for (int skip=2; skip <9; skip++)
-    CurrentToken = tkz.GetNextToken();
- 
-  Pbase = CurrentToken;
-  Tbase = tkz.GetNextToken();
-  
-  if (Pbase.Cmp(Tbase) == 0){
-    *isPM = false;
-  } else if (((Pbase.Cmp(_T("A"))== 0) && (Tbase.Cmp(_T("T")) != 0)) || ((Pbase.Cmp(_T("T"))== 0) && (Tbase.Cmp(_T("A")) != 0))){
-    *isPM = false;
-  } else if (((Pbase.Cmp(_T("C"))== 0) && (Tbase.Cmp(_T("G")) != 0)) || ((Pbase.Cmp(_T("G"))== 0) && (Tbase.Cmp(_T("C")) != 0))){
-    *isPM = false;
-  } else {
-    *isPM = true;
-  }
-}
-
- 
 /******************************************************
  **
  ** int xy2i(int xloc, int yloc, int sidelength)
@@ -328,608 +297,1980 @@ int is_cdf_text(const wxString cdf_path){
 
 
 
-/******************************************************
- **
- ** bool DataGroup::ReadCDFFile(const wxString cdf_fname, 
- **                             const wxString cdf_path)
- **
- ** const wxString cdf_fname - just the filename
- ** const wxString cdf_path - full path including filename
- **                           
- **
- **
- ******************************************************/
+/* Decodes blocks first to last-1 of a binary cdf file into their 
+   places in the PM and MM locations */
 
-void DataGroup::ReadCDFFile(const wxString cdf_fname, 
-			    const wxString cdf_path){
-  int i,j,k;
+struct CDFXDADecodeRange {
+  const cdf_xda_map *cdf;
+  const std::vector<cdf_xda_block> *blocks;
+  const std::vector<int> *pm_start;
+  const std::vector<int> *mm_start;
+  std::vector<int> *pm_locs;
+  std::vector<int> *mm_locs;
+  int first;
+  int last;
+  bool ok;
 
+  void Decode(){
+    int b;
+    int *PM = pm_locs->empty() ? NULL : &(*pm_locs)[0];
+    int *MM = mm_locs->empty() ? NULL : &(*mm_locs)[0];
 
-  int *PMLoc;
-  int *MMLoc;
+    ok = true;
+    for (b = first; b < last && ok; b++){
+      ok = (decode_cdf_xda_block(cdf, &(*blocks)[b], PM + (*pm_start)[b],
+				 ((*mm_start)[b+1] > (*mm_start)[b]) ? MM + (*mm_start)[b] : NULL) != 0);
+    }
+  }
+};
 
-  LocMapItem *currentitem;
-  wxString currentName;
-  
-  if (is_cdf_xda((char *)cdf_path.char_str())){ 
 
-    cdf_xda my_cdf;
-    int cur_blocks,cur_cells, cur_atoms;
-    cdf_unit_cell *current_cell;
+#if wxUSE_THREADS
+class CDFXDADecoder : public wxThread
+{
+ public:
+  CDFXDADecoder(CDFXDADecodeRange *r) : wxThread(wxTHREAD_JOINABLE), range(r) {}
 
+ protected:
+  ExitCode Entry(){
+    range->Decode();
+    return 0;
+  }
 
+ private:
+  CDFXDADecodeRange *range;
+};
+#endif
 
-    if (!read_cdf_xda((char *)cdf_path.char_str(),&my_cdf)){
-      dealloc_cdf_xda(&my_cdf);
-      wxString Error = _T("Problem reading binary cdf file ") + cdf_fname + _T(". Possibly corrupted or truncated?\n");
-      throw Error;
-    }
-    // Use the name of the cdf file as the ArrayTypeName
-    ArrayTypeName.Add(cdf_fname.Mid(0, cdf_fname.length()-4));
 
-    
-    array_rows = (int )my_cdf.header.rows;
-    array_cols = (int )my_cdf.header.cols;
-    n_probesets  = my_cdf.header.n_units;
-#if RMA_GUI_APP
-    wxProgressDialog CDFProgress(_T("CDF Progress"),_T("Reading in CDF file"),n_probesets,this->parent,wxPD_AUTO_HIDE);
-#endif
+/* The PM and MM locations of a cdf file, attached to the CDFLocMapTree */
 
-    for (i=0; i < my_cdf.header.n_units; i++){
-      cur_blocks = my_cdf.units[i].nblocks;
-
-      if (my_cdf.units[i].unittype ==1){
-	/* Expression analysis */
-	for (j=0; j < cur_blocks; j++){
-
-	  cur_cells = my_cdf.units[i].unit_block[j].ncells;
-	  cur_atoms = my_cdf.units[i].unit_block[j].natoms;
-	  n_probes+=cur_atoms;
-	  currentName =  wxString(my_cdf.units[i].unit_block[j].blockname,wxConvUTF8);
-	  
-	  PMLoc = new int[cur_atoms];
-	
-	  if (cur_cells == 2*cur_atoms){
-	    MMLoc = new int[cur_atoms];
-	  } else {
-	    MMLoc = NULL;
-	  }
-	  
-	  for (k=0; k < cur_cells; k++){
-	    current_cell = &(my_cdf.units[i].unit_block[j].unit_cells[k]);
-	    
-	    if(isPM(current_cell->pbase,current_cell->tbase)){
-	      PMLoc[current_cell->atomnumber] = current_cell->x + current_cell->y*(my_cdf.header.rows);        
-	    } else {
-	      MMLoc[current_cell->atomnumber] = current_cell->x + current_cell->y*(my_cdf.header.rows);
-	    }
-	  }
-	  
-	  if (MMLoc == NULL){
-	    currentitem = new LocMapItem(currentName,cur_atoms,0,PMLoc,MMLoc); 
-	  } else {
-	    currentitem = new LocMapItem(currentName,cur_atoms,cur_atoms,PMLoc,MMLoc); 
-	  }
-	  cdflocs.Insert(currentitem);
-	  probeset_names.Add(currentName);
-	} 
+struct CDFLocations {
+  std::vector<int> pm_start;
+  std::vector<int> mm_start;
+  std::vector<int> pm_locs;
+  std::vector<int> mm_locs;
+};
+
+static void release_cdf_locations(void *storage){
+  delete (CDFLocations *)storage;
+}
+
+
+struct CDFXDANameOrder {
+  const wxArrayString *names;
+  bool operator()(int a, int b) const {
+    return (*names)[a].Cmp((*names)[b]) < 0;
+  }
+};
+
+
+/******************************************************
+ **
+ ** void DataGroup::ReadXDACDF(const wxString cdf_fname, 
+ **                            const wxString cdf_path)
+ **
+ ** Reads a binary (XDA) cdf file. The file is mapped into 
+ ** memory and only the unit and block headers are read in 
+ ** turn. Once it is known where each probeset's locations
+ ** go, in the order of the sorted probeset names, the cells
+ ** are decoded straight into place by several threads, 
+ ** each taking a range of the probesets.
+ **
+ ******************************************************/
+
+void DataGroup::ReadXDACDF(const wxString cdf_fname, const wxString cdf_path){
+
+  cdf_xda_map my_cdf;
+  cdf_xda_block block;
+  std::vector<cdf_xda_block> file_blocks, blocks;
+  std::vector<int> order;
+  wxArrayString names;
+  CDFLocations *locations;
+  CDFXDANameOrder name_order;
+  unsigned short unittype;
+  size_t position;
+  char blockname[65];
+  int i, j, n, nblocks = 0;
+  int nthreads = 1;
+  bool ok = true;
+  wxString Error;
+  wxString Corrupt = _T("Problem reading binary cdf file ") + cdf_fname + _T(". Possibly corrupted or truncated?\n");
+
+  if (!map_cdf_xda((char *)cdf_path.char_str(), &my_cdf)){
+    throw Corrupt;
+  }
+
+  /* Where the blocks are, in the order of the file */
+  file_blocks.reserve(my_cdf.header.n_units);
+  for (i = 0; i < my_cdf.header.n_units && Error.IsEmpty(); i++){
+    if (!get_cdf_xda_unit(&my_cdf, i, &unittype, &nblocks, &position)){
+      Error = Corrupt;
+    } else if (unittype != 1){
+      Error = _T("This looks like a cdf file for an non-expression array. Genotyping array? Not handled.\n");
+    }
+    for (j = 0; Error.IsEmpty() && j < nblocks; j++){
+      if (!get_cdf_xda_block(&my_cdf, &position, &block)){
+	Error = Corrupt;
       } else {
-	wxString Error = _T("This looks like a cdf file for an non-expression array. Genotyping array? Not handled.\n");
-	throw Error;
+	file_blocks.push_back(block);
       }
-#if RMA_GUI_APP   
-      if (i % (n_probesets/200) == 0){
-	CDFProgress.Update(i);
-      }
-#endif
     }
-    currentitem = NULL;
-    probeset_names.Sort();
-    dealloc_cdf_xda(&my_cdf);
-  } else if (is_cdf_text(cdf_path)){
-
-    int n_cells = 0, n_blocks = 0, unit_type=0;
-    int xloc, yloc;
-    bool isPM;
-    int whichPM=0;
-    int whichMM=0;
-    int current_npp;
-    //    int nremoved = 0;
+  }
+  if (!Error.IsEmpty()){
+    unmap_cdf_xda(&my_cdf);
+    throw Error;
+  }
 
-    long tempbuffer;
-  
+  /* and in the order of their names */
+  n = (int)file_blocks.size();
+  names.Alloc(n);
+  order.resize(n);
+  for (i = 0; i < n; i++){
+    memcpy(blockname, file_blocks[i].blockname, 64);
+    blockname[64] = '\0';
+    names.Add(wxString(blockname, wxConvUTF8));
+    order[i] = i;
+  }
+  name_order.names = &names;
+  std::stable_sort(order.begin(), order.end(), name_order);
+
+  locations = new CDFLocations;
+  blocks.resize(n);
+  probeset_names.Alloc(n);
+  locations->pm_start.resize(n + 1);
+  locations->mm_start.resize(n + 1);
+  locations->pm_start[0] = 0;
+  locations->mm_start[0] = 0;
+  for (i = 0; i < n; i++){
+    blocks[i] = file_blocks[order[i]];
+    probeset_names.Add(names[order[i]]);
+    if (blocks[i].natoms > INT_MAX - locations->pm_start[i]){
+      ok = false;
+      break;
+    }
+    locations->pm_start[i+1] = locations->pm_start[i] + blocks[i].natoms;
+    locations->mm_start[i+1] = locations->mm_start[i] + ((blocks[i].ncells - blocks[i].natoms == blocks[i].natoms) ? blocks[i].natoms : 0);
+  }
+  if (ok){
+    locations->pm_locs.assign(locations->pm_start[n], 0);
+    locations->mm_locs.assign(locations->mm_start[n], 0);
+
+#if wxUSE_THREADS
+    /* a thread is not worth it for less than a few thousand probesets */
+    nthreads = wxThread::GetCPUCount();
+    if (nthreads > n/4096 + 1){
+      nthreads = n/4096 + 1;
+    }
+#endif
+    if (nthreads < 1){
+      nthreads = 1;
+    }
     
-    wxString LineBuffer;
-    wxString restofline;
-
+    std::vector<CDFXDADecodeRange> ranges(nthreads);
+    for (i = 0; i < nthreads; i++){
+      ranges[i].cdf = &my_cdf;
+      ranges[i].blocks = &blocks;
+      ranges[i].pm_start = &locations->pm_start;
+      ranges[i].mm_start = &locations->mm_start;
+      ranges[i].pm_locs = &locations->pm_locs;
+      ranges[i].mm_locs = &locations->mm_locs;
+      ranges[i].first = (int)(((long long)n*i)/nthreads);
+      ranges[i].last = (int)(((long long)n*(i+1))/nthreads);
+    }
 
-    wxFFileInputStream my_CDF_file_stream(cdf_path);
-    wxTextInputStream my_CDF_file(my_CDF_file_stream);
-    LineBuffer.Alloc(1000);    
-    LineBuffer = my_CDF_file.ReadLine();
-    
-    if (LineBuffer.StartsWith(_T("[CDF]")) != true){
-      wxString Error = _T("The file ") + cdf_fname + _T(" doesn't look like a valid CDF file.\n");
-      throw Error;
-      
-    } 
-    
-    while (LineBuffer.StartsWith(_T("[Chip]")) != true){
-      LineBuffer = my_CDF_file.ReadLine();
+#if wxUSE_THREADS
+    std::vector<CDFXDADecoder *> decoders;
+    for (i = 1; i < nthreads; i++){
+      CDFXDADecoder *decoder = new CDFXDADecoder(&ranges[i]);
+      if (decoder->Create() != wxTHREAD_NO_ERROR || decoder->Run() != wxTHREAD_NO_ERROR){
+	/* do it here instead */
+	delete decoder;
+	ranges[i].Decode();
+      } else {
+	decoders.push_back(decoder);
+      }
+    }
+#endif
+    ranges[0].Decode();
+#if wxUSE_THREADS
+    for (i = 0; i < (int)decoders.size(); i++){
+      decoders[i]->Wait();
+      delete decoders[i];
     }
-    
-    // readinchip  name
-    LineBuffer = my_CDF_file.ReadLine();
-    
-    //ArrayTypeName = LineBuffer.After('=');
-    
-    ArrayTypeName.Add(cdf_fname.Mid(0, cdf_fname.length()-4));
-    
-    
-    while (LineBuffer.StartsWith(_T("Rows="),&restofline) != true)
-      LineBuffer = my_CDF_file.ReadLine();
-    restofline.ToLong(&tempbuffer,10);
-    array_rows = (int)tempbuffer;
-    
-    while (LineBuffer.StartsWith(_T("Cols="),&restofline) != true){
-      LineBuffer = my_CDF_file.ReadLine();
-#if DEBUG
-      wxPrintf(LineBuffer+" \n", i);
 #endif
+    for (i = 0; i < nthreads; i++){
+      ok = ok && ranges[i].ok;
     }
-    // restofline.ToLong((long int*)&array_cols,10);
-    restofline.ToLong(&tempbuffer,10);
-    array_cols = (int)tempbuffer;
+  }
+  if (!ok){
+    unmap_cdf_xda(&my_cdf);
+    delete locations;
+    throw Corrupt;
+  }
 
-    while (LineBuffer.StartsWith(_T("NumberOfUnits="),&restofline) != true)
-      LineBuffer = my_CDF_file.ReadLine();
-    // restofline.ToLong((long int*)&n_probesets,10);
-    restofline.ToLong(&tempbuffer,10);
-    n_probesets = (int)tempbuffer;
+  // Use the name of the cdf file as the ArrayTypeName
+  ArrayTypeName.Add(cdf_fname.Mid(0, cdf_fname.length()-4));
+  array_rows = (int )my_cdf.header.rows;
+  array_cols = (int )my_cdf.header.cols;
+  n_probesets  = my_cdf.header.n_units;
+  n_probes += locations->pm_start[n];
+  unmap_cdf_xda(&my_cdf);
+
+  cdflocs.Attach(probeset_names, &locations->pm_start[0], &locations->mm_start[0],
+		 locations->pm_locs.empty() ? NULL : &locations->pm_locs[0],
+		 locations->mm_locs.empty() ? NULL : &locations->mm_locs[0],
+		 locations, release_cdf_locations);
+}
 
-#if RMA_GUI_APP
-    wxProgressDialog CDFProgress(_T("CDF Progress"),_T("Reading in CDF file"),n_probesets,this->parent,wxPD_AUTO_HIDE);
-#endif
-    
-    probeset_names.Alloc(n_probesets);
-    
-    for (i =0; i < n_probesets; i++){
-      // Look for appearance of a line containing "[Unit"
 
-      
-      if (!StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("[Unit"),my_CDF_file_stream)){
-	wxString Error =_T("Unexpectely reached the end of this cdf file. Perhaps it is corrupted.\n"); 
-    	throw Error;
-      }
-      
-      // Check unit type. 1 is CustomSeq, 2 is genotyping, 3 is expression, 7 is tag/genflex. All but 3 are unsupported 
-      
-      if (!StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("UnitType"),my_CDF_file_stream)){
-	wxString Error =_T("Unexpectely reached the end of this cdf file. Perhaps it is corrupted.\n"); 
-	throw Error;
-      }
-      
-      LineBuffer.StartsWith(_T("UnitType="),&restofline);
-      //restofline.ToLong((long int*)&unit_type,10);
-      restofline.ToLong(&tempbuffer,10);
-      unit_type = (int)tempbuffer;
+/* A text cdf file held in memory as it is (mapped where possible), 
+   gone through a line at a time the way wxTextInputStream::ReadLine()
+   would: lines end with \n, \r\n or \r */
 
+class CDFTextFile
+{
+ public:
+  CDFTextFile() : contents(NULL), length(0), map(NULL), map_length(0), buffer(NULL) {}
+  ~CDFTextFile();
+  bool Open(const wxString &path);
+  bool ReadLine(size_t *position, const char **line, size_t *line_length) const;
+  bool FindLine(size_t *position, const char *search, const char **line, size_t *line_length) const;
 
-      if ((unit_type !=3) && (unit_type > 0)){
-	wxString Error = _T("The file ") + cdf_fname + _T(" does not appear to be for an expression array. This format not currently handled by RMAExpress.\n");
-	throw Error;
-      }
-      
-      // now find number of blocks within unit
-      if (!StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("NumberBlocks"),my_CDF_file_stream)){
-	wxString Error = _T("Unexpectely reached the end of this cdf file. Perhaps it is corrupted.\n"); 
-	throw Error;
-	
-      }
-      
-      LineBuffer.StartsWith(_T("NumberBlocks="),&restofline);
-      //restofline.ToLong((long int*)&n_blocks,10);
-      restofline.ToLong(&tempbuffer,10);
-      n_blocks = (int)tempbuffer;
-      for (j = 0; j < n_blocks; j++){
-	// Go through each block
-	StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("Name"),my_CDF_file_stream);
-	LineBuffer.StartsWith(_T("Name="),&restofline);
-	currentName=restofline;
-	
-	StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("NumAtoms"),my_CDF_file_stream);
-	LineBuffer.StartsWith(_T("NumAtoms="),&restofline);
-	restofline.ToLong(&tempbuffer,10);
-	current_npp = (int)tempbuffer;
-	StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("NumCells"),my_CDF_file_stream);
-	LineBuffer.StartsWith(_T("NumCells="),&restofline);
-	restofline.ToLong(&tempbuffer,10);
-	n_cells = (int)tempbuffer;
-	
-	if (current_npp > 0){
-	  PMLoc = NULL;
-	  MMLoc = NULL;
-	
-	  if (n_cells == 2*current_npp){ 
-	    PMLoc = new int[current_npp];
-	    MMLoc = new int[current_npp];
-	  } else {
-	    PMLoc = new int[n_cells];
-	    MMLoc = new int[n_cells];
-	  }
-	  
-	  StopAtNextOccurance(&my_CDF_file, &LineBuffer,_T("CellHeader"),my_CDF_file_stream);
-	  //LineBuffer = my_CDF_file.ReadLine();
-	  //n_cells = 2*current_npp;
-	  
-	  //cout << "Ncels :" << n_cells << endl;
-	  whichPM=whichMM=0;
-	  for (k = 0; k < n_cells; k++){
-	    // Go through reading each cell= line
-	    LineBuffer = my_CDF_file.ReadLine();
-	    
-	    parse_CDF_CEL_LINE(LineBuffer,&xloc,&yloc,&isPM);
-	    //cout << xloc << " " << yloc << " " << isPM << endl;
-	    if (isPM){
-	      PMLoc[whichPM] = xy2i(xloc,yloc,array_rows);
-	      whichPM++;
-	    } else {
-	      MMLoc[whichMM] =  xy2i(xloc,yloc,array_rows);
-	      whichMM++;
-	    }
-	  }
-	  if (whichMM == 0){
-	    delete [] MMLoc;
-	    MMLoc = NULL;
-	  }
-	  if (whichPM == 0){
-	    delete [] PMLoc;
-	    PMLoc = NULL;
-	  }
-	  if (n_cells != 2*current_npp){
-	    int *tmpptr;
-	    if ((whichMM < n_cells) && (whichMM > 0)){
-	      tmpptr = new int[whichMM];
-	      for (k=0; k < whichMM; k++){
-		tmpptr[k] = MMLoc[k];
-	      }
-	      delete [] MMLoc;
-	      MMLoc = tmpptr;
-	    }
-	    if ((whichPM < n_cells) && (whichPM > 0)){
-	      tmpptr = new int[whichPM];
-	      for (k=0; k < whichPM; k++){
-		tmpptr[k] = PMLoc[k];
-	      }
-	      delete [] PMLoc;
-	      PMLoc = tmpptr;
-	    }
-	  }
+  const char *contents;
+  size_t length;
 
+ private:
+  void *map;
+  size_t map_length;
+  char *buffer;
+};
 
 
-	  n_probes+=whichPM;
-	  /* if (whichPM > 0){
-	     wxPrintf("*** ");
-	     }
-	     wxPrintf(currentName+" %d %d %d\n",whichPM,whichMM,n_probes);
-	  */
-		 
-	  currentitem = new LocMapItem(currentName,whichPM,whichMM,PMLoc,MMLoc); 
-	  cdflocs.Insert(currentitem); 
-	  if (j==0){
-	    probeset_names.Add(currentName);
-	  }
-	  
-#if DEBUG
-	  if ( i > 2400000){
-	    wxPrintf(currentName+_T(" %d\n"), i);
-	  }
+CDFTextFile::~CDFTextFile(){
+#if defined(CDF_TEXT_HAVE_MMAP)
+  if (map != NULL){
+    munmap(map, map_length);
+  }
 #endif
-	  
-	  //currentitem->MM
-	  //delete currentitem;
-	} else {
+  free(buffer);
+}
 
-	  PMLoc = NULL;
-	  MMLoc = NULL;
-	  currentitem = new LocMapItem(currentName,0,0,PMLoc,MMLoc); 	  
-	  cdflocs.Insert(currentitem);
-	  if (j==0){
-	    probeset_names.Add(currentName);
-	  }
-	}
-	
-      }
-      
-#if RMA_GUI_APP   
-      if (i % (n_probesets/400) == 0){   // was 200
-	CDFProgress.Update(i);
-      }
+
+bool CDFTextFile::Open(const wxString &path){
+
+  FILE *infile;
+  long file_length;
+
+  if ((infile = fopen(path.mb_str(), "rb")) == NULL){
+    return false;
+  }
+  if (fseek(infile, 0, SEEK_END) != 0 || (file_length = ftell(infile)) < 0){
+    fclose(infile);
+    return false;
+  }
+  length = (size_t)file_length;
+  if (length == 0){
+    fclose(infile);
+    contents = "";
+    return true;
+  }
+
+#if defined(CDF_TEXT_HAVE_MMAP)
+  map = mmap(0, length, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+  if (map == MAP_FAILED){
+    map = NULL;
+  } else {
+    map_length = length;
+    contents = (const char *)map;
+  }
 #endif
-      
+  if (contents == NULL){
+    buffer = (char *)malloc(length);
+    if (buffer == NULL || fseek(infile, 0, SEEK_SET) != 0 || fread(buffer, 1, length, infile) != length){
+      fclose(infile);
+      return false;
     }
-      
-    currentitem = NULL;
-    probeset_names.Sort();
-#if DEBUG
-    wxPrintf("Done with CDF\n");
-    wxPrintf("ps: %d   p:%d\n",n_probesets,n_probes);
-#endif    
-  } else if (is_cdf_RME(cdf_path)){
-    ReadBinaryCDF(cdf_fname, cdf_path);
-  } else {
-    wxString Error = _T("The file ") + cdf_fname + _T(" does not looks like a a valid CDF file. Tried both text, xda (binary) and RMECDF formats.\n");
-    throw Error;
+    contents = buffer;
   }
-  
-  
-  
-  
+  fclose(infile);
+  return true;
 }
 
 
-static bool isRMECEL(wxString cel_path){
-  
-  int strlength = 0;
-  wxString filetype;
-  wxFileInputStream input(cel_path);
-  wxDataInputStream store(input);
-  
-  /* this prevents reading a file which clearly is not of the right type causing a crash */
-  strlength = store.Read32();
-  if (strlength  > 10){
-    return false;
-  }
-  input.SeekI(0);
-  
+/* The line at position, without its end of line, moving position
+   on to the next line. false at the end of the file */
 
-  filetype = store.ReadString();
+bool CDFTextFile::ReadLine(size_t *position, const char **line, size_t *line_length) const {
 
+  size_t i = *position;
 
-  if (filetype.Cmp(_T("CEL")) != 0 && filetype.Cmp(_T("RMECEL")) != 0){
+  if (i >= length){
     return false;
   }
-
+  while (i < length && contents[i] != '\n' && contents[i] != '\r'){
+    i++;
+  }
+  *line = contents + *position;
+  *line_length = i - *position;
+  if (i < length && contents[i] == '\r'){
+    i++;
+    if (i < length && contents[i] == '\n'){
+      i++;
+    }
+  } else if (i < length){
+    i++;
+  }
+  *position = i;
   return true;
 }
 
-char *rmecel_get_header_info(wxString cel_path, int *cur_dim1, int *cur_dim2){
 
-  wxString filetype;
-  wxString ArrayType;
+/* The next line containing search, moving position on past it */
 
-  int versionnumber;
+bool CDFTextFile::FindLine(size_t *position, const char *search, const char **line, size_t *line_length) const {
 
-  char *cdfName, *curCDFName;
+  size_t search_length = strlen(search);
+  size_t i;
 
-  wxFileInputStream input(cel_path);
-  wxDataInputStream store(input);
-  filetype = store.ReadString();
-  
-  if (filetype.Cmp(_T("CEL")) != 0 && filetype.Cmp(_T("RMECEL")) != 0){
-    wxString Error=_T("Problem with RME (CEL). Malformed?");
-    throw Error;
+  while (ReadLine(position, line, line_length)){
+    for (i = 0; i + search_length <= *line_length; i++){
+      if ((*line)[i] == search[0] && memcmp(*line + i, search, search_length) == 0){
+	return true;
+      }
+    }
   }
-  
-  versionnumber = store.Read32();
-  store.ReadString();  // the arrayname
-  ArrayType = store.ReadString();
-  *cur_dim1 =  store.Read32();
-  *cur_dim2 =  store.Read32();
-  
-  const wxWX2MBbuf tmp_buf = wxConvCurrent->cWX2MB(ArrayType.c_str());
-  cdfName = (char *)(const char*) tmp_buf;
- 
-  curCDFName = new char[strlen(cdfName) + 1]; 
-  
-  strcpy(curCDFName,cdfName);
-
-  return curCDFName;
+  return false;
 }
 
 
-/*****************************************************************
- **
- ** This function checks the supplied CEL files and verifies that
- ** they are all of the same kind (via the CDF information) and
- ** of the same dimensions
- **
- **
- **
- ****************************************************************/
+/* As wxString::StartsWith(): sets rest (only) if line starts with key */
 
-static void checkCelHeaders(const wxArrayString cel_paths){
+static bool cdf_text_starts_with(const char *line, size_t line_length, const char *key, 
+				 const char **rest, size_t *rest_length){
 
-  char *cur_cdfName;
-  int cur_dim1;
-  int cur_dim2;
+  size_t key_length = strlen(key);
 
-  char *ref_cdfName=NULL;
-  int ref_dim1=0;
-  int ref_dim2=0;
-  int err_code = 0;
-  
-  for (int i =0; i < (int)cel_paths.GetCount(); i++){
-    if (isTextCelFile(cel_paths[i].mb_str())){
-      cur_cdfName = get_header_info(cel_paths[i].mb_str(), &cur_dim1, &cur_dim2, &err_code);
-    } else if (isBinaryCelFile(cel_paths[i].mb_str())){
-      cur_cdfName = binary_get_header_info(cel_paths[i].mb_str(), &cur_dim1, &cur_dim2, &err_code);
-    } else if (isGenericCelFile(cel_paths[i].mb_str())){
-      cur_cdfName = generic_get_header_info(cel_paths[i].mb_str(), &cur_dim1, &cur_dim2, &err_code);
-    } else if (isRMECEL(cel_paths[i])){
-      cur_cdfName = rmecel_get_header_info(cel_paths[i], &cur_dim1, &cur_dim2);
-    } else {
-      wxString Error = wxT("Format for file ") + cel_paths[i] + wxT(" was not recognized.\n");
-      throw Error;
-    }
-    if (err_code){
-      wxString Error = cel_paths[i] + wxT(": ") + parsingErrorCode(err_code) + wxT("\n"); 
-      throw Error;
-    }
+  if (line_length < key_length || memcmp(line, key, key_length) != 0){
+    return false;
+  }
+  *rest = line + key_length;
+  *rest_length = line_length - key_length;
+  return true;
+}
 
 
-    if (i == 0){
-      ref_dim1 = cur_dim1;
-      ref_dim2 = cur_dim2;
-      ref_cdfName = cur_cdfName;
-    } else {
-      if (strncmp(cur_cdfName,ref_cdfName,100) != 0){
-		wxString Error = wxString(cur_cdfName,wxConvUTF8) + wxT(" does not match ") + wxString(ref_cdfName,wxConvUTF8) + wxT(" for file ") +  cel_paths[i] + wxT("\n");
-		delete [] cur_cdfName;
-		delete [] ref_cdfName;
-		throw Error;
-      }
-      if ((ref_dim1 != cur_dim1) && (ref_dim2 != cur_dim2)){
-		delete [] cur_cdfName;
-		delete [] ref_cdfName;
-		wxString Error = wxT("The dimensions of ") + cel_paths[i] + wxT(" were ") << cur_dim1 << wxT(" by ") <<  cur_dim2 << wxT(" while ") << ref_dim1 << wxT(" by ") << ref_dim2  << wxT(" was expected.\n");
-		throw Error;
-      } 
-      delete [] cur_cdfName;
+/* A decimal integer, as wxString::ToLong() would read it, or 0 */
+
+static long cdf_text_long(const char *p, size_t n){
+
+  size_t i = 0;
+  long value = 0;
+  bool negative = false;
+
+  while (i < n && (p[i] == ' ' || p[i] == '\t')){
+    i++;
+  }
+  if (i < n && (p[i] == '-' || p[i] == '+')){
+    negative = (p[i] == '-');
+    i++;
+  }
+  for (; i < n && p[i] >= '0' && p[i] <= '9'; i++){
+    if (value < INT_MAX){
+      value = 10*value + (p[i] - '0');
     }
   }
-
-  delete [] ref_cdfName;
+  return negative ? -value : value;
 }
 
 
+/* Whether a cell is PM, from its PBASE and TBASE: it is unless they are 
+   equal or one is A, T, C or G and the other not its complement */
 
+static bool cdf_text_is_pm(const char *pbase, size_t pbase_length, const char *tbase, size_t tbase_length){
 
-static void checkCDFCelAgreement(const wxArrayString &cel_paths, const wxArrayString &cdfNames,  int array_rows, int array_cols){
-  
-  char *cur_cdfName=NULL;
-  int cur_dim1;
-  int cur_dim2;
-  size_t j;
-  int err_code = 0;
-
-  for (int i =0; i < (int)cel_paths.GetCount(); i++){
-    if (isTextCelFile(cel_paths[i].mb_str())){
-      cur_cdfName = get_header_info(cel_paths[i].mb_str(), &cur_dim1, &cur_dim2, &err_code);
-    } else if (isBinaryCelFile(cel_paths[i].mb_str())){
-      cur_cdfName = binary_get_header_info(cel_paths[i].mb_str(), &cur_dim1, &cur_dim2, &err_code);
-    } else if (isGenericCelFile(cel_paths[i].mb_str())){
-      cur_cdfName = generic_get_header_info(cel_paths[i].mb_str(), &cur_dim1, &cur_dim2, &err_code);
-    } else if (isRMECEL(cel_paths[i])){
-      cur_cdfName = rmecel_get_header_info(cel_paths[i], &cur_dim1, &cur_dim2);
-    } else {
-      wxString Error = wxT("Format for file ") + cel_paths[i] + wxT(" was not recognized.\n");
-      throw Error;
-    }
-    if (err_code){
-      wxString Error = cel_paths[i] + wxT(": ") + parsingErrorCode(err_code) + wxT("\n"); 
-      throw Error;
-    }
+  char p = (pbase_length == 1) ? pbase[0] : 0;
+  char t = (tbase_length == 1) ? tbase[0] : 0;
 
-    for (j =0; j < cdfNames.GetCount(); j++){
-      if (wxString(cur_cdfName,wxConvUTF8).CmpNoCase(cdfNames[j]) == 0){
+  if (pbase_length == tbase_length && memcmp(pbase, tbase, pbase_length) == 0){
+    return false;
+  } else if ((p == 'A' && !(t == 'T')) || (p == 'T' && !(t == 'A'))){
+    return false;
+  } else if ((p == 'C' && !(t == 'G')) || (p == 'G' && !(t == 'C'))){
+    return false;
+  }
+  return true;
+}
+
+
+/* A block of a text cdf file: its name, and where its cell lines are */
+
+struct CDFTextBlock {
+  const char *name;
+  size_t name_length;
+  int ncells;          /* 0 if there are no atoms, when the cells are not looked at */
+  size_t cells;        /* position of the first cell line */
+  size_t first;        /* where its cells go in the PM and MM scratch arrays */
+  int n_pm;
+  int n_mm;
+};
+
+
+/* Parses the cell lines of blocks first to last-1 of a text cdf file, 
+   storing the locations of the PM cells, in the order they are listed, 
+   in pm_cells from the block's first, and likewise the MM cells */
+
+struct CDFTextParseRange {
+  const CDFTextFile *cdf;
+  std::vector<CDFTextBlock> *blocks;
+  std::vector<int> *pm_cells;
+  std::vector<int> *mm_cells;
+  int rows;
+  int first;
+  int last;
+
+  void Parse(){
+    int b, k, token;
+    size_t position, start, i;
+    const char *line;
+    size_t line_length;
+    const char *tokens[11];
+    size_t token_lengths[11];
+
+    for (b = first; b < last; b++){
+      CDFTextBlock &block = (*blocks)[b];
+      int *PM = block.ncells > 0 ? &(*pm_cells)[block.first] : NULL;
+      int *MM = block.ncells > 0 ? &(*mm_cells)[block.first] : NULL;
+
+      position = block.cells;
+      block.n_pm = block.n_mm = 0;
+      for (k = 0; k < block.ncells; k++){
+	cdf->ReadLine(&position, &line, &line_length);
+
+	/* Cell1=X\tY\tPROBE\tFEAT\tQUAL\tEXPOS\tPOS\tCBASE\tPBASE\tTBASE\t... */
+	token = 0;
+	start = 0;
+	for (i = 0; i <= line_length && token < 11; i++){
+	  if (i == line_length || line[i] == '=' || line[i] == '\t'){
+	    tokens[token] = line + start;
+	    token_lengths[token] = i - start;
+	    token++;
+	    start = i + 1;
+	  }
+	}
+	for (; token < 11; token++){
+	  tokens[token] = line;
+	  token_lengths[token] = 0;
+	}
+
+	int location = xy2i((int)cdf_text_long(tokens[1], token_lengths[1]), (int)cdf_text_long(tokens[2], token_lengths[2]), rows);
+	if (cdf_text_is_pm(tokens[9], token_lengths[9], tokens[10], token_lengths[10])){
+	  PM[block.n_pm++] = location;
+	} else {
+	  MM[block.n_mm++] = location;
+	}
+      }
+    }
+  }
+};
+
+
+#if wxUSE_THREADS
+class CDFTextParser : public wxThread
+{
+ public:
+  CDFTextParser(CDFTextParseRange *r) : wxThread(wxTHREAD_JOINABLE), range(r) {}
+
+ protected:
+  ExitCode Entry(){
+    range->Parse();
+    return 0;
+  }
+
+ private:
+  CDFTextParseRange *range;
+};
+#endif
+
+
+/* orders indices into of (or, if of is NULL, into names) by name */
+
+struct CDFTextNameOrder {
+  const wxArrayString *names;
+  const std::vector<int> *of;
+  bool operator()(int a, int b) const {
+    if (of != NULL){
+      a = (*of)[a];
+      b = (*of)[b];
+    }
+    return (*names)[a].Cmp((*names)[b]) < 0;
+  }
+};
+
+
+/******************************************************
+ **
+ ** void DataGroup::ReadTextCDF(const wxString cdf_fname, 
+ **                             const wxString cdf_path)
+ **
+ ** Reads a text cdf file. The file is mapped into memory
+ ** and its headers and [Unit] sections found in one pass,
+ ** which counts its way over the cell lines without 
+ ** parsing them. The cell lines are then parsed by 
+ ** several threads, each taking a range of the blocks,
+ ** and the locations laid out in the order of the sorted
+ ** probeset names, as ReadCDFFile() always has.
+ **
+ ** Which lines are looked at is just as it was when the
+ ** file was read through wxTextInputStream, so the same
+ ** probesets come out: the first block of each unit 
+ ** names a probeset, and a name given to more than one
+ ** block has the cells of the first.
+ **
+ ******************************************************/
+
+void DataGroup::ReadTextCDF(const wxString cdf_fname, const wxString cdf_path){
+
+  CDFTextFile cdf;
+  CDFTextBlock block;
+  std::vector<CDFTextBlock> blocks;
+  std::vector<int> unit_blocks, order, block_order, entries;
+  std::vector<char> used;
+  wxArrayString block_names, names;
+  CDFTextNameOrder name_order;
+  CDFLocations *locations;
+  const char *line = NULL, *rest = NULL;
+  size_t line_length = 0, rest_length = 0;
+  size_t position = 0, n_cells = 0;
+  int i, j, k, n, n_units, n_blocks, unit_type, current_npp, ncells;
+  int nthreads = 1;
+  wxString Truncated = _T("Unexpectely reached the end of this cdf file. Perhaps it is corrupted.\n");
+
+  if (!cdf.Open(cdf_path)){
+    wxString Error = _T("Could not open the cdf file ") + cdf_fname + _T("\n");
+    throw Error;
+  }
+
+  if (!cdf.ReadLine(&position, &line, &line_length) || 
+      !cdf_text_starts_with(line, line_length, "[CDF]", &rest, &rest_length)){
+    wxString Error = _T("The file ") + cdf_fname + _T(" doesn't look like a valid CDF file.\n");
+    throw Error;
+  }
+  while (!cdf_text_starts_with(line, line_length, "[Chip]", &rest, &rest_length)){
+    if (!cdf.ReadLine(&position, &line, &line_length)){
+      throw Truncated;
+    }
+  }
+  // the chip name line
+  if (!cdf.ReadLine(&position, &line, &line_length)){
+    throw Truncated;
+  }
+  while (!cdf_text_starts_with(line, line_length, "Rows=", &rest, &rest_length)){
+    if (!cdf.ReadLine(&position, &line, &line_length)){
+      throw Truncated;
+    }
+  }
+  array_rows = (int)cdf_text_long(rest, rest_length);
+  while (!cdf_text_starts_with(line, line_length, "Cols=", &rest, &rest_length)){
+    if (!cdf.ReadLine(&position, &line, &line_length)){
+      throw Truncated;
+    }
+  }
+  array_cols = (int)cdf_text_long(rest, rest_length);
+  while (!cdf_text_starts_with(line, line_length, "NumberOfUnits=", &rest, &rest_length)){
+    if (!cdf.ReadLine(&position, &line, &line_length)){
+      throw Truncated;
+    }
+  }
+  n_units = (int)cdf_text_long(rest, rest_length);
+
+  /* Where each block and its cells are, in the order of the file */
+  for (i = 0; i < n_units; i++){
+    if (!cdf.FindLine(&position, "[Unit", &line, &line_length) ||
+	!cdf.FindLine(&position, "UnitType", &line, &line_length)){
+      throw Truncated;
+    }
+    // 1 is CustomSeq, 2 is genotyping, 3 is expression, 7 is tag/genflex. All but 3 are unsupported 
+    cdf_text_starts_with(line, line_length, "UnitType=", &rest, &rest_length);
+    unit_type = (int)cdf_text_long(rest, rest_length);
+    if ((unit_type != 3) && (unit_type > 0)){
+      wxString Error = _T("The file ") + cdf_fname + _T(" does not appear to be for an expression array. This format not currently handled by RMAExpress.\n");
+      throw Error;
+    }
+    if (!cdf.FindLine(&position, "NumberBlocks", &line, &line_length)){
+      throw Truncated;
+    }
+    cdf_text_starts_with(line, line_length, "NumberBlocks=", &rest, &rest_length);
+    n_blocks = (int)cdf_text_long(rest, rest_length);
+
+    if (n_blocks > 0){
+      unit_blocks.push_back((int)blocks.size());
+    }
+    for (j = 0; j < n_blocks; j++){
+      if (!cdf.FindLine(&position, "Name", &line, &line_length)){
+	throw Truncated;
+      }
+      cdf_text_starts_with(line, line_length, "Name=", &rest, &rest_length);
+      block.name = rest;
+      block.name_length = rest_length;
+      if (!cdf.FindLine(&position, "NumAtoms", &line, &line_length)){
+	throw Truncated;
+      }
+      cdf_text_starts_with(line, line_length, "NumAtoms=", &rest, &rest_length);
+      current_npp = (int)cdf_text_long(rest, rest_length);
+      if (!cdf.FindLine(&position, "NumCells", &line, &line_length)){
+	throw Truncated;
+      }
+      cdf_text_starts_with(line, line_length, "NumCells=", &rest, &rest_length);
+      ncells = (int)cdf_text_long(rest, rest_length);
+
+      block.ncells = 0;
+      block.cells = 0;
+      block.first = n_cells;
+      if (current_npp > 0){
+	if (!cdf.FindLine(&position, "CellHeader", &line, &line_length)){
+	  throw Truncated;
+	}
+      }
+      if (current_npp > 0 && ncells > 0){
+	block.ncells = ncells;
+	block.cells = position;
+	for (k = 0; k < ncells; k++){
+	  if (!cdf.ReadLine(&position, &line, &line_length)){
+	    throw Truncated;
+	  }
+	}
+	n_cells += ncells;
+      }
+      blocks.push_back(block);
+    }
+  }
+
+  n = (int)blocks.size();
+  block_names.Alloc(n);
+  for (i = 0; i < n; i++){
+    block_names.Add(wxString(blocks[i].name, wxConvUTF8, blocks[i].name_length));
+  }
+
+  /* Parse the cells */
+  std::vector<int> pm_cells(n_cells), mm_cells(n_cells);
+
+#if wxUSE_THREADS
+  /* a thread is not worth it for less than a few thousand probesets */
+  nthreads = wxThread::GetCPUCount();
+  if (nthreads > n/4096 + 1){
+    nthreads = n/4096 + 1;
+  }
+#endif
+  if (nthreads < 1){
+    nthreads = 1;
+  }
+
+  std::vector<CDFTextParseRange> ranges(nthreads);
+  for (i = 0; i < nthreads; i++){
+    ranges[i].cdf = &cdf;
+    ranges[i].blocks = &blocks;
+    ranges[i].pm_cells = &pm_cells;
+    ranges[i].mm_cells = &mm_cells;
+    ranges[i].rows = array_rows;
+    ranges[i].first = (int)(((long long)n*i)/nthreads);
+    ranges[i].last = (int)(((long long)n*(i+1))/nthreads);
+  }
+
+#if wxUSE_THREADS
+  std::vector<CDFTextParser *> parsers;
+  for (i = 1; i < nthreads; i++){
+    CDFTextParser *parser = new CDFTextParser(&ranges[i]);
+    if (parser->Create() != wxTHREAD_NO_ERROR || parser->Run() != wxTHREAD_NO_ERROR){
+      /* do it here instead */
+      delete parser;
+      ranges[i].Parse();
+    } else {
+      parsers.push_back(parser);
+    }
+  }
+#endif
+  ranges[0].Parse();
+#if wxUSE_THREADS
+  for (i = 0; i < (int)parsers.size(); i++){
+    parsers[i]->Wait();
+    delete parsers[i];
+  }
+#endif
+
+  /* The probesets are named by the first block of each unit, sorted.
+     Each takes the cells of the first block of that name, and any 
+     blocks not taken follow, in the order of the file */
+  order.resize(unit_blocks.size());
+  for (i = 0; i < (int)order.size(); i++){
+    order[i] = i;
+  }
+  name_order.names = &block_names;
+  name_order.of = &unit_blocks;
+  std::stable_sort(order.begin(), order.end(), name_order);
+
+  block_order.resize(n);
+  for (i = 0; i < n; i++){
+    block_order[i] = i;
+  }
+  name_order.of = NULL;
+  std::stable_sort(block_order.begin(), block_order.end(), name_order);
+
+  used.assign(n, 0);
+  entries.reserve(n);
+  probeset_names.Alloc(order.size());
+  names.Alloc(n);
+  for (i = 0, j = 0; i < (int)order.size(); i++){
+    const wxString &name = block_names[unit_blocks[order[i]]];
+    while (block_names[block_order[j]].Cmp(name) < 0){
+      j++;
+    }
+    entries.push_back(block_order[j]);
+    used[block_order[j]] = 1;
+    probeset_names.Add(name);
+    names.Add(name);
+  }
+  for (i = 0; i < n; i++){
+    if (!used[i]){
+      entries.push_back(i);
+      names.Add(block_names[i]);
+    }
+  }
+
+  locations = new CDFLocations;
+  locations->pm_start.resize(entries.size() + 1);
+  locations->mm_start.resize(entries.size() + 1);
+  locations->pm_start[0] = 0;
+  locations->mm_start[0] = 0;
+  for (i = 0; i < (int)entries.size(); i++){
+    const CDFTextBlock &b = blocks[entries[i]];
+    if (b.n_pm > INT_MAX - locations->pm_start[i] || b.n_mm > INT_MAX - locations->mm_start[i]){
+      delete locations;
+      wxString Error = _T("The file ") + cdf_fname + _T(" has too many cells.\n");
+      throw Error;
+    }
+    locations->pm_start[i+1] = locations->pm_start[i] + b.n_pm;
+    locations->mm_start[i+1] = locations->mm_start[i] + b.n_mm;
+  }
+  locations->pm_locs.resize(locations->pm_start[entries.size()]);
+  locations->mm_locs.resize(locations->mm_start[entries.size()]);
+  for (i = 0; i < (int)entries.size(); i++){
+    const CDFTextBlock &b = blocks[entries[i]];
+    if (b.n_pm > 0){
+      memcpy(&locations->pm_locs[locations->pm_start[i]], &pm_cells[b.first], b.n_pm*sizeof(int));
+    }
+    if (b.n_mm > 0){
+      memcpy(&locations->mm_locs[locations->mm_start[i]], &mm_cells[b.first], b.n_mm*sizeof(int));
+    }
+  }
+  for (i = 0; i < n; i++){
+    n_probes += blocks[i].n_pm;
+  }
+
+  // Use the name of the cdf file as the ArrayTypeName
+  ArrayTypeName.Add(cdf_fname.Mid(0, cdf_fname.length()-4));
+  n_probesets = n_units;
+
+  cdflocs.Attach(names, &locations->pm_start[0], &locations->mm_start[0],
+		 locations->pm_locs.empty() ? NULL : &locations->pm_locs[0],
+		 locations->mm_locs.empty() ? NULL : &locations->mm_locs[0],
+		 locations, release_cdf_locations);
+}
+
+
+/******************************************************
+ **
+ ** bool DataGroup::ReadCDFFile(const wxString cdf_fname, 
+ **                             const wxString cdf_path)
+ **
+ ** const wxString cdf_fname - just the filename
+ ** const wxString cdf_path - full path including filename
+ **                           
+ ** With an annotation_cache, the CDF file is read from 
+ ** its compiled file there if it has one, and otherwise
+ ** compiled into it once read (see CompiledCDFName())
+ **
+ ******************************************************/
+
+void DataGroup::ReadCDFFile(const wxString cdf_fname, 
+			    const wxString cdf_path){
+
+  wxString compiled_path = CompiledCDFName(cdf_fname, cdf_path);
+
+  if (!compiled_path.IsEmpty() && ReadCompiledCDF(compiled_path)){
+    return;
+  }
+
+  if (is_cdf_xda((char *)cdf_path.char_str())){ 
+    ReadXDACDF(cdf_fname, cdf_path);
+  } else if (is_cdf_text(cdf_path)){
+    ReadTextCDF(cdf_fname, cdf_path);
+  } else if (is_cdf_RME(cdf_path)){
+    ReadBinaryCDF(cdf_fname, cdf_path);
+  } else {
+    wxString Error = _T("The file ") + cdf_fname + _T(" does not looks like a a valid CDF file. Tried both text, xda (binary) and RMECDF formats.\n");
+    throw Error;
+  }
+
+  if (!compiled_path.IsEmpty()){
+    WriteCompiledCDF(compiled_path);
+  }
+}
+
+
+/*****************************************************************
+ **
+ ** CEL file descriptors
+ **
+ ** Everything needed to check and then read a CEL file (its format,
+ ** dimensions, CDF name and where the intensities start) comes from 
+ ** one look at the start of the file, by probeCelFile(), which opens 
+ ** it once and tries each format in turn on the open file.
+ **
+ ** describeCelFile() keeps what was found for as long as the size and
+ ** modification time of the file are unchanged, so the checks and the
+ ** reading that follow do not look at the header again. The 
+ ** descriptors are also saved in a small file in each directory of 
+ ** CEL files (see CELHeaderCache) so that a later run, on the same 
+ ** files, need not parse any headers at all.
+ **
+ ** A gzipped CEL file (when built with zlib) is probed in the same 
+ ** way through zlib, and its data_offset is then an offset into the
+ ** decompressed file.
+ **
+ ****************************************************************/
+
+struct CELDescriptor
+{
+  int format;          /* one of the CEL_FORMAT_ values */
+  int dim1;
+  int dim2;
+  int n_cells;
+  long data_offset;    /* where the intensities start, 0 if not known */
+  bool compressed;     /* gzipped */
+  wxString cdfName;
+};
+
+
+/* The RME format is written with a wxDataOutputStream, strings are a 
+   little endian 32 bit length followed by the (UTF-8) characters */
+
+static bool readRMEString(FILE *infile, std::string &value){
+
+  int length;
+
+  if (!fread_int32(&length,1,infile) || length < 0 || length > 4096){
+    return false;
+  }
+  value.resize(length);
+  return (length == 0 || fread(&value[0], 1, length, infile) == (size_t)length);
+}
+
+
+/* As the probe_*_cel_file() functions, for RME format CEL files */
+
+static int probeRMECEL(FILE *infile, cel_descriptor *descriptor){
+
+  std::string filetype, ArrayType;
+  int versionnumber;
+
+  /* this prevents reading a file which clearly is not of the right type causing a crash */
+  if (!readRMEString(infile, filetype) || (filetype != "CEL" && filetype != "RMECEL")){
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_RME;
+
+  if (!fread_int32(&versionnumber,1,infile) ||
+      !readRMEString(infile, ArrayType) ||     // the arrayname
+      !readRMEString(infile, ArrayType) ||
+      !fread_int32(&descriptor->dim1,1,infile) ||
+      !fread_int32(&descriptor->dim2,1,infile)){
+    wxString Error=_T("Problem with RME (CEL). Malformed?");
+    throw Error;
+  }
+  descriptor->n_cells = descriptor->dim1*descriptor->dim2;
+  descriptor->cdfName = (char *)calloc(ArrayType.size() + 1, sizeof(char));
+  strcpy(descriptor->cdfName, ArrayType.c_str());
+
+  return 0;
+}
+
+
+/* As the probing in probeCelFile(), for a gzipped CEL file. 
+   There are no gzipped RME files */
+
+static int probeGzCelFile(const wxString &cel_path, cel_descriptor *descriptor){
+
+#if defined(HAVE_ZLIB)
+  gzFile infile;
+  int err_code;
+  std::string filename((const char *)cel_path.mb_str());
+
+  if ((infile = gzopen(filename.c_str(), "rb")) == NULL){
+    wxString Error = wxT("Could not open file ") + cel_path + wxT("\n");
+    throw Error;
+  }
+
+  try {
+    err_code = probe_gztext_cel_file(infile, filename.c_str(), descriptor);
+    if (err_code < 0){
+      gzrewind(infile);
+      err_code = probe_gzbinary_cel_file(infile, descriptor);
+    }
+    if (err_code < 0){
+      gzrewind(infile);
+      err_code = probe_gzgeneric_cel_file(infile, descriptor);
+    }
+  } catch (wxString &Problem){
+    gzclose(infile);
+    free(descriptor->cdfName);
+    descriptor->cdfName = NULL;
+    throw Problem;
+  }
+  gzclose(infile);
+
+  return err_code;
+#else
+  wxString Error = cel_path + wxT(" is gzipped. This version of RMAExpress can not read gzipped CEL files.\n");
+  throw Error;
+#endif
+}
+
+
+/* Works out the format and reads the header of a CEL file. Throws if
+   the file is not recognized or its header could not be parsed */
+
+static CELDescriptor probeCelFile(const wxString &cel_path){
+
+  FILE *infile;
+  cel_descriptor descriptor;
+  CELDescriptor result;
+  int err_code;
+  unsigned char magic[2];
+  
+  memset(&descriptor, 0, sizeof(cel_descriptor));
+
+  if ((infile = fopen(cel_path.mb_str(), "rb")) == NULL){
+    wxString Error = wxT("Could not open file ") + cel_path + wxT("\n");
+    throw Error;
+  }
+
+  /* the two bytes every gzip file starts with */
+  result.compressed = (fread(magic, 1, 2, infile) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+  rewind(infile);
+
+  if (result.compressed){
+    fclose(infile);
+    err_code = probeGzCelFile(cel_path, &descriptor);
+  } else {
+    try {
+      err_code = probe_text_cel_file(infile, &descriptor);
+      if (err_code < 0){
+	rewind(infile);
+	err_code = probe_binary_cel_file(infile, &descriptor);
+      }
+      if (err_code < 0){
+	rewind(infile);
+	err_code = probe_generic_cel_file(infile, &descriptor);
+      }
+      if (err_code < 0){
+	rewind(infile);
+	err_code = probeRMECEL(infile, &descriptor);
+      }
+    } catch (wxString &Problem){
+      fclose(infile);
+      free(descriptor.cdfName);
+      throw Problem;
+    }
+    fclose(infile);
+  }
+
+  if (err_code == 0 && descriptor.cdfName != NULL){
+    result.cdfName = wxString(descriptor.cdfName,wxConvUTF8);
+  }
+  free(descriptor.cdfName);
+
+  if (err_code < 0){
+    wxString Error = wxT("Format for file ") + cel_path + wxT(" was not recognized.\n");
+    throw Error;
+  } else if (err_code){
+    wxString Error = cel_path + wxT(": ") + parsingErrorCode(err_code) + wxT("\n"); 
+    throw Error;
+  }
+
+  result.format = descriptor.format;
+  result.dim1 = descriptor.dim1;
+  result.dim2 = descriptor.dim2;
+  result.n_cells = descriptor.n_cells;
+  result.data_offset = descriptor.data_offset;
+
+  return result;
+}
+
+
+
+/*****************************************************************
+ **
+ ** class CELHeaderCache
+ **
+ ** Holds a CELDescriptor for each CEL file probed, along with the 
+ ** size and modification time (the stamp) of the file at the time.
+ ** A descriptor is only used while the stamp still matches.
+ **
+ ** The descriptors for the CEL files in a directory are kept in the 
+ ** file CEL_HEADER_CACHE_NAME there, one line per CEL file:
+ **
+ ** format  compressed  dim1  dim2  n_cells  data_offset  stamp  cdfName  filename
+ **
+ ** separated by tabs, after a first line giving the version. The file 
+ ** is read the first time a CEL file in the directory is looked up. It
+ ** is only a cache, if it can not be read or written (a read only 
+ ** directory, say) the headers are simply probed again.
+ **
+ ****************************************************************/
+
+#define CEL_HEADER_CACHE_NAME wxT(".RMAExpress_CEL_headers")
+#define CEL_HEADER_CACHE_VERSION wxT("RMAExpress CEL headers 2")
+
+class CELHeaderCache
+{
+ public:
+  bool Find(const wxString &cel_path, const wxString &stamp, CELDescriptor &descriptor);
+  void Store(const wxString &cel_path, const wxString &stamp, const CELDescriptor &descriptor);
+  void Save();
+
+ private:
+  struct Entry
+  {
+    wxString stamp;
+    CELDescriptor descriptor;
+  };
+
+  void LoadDirectory(const wxString &directory);
+
+  std::map<wxString, Entry> entries;       /* by full path of the CEL file */
+  std::map<wxString, bool> directories;    /* directories looked at, true if entries 
+					      there have changed since the cache file was read */
+};
+
+
+bool CELHeaderCache::Find(const wxString &cel_path, const wxString &stamp, CELDescriptor &descriptor){
+
+  std::map<wxString, Entry>::iterator found;
+  wxString directory = wxFileName(cel_path).GetPath();
+
+  if (directories.find(directory) == directories.end()){
+    LoadDirectory(directory);
+  }
+  
+  found = entries.find(cel_path);
+  if (found == entries.end() || found->second.stamp != stamp){
+    return false;
+  }
+  descriptor = found->second.descriptor;
+  return true;
+}
+
+
+void CELHeaderCache::Store(const wxString &cel_path, const wxString &stamp, const CELDescriptor &descriptor){
+
+  Entry &entry = entries[cel_path];
+
+  entry.stamp = stamp;
+  entry.descriptor = descriptor;
+  directories[wxFileName(cel_path).GetPath()] = true;
+}
+
+
+void CELHeaderCache::LoadDirectory(const wxString &directory){
+
+  wxLogNull quiet;    /* a missing or unreadable cache file is not an error */
+  wxTextFile cachefile;
+  wxString line, cel_path;
+  Entry entry;
+  long format, compressed, dim1, dim2, n_cells, data_offset;
+
+  directories[directory] = false;
+
+  wxFileName cachename(directory, CEL_HEADER_CACHE_NAME);
+  if (!cachename.FileExists() || !cachefile.Open(cachename.GetFullPath())){
+    return;
+  }
+  if (cachefile.GetFirstLine() != CEL_HEADER_CACHE_VERSION){
+    return;
+  }
+
+  while (!cachefile.Eof()){
+    line = cachefile.GetNextLine();
+    wxStringTokenizer fields(line, wxT("\t"), wxTOKEN_RET_EMPTY_ALL);
+    if (fields.CountTokens() != 9 ||
+	!fields.GetNextToken().ToLong(&format) ||
+	!fields.GetNextToken().ToLong(&compressed) ||
+	!fields.GetNextToken().ToLong(&dim1) ||
+	!fields.GetNextToken().ToLong(&dim2) ||
+	!fields.GetNextToken().ToLong(&n_cells) ||
+	!fields.GetNextToken().ToLong(&data_offset)){
+      continue;
+    }
+    entry.descriptor.format = (int)format;
+    entry.descriptor.compressed = (compressed != 0);
+    entry.descriptor.dim1 = (int)dim1;
+    entry.descriptor.dim2 = (int)dim2;
+    entry.descriptor.n_cells = (int)n_cells;
+    entry.descriptor.data_offset = data_offset;
+    entry.stamp = fields.GetNextToken();
+    entry.descriptor.cdfName = fields.GetNextToken();
+    cel_path = wxFileName(directory, fields.GetNextToken()).GetFullPath();
+    /* anything probed in this run is more recent */
+    if (entries.find(cel_path) == entries.end()){
+      entries[cel_path] = entry;
+    }
+  }
+  cachefile.Close();
+}
+
+
+void CELHeaderCache::Save(){
+
+  wxLogNull quiet;    /* nor is failing to write one */
+  std::map<wxString, bool>::iterator directory;
+  std::map<wxString, Entry>::iterator entry;
+
+  for (directory = directories.begin(); directory != directories.end(); directory++){
+    if (!directory->second){
+      continue;
+    }
+    directory->second = false;
+
+    wxFileName cachename(directory->first, CEL_HEADER_CACHE_NAME);
+    if (!wxFileName::IsDirWritable(directory->first)){
+      continue;
+    }
+    wxTextFile cachefile(cachename.GetFullPath());
+    if (cachename.FileExists() ? !cachefile.Open() : !cachefile.Create()){
+      continue;
+    }
+    cachefile.Clear();
+    cachefile.AddLine(CEL_HEADER_CACHE_VERSION);
+    for (entry = entries.begin(); entry != entries.end(); entry++){
+      wxFileName cel_name(entry->first);
+      if (cel_name.GetPath() != directory->first){
+	continue;
+      }
+      const CELDescriptor &descriptor = entry->second.descriptor;
+      cachefile.AddLine(wxString::Format(wxT("%d\t%d\t%d\t%d\t%d\t%ld\t"), descriptor.format, (int)descriptor.compressed, descriptor.dim1, descriptor.dim2, descriptor.n_cells, descriptor.data_offset) + 
+			entry->second.stamp + wxT("\t") + descriptor.cdfName + wxT("\t") + cel_name.GetFullName());
+    }
+    cachefile.Write();
+    cachefile.Close();
+  }
+}
+
+
+static CELHeaderCache celHeaderCache;
+
+
+/* The size and modification time of a file, which between them should 
+   change whenever the file does */
+
+static wxString celFileStamp(const wxString &cel_path){
+
+  return wxFileName::GetSize(cel_path).ToString() + wxString::Format(wxT(" %ld"), (long)wxFileModificationTime(cel_path));
+}
+
+
+/* Gives the descriptor of a CEL file, probing it only if it has not been
+   seen (unchanged) before. Throws as probeCelFile() */
+
+static CELDescriptor describeCelFile(const wxString &cel_path){
+
+  CELDescriptor descriptor;
+  wxFileName cel_name(cel_path);
+  wxString full_path, stamp;
+
+  cel_name.MakeAbsolute();
+  full_path = cel_name.GetFullPath();
+  stamp = celFileStamp(full_path);
+
+  if (!celHeaderCache.Find(full_path, stamp, descriptor)){
+    descriptor = probeCelFile(cel_path);
+    celHeaderCache.Store(full_path, stamp, descriptor);
+  }
+  return descriptor;
+}
+
+
+
+/*****************************************************************
+ **
+ ** This function checks the supplied CEL files and verifies that
+ ** they are all of the same kind (via the CDF information) and
+ ** of the same dimensions
+ **
+ ** It is the first to look at the files, so it also saves any
+ ** newly probed headers (see CELHeaderCache)
+ **
+ ****************************************************************/
+
+static void checkCelHeaders(const wxArrayString cel_paths){
+
+  CELDescriptor cur, ref;
+  
+  for (int i =0; i < (int)cel_paths.GetCount(); i++){
+    cur = describeCelFile(cel_paths[i]);
+
+    if (i == 0){
+      ref = cur;
+    } else {
+      if (cur.cdfName.Cmp(ref.cdfName) != 0){
+	wxString Error = cur.cdfName + wxT(" does not match ") + ref.cdfName + wxT(" for file ") +  cel_paths[i] + wxT("\n");
+	celHeaderCache.Save();
+	throw Error;
+      }
+      if ((ref.dim1 != cur.dim1) && (ref.dim2 != cur.dim2)){
+	wxString Error = wxT("The dimensions of ") + cel_paths[i] + wxT(" were ") << cur.dim1 << wxT(" by ") <<  cur.dim2 << wxT(" while ") << ref.dim1 << wxT(" by ") << ref.dim2  << wxT(" was expected.\n");
+	celHeaderCache.Save();
+	throw Error;
+      } 
+    }
+  }
+
+  celHeaderCache.Save();
+}
+
+
+
+
+static void checkCDFCelAgreement(const wxArrayString &cel_paths, const wxArrayString &cdfNames,  int array_rows, int array_cols){
+  
+  CELDescriptor cur;
+  size_t j;
+
+  for (int i =0; i < (int)cel_paths.GetCount(); i++){
+    cur = describeCelFile(cel_paths[i]);
+
+    for (j =0; j < cdfNames.GetCount(); j++){
+      if (cur.cdfName.CmpNoCase(cdfNames[j]) == 0){
 	break;
       }
     }
     
-    if (j == cdfNames.GetCount()){
-      wxString Error = wxString(cur_cdfName,wxConvUTF8) + wxT(" does not match: ");
-      for (j=0; j < cdfNames.GetCount(); j++){
-	Error = Error + _T("  ") + cdfNames[j];
+    if (j == cdfNames.GetCount()){
+      wxString Error = cur.cdfName + wxT(" does not match: ");
+      for (j=0; j < cdfNames.GetCount(); j++){
+	Error = Error + _T("  ") + cdfNames[j];
+      }
+      Error = Error + wxT(" for file ") +  cel_paths[i] + wxT("\n");
+      throw Error;
+    }
+  }
+}
+
+
+static wxString getCelType(const wxString cel_path, int *dim1, int *dim2){
+
+  CELDescriptor cur = describeCelFile(cel_path);
+
+  if (cur.format == CEL_FORMAT_RME){
+    wxString Error = wxT("Format for file ") + cel_path + wxT(" was not recognized.\n");
+    throw Error;
+  }
+
+  *dim1 = cur.dim1;
+  *dim2 = cur.dim2;
+  
+  return cur.cdfName;
+}
+
+
+
+
+
+
+/* As read_cel_intensities(), but the whole (decompressed) file is already 
+   in memory, the contents_length bytes at contents */
+
+static int parse_cel_contents(const char *cel_path, const CELDescriptor &descriptor, const char *contents, size_t contents_length, double *intensity, int length, int chip_dim_rows){
+
+  if (descriptor.format == CEL_FORMAT_TEXT){
+    return read_cel_buffer_intensities(contents, contents_length, descriptor.data_offset, cel_path, intensity, 0, length, 1, chip_dim_rows);
+  } else if (descriptor.format == CEL_FORMAT_XDA){
+    return read_binarycel_buffer_intensities(contents, contents_length, descriptor.data_offset, descriptor.n_cells, intensity, 0, length, 1, chip_dim_rows);
+  } else if (descriptor.format == CEL_FORMAT_CALVIN && descriptor.data_offset > 0){
+    return read_genericcel_buffer_intensities(contents, contents_length, descriptor.data_offset, descriptor.n_cells, intensity, 0, length, 1, chip_dim_rows);
+  }
+  return -1;
+}
+
+
+/* true for a gzipped file that parse_cel_contents() can parse once it is decompressed */
+
+static bool inflatable(const CELDescriptor &descriptor){
+  return descriptor.compressed && descriptor.data_offset > 0;
+}
+
+
+/* Parse the intensities of a text, binary (XDA) or generic (Command Console) 
+   CEL file, as described by descriptor, into intensity. Returns 0 on success,
+   a parsing error code, or -1 if the file is none of these. Touches nothing 
+   but its arguments, so may be used in several threads at once */
+
+static int read_cel_intensities(const char *cel_path, const CELDescriptor &descriptor, double *intensity, int length, int chip_dim_rows){
+
+  if (descriptor.compressed){
+#if defined(HAVE_ZLIB)
+    char *contents;
+    size_t contents_length;
+    int err_code;
+
+    if (!inflatable(descriptor)){
+      return (descriptor.format == CEL_FORMAT_CALVIN) ? gzread_genericcel_file_intensities(cel_path, intensity, 0, length, 1, chip_dim_rows) : -1;
+    }
+    if ((contents = gzread_whole_file(cel_path, &contents_length)) == NULL){
+      wxString Error = wxT("Could not decompress ") + wxString(cel_path, wxConvUTF8) + wxT("\n");
+      throw Error;
+    }
+    err_code = parse_cel_contents(cel_path, descriptor, contents, contents_length, intensity, length, chip_dim_rows);
+    free(contents);
+    return err_code;
+#else
+    wxString Error = wxString(cel_path, wxConvUTF8) + wxT(" is gzipped. This version of RMAExpress can not read gzipped CEL files.\n");
+    throw Error;
+#endif
+  }
+
+  if (descriptor.format == CEL_FORMAT_TEXT){
+    return read_cel_file_intensities_at(cel_path, descriptor.data_offset, intensity, 0, length, 1, chip_dim_rows);
+  } else if (descriptor.format == CEL_FORMAT_XDA){
+    return read_binarycel_file_intensities_at(cel_path, descriptor.data_offset, descriptor.n_cells, intensity, 0, length, 1, chip_dim_rows);
+  } else if (descriptor.format == CEL_FORMAT_CALVIN){
+    if (descriptor.data_offset > 0){
+      return read_genericcel_file_intensities_at(cel_path, descriptor.data_offset, descriptor.n_cells, intensity, 0, length, 1, chip_dim_rows);
+    }
+    return read_genericcel_file_intensities(cel_path, intensity, 0, length, 1, chip_dim_rows);
+  }
+  return -1;
+}
+
+
+
+/* copy the PM cells, in pm_locations order, into column */
+
+static void gather_pm_cells(const double *cells, const std::vector<int> &pm_locations, double *column){
+
+  int i;
+  int n = (int)pm_locations.size();
+
+  for (i=0; i < n; i++){
+    column[i] = cells[pm_locations[i]];
+  }
+}
+
+
+#ifdef BUFFERED
+
+/* The stream_steps (DATAGROUP_STREAM_ values) done to array col, of n_cols, 
+   as soon as it has been read: background adjust it where it is, then put 
+   a sorted copy in sorted for adding into the quantile normalization 
+   distribution. Safe to use on different columns in several threads at once */
+
+static void stream_preprocess_column(BufferedMatrix *matrix, int col, int rows, int n_cols, int stream_steps, double *sorted){
+
+  double param[3];
+  double *column;
+
+  if (stream_steps & DATAGROUP_STREAM_BACKGROUND){
+    bg_parameters2(matrix, matrix, param, rows, n_cols, col);
+    bg_adjust(matrix, matrix, param, rows, n_cols, col);
+  }
+  if (stream_steps & DATAGROUP_STREAM_QUANTILES){
+    column = matrix->PinColumn(col);
+    qnorm_sort_copy(column, sorted, rows);
+    matrix->UnpinColumn(col);
+  }
+}
+
+#endif
+
+
+
+/******************************************************
+ **
+ ** bool DataGroup::ReadCELFile(const wxString cel_fname, 
+ * 			        const wxString cel_path,
+ **                             const int col)
+ **
+ ** const wxString cel_fname
+ ** const wxString cel_path
+ ** const int col
+ **
+ ** Reads in an arbitary format CEL file into the DataGroup object
+ ** The intensities are parsed straight into the (pinned) column
+ **
+ ******************************************************/
+
+void DataGroup::ReadCELFile(const wxString cel_path,
+			    const int col){
+
+  double *cur_intensities;
+  int err_code=0;
+  wxString Error;
+  CELDescriptor descriptor = describeCelFile(cel_path);
+
+  if (descriptor.format == CEL_FORMAT_RME){
+    ReadBinaryCEL(cel_path, col);
+    return;
+  }
+
+#ifdef BUFFERED
+  if (!pm_only){
+    /* parse straight into the column */
+    cur_intensities = intensitydata->PinColumn(col);
+  } else {
+    cur_intensities = new double[array_rows*array_cols];
+  }
+#else
+  cur_intensities = new double[array_rows*array_cols];
+#endif
+
+  try {
+    err_code = read_cel_intensities(cel_path.mb_str(), descriptor, cur_intensities, array_rows*array_cols, array_rows);
+  } catch (wxString &Problem){
+    Error = Problem;
+  }
+
+#ifdef BUFFERED
+  if (!pm_only){
+    intensitydata->UnpinColumn(col);
+  } else {
+    if (Error.IsEmpty() && err_code == 0){
+      StorePMCells(cur_intensities, col);
+    }
+    delete [] cur_intensities;
+  }
+#else
+  if (Error.IsEmpty() && err_code == 0){
+    for (int i=0; i < array_rows*array_cols; i++){
+      (*intensitydata)(i,col) = cur_intensities[i];
+    }
+  }
+  delete [] cur_intensities;
+#endif
+
+  if (!Error.IsEmpty()){
+    throw Error;
+  } else if (err_code < 0){
+    Error = wxT("Format for file ") + cel_path + wxT(" was not recognized.\n");
+    throw Error;
+  } else if (err_code){
+    Error = cel_path + wxT(": ") + parsingErrorCode(err_code) + wxT("\n"); 
+    throw Error;
+  }
+}
+
+
+
+/******************************************************
+ **
+ ** void DataGroup::ReadCELFiles(const wxArrayString &fnames,
+ **                              const wxArrayString &paths)
+ **
+ ** Reads in CEL files (of any format) adding each as the next 
+ ** array of the DataGroup, in order.
+ **
+ ** Parsing a CEL file (a text one in particular) takes far longer 
+ ** than storing its intensities, and the files are independent of
+ ** each other, so when there are several processors the files are 
+ ** parsed by a pool of worker threads. The calling thread is the 
+ ** only one that adds columns to intensitydata or brings them into 
+ ** its buffer. It adds the columns for a batch of files, pins them 
+ ** and hands them to the workers, which parse each file straight 
+ ** into its column. Once the whole batch has been parsed the columns 
+ ** are unpinned and the results checked in order. RME format files 
+ ** are read by the calling thread itself after the batch, since they 
+ ** are read through the matrix.
+ **
+ ** When only PM probes are kept, the stream_steps (DATAGROUP_STREAM_ 
+ ** values) are done to each array straight after it is read, by the 
+ ** same worker, while its column is still pinned. So the RMA background 
+ ** adjustment overlaps the reading, and the arrays need not be read 
+ ** back from the temporary files to find the quantile normalization 
+ ** distribution. The workers leave a sorted copy of each array for the 
+ ** calling thread, which adds them into quantile_target in file order.
+ ** If there is a preprocessed_cache directory, the calling thread also 
+ ** writes each array out there after the stream_steps, and files that 
+ ** have been through them before are not parsed but read back from it 
+ ** (by the calling thread, like RME files).
+ **
+ ** Gzipped files are decompressed whole into memory and parsed from 
+ ** there. One more thread (CELInflater) decompresses them, in order, 
+ ** ahead of the workers, but holds no more than inflate_depth of them 
+ ** waiting to be parsed, since each may be tens of megabytes. A worker
+ ** that gets to a file the CELInflater has not yet started on 
+ ** decompresses it itself.
+ **
+ ******************************************************/
+
+#if wxUSE_THREADS && defined(BUFFERED)
+
+/* what has become of each gzipped file */
+#define INFLATE_NONE 0        /* not gzipped (or read straight from the gzipped file) */
+#define INFLATE_WAITING 1     /* not yet started on */
+#define INFLATE_BUSY 2        /* being decompressed by the CELInflater */
+#define INFLATE_DONE 3        /* in contents[i], NULL if that failed */
+#define INFLATE_TAKEN 4       /* a worker has it */
+
+class CELReadQueue
+{
+ public:
+  CELReadQueue(int n) : paths(n), descriptors(n), skip(n, 0), ready(n, 0), target(n, (double *)0), column(n, 0), err_code(n, 0), problem(n), 
+    storage_problem(n, (const char *)0), inflate_state(n, INFLATE_NONE), contents(n, (char *)0), contents_length(n, 0), 
+    parsed(lock), targeted(lock), inflation(lock) {}
+  ~CELReadQueue();
+
+  std::vector<std::string> paths;   /* multibyte copies, wxString is not safe to share between threads */
+  std::vector<CELDescriptor> descriptors; /* filled in before the workers start, only 
+					     the numbers are looked at by them */
+  std::vector<char> skip;           /* RME files, left for the calling thread */
+  std::vector<char> ready;          /* file has been parsed into target[i] (or failed) */
+  std::vector<double *> target;     /* the pinned column file i is parsed into, 0 once unpinned */
+  std::vector<int> column;          /* and which column of the matrix that is */
+  std::vector<int> err_code;        /* parsing error code, -1 for an unrecognized format */
+  std::vector<wxString> problem;    /* message thrown by the parser, if any */
+  std::vector<const char *> storage_problem; /* or by the BufferedMatrix */
+  const std::vector<int> *pm_locations; /* if only PM probes are kept, else 0 */
+  int length;                       /* intensities in an array */
+  int chip_dim_rows;
+  int next;                         /* next file to hand out */
+  int available;                    /* files before this one have a target */
+  bool stop;                        /* calling thread has given up */
+
+  int stream_steps;                 /* DATAGROUP_STREAM_ steps done by the worker after parsing (PM only) */
+  BufferedMatrix *matrix;           /* for those steps, which only pin columns that are already pinned */
+  int stream_batch;                 /* files in a batch */
+  std::vector<double> sorted;       /* sorted copy of file i at (i % stream_batch)*(PM probes), 
+				       for the calling thread to add into the quantile distribution */
+
+  std::vector<char> inflate_state;  /* INFLATE_ values */
+  std::vector<char *> contents;     /* decompressed files, malloc()ed by gzread_whole_file() */
+  std::vector<size_t> contents_length;
+  int inflate_next;                 /* next file the CELInflater will look at */
+  int inflate_depth;                /* most files it may hold decompressed and not yet taken */
+  int inflated;                     /* files it holds */
+
+  wxMutex lock;
+  wxCondition parsed;               /* signalled when a file has been parsed */
+  wxCondition targeted;             /* signalled when available or stop changes */
+  wxCondition inflation;            /* signalled when inflate_state, inflated or stop changes */
+
+  void Run();
+  void Inflate();
+};
+
+
+CELReadQueue::~CELReadQueue(){
+
+  /* anything decompressed but never parsed (after an error) */
+  for (int i=0; i < (int)contents.size(); i++){
+    if (inflate_state[i] == INFLATE_DONE){
+      free(contents[i]);
+    }
+  }
+}
+
+
+void CELReadQueue::Run(){
+
+  int i;
+  double *cells = 0;
+
+  wxMutexLocker locker(lock);
+  while (!stop){
+    while (next < available && skip[next]){
+      next++;
+    }
+    if (next >= (int)paths.size()){
+      break;
+    }
+    if (next >= available){
+      targeted.Wait();
+      continue;
+    }
+    i = next++;
+
+    /* take the decompressed file, if the CELInflater has (or is about to have) it */
+    char *file_contents = 0;
+    bool from_inflater = false;
+    if (inflate_state[i] != INFLATE_NONE){
+      while (inflate_state[i] == INFLATE_BUSY){
+	inflation.Wait();
+      }
+      if (inflate_state[i] == INFLATE_DONE){
+	file_contents = contents[i];
+	from_inflater = true;
+	inflated--;
+      }
+      inflate_state[i] = INFLATE_TAKEN;
+      inflation.Broadcast();
+    }
+    
+    lock.Unlock();
+    try {
+      /* when only PM probes are kept, files are parsed here and then the PM cells stored */
+      if (pm_locations != 0 && cells == 0){
+	cells = new double[length];
       }
-      Error = Error + wxT(" for file ") +  cel_paths[i] + wxT("\n");
-      free(cur_cdfName);
-      throw Error;
+      double *destination = (cells == 0) ? target[i] : cells;
+
+      if (!from_inflater){
+	err_code[i] = read_cel_intensities(paths[i].c_str(), descriptors[i], destination, length, chip_dim_rows);
+      } else if (file_contents == 0){
+	problem[i] = wxT("Could not decompress ") + wxString(paths[i].c_str(), wxConvUTF8) + wxT("\n");
+	err_code[i] = 0;
+      } else {
+	err_code[i] = parse_cel_contents(paths[i].c_str(), descriptors[i], file_contents, contents_length[i], destination, length, chip_dim_rows);
+      }
+      if (cells != 0 && problem[i].IsEmpty() && err_code[i] == 0){
+	gather_pm_cells(cells, *pm_locations, target[i]);
+	if (stream_steps){
+	  stream_preprocess_column(matrix, column[i], (int)pm_locations->size(), (int)paths.size(), stream_steps, 
+				   (stream_steps & DATAGROUP_STREAM_QUANTILES) ? &sorted[(size_t)(i % stream_batch)*pm_locations->size()] : 0);
+	}
+      }
+    } catch (wxString &Problem){
+      problem[i] = Problem;
+      err_code[i] = 0;
+    } catch (const char *Problem){
+      storage_problem[i] = Problem;
+      err_code[i] = 0;
+    } catch (std::bad_alloc &){
+      problem[i] = wxT("Failed to allocate adequate memory reading ") + wxString(paths[i].c_str(), wxConvUTF8) + wxT(". You may need more RAM and swap space.\n");
+      err_code[i] = 0;
     }
+    free(file_contents);
+    lock.Lock();
+
+    ready[i] = 1;
+    parsed.Broadcast();
   }
-  free(cur_cdfName);
+
+  delete [] cells;
 }
 
 
-static wxString getCelType(const wxString cel_path, int *dim1, int *dim2){
+#if defined(HAVE_ZLIB)
 
-  wxString cdfName;
+/* Decompresses the gzipped files, in order, while there is room. Run by the CELInflater */
 
-  char *cur_cdfName;
-  int cur_dim1;
-  int cur_dim2;
-  int err_code = 0;
-
-  if (isTextCelFile(cel_path.mb_str())){
-    cur_cdfName = get_header_info(cel_path.mb_str(), &cur_dim1, &cur_dim2, &err_code);
-  } else if (isBinaryCelFile(cel_path.mb_str())){
-    cur_cdfName = binary_get_header_info(cel_path.mb_str(), &cur_dim1, &cur_dim2, &err_code);
-  } else if (isGenericCelFile(cel_path.mb_str())){
-    cur_cdfName = generic_get_header_info(cel_path.mb_str(), &cur_dim1, &cur_dim2, &err_code);
-  } else {
-    wxString Error = wxT("Format for file ") + cel_path + wxT(" was not recognized.\n");
-    throw Error;
+void CELReadQueue::Inflate(){
+
+  int i;
+  char *file_contents;
+  size_t file_length = 0;
+
+  wxMutexLocker locker(lock);
+  while (!stop){
+    while (inflate_next < (int)paths.size() && inflate_state[inflate_next] != INFLATE_WAITING){
+      inflate_next++;
+    }
+    if (inflate_next >= (int)paths.size()){
+      break;
+    }
+    if (inflated >= inflate_depth){
+      inflation.Wait();
+      continue;
+    }
+    i = inflate_next++;
+    inflate_state[i] = INFLATE_BUSY;
+
+    lock.Unlock();
+    file_contents = gzread_whole_file(paths[i].c_str(), &file_length);
+    lock.Lock();
+
+    contents[i] = file_contents;
+    contents_length[i] = file_length;
+    inflate_state[i] = INFLATE_DONE;
+    inflated++;
+    inflation.Broadcast();
   }
-  if (err_code){
-    wxString Error = cel_path + wxT(": ") + parsingErrorCode(err_code) + wxT("\n"); 
-    throw Error;
+}
+
+
+class CELInflater : public wxThread
+{
+ public:
+  CELInflater(CELReadQueue *q) : wxThread(wxTHREAD_JOINABLE), queue(q) {}
+
+ protected:
+  ExitCode Entry(){
+    queue->Inflate();
+    return 0;
   }
 
-  *dim1 = cur_dim1;
-  *dim2 = cur_dim2;
-  
-  cdfName = wxString(cur_cdfName,wxConvUTF8);
-  
-  //  free(cur_cdfName);
-  
-  return cdfName;
-}
+ private:
+  CELReadQueue *queue;
+};
 
+#endif
 
 
+class CELReadWorker : public wxThread
+{
+ public:
+  CELReadWorker(CELReadQueue *q) : wxThread(wxTHREAD_JOINABLE), queue(q) {}
 
+ protected:
+  ExitCode Entry(){
+    queue->Run();
+    return 0;
+  }
 
+ private:
+  CELReadQueue *queue;
+};
 
-/******************************************************
- **
- ** bool DataGroup::ReadCELFile(const wxString cel_fname, 
- * 			        const wxString cel_path,
- **                             const int col)
- **
- ** const wxString cel_fname
- ** const wxString cel_path
- ** const int col
- **
- ** Reads in an arbitary format CEL file into the DataGroup object
- **
- **
- ******************************************************/
+#endif
 
-void DataGroup::ReadCELFile(const wxString cel_path,
-			    const int col){
+
+void DataGroup::ReadCELFiles(const wxArrayString &fnames, const wxArrayString &paths){
 
   int i;
-  double *cur_intensities = new double[array_rows*array_cols];
-  
-  int err_code=0;
+  int n = (int)paths.GetCount();
+  int nthreads = 1;
+  int pm_rows = (int)pm_locations.size();
+  int n_total = n_arrays + n;     /* arrays in the quantile normalization distribution */
+  bool preprocessed = (stream_steps != 0 && !preprocessed_cache.IsEmpty());
+
+#if wxUSE_THREADS && defined(BUFFERED)
+  nthreads = wxThread::GetCPUCount();
+  if (nthreads > n){
+    nthreads = n;
+  }
+#endif
 
-  if (isTextCelFile(cel_path.mb_str())){
-    err_code=read_cel_file_intensities(cel_path.mb_str(), cur_intensities, 0 , array_rows*array_cols, 1, array_rows);
-  } else if (isBinaryCelFile(cel_path.mb_str())){
-    err_code=read_binarycel_file_intensities(cel_path.mb_str(), cur_intensities, 0 , array_rows*array_cols, 1, array_rows);
-  } else if (isGenericCelFile(cel_path.mb_str())){
-    err_code=read_genericcel_file_intensities(cel_path.mb_str(), cur_intensities, 0 , array_rows*array_cols, 1, array_rows);
-  } else if (isRMECEL(cel_path)){
-    ReadBinaryCEL(cel_path, col);
-  } else {
-    wxString Error = wxT("Format for file ") + cel_path + wxT(" was not recognized.\n");
-    throw Error;
+  if (nthreads <= 1){
+    std::vector<double> sorted((stream_steps & DATAGROUP_STREAM_QUANTILES) ? pm_rows : 0);
+
+    for (i =0; i < n; i++){
+#if RMA_GUI_APP 
+      DataGroupProgress->Update(i, fnames[i]);
+#endif
+      intensitydata->AddColumn();
+#ifdef BUFFERED
+      if (preprocessed && ReadPreprocessedArray(paths[i], n_arrays, sorted.empty() ? 0 : &sorted[0])){
+	/* the stream_steps were done last time */
+      } else {
+	ReadCELFile(paths[i],n_arrays);
+	if (stream_steps){
+	  stream_preprocess_column(intensitydata, n_arrays, pm_rows, n, stream_steps, sorted.empty() ? 0 : &sorted[0]);
+	}
+	if (preprocessed){
+	  WritePreprocessedArray(paths[i], n_arrays, sorted.empty() ? 0 : &sorted[0]);
+	}
+      }
+      if (stream_steps & DATAGROUP_STREAM_QUANTILES){
+	qnorm_add_sorted(&quantile_target[0], &sorted[0], pm_rows, n_total);
+      }
+#else
+      ReadCELFile(paths[i],n_arrays);
+#endif
+      n_arrays++;
+      ArrayNames.Add(fnames[i]);
+    }
+    return;
   }
 
-  if (err_code){
-    wxString Error = cel_path + wxT(": ") + parsingErrorCode(err_code) + wxT("\n"); 
+#if wxUSE_THREADS && defined(BUFFERED)
+  CELReadQueue queue(n);
+  std::vector<CELReadWorker *> workers;
+#if defined(HAVE_ZLIB)
+  CELInflater *inflater = 0;
+#endif
+  wxString Error;
+  const char *StorageError = 0;
+  int first, last, batch;
+  std::vector<char> cached(n, 0);   /* the file has a preprocessed array to read instead */
+
+  queue.length = array_rows*array_cols;
+  queue.pm_locations = pm_only ? &pm_locations : 0;
+  queue.chip_dim_rows = array_rows;
+  queue.next = 0;
+  queue.available = 0;
+  queue.stop = false;
+  queue.inflate_next = 0;
+  queue.inflate_depth = inflate_depth;
+  queue.inflated = 0;
+  queue.stream_steps = stream_steps;
+  queue.matrix = intensitydata;
+  for (i =0; i < n; i++){
+    queue.paths[i] = std::string((const char *)paths[i].mb_str());
+    queue.descriptors[i] = describeCelFile(paths[i]);
+    cached[i] = (preprocessed && HasPreprocessedArray(paths[i]));
+    queue.skip[i] = (queue.descriptors[i].format == CEL_FORMAT_RME || cached[i]);
+    if (!queue.skip[i] && inflatable(queue.descriptors[i])){
+      queue.inflate_state[i] = INFLATE_WAITING;
+    }
+  }
+
+#if defined(HAVE_ZLIB)
+  if (inflate_depth > 0 && std::find(queue.inflate_state.begin(), queue.inflate_state.end(), INFLATE_WAITING) != queue.inflate_state.end()){
+    inflater = new CELInflater(&queue);
+    if (inflater->Create() != wxTHREAD_NO_ERROR || inflater->Run() != wxTHREAD_NO_ERROR){
+      /* the workers decompress the files themselves */
+      delete inflater;
+      inflater = 0;
+    }
+  }
+#endif
+
+  for (i =0; i < nthreads; i++){
+    CELReadWorker *worker = new CELReadWorker(&queue);
+    if (worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR){
+      /* carry on with the threads we have */
+      delete worker;
+      break;
+    }
+    workers.push_back(worker);
+  }
+  if (workers.empty()){
+#if defined(HAVE_ZLIB)
+    if (inflater != 0){
+      queue.lock.Lock();
+      queue.stop = true;
+      queue.inflation.Broadcast();
+      queue.lock.Unlock();
+      inflater->Wait();
+      delete inflater;
+    }
+#endif
+    Error = wxT("Could not start any threads to read the CEL files.\n");
     throw Error;
   }
 
-  
-  if (!isRMECEL(cel_path)){
-    for (i=0; i < array_rows*array_cols; i++){
-      (*intensitydata)(i,col) = cur_intensities[i];
+  /* Two files per worker keeps them busy while the slowest file of
+     a batch finishes, but every column of a batch is pinned at once */
+  batch = 2*(int)workers.size();
+  if (intensitydata->PinnableColumns() > 0 && batch > intensitydata->PinnableColumns()){
+    batch = intensitydata->PinnableColumns();
+  }
+  queue.stream_batch = batch;
+  if (stream_steps & DATAGROUP_STREAM_QUANTILES){
+    queue.sorted.resize((size_t)batch*pm_rows);
+  }
+
+  /* the workers have to be stopped whatever happens, so errors are held until then */
+  try {
+    for (first = 0; first < n && Error.IsEmpty() && StorageError == 0; first = last){
+      last = (first + batch < n) ? first + batch : n;
+
+      for (i = first; i < last; i++){
+	intensitydata->AddColumn();
+      }
+      for (i = first; i < last; i++){
+	queue.column[i] = n_arrays + i - first;
+	if (!queue.skip[i]){
+	  queue.target[i] = intensitydata->PinColumn(queue.column[i]);
+	}
+      }
+
+      queue.lock.Lock();
+      queue.available = last;
+      queue.targeted.Broadcast();
+      for (i = first; i < last; i++){
+	while (!queue.skip[i] && !queue.ready[i]){
+	  queue.parsed.Wait();
+	}
+      }
+      queue.lock.Unlock();
+      
+      for (i = first; i < last; i++){
+	if (queue.target[i] != 0){
+	  intensitydata->UnpinColumn(queue.column[i]);
+	  queue.target[i] = 0;
+	}
+      }
+
+      /* n_arrays is now the column of file i */
+      for (i = first; i < last; i++){
+#if RMA_GUI_APP 
+	DataGroupProgress->Update(i, fnames[i]);
+#endif
+	double *sorted_copy = queue.sorted.empty() ? 0 : &queue.sorted[(size_t)(i % batch)*pm_rows];
+	if (queue.skip[i]){
+	  try {
+	    if (!cached[i] || !ReadPreprocessedArray(paths[i], n_arrays, sorted_copy)){
+	      /* an RME file (or the preprocessed array has gone) */
+	      cached[i] = 0;
+	      ReadCELFile(paths[i], n_arrays);
+	    }
+	  } catch (wxString &Problem){
+	    Error = Problem;
+	    break;
+	  }
+	  if (stream_steps && !cached[i]){
+	    stream_preprocess_column(intensitydata, n_arrays, pm_rows, n, stream_steps, sorted_copy);
+	  }
+	} else if (queue.storage_problem[i] != 0){
+	  StorageError = queue.storage_problem[i];
+	  break;
+	} else if (!queue.problem[i].IsEmpty()){
+	  Error = queue.problem[i];
+	  break;
+	} else if (queue.err_code[i] < 0){
+	  Error = wxT("Format for file ") + paths[i] + wxT(" was not recognized.\n");
+	  break;
+	} else if (queue.err_code[i]){
+	  Error = paths[i] + wxT(": ") + parsingErrorCode(queue.err_code[i]) + wxT("\n"); 
+	  break;
+	}
+	if (preprocessed && !cached[i]){
+	  WritePreprocessedArray(paths[i], n_arrays, sorted_copy);
+	}
+	if (stream_steps & DATAGROUP_STREAM_QUANTILES){
+	  /* in file order, so the distribution does not depend on the threads */
+	  qnorm_add_sorted(&quantile_target[0], sorted_copy, pm_rows, n_total);
+	}
+	n_arrays++;
+	ArrayNames.Add(fnames[i]);
+      }
     }
+  } catch (const char *Problem){
+    StorageError = Problem;
+  } catch (std::bad_alloc &){
+    Error = wxT("Failed to allocate adequate memory reading the CEL files. You may need more RAM and swap space.\n");
   }
-  delete [] cur_intensities;
-  
+
+  queue.lock.Lock();
+  queue.stop = true;
+  queue.targeted.Broadcast();
+  queue.inflation.Broadcast();
+  queue.lock.Unlock();
+  for (i=0; i < (int)workers.size(); i++){
+    workers[i]->Wait();
+    delete workers[i];
+  }
+#if defined(HAVE_ZLIB)
+  if (inflater != 0){
+    inflater->Wait();
+    delete inflater;
+  }
+#endif
+
+  /* columns left pinned by an error part way through a batch */
+  for (i = 0; i < n; i++){
+    if (queue.target[i] != 0){
+      intensitydata->UnpinColumn(queue.column[i]);
+      queue.target[i] = 0;
+    }
+  }
+
+  if (StorageError != 0){
+    throw StorageError;
+  }
+  if (!Error.IsEmpty()){
+    throw Error;
+  }
+#endif
 }
 
 
@@ -956,12 +2297,338 @@ void DataGroup::ReadBinaryCDF(const wxString cdf_fname, const wxString cdf_path)
   n_probesets = header->n_probesets;
   probeset_names = header->probeset_names;
   n_probes  = header->n_probes; 
+  cdflocs.Reorder(probeset_names);
+
+  delete header;
+
+}
+
+
+/*****************************************************************
+ **
+ ** Compiled CDF files
+ **
+ ** Given a directory for them (Preferences::SetAnnotationCachePath()),
+ ** a text or binary CDF file, or an RME CDF file older than version 4
+ ** (as RMADataConv makes from PGF/CLF files), is parsed only once. It
+ ** is kept there as a version 4 RME CDF file, which later runs map 
+ ** into memory rather than parse (see ReadRMECDF()).
+ **
+ ** The compiled file is named after a hash (64 bit FNV-1a) of the 
+ ** contents of the CDF file and of its name, which gives the array 
+ ** type. So a CDF file that has changed is compiled again, while the
+ ** same CDF file elsewhere is not.
+ **
+ ** So that the CDF file need not be read through to find its hash on
+ ** every run, the hashes are also kept in ANNOTATION_CACHE_INDEX there,
+ ** one line per CDF file
+ **
+ ** hash  stamp  full path
+ **
+ ** separated by tabs, after a first line giving the version. A hash is 
+ ** only used while the stamp (celFileStamp()) of the file still matches.
+ **
+ ** As with the other caches, a directory or file that can not be read
+ ** or written is passed over and the CDF file parsed as usual. Compiled
+ ** files no longer wanted may simply be deleted.
+ **
+ ****************************************************************/
+
+#define ANNOTATION_CACHE_INDEX wxT("RMAExpress_CDF_hashes")
+#define ANNOTATION_CACHE_VERSION wxT("RMAExpress CDF hashes 1")
+#define ANNOTATION_CACHE_EXTENSION wxT(".CDFRME")
+#define ANNOTATION_CACHE_PROBESETS wxT("Probesets: ")
+#define ANNOTATION_CACHE_PROBES wxT("Probes: ")
+
+static void WriteRMECDFBlocks(wxFileOutputStream &output, wxDataOutputStream &store, CDFLocMapTree &cdflocs, const std::vector<int> &items);
+
+
+/* 64 bit FNV-1a, carried on from hash */
+
+static wxUint64 fnv1a64(wxUint64 hash, const unsigned char *bytes, size_t n){
+
+  for (size_t i = 0; i < n; i++){
+    hash = (hash ^ bytes[i])*wxULL(1099511628211);
+  }
+  return hash;
+}
+
+
+/* as 16 hex digits */
+
+static wxString hashString(wxUint64 hash){
+
+  return wxString::Format(wxT("%08lx%08lx"), (unsigned long)(hash >> 32), (unsigned long)(hash & 0xffffffffUL));
+}
+
+
+/* The hash of the contents of the file cdf_path, as 16 hex digits, or
+   an empty string if it can not be read */
+
+static wxString annotationHash(const wxString &cdf_path){
+
+  wxUint64 hash = wxULL(14695981039346656037);
+  std::vector<unsigned char> buffer(1 << 20);
+  size_t n;
+  FILE *infile = fopen(cdf_path.mb_str(), "rb");
+
+  if (infile == NULL){
+    return wxEmptyString;
+  }
+  while ((n = fread(&buffer[0], 1, buffer.size(), infile)) > 0){
+    hash = fnv1a64(hash, &buffer[0], n);
+  }
+  if (ferror(infile)){
+    fclose(infile);
+    return wxEmptyString;
+  }
+  fclose(infile);
+  return hashString(hash);
+}
+
+
+/* The version of the RME CDF file cdf_path, or 0 if it is not one */
+
+static int rmeCDFVersion(const wxString &cdf_path){
+
+  unsigned char header[14];
+  FILE *infile = fopen(cdf_path.mb_str(), "rb");
+  size_t n;
+
+  if (infile == NULL){
+    return 0;
+  }
+  n = fread(header, 1, sizeof(header), infile);
+  fclose(infile);
+  /* the string RMECDF, as wxDataOutputStream writes it, then the version */
+  if (n != sizeof(header) || header[0] != 6 || header[1] != 0 || header[2] != 0 || header[3] != 0 || 
+      memcmp(header + 4, "RMECDF", 6) != 0){
+    return 0;
+  }
+  return (int)(header[10] | (header[11] << 8) | (header[12] << 16) | ((wxUint32)header[13] << 24));
+}
+
+
+/* The hash of cdf_path as it is now, from the index of directory if it
+   is there, otherwise worked out and added to the index */
+
+static wxString indexedAnnotationHash(const wxString &directory, const wxString &cdf_path){
+
+  wxLogNull quiet;    /* it is only a cache, a missing or unwritable index is not an error */
+  wxTextFile index;
+  wxString stamp = celFileStamp(cdf_path);
+  wxString line, hash;
+  wxFileName index_name(directory, ANNOTATION_CACHE_INDEX);
+  size_t i;
+
+  if (index_name.FileExists() && index.Open(index_name.GetFullPath()) && 
+      index.GetLineCount() > 0 && index.GetFirstLine() == ANNOTATION_CACHE_VERSION){
+    for (i = 1; i < index.GetLineCount(); i++){
+      wxStringTokenizer fields(index[i], wxT("\t"), wxTOKEN_RET_EMPTY_ALL);
+      if (fields.CountTokens() != 3){
+	continue;
+      }
+      hash = fields.GetNextToken();
+      if (fields.GetNextToken() == stamp && fields.GetNextToken() == cdf_path && hash.length() == 16){
+	return hash;
+      }
+    }
+  } else {
+    if (index.IsOpened()){
+      index.Close();
+    }
+    if (!index.Create(index_name.GetFullPath()) && !index.Open(index_name.GetFullPath())){
+      return annotationHash(cdf_path);
+    }
+    index.Clear();
+    index.AddLine(ANNOTATION_CACHE_VERSION);
+  }
+
+  hash = annotationHash(cdf_path);
+  if (hash.IsEmpty()){
+    return hash;
+  }
+  for (i = index.GetLineCount(); i > 1; i--){
+    if (index[i-1].AfterLast(wxT('\t')) == cdf_path){
+      index.RemoveLine(i-1);
+    }
+  }
+  index.AddLine(hash + wxT("\t") + stamp + wxT("\t") + cdf_path);
+  index.Write();
+  index.Close();
+  return hash;
+}
+
+
+/******************************************************
+ **
+ ** wxString DataGroup::CompiledCDFName(const wxString cdf_fname, 
+ **                                     const wxString cdf_path)
+ **
+ ** The compiled file for the CDF file cdf_path (named 
+ ** cdf_fname) in annotation_cache, whether or not it has
+ ** been made yet. Empty if there is nothing to compile: 
+ ** no annotation_cache, an unreadable file or one that is
+ ** already a version 4 RME CDF file.
+ **
+ ******************************************************/
+
+wxString DataGroup::CompiledCDFName(const wxString cdf_fname, const wxString cdf_path){
+
+  wxFileName cdf_name(cdf_path);
+  wxString hash, type_name;
+  wxUint64 value;
+  unsigned long high, low;
+  
+  if (annotation_cache.IsEmpty() || rmeCDFVersion(cdf_path) >= 4){
+    return wxEmptyString;
+  }
+  if (!wxFileName::DirExists(annotation_cache) && !wxFileName::Mkdir(annotation_cache, 0777, wxPATH_MKDIR_FULL)){
+    return wxEmptyString;
+  }
+
+  cdf_name.MakeAbsolute();
+  hash = indexedAnnotationHash(annotation_cache, cdf_name.GetFullPath());
+  if (hash.IsEmpty() || !hash.Mid(0, 8).ToULong(&high, 16) || !hash.Mid(8).ToULong(&low, 16)){
+    return wxEmptyString;
+  }
+  value = ((wxUint64)high << 32) | (wxUint64)low;
+
+  /* the text and binary readers name the array type after the file */
+  type_name = cdf_fname.Mid(0, cdf_fname.length()-4);
+  const wxWX2MBbuf type_buf = wxConvUTF8.cWX2MB(type_name.c_str());
+  const char *type_str = (const char *)type_buf;
+  value = fnv1a64(value, (const unsigned char *)type_str, strlen(type_str));
+
+  return wxFileName(annotation_cache, hashString(value) + ANNOTATION_CACHE_EXTENSION).GetFullPath();
+}
+
+
+/* The number of probesets and probes given by the descriptions of the
+   compiled file compiled_path. false if it is not one, or they are not
+   as many as its probeset names allow */
+
+static bool compiledCDFCounts(const wxString &compiled_path, long *n_probesets, long *n_probes){
+
+  wxFFileInputStream input(compiled_path);
+  wxDataInputStream store(input);
+  wxString description, value;
+  wxUint32 i, n;
+  long n_names;
+  
+  *n_probesets = -1;
+  *n_probes = -1;
+  if (!input.IsOk() || rmeCDFVersion(compiled_path) != 4){
+    return false;
+  }
+  store.ReadString();    /* RMECDF */
+  store.Read32();        /* version */
+  n = store.Read32();
+  for (i = 0; i < n && !input.Eof(); i++){
+    store.ReadString();  /* array types */
+  }
+  n = store.Read32();
+  for (i = 0; i < n && !input.Eof(); i++){
+    description = store.ReadString();
+    if (description.StartsWith(ANNOTATION_CACHE_PROBESETS, &value)){
+      value.ToLong(n_probesets);
+    } else if (description.StartsWith(ANNOTATION_CACHE_PROBES, &value)){
+      value.ToLong(n_probes);
+    }
+  }
+  store.Read32();        /* rows */
+  store.Read32();        /* cols */
+  n_names = (long)store.Read32();
+  
+  return !input.Eof() && *n_probesets >= 0 && *n_probesets <= n_names && *n_probes >= 0;
+}
+
+
+/* Reads the compiled file compiled_path in place of the CDF file it 
+   was compiled from, if there is one. false if there is not, or it 
+   can not be read, in which case nothing has been changed */
+
+bool DataGroup::ReadCompiledCDF(const wxString compiled_path){
+
+  RME_CDF_Header header;
+  long compiled_probesets, compiled_probes;
+
+  if (!wxFileExists(compiled_path)){
+    return false;
+  }
+  if (!compiledCDFCounts(compiled_path, &compiled_probesets, &compiled_probes)){
+    wxLogNull quiet;
+    wxRemoveFile(compiled_path);
+    return false;
+  }
+  /* version 4 files are checked through before anything is kept */
+  try {
+    ReadRMECDF(compiled_path, &cdflocs, &header);
+  } catch (wxString &) {
+    wxLogNull quiet;
+    wxRemoveFile(compiled_path);
+    return false;
+  }
+
+  ArrayTypeName = header.ArrayTypeName;
+  array_rows = header.array_rows;
+  array_cols = header.array_cols;
+  n_probesets = (int)compiled_probesets;
+  probeset_names = header.probeset_names;
+  n_probes = (int)compiled_probes;
+  
+  return true;
+}
+
 
-  delete header;
+/* Writes what has just been read from a CDF file to compiled_path, as
+   a version 4 RME CDF file holding every one of probeset_names. So 
+   that what is read back is just what was read, n_probesets (which a
+   binary CDF file gives as its number of units, each of which may be
+   several of probeset_names) and n_probes are kept as descriptions. 
+   The file is written under another name and then renamed, so that a
+   half written one is never read */
 
-}
+void DataGroup::WriteCompiledCDF(const wxString compiled_path){
+
+  wxLogNull quiet;    /* it is only a cache, failing to write it is not an error */
+  wxString partname = compiled_path + wxString::Format(wxT(".%lu.part"), (unsigned long)wxGetProcessId());
+  int n = (int)probeset_names.GetCount();
+  bool written;
+  size_t j;
 
+  if (ArrayTypeName.GetCount() == 0 || n_probesets > n || cdflocs.GetCount() < n){
+    return;
+  }
+
+  {
+    wxFileOutputStream output(partname);
+    wxDataOutputStream store(output);
+    std::vector<int> items(n);
 
+    store.WriteString(wxString(_T("RMECDF")));
+    store.Write32(4);
+    store.Write32(ArrayTypeName.GetCount());
+    for (j = 0; j < ArrayTypeName.GetCount(); j++){
+      store.WriteString(ArrayTypeName[j]);
+    }  
+    store.Write32(2);
+    store.WriteString(ANNOTATION_CACHE_PROBESETS + wxString::Format(wxT("%d"), n_probesets));
+    store.WriteString(ANNOTATION_CACHE_PROBES + wxString::Format(wxT("%d"), n_probes));
+    store.Write32(array_rows);
+    store.Write32(array_cols);
+    store.Write32(n);
+    /* cdflocs holds the probesets in probeset_names order */
+    for (j = 0; j < (size_t)n; j++){
+      items[j] = (int)j;
+    }
+    WriteRMECDFBlocks(output, store, cdflocs, items);
+    written = output.IsOk();
+  }
+  if (!written || !wxRenameFile(partname, compiled_path, true)){
+    wxRemoveFile(partname);
+  }
+}
 
 
 
@@ -1049,6 +2716,15 @@ void DataGroup::ReadBinaryCEL(const wxString cel_path,const int col){
   
   numbercells = rows*cols;
 
+  if (pm_only){
+    std::vector<double> cells(numbercells);
+    for (j =0; j < numbercells ; j++){
+      cells[j] = store.ReadDouble();
+    }
+    StorePMCells(&cells[0], col);
+    return;
+  }
+
   for (j =0; j < numbercells ; j++){
     (*intensitydata)(j,col) = store.ReadDouble();
   }
@@ -1056,6 +2732,217 @@ void DataGroup::ReadBinaryCEL(const wxString cel_path,const int col){
 
 
 
+/******************************************************
+ **
+ ** void DataGroup::StorePMCells(const double *cells, const int col)
+ **
+ ** Stores the PM intensities from cells (every cell of
+ ** an array) as column col, when only PM probes are kept.
+ **
+ ******************************************************/
+
+void DataGroup::StorePMCells(const double *cells, const int col){
+
+#ifdef BUFFERED
+  double *column = intensitydata->PinColumn(col);
+  gather_pm_cells(cells, pm_locations, column);
+  intensitydata->UnpinColumn(col);
+#endif
+}
+
+
+
+#ifdef BUFFERED
+
+/*****************************************************************
+ **
+ ** Preprocessed arrays
+ **
+ ** Given a directory for them (Preferences::SetPreprocessedCachePath()),
+ ** a DataGroup doing stream_steps keeps what they made of each array 
+ ** in a file there. So when a CEL file is used again, in a batch that 
+ ** grows a few arrays at a time say, it need not be parsed, background 
+ ** adjusted or sorted again. The file for a CEL file is named after it
+ ** and a hash of its full path and the stream_steps (so CEL files of the
+ ** same name in different directories, or the same one streamed in 
+ ** different ways, have files of their own), with 
+ ** PREPROCESSED_CACHE_EXTENSION added, and holds
+ **
+ ** a line giving the version (PREPROCESSED_CACHE_VERSION)
+ ** a line giving what it was made from (PreprocessedKey())
+ ** the double 1.0
+ ** the PM intensities after the stream_steps, in PMProbeBatch order
+ ** those same values sorted (DATAGROUP_STREAM_QUANTILES only)
+ **
+ ** The doubles are written as they are held in memory, so the files are 
+ ** only of use on the kind of machine that wrote them (which the 1.0 
+ ** checks). As with CELHeaderCache, files that can not be read or 
+ ** written are passed over and the arrays read from the CEL files.
+ **
+ ****************************************************************/
+
+#define PREPROCESSED_CACHE_EXTENSION wxT(".rmepp")
+#define PREPROCESSED_CACHE_VERSION wxT("RMAExpress preprocessed array 1")
+
+
+/* Identifies the CDF and the PM probes kept, in order (FNV-1a hash of pm_locations) */
+
+static wxString pmLayout(const wxString &cdf_name, const std::vector<int> &pm_locations){
+
+  unsigned long hash = 2166136261UL;
+  unsigned int location;
+  
+  for (size_t i = 0; i < pm_locations.size(); i++){
+    location = (unsigned int)pm_locations[i];
+    for (int k = 0; k < 4; k++){
+      hash = ((hash ^ (location & 0xff))*16777619UL) & 0xffffffffUL;
+      location = location >> 8;
+    }
+  }
+  return cdf_name + wxString::Format(wxT(" %d %08lx"), (int)pm_locations.size(), hash);
+}
+
+
+static wxString preprocessedFileName(const wxString &directory, const wxString &cel_path, int stream_steps){
+
+  wxFileName cel_name(cel_path);
+  wxUint64 hash = wxULL(14695981039346656037);
+  unsigned char steps[4];
+
+  cel_name.MakeAbsolute();
+  const wxWX2MBbuf path_buf = wxConvUTF8.cWX2MB(cel_name.GetFullPath().c_str());
+  const char *path_str = (const char *)path_buf;
+  hash = fnv1a64(hash, (const unsigned char *)path_str, strlen(path_str));
+  for (int k = 0; k < 4; k++){
+    steps[k] = (unsigned char)(((unsigned int)stream_steps >> (8*k)) & 0xff);
+  }
+  hash = fnv1a64(hash, steps, 4);
+
+  return wxFileName(directory, cel_name.GetFullName() + wxT("-") + hashString(hash) + PREPROCESSED_CACHE_EXTENSION).GetFullPath();
+}
+
+
+/* The first two lines of the preprocessed file for a CEL file with the given key */
+
+static std::string preprocessedHeader(const wxString &key){
+
+  wxString header = wxString(PREPROCESSED_CACHE_VERSION) + wxT("\n") + key + wxT("\n");
+
+  return std::string((const char *)header.mb_str(wxConvUTF8));
+}
+
+
+/* The CEL file as it is now (stamp and full path), the steps done to it 
+   and the PM probes kept. A preprocessed file is only used if its key 
+   is the same */
+
+wxString DataGroup::PreprocessedKey(const wxString &cel_path){
+
+  wxFileName cel_name(cel_path);
+
+  cel_name.MakeAbsolute();
+  return celFileStamp(cel_name.GetFullPath()) + wxString::Format(wxT("\t%d\t"), stream_steps) + preprocessed_layout + wxT("\t") + cel_name.GetFullPath();
+}
+
+
+/* Opens the preprocessed file for cel_path, positioned at the intensities, 
+   or returns NULL if there is no such file for it as it is now */
+
+FILE *DataGroup::OpenPreprocessedArray(const wxString &cel_path){
+
+  std::string header = preprocessedHeader(PreprocessedKey(cel_path));
+  std::vector<char> found(header.size());
+  double one = 0.0;
+  FILE *cachefile = fopen(preprocessedFileName(preprocessed_cache, cel_path, stream_steps).mb_str(), "rb");
+
+  if (cachefile == NULL){
+    return NULL;
+  }
+  if (fread(&found[0], 1, found.size(), cachefile) != found.size() || memcmp(&found[0], header.data(), found.size()) != 0 ||
+      fread(&one, sizeof(double), 1, cachefile) != 1 || one != 1.0){
+    fclose(cachefile);
+    return NULL;
+  }
+  return cachefile;
+}
+
+
+bool DataGroup::HasPreprocessedArray(const wxString &cel_path){
+
+  FILE *cachefile = OpenPreprocessedArray(cel_path);
+
+  if (cachefile == NULL){
+    return false;
+  }
+  fclose(cachefile);
+  return true;
+}
+
+
+/* Reads the preprocessed array for cel_path into column col, and its sorted 
+   values into sorted (if not 0). Returns false, leaving the column in no 
+   particular state, if they could not all be read */
+
+bool DataGroup::ReadPreprocessedArray(const wxString &cel_path, int col, double *sorted){
+
+  size_t rows = pm_locations.size();
+  bool complete;
+  double *column = intensitydata->PinColumn(col);
+  FILE *cachefile = OpenPreprocessedArray(cel_path);
+
+  complete = (cachefile != NULL && fread(column, sizeof(double), rows, cachefile) == rows);
+  if (complete && sorted != 0){
+    complete = (fread(sorted, sizeof(double), rows, cachefile) == rows);
+  }
+  intensitydata->UnpinColumn(col);
+  if (cachefile != NULL){
+    fclose(cachefile);
+  }
+  return complete;
+}
+
+
+/* Writes column col (the CEL file cel_path after the stream_steps), and 
+   its sorted values if not 0, as the preprocessed array for cel_path. 
+   The file is written under another name and then renamed, so that a 
+   half written one is never read */
+
+void DataGroup::WritePreprocessedArray(const wxString &cel_path, int col, const double *sorted){
+
+  wxLogNull quiet;    /* it is only a cache, failing to write it is not an error */
+  size_t rows = pm_locations.size();
+  std::string header = preprocessedHeader(PreprocessedKey(cel_path));
+  double one = 1.0;
+  wxString cachename = preprocessedFileName(preprocessed_cache, cel_path, stream_steps);
+  wxString partname = cachename + wxT(".part");
+  bool complete;
+
+  if (!wxFileName::DirExists(preprocessed_cache) && !wxFileName::Mkdir(preprocessed_cache, 0777, wxPATH_MKDIR_FULL)){
+    return;
+  }
+  
+  double *column = intensitydata->PinColumn(col);
+  FILE *cachefile = fopen(partname.mb_str(), "wb");
+  
+  complete = (cachefile != NULL &&
+	      fwrite(header.data(), 1, header.size(), cachefile) == header.size() &&
+	      fwrite(&one, sizeof(double), 1, cachefile) == 1 &&
+	      fwrite(column, sizeof(double), rows, cachefile) == rows &&
+	      (sorted == 0 || fwrite(sorted, sizeof(double), rows, cachefile) == rows));
+  intensitydata->UnpinColumn(col);
+  if (cachefile == NULL){
+    return;
+  }
+  complete = (fclose(cachefile) == 0) && complete;
+  if (!complete || !wxRenameFile(partname, cachename, true)){
+    wxRemoveFile(partname);
+  }
+}
+
+#endif
+
+
+
 
 
 
@@ -1075,24 +2962,42 @@ void DataGroup::ReadBinaryCEL(const wxString cel_path,const int col){
  **   and probeset mapping information for the probes. In addition
  **   we will hold the cel intensities in a big array
  **
+ **   If pm_only is true (BUFFERED builds) only the PM probes are 
+ **   kept, in the order PMProbeBatch uses, so that it can take the 
+ **   intensities over with GivePMIntensities() rather than gathering
+ **   them from every cell. Such a DataGroup can only be used to 
+ **   make a PMProbeBatch (once), not to look at the raw data.
+ **
+ **   Such a DataGroup may also do some of the preprocessing to each
+ **   array as it is read, stream_steps being DATAGROUP_STREAM_ values
+ **   or'ed together. PMProbeBatch then skips those steps. Otherwise
+ **   stream_steps is ignored. The arrays are kept in preferences'
+ **   preprocessed cache directory, if it has one, after those steps, 
+ **   and read back from there when the same CEL files are used again.
+ **
  ******************************************************/
 
 DataGroup::DataGroup(wxWindow *parent,const wxString cdf_fname, 
 		     const wxString cdf_path,
 		     const wxArrayString cel_fnames, 
-		     const wxArrayString cel_paths, Preferences *preferences){
+		     const wxArrayString cel_paths, Preferences *preferences, bool pm_only, int stream_steps){
 
   int i;// j;
   wxString Error;
   
 
   this->parent = parent;
+  inflate_depth = preferences->GetInflateDepth();
+  this->stream_steps = 0;
+  streamed_steps = 0;
+  this->pm_only = false;
 
   n_probes = 0;
 
   /* Check that CEL files are all of the same type */
   checkCelHeaders(cel_paths);
 
+  annotation_cache = preferences->GetAnnotationCachePath();
   ReadCDFFile(cdf_fname,cdf_path);  
 
   /* check that CEL files and CDF agree */
@@ -1104,26 +3009,64 @@ DataGroup::DataGroup(wxWindow *parent,const wxString cdf_fname,
   wxString tempFullPath = preferences->GetFullFilePath();
   const wxWX2MBbuf tmp_buf = wxConvCurrent->cWX2MB(tempFullPath);
   const char *tmp_str = (const char*) tmp_buf;
+  int buffer_rows = preferences->GetProbesBufSize();
+  int buffer_cols = preferences->GetArrayBufSize();
+  double budget;
+  int stored_rows = array_rows*array_cols;
+
+  if (pm_only){
+    const int *current_PMLocs;
+
+    /* cdflocs holds the probesets in probeset_names order */
+    pm_locations.reserve(n_probes);
+    for (i =0; i < n_probesets; i++){
+      current_PMLocs = cdflocs.GetPMLocs(i);
+      if (current_PMLocs != NULL){
+	pm_locations.insert(pm_locations.end(), current_PMLocs, current_PMLocs + cdflocs.GetPMSize(i));
+      }
+    }
+    stored_rows = (int)pm_locations.size();
+    /* the rows PMProbeBatch will have (count_pm()) are the rows stored. A unit 
+       may have several blocks in the CDF, past the first n_probesets */
+    n_probes = stored_rows;
+    this->pm_only = true;
+
+    this->stream_steps = stream_steps;
+    if (stream_steps & DATAGROUP_STREAM_QUANTILES){
+      quantile_target.assign(stored_rows, 0.0);
+    }
+    if (stream_steps != 0 && !preferences->GetPreprocessedCachePath().IsEmpty()){
+      preprocessed_cache = preferences->GetPreprocessedCachePath();
+      preprocessed_layout = pmLayout(ArrayTypeName[0], pm_locations);
+    }
+  }
+
+  /* the arrays are only ever read in whole, so all the memory goes on arrays */
+  if (preferences->GetAutoBufSize()){
+    budget = BufferedMatrix::MemoryBudget();
+    if (budget > 0.0){
+      BufferedMatrix::ChooseBufferSize(budget, stored_rows, (int)cel_fnames.GetCount(), false, &buffer_rows, &buffer_cols);
+    }
+  }
   
-  intensitydata = new BufferedMatrix(preferences->GetProbesBufSize(),preferences->GetArrayBufSize(),(char *)tmp_str);
+  intensitydata = new BufferedMatrix(buffer_rows,buffer_cols,(char *)tmp_str);
+  intensitydata->SetStorageMode(preferences->GetStorageMode());
+  intensitydata->SetSinglePrecisionStorage(preferences->GetSinglePrecisionStorage());
+  intensitydata->SetRows(stored_rows);
 #else
   intensitydata = new Matrix();
+  intensitydata->SetRows(array_rows*array_cols);
 #endif
 
-
-  intensitydata->SetRows(array_rows*array_cols);
 #if RMA_GUI_APP
   DataGroupProgress = new wxProgressDialog(_T("Reading in .........."),_T(""),cel_fnames.GetCount(),this->parent,wxPD_AUTO_HIDE );
 #endif
   
   try{
-    for (i =0; i < (int)cel_fnames.GetCount(); i++){
-#if RMA_GUI_APP 
-      DataGroupProgress->Update(i, cel_fnames[i]);
-#endif
-      intensitydata->AddColumn();
-      ReadCELFile(cel_paths[i],i);
-    }
+    n_arrays = 0;
+    ReadCELFiles(cel_fnames, cel_paths);
+    streamed_steps = this->stream_steps;
+    this->stream_steps = 0;
     
     n_arrays = cel_fnames.GetCount();
     ArrayNames = cel_fnames;
@@ -1165,6 +3108,10 @@ DataGroup::DataGroup(wxWindow *parent,
   //  bool read_ok;
 
   this->parent = parent;
+  inflate_depth = preferences->GetInflateDepth();
+  stream_steps = 0;
+  streamed_steps = 0;
+  pm_only = false;
 
   n_probes = 0;
 #ifdef BUFFERED
@@ -1173,6 +3120,8 @@ DataGroup::DataGroup(wxWindow *parent,
   const char *tmp_str = (const char*) tmp_buf;
   
   intensitydata = new BufferedMatrix(preferences->GetProbesBufSize(),preferences->GetArrayBufSize(),(char *)tmp_str);
+  intensitydata->SetStorageMode(preferences->GetStorageMode());
+  intensitydata->SetSinglePrecisionStorage(preferences->GetSinglePrecisionStorage());
 
 #else
   intensitydata = new Matrix();
@@ -1258,6 +3207,10 @@ DataGroup::DataGroup(wxWindow *parent,
 DataGroup::DataGroup(wxWindow *parent,const wxString cdf_fname){
   
   this->parent = parent;
+  inflate_depth = 2;
+  stream_steps = 0;
+  streamed_steps = 0;
+  pm_only = false;
   
   n_probes = 0;
 
@@ -1284,6 +3237,10 @@ DataGroup::DataGroup(wxWindow *parent,const wxArrayString cel_paths, Preferences
 
 
   this->parent = parent;
+  inflate_depth = preferences->GetInflateDepth();
+  stream_steps = 0;
+  streamed_steps = 0;
+  pm_only = false;
   
 
   checkCelHeaders(cel_paths);
@@ -1295,6 +3252,8 @@ DataGroup::DataGroup(wxWindow *parent,const wxArrayString cel_paths, Preferences
   const char *tmp_str = (const char*) tmp_buf;
   
   intensitydata = new BufferedMatrix(preferences->GetProbesBufSize(),preferences->GetArrayBufSize(),(char *)tmp_str);
+  intensitydata->SetStorageMode(preferences->GetStorageMode());
+  intensitydata->SetSinglePrecisionStorage(preferences->GetSinglePrecisionStorage());
 #else
   intensitydata = new Matrix();
 #endif
@@ -1315,14 +3274,7 @@ DataGroup::DataGroup(wxWindow *parent,const wxArrayString cel_paths, Preferences
 
   intensitydata->SetRows(array_rows*array_cols);
 
-  for (i =0; i < (int)cel_fnames.GetCount(); i++){
-#if RMA_GUI_APP 
-    DataGroupProgress->Update(i, cel_fnames[i]);
-#endif
-    intensitydata->AddColumn();
-    ReadCELFile(cel_paths[i],i);
-    n_arrays++;
-  }
+  ReadCELFiles(cel_fnames, cel_paths);
   
   n_arrays = cel_fnames.GetCount();
   ArrayNames = cel_fnames;
@@ -1336,24 +3288,53 @@ DataGroup::DataGroup(wxWindow *parent,const wxArrayString cel_paths, Preferences
 
 void DataGroup::Add(const wxArrayString &fnames, const wxArrayString &paths){
 
-  int i;
+  int old_arrays = n_arrays;
+  std::vector<double> old_target;
 
   checkCelHeaders(paths);
   checkCDFCelAgreement(paths, ArrayTypeName, array_cols, array_rows);
+
+  if (streamed_steps){
+    /* The new arrays go through the same steps as they are read, and the 
+       quantile normalization distribution is of n_arrays arrays so far, 
+       of n_arrays + (the new ones) after */
+    if (intensitydata == NULL || ((streamed_steps & DATAGROUP_STREAM_QUANTILES) && quantile_target.empty())){
+      wxString Error = _T("The intensities of this data set have already been used.\n");
+      throw Error;
+    }
+    old_target = quantile_target;
+    for (int i = 0; i < (int)quantile_target.size(); i++){
+      quantile_target[i] = quantile_target[i]*n_arrays/(n_arrays + (double)fnames.GetCount());
+    }
+    stream_steps = streamed_steps;
+  }
   
 #if RMA_GUI_APP
   DataGroupProgress = new wxProgressDialog(_T("Reading in .........."),_T(""),fnames.GetCount(),this->parent,wxPD_AUTO_HIDE );
 #endif
 
-  for (i =0; i < (int)fnames.GetCount(); i++){
-#if RMA_GUI_APP 
-    DataGroupProgress->Update(i, fnames[i]);
+  try{
+    ReadCELFiles(fnames, paths);
+  }
+  catch(...){
+    /* Leave the DataGroup as it was, without any of the new arrays */
+    stream_steps = 0;
+    if (streamed_steps){
+      quantile_target.swap(old_target);
+    }
+    while ((int)ArrayNames.GetCount() > old_arrays){
+      ArrayNames.RemoveAt(ArrayNames.GetCount() - 1);
+    }
+    n_arrays = old_arrays;
+    while (intensitydata != NULL && intensitydata->Cols() > n_arrays){
+      intensitydata->RemoveLastColumn();
+    }
+#if RMA_GUI_APP  
+    delete DataGroupProgress;
 #endif
-    intensitydata->AddColumn();
-    ReadCELFile(paths[i],n_arrays);
-    n_arrays++;
-    ArrayNames.Add(fnames[i]);
+    throw;
   }
+  stream_steps = 0;
 #if RMA_GUI_APP  
   delete DataGroupProgress;
 #endif
@@ -1475,22 +3456,6 @@ wxArrayString DataGroup::GiveNames(){
 
 }
 
-/******************************************************
- **
- ** LocMapItem *DataGroup::FindLocMapItem(const wxString &name)
- **  
- ** const wxString &name
- **
- **
- **
- **
- **
- *****************************************************/
-
-LocMapItem *DataGroup::FindLocMapItem(const wxString &name){
-  
-  return cdflocs.Find(name);
-}
 
 /******************************************************
  **
@@ -1541,12 +3506,86 @@ wxArrayString DataGroup::GetArrayNames(){
 **/
 
 
-bool DataGroup::WriteBinaryCDF(wxString path){
+/**** 
+ version 4 RME CDF files, which can be used where they lie (memory mapped) 
+ rather than parsed, go on from the number of probesets with
+
+ int  number of PM locations
+ int  number of MM locations
+ int  number of bytes of probeset names
+ int  offset of the blocks below from the start of the file (a multiple of 16)
+
+ then, from that offset
+
+ int  start of the PM locations of each probeset in the PM locations, then the number of PM locations
+ int  likewise for the MM locations
+ int  likewise for the probeset names in the bytes of names
+ int  PM locations, probeset by probeset
+ int  MM locations
+ char probeset names, UTF-8 and each followed by a 0
+
+ all little endian as with the rest of the file. See ReadRMECDF()
+**/
+
+static void WriteRMECDFBlocks(wxFileOutputStream &output, wxDataOutputStream &store, CDFLocMapTree &cdflocs, const std::vector<int> &items){
+
+  int n = (int)items.size();
+  int i;
+  std::vector<wxUint32> pm_start(n+1), mm_start(n+1), name_start(n+1);
+  std::vector<wxUint32> pm_locs, mm_locs;
+  std::vector<char> names;
+  
+  pm_start[0] = mm_start[0] = name_start[0] = 0;
+  for (i = 0; i < n; i++){
+    const int *PMLocs = cdflocs.GetPMLocs(items[i]);
+    const int *MMLocs = cdflocs.GetMMLocs(items[i]);
+    const wxWX2MBbuf name_buf = wxConvUTF8.cWX2MB(cdflocs.GetName(items[i]).c_str());
+    const char *name = (const char *)name_buf;
+    
+    if (PMLocs != NULL){
+      pm_locs.insert(pm_locs.end(), PMLocs, PMLocs + cdflocs.GetPMSize(items[i]));
+    }
+    if (MMLocs != NULL){
+      mm_locs.insert(mm_locs.end(), MMLocs, MMLocs + cdflocs.GetMMSize(items[i]));
+    }
+    names.insert(names.end(), name, name + strlen(name) + 1);
+    pm_start[i+1] = (wxUint32)pm_locs.size();
+    mm_start[i+1] = (wxUint32)mm_locs.size();
+    name_start[i+1] = (wxUint32)names.size();
+  }
+
+  store.Write32((wxUint32)pm_locs.size());
+  store.Write32((wxUint32)mm_locs.size());
+  store.Write32((wxUint32)names.size());
+  
+  wxFileOffset at = output.TellO() + 4;
+  wxFileOffset data_offset = (at + 15) & ~(wxFileOffset)15;
+  store.Write32((wxUint32)data_offset);
+  for (; at < data_offset; at++){
+    store.Write8(0);
+  }
+
+  store.Write32(&pm_start[0], pm_start.size());
+  store.Write32(&mm_start[0], mm_start.size());
+  store.Write32(&name_start[0], name_start.size());
+  if (!pm_locs.empty()){
+    store.Write32(&pm_locs[0], pm_locs.size());
+  }
+  if (!mm_locs.empty()){
+    store.Write32(&mm_locs[0], mm_locs.size());
+  }
+  if (!names.empty()){
+    output.Write(&names[0], names.size());
+  }
+}
+
+
+bool DataGroup::WriteBinaryCDF(wxString path, int version){
 
   size_t i,j;
   int numbercells;
   wxString currentName;
-  LocMapItem *current_item;
+  int current_item;
   
   // Store the CEL file data
 #if RMA_GUI_APP 
@@ -1573,15 +3612,15 @@ bool DataGroup::WriteBinaryCDF(wxString path){
   store.Write32(n_probesets);
   
   for (i = 0; i < n_probesets; i++){
-    current_item = cdflocs.Find(probeset_names[i]);
-    store.WriteString(current_item->GetName());
-    store.Write32(current_item->GetPMSize());
-    for (j = 0; j < current_item->GetPMSize(); j++){
-      store.Write32(current_item->GetPMLocs()[j]); 
-    }
-    if (current_item->GetMMLocs() != NULL){
-      for (j= 0; j < current_item->GetMMSize(); j++){
-	store.Write32(current_item->GetMMLocs()[j]);
+    current_item = i;
+    store.WriteString(cdflocs.GetName(current_item));
+    store.Write32(cdflocs.GetPMSize(current_item));
+    for (j = 0; j < cdflocs.GetPMSize(current_item); j++){
+      store.Write32(cdflocs.GetPMLocs(current_item)[j]); 
+    }
+    if (cdflocs.GetMMLocs(current_item) != NULL){
+      for (j= 0; j < cdflocs.GetMMSize(current_item); j++){
+	store.Write32(cdflocs.GetMMLocs(current_item)[j]);
       }
     }
   }
@@ -1606,27 +3645,27 @@ bool DataGroup::WriteBinaryCDF(wxString path){
   store.Write32(array_cols);
   store.Write32(n_probesets);
   for (i = 0; i < n_probesets; i++){
-    current_item = cdflocs.Find(probeset_names[i]);
-    store.WriteString(current_item->GetName());
-    store.Write32(current_item->GetPMSize());
-    for (j = 0; j < current_item->GetPMSize(); j++){
-      store.Write32(current_item->GetPMLocs()[j]); 
+    current_item = i;
+    store.WriteString(cdflocs.GetName(current_item));
+    store.Write32(cdflocs.GetPMSize(current_item));
+    for (j = 0; j < cdflocs.GetPMSize(current_item); j++){
+      store.Write32(cdflocs.GetPMLocs(current_item)[j]); 
     }
-    store.Write32(current_item->GetMMSize());
-    for (j= 0; j < current_item->GetMMSize(); j++){
-	store.Write32(current_item->GetMMLocs()[j]);
+    store.Write32(cdflocs.GetMMSize(current_item));
+    for (j= 0; j < cdflocs.GetMMSize(current_item); j++){
+	store.Write32(cdflocs.GetMMLocs(current_item)[j]);
     }
   }
   **/
 
-  /* this code is for format 3 introduced at 1.0 beta 4 */
+  /* this code is for format 3 introduced at 1.0 beta 4, and format 4 which differs from it after the number of probesets */
   wxFileName currentPath(path,ArrayTypeName[0] + _T(".CDFRME"));
   currentName =currentPath.GetFullPath();
   
   wxFileOutputStream output(currentName);
   wxDataOutputStream store(output);
   store.WriteString(wxString(_T("RMECDF")));
-  store.Write32(3);
+  store.Write32(version);
   store.Write32(ArrayTypeName.GetCount());
   for (j = 0; j < ArrayTypeName.GetCount(); j++){
     store.WriteString(ArrayTypeName[j]);
@@ -1648,16 +3687,24 @@ bool DataGroup::WriteBinaryCDF(wxString path){
   store.Write32(array_rows);
   store.Write32(array_cols);
   store.Write32(n_probesets);  
+  if (version == 4){
+    std::vector<int> items(n_probesets);
+    for (i = 0; i < n_probesets; i++){
+      items[i] = (int)i;
+    }
+    WriteRMECDFBlocks(output, store, cdflocs, items);
+    return true;
+  }
   for (i = 0; i < n_probesets; i++){
-    current_item = cdflocs.Find(probeset_names[i]);
-    store.WriteString(current_item->GetName());
-    store.Write32(current_item->GetPMSize());
-    for (j = 0; j < current_item->GetPMSize(); j++){
-      store.Write32(current_item->GetPMLocs()[j]); 
+    current_item = i;
+    store.WriteString(cdflocs.GetName(current_item));
+    store.Write32(cdflocs.GetPMSize(current_item));
+    for (j = 0; j < cdflocs.GetPMSize(current_item); j++){
+      store.Write32(cdflocs.GetPMLocs(current_item)[j]); 
     }
-    store.Write32(current_item->GetMMSize());
-    for (j= 0; j < current_item->GetMMSize(); j++){
-	store.Write32(current_item->GetMMLocs()[j]);
+    store.Write32(cdflocs.GetMMSize(current_item));
+    for (j= 0; j < cdflocs.GetMMSize(current_item); j++){
+	store.Write32(cdflocs.GetMMLocs(current_item)[j]);
     }
   }
 
@@ -1712,12 +3759,12 @@ bool DataGroup::WriteBinaryCEL(wxString path){
 
 
 
-bool DataGroup::WriteBinaryCDF(wxString path, wxString restrictfname, wxArrayString restrictlist){
+bool DataGroup::WriteBinaryCDF(wxString path, wxString restrictfname, wxArrayString restrictlist, int version){
   
   size_t i,j;
   
   wxString currentName;
-  LocMapItem *current_item;
+  int current_item;
   
 #if RMA_GUI_APP
   wxProgressDialog RMEProgress(_T("RME Progress"),_T("Writing CEL files"),n_arrays,this->parent,wxPD_AUTO_HIDE);
@@ -1745,19 +3792,19 @@ bool DataGroup::WriteBinaryCDF(wxString path, wxString restrictfname, wxArrayStr
   
   for (i = 0; i < restrictlist.Count(); i++){
     current_item = cdflocs.Find(restrictlist[i]);
-    if (current_item == 0){
+    if (current_item < 0){
 
       wxString ErrorMessage = "Can't find it " + restrictlist[i] + "\n";
       throw ErrorMessage;
     }
-    store.WriteString(current_item->GetName());
-    store.Write32(current_item->GetPMSize());
-    for (j = 0; j < current_item->GetPMSize(); j++){
-      store.Write32(current_item->GetPMLocs()[j]); 
+    store.WriteString(cdflocs.GetName(current_item));
+    store.Write32(cdflocs.GetPMSize(current_item));
+    for (j = 0; j < cdflocs.GetPMSize(current_item); j++){
+      store.Write32(cdflocs.GetPMLocs(current_item)[j]); 
     }
-    if (current_item->GetMMLocs() != NULL){
-      for (j= 0; j < current_item->GetMMSize(); j++){
-	store.Write32(current_item->GetMMLocs()[j]);
+    if (cdflocs.GetMMLocs(current_item) != NULL){
+      for (j= 0; j < cdflocs.GetMMSize(current_item); j++){
+	store.Write32(cdflocs.GetMMLocs(current_item)[j]);
       }
     }
   }
@@ -1780,31 +3827,31 @@ bool DataGroup::WriteBinaryCDF(wxString path, wxString restrictfname, wxArrayStr
   store.Write32(n_probesets);
   for (i = 0; i < (int)restrictlist.Count(); i++){
     current_item = cdflocs.Find(restrictlist[i]);
-    if (current_item == 0){
+    if (current_item < 0){
 
       wxString ErrorMessage = _T("Can't find it ") + restrictlist[i] + _T("\n");
       throw ErrorMessage;
     }
-    store.WriteString(current_item->GetName());
-    store.Write32(current_item->GetPMSize());
-    for (j = 0; j < current_item->GetPMSize(); j++){
-      store.Write32(current_item->GetPMLocs()[j]); 
+    store.WriteString(cdflocs.GetName(current_item));
+    store.Write32(cdflocs.GetPMSize(current_item));
+    for (j = 0; j < cdflocs.GetPMSize(current_item); j++){
+      store.Write32(cdflocs.GetPMLocs(current_item)[j]); 
     }  
-    store.Write32(current_item->GetMMSize());
-    for (j= 0; j < current_item->GetMMSize(); j++){
-      store.Write32(current_item->GetMMLocs()[j]);
+    store.Write32(cdflocs.GetMMSize(current_item));
+    for (j= 0; j < cdflocs.GetMMSize(current_item); j++){
+      store.Write32(cdflocs.GetMMLocs(current_item)[j]);
     }
   }
   **/
 
-  /* this code is for format 3 introduced at 1.0 beta 4 */
+  /* this code is for format 3 introduced at 1.0 beta 4, and format 4 which differs from it after the number of probesets */
   wxFileName currentPath(path,ArrayTypeName[0] + _T(".CDFRME"));
   currentName =currentPath.GetFullPath();
   
   wxFileOutputStream output(currentName);
   wxDataOutputStream store(output);
   store.WriteString(wxString(_T("RMECDF")));
-  store.Write32(3);
+  store.Write32(version);
   store.Write32(ArrayTypeName.GetCount());
   for (j = 0; j < ArrayTypeName.GetCount(); j++){
     store.WriteString(ArrayTypeName[j]);
@@ -1817,21 +3864,33 @@ bool DataGroup::WriteBinaryCDF(wxString path, wxString restrictfname, wxArrayStr
   store.Write32(array_rows);
   store.Write32(array_cols);
   store.Write32(n_probesets);
+  if (version == 4){
+    std::vector<int> items(n_probesets);
+    for (i = 0; i < restrictlist.Count(); i++){
+      items[i] = cdflocs.Find(restrictlist[i]);
+      if (items[i] < 0){
+	wxString ErrorMessage = _T("Can't find it ") + restrictlist[i] + _T("\n");
+	throw ErrorMessage;
+      }
+    }
+    WriteRMECDFBlocks(output, store, cdflocs, items);
+    return true;
+  }
   for (i = 0; i < restrictlist.Count(); i++){
     current_item = cdflocs.Find(restrictlist[i]);
-    if (current_item == 0){
+    if (current_item < 0){
 
       wxString ErrorMessage = _T("Can't find it ") + restrictlist[i] + _T("\n");
       throw ErrorMessage;
     }
-    store.WriteString(current_item->GetName());
-    store.Write32(current_item->GetPMSize());
-    for (j = 0; j < current_item->GetPMSize(); j++){
-      store.Write32(current_item->GetPMLocs()[j]); 
+    store.WriteString(cdflocs.GetName(current_item));
+    store.Write32(cdflocs.GetPMSize(current_item));
+    for (j = 0; j < cdflocs.GetPMSize(current_item); j++){
+      store.Write32(cdflocs.GetPMLocs(current_item)[j]); 
     }  
-    store.Write32(current_item->GetMMSize());
-    for (j= 0; j < current_item->GetMMSize(); j++){
-      store.Write32(current_item->GetMMLocs()[j]);
+    store.Write32(cdflocs.GetMMSize(current_item));
+    for (j= 0; j < cdflocs.GetMMSize(current_item); j++){
+      store.Write32(cdflocs.GetMMLocs(current_item)[j]);
     }
   }
 
@@ -1862,7 +3921,9 @@ CDFLocMapTree *DataGroup::GiveLocMapTree(){
 void DataGroup::ResizeBuffer(int rows, int cols){
 
 #ifdef BUFFERED
-  intensitydata->ResizeBuffer(rows, cols);
+  if (intensitydata != NULL){
+    intensitydata->ResizeBuffer(rows, cols);
+  }
 #endif
 }
 
@@ -1877,17 +3938,120 @@ double DataGroup::operator()(int row, int col){
 }
 
 
+/******************************************************
+ **
+ ** void DataGroup::GetColumn(int col, double *dest)
+ **
+ ** copies all nrows()*ncols() intensities of array col
+ ** into dest.
+ **
+ ******************************************************/
+
+void DataGroup::GetColumn(int col, double *dest){
+
+#ifdef BUFFERED
+  intensitydata->GetFullColumn(col, dest);
+#else
+  int i;
+  int length = array_rows*array_cols;
+
+  for (i=0; i < length; i++){
+    dest[i] = (*intensitydata)[(unsigned long)col*length + i];
+  }
+#endif
+}
+
+
 void DataGroup::ReadOnlyMode(bool setting=false){
   
   
 #ifdef BUFFERED
-  intensitydata->ReadOnlyMode(setting);
+  if (intensitydata != NULL){
+    intensitydata->ReadOnlyMode(setting);
+  }
 #endif
   
 
 }
 
 
+/******************************************************
+ **
+ ** bool DataGroup::PMOnly()
+ **
+ ** true if only the PM probes were stored
+ **
+ ******************************************************/
+
+bool DataGroup::PMOnly(){
+
+  return pm_only;
+}
+
+
+#ifdef BUFFERED
+
+/******************************************************
+ **
+ ** BufferedMatrix *DataGroup::GivePMIntensities()
+ **
+ ** Hands over the PM intensities (one row per PM probe
+ ** in PMProbeBatch order, one column per array). The 
+ ** caller is then responsible for deleting them. Returns
+ ** NULL if they have already been given away, or if every
+ ** cell was stored.
+ **
+ ******************************************************/
+
+BufferedMatrix *DataGroup::GivePMIntensities(){
+
+  BufferedMatrix *pm_intensities;
+
+  if (!pm_only){
+    return NULL;
+  }
+  pm_intensities = intensitydata;
+  intensitydata = NULL;
+  return pm_intensities;
+}
+
+#endif
+
+
+/******************************************************
+ **
+ ** int DataGroup::StreamedSteps()
+ **
+ ** The DATAGROUP_STREAM_ steps that were done to every 
+ ** array as it was read (or 0)
+ **
+ ******************************************************/
+
+int DataGroup::StreamedSteps(){
+
+  return streamed_steps;
+}
+
+
+/******************************************************
+ **
+ ** void DataGroup::GiveQuantileTarget(std::vector<double> &target)
+ **
+ ** Hands over the quantile normalization distribution 
+ ** (one value per PM probe) found as the arrays were read. 
+ ** target is left empty if there is none.
+ **
+ ******************************************************/
+
+void DataGroup::GiveQuantileTarget(std::vector<double> &target){
+
+  target.clear();
+  if (streamed_steps & DATAGROUP_STREAM_QUANTILES){
+    target.swap(quantile_target);
+  }
+}
+
+
 void DataGroup::AddCDF_desc(wxString &desc){
 
 
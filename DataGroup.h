@@ -3,17 +3,23 @@
 
 #include <wx/wx.h>
 #include <wx/progdlg.h>
+#include <vector>
+#include <cstdio>
 #include "CDFLocMapTree.h"
 #include "Storage/Matrix.h"
 #include "Storage/BufferedMatrix.h"
 #include "PreferencesDialog.h"
 
+/* Preprocessing that a DataGroup holding only PM probes may do to each 
+   array as it is read (the stream_steps of the constructor) */
+#define DATAGROUP_STREAM_BACKGROUND 1  /* RMA background adjustment */
+#define DATAGROUP_STREAM_QUANTILES 2   /* add it into the quantile normalization distribution */
 
 class DataGroup
 {
  public: 
   DataGroup(wxWindow *parent,const wxString cdf_fname, const wxString cdf_path,
-	    const wxArrayString cel_fnames, const wxArrayString cel_paths, Preferences *preferences); // instantiate with CDF and CEL files
+	    const wxArrayString cel_fnames, const wxArrayString cel_paths, Preferences *preferences, bool pm_only=false, int stream_steps=0); // instantiate with CDF and CEL files
   DataGroup(wxWindow *parent,const wxArrayString binary_fnames, const wxArrayString binary_paths, Preferences *preferences); //instantiate with RME files.
   DataGroup(wxWindow *parent,const wxString cdf_fname);       // instantiate with only a CDF file
   DataGroup(wxWindow *parent,const wxArrayString cel_fnames, Preferences *preferences); // instantiate with only CEL files
@@ -25,12 +31,11 @@ class DataGroup
   double &operator[](unsigned int i);
  
   wxArrayString GiveNames();
-  LocMapItem *FindLocMapItem(const wxString &);
   wxArrayString GetArrayNames();
   CDFLocMapTree *GiveLocMapTree();
 
-  bool WriteBinaryCDF(wxString path);
-  bool WriteBinaryCDF(wxString path, wxString restrictfname ,wxArrayString restrictnames);
+  bool WriteBinaryCDF(wxString path, int version = 3);  // version 3, or 4 to memory map when read
+  bool WriteBinaryCDF(wxString path, wxString restrictfname ,wxArrayString restrictnames, int version = 3);
 
   bool WriteBinaryCEL(wxString path);
 
@@ -46,24 +51,46 @@ class DataGroup
   void ResizeBuffer(int rows, int cols);
 
   double operator()(int row, int col);
+  void GetColumn(int col, double *dest);
 
   void ReadOnlyMode(bool setting);
 
   void AddCDF_desc(wxString &desc);
+
+  bool PMOnly();
+#ifdef BUFFERED
+  BufferedMatrix *GivePMIntensities();
+#endif
+  int StreamedSteps();
+  void GiveQuantileTarget(std::vector<double> &target);
  private:
 
   void ReadCDFFile(const wxString cdf_fname, const wxString cdf_path);
   void ReadCELFile(const wxString cel_path,const int col);
+  void ReadCELFiles(const wxArrayString &fnames, const wxArrayString &paths);
   void ReadBinaryCDF(const wxString cdf_fname, const wxString cdf_path);
+  void ReadXDACDF(const wxString cdf_fname, const wxString cdf_path);
+  void ReadTextCDF(const wxString cdf_fname, const wxString cdf_path);
+  wxString CompiledCDFName(const wxString cdf_fname, const wxString cdf_path);
+  bool ReadCompiledCDF(const wxString compiled_path);
+  void WriteCompiledCDF(const wxString compiled_path);
   void ReadBinaryCEL(const wxString cel_fname, const wxString cel_path,const int col);
   void ReadBinaryCEL(const wxString cel_path,const int col);
+  void StorePMCells(const double *cells, const int col);
+#ifdef BUFFERED
+  wxString PreprocessedKey(const wxString &cel_path);
+  FILE *OpenPreprocessedArray(const wxString &cel_path);
+  bool HasPreprocessedArray(const wxString &cel_path);
+  bool ReadPreprocessedArray(const wxString &cel_path, int col, double *sorted);
+  void WritePreprocessedArray(const wxString &cel_path, int col, const double *sorted);
+#endif
 
   wxWindow *parent;
   wxArrayString ArrayTypeName;
   wxArrayString probeset_names;
   wxArrayString ArrayNames;
   
-  CDFLocMapTree cdflocs;
+  CDFLocMapTree cdflocs;  // in probeset_names order, see CDFLocMapTree::Reorder()
   wxArrayString  CDF_descStr;
 
 
@@ -78,6 +105,20 @@ class DataGroup
   BufferedMatrix *intensitydata;
 
 #endif
+  bool pm_only;                   /* only the PM probes are stored (see PMOnly()) */
+  std::vector<int> pm_locations;  /* when pm_only, the cell held in each row of intensitydata
+				     (PMProbeBatch order). Otherwise empty and intensitydata 
+				     holds every cell */
+
+  int inflate_depth;   /* gzipped CEL files decompressed ahead of the parsing (see ReadCELFiles()) */
+  wxString annotation_cache;     /* directory CDF files are kept compiled in, if any (see CompiledCDFName()) */
+
+  int stream_steps;    /* DATAGROUP_STREAM_ steps ReadCELFiles() is to do to each array as it is read */
+  int streamed_steps;  /* and those that were done to every array */
+  std::vector<double> quantile_target; /* with DATAGROUP_STREAM_QUANTILES, the quantile normalization
+					  distribution of the (background adjusted) arrays */
+  wxString preprocessed_cache;   /* directory the arrays are kept in after the stream_steps, if any */
+  wxString preprocessed_layout;  /* the CDF and pm_locations those were made with (see PreprocessedKey()) */
 
 
 #if RMA_GUI_APP 
@@ -29,6 +29,18 @@
  ** Sept 16, 2006 - fix compile problems with Unicode builds ow wxWidgets
  ** Jan 6, 2007 - add Commpute5Summary
  ** Jan 27, 2007 - add summarize_PLM() method
+ ** Oct 17, 2026 - Row buffer read-ahead during summarization. Add GetPrefetchCounts()
+ ** Oct 17, 2026 - Constructor copies a whole array at a time into a pinned column
+ ** Oct 17, 2026 - Background adjust several arrays at once in separate threads
+ ** Oct 17, 2026 - Column read-ahead during background adjustment and normalization
+ ** Oct 17, 2026 - Buffer sizes may be chosen from the available memory, separately for the
+ **                column at a time steps and for summarization
+ ** Oct 17, 2026 - Take over the intensities of a DataGroup that holds only PM probes
+ **                rather than gathering them
+ ** Oct 17, 2026 - Skip the background adjustment, and the first half of the 
+ **                normalization, when the DataGroup did them as the arrays were read
+ ** Oct 17, 2026 - Walk the probesets of the CDFLocMapTree by index rather than looking up each name
+ ** Oct 17, 2026 - Check that the PM intensities taken over have one row per PM probe
  **
  *****************************************************/
 
@@ -66,12 +78,12 @@ PMProbeBatch::PMProbeBatch(DataGroup &x, Preferences *preferences){
 
   wxString current_name;
   int current_n_probes=0;
-  int *current_PMLocs;
-  wxArrayString probeset_names = x.GiveNames();
-  LocMapItem *current_item;
+  const int *current_PMLocs;
+  CDFLocMapTree *current_locs = x.GiveLocMapTree(); // probesets in x.GiveNames() order
 
   int n_remove = 0;
 
+  streamed_steps = 0;
 
   n_probes = x.count_pm();
   n_arrays = x.count_arrays();
@@ -85,11 +97,37 @@ PMProbeBatch::PMProbeBatch(DataGroup &x, Preferences *preferences){
   wxString tempFullPath = preferences->GetFullFilePath();
   const wxWX2MBbuf tmp_buf = wxConvCurrent->cWX2MB(tempFullPath);
   const char *tmp_str = (const char*) tmp_buf;
+  int buffer_rows = preferences->GetProbesBufSize();
+  int buffer_cols = preferences->GetArrayBufSize();
+
+  buffer_budget = 0.0;
+  buffer_inram = false;
+  if (preferences->GetAutoBufSize()){
+    buffer_budget = BufferedMatrix::MemoryBudget();
+    if (buffer_budget > 0.0){
+      buffer_inram = BufferedMatrix::ChooseBufferSize(buffer_budget, n_probes, n_arrays, false, &buffer_rows, &buffer_cols);
+    }
+  }
   
-  intensity = new BufferedMatrix(preferences->GetProbesBufSize(),preferences->GetArrayBufSize(),(char *)tmp_str);
-  intensity->SetRows(n_probes);
-  for (k=0; k < n_arrays;k++){
-		intensity->AddColumn();
+  if (x.PMOnly()){
+    /* The DataGroup holds just the PM probes, already in our order, so take them over */
+    intensity = x.GivePMIntensities();
+    if (intensity == NULL){
+      wxString Error = _T("The intensities of this data set have already been used.\n");
+      throw Error;
+    }
+    intensity->ReadOnlyMode(false);
+    intensity->ResizeBuffer(buffer_rows, buffer_cols);
+    streamed_steps = x.StreamedSteps();
+    x.GiveQuantileTarget(quantile_target);
+  } else {
+    intensity = new BufferedMatrix(buffer_rows,buffer_cols,(char *)tmp_str);
+    intensity->SetStorageMode(preferences->GetStorageMode());
+    intensity->SetSinglePrecisionStorage(preferences->GetSinglePrecisionStorage());
+    intensity->SetRows(n_probes);
+    for (k=0; k < n_arrays;k++){
+      intensity->AddColumn();
+    }
   }
 #else
   intensity = new double[n_probes*n_arrays];
@@ -112,10 +150,9 @@ PMProbeBatch::PMProbeBatch(DataGroup &x, Preferences *preferences){
 #ifndef BUFFERED
   for (i =0; i < n_probesets; i++){
    
-    current_item =  x.FindLocMapItem(probeset_names[i]);
-    current_name = current_item->GetName();
-    current_n_probes = current_item->GetPMSize();
-    current_PMLocs = current_item->GetPMLocs(); 
+    current_name = current_locs->GetName(i);
+    current_n_probes = current_locs->GetPMSize(i);
+    current_PMLocs = current_locs->GetPMLocs(i); 
     //#if DEBUG
     //wxPrintf(current_name+"\n");
     //#endif
@@ -143,9 +180,8 @@ PMProbeBatch::PMProbeBatch(DataGroup &x, Preferences *preferences){
   int l = 0;
 
   for (i =0; i < n_probesets; i++){ 
-    current_item =  x.FindLocMapItem(probeset_names[i]);
-    current_name = current_item->GetName();
-    current_n_probes = current_item->GetPMSize();
+    current_name = current_locs->GetName(i);
+    current_n_probes = current_locs->GetPMSize(i);
    // ProbesetRowNames.Add(current_name,current_n_probes);
 	ProbesetRowNames_count.push_back(make_pair(current_name, current_n_probes));
 	l += current_n_probes;
@@ -160,9 +196,8 @@ PMProbeBatch::PMProbeBatch(DataGroup &x, Preferences *preferences){
 
   l = 0;
   for (i =0; i < n_probesets; i++){
-    current_item =  x.FindLocMapItem(probeset_names[i]);
-    current_n_probes = current_item->GetPMSize();
-    current_PMLocs = current_item->GetPMLocs(); 
+    current_n_probes = current_locs->GetPMSize(i);
+    current_PMLocs = current_locs->GetPMLocs(i); 
     for (j =0; j < current_n_probes; j++){
       PMLocations[l + j] = current_PMLocs[j];
     }
@@ -180,15 +215,31 @@ PMProbeBatch::PMProbeBatch(DataGroup &x, Preferences *preferences){
   wxPrintf(_T("ps: %d   p:%d    lofn: %d\n"),n_probesets,n_probes,ProbesetRowNames.GetCount());
 #endif
 
-  for (k =0; k < n_arrays; k++){
-    //intensity->AddColumn();
-    for (current_row=0; current_row < l; current_row++){
-      (*intensity)[k*n_probes + current_row] =  x(PMLocations[current_row],k);
-    }
+  if (x.PMOnly() && l != n_probes){
+    /* the rows taken over must be the PM probes, one for one */
+    delete intensity;
+    intensity = NULL;
+    wxString Error = _T("The PM intensities do not match the probesets of the CDF.\n");
+    throw Error;
+  }
+
+  if (!x.PMOnly()){
+    std::vector<double> x_column(x_length);
+    double *column;
+
+    for (k =0; k < n_arrays; k++){
+      //intensity->AddColumn();
+      x.GetColumn(k, &x_column[0]);
+      column = intensity->PinColumn(k);
+      for (current_row=0; current_row < l; current_row++){
+	column[current_row] = x_column[PMLocations[current_row]];
+      }
+      intensity->UnpinColumn(k);
 #if RMA_GUI_APP
-	PreprocessDialog->Update(k);
-    //InitializeProgress.Update(k);
+      PreprocessDialog->Update(k);
+      //InitializeProgress.Update(k);
 #endif    
+    }
   }
   
 
@@ -230,11 +281,29 @@ void PMProbeBatch::normalize(bool lowmem){
   int lowmemflag = (int)lowmem;
   int nprobes = (int)n_probes;
   int narrs = (int)n_arrays;
+  int result;
+
+#ifdef BUFFERED
+  intensity->SetPrefetch(true);
+  if (!quantile_target.empty()){
+    /* the distribution was found as the arrays were read */
+#if RMA_GUI_APP
+    result = qnorm_c_target(intensity, &nprobes, &narrs, &quantile_target[0], PreprocessDialog);
+#else 
+    result = qnorm_c_target(intensity, &nprobes, &narrs, &quantile_target[0]);
+#endif
+  } else {
+#endif
 #if RMA_GUI_APP
-  if (qnorm_c(intensity, &nprobes, &narrs, &lowmemflag, PreprocessDialog)){
+    result = qnorm_c(intensity, &nprobes, &narrs, &lowmemflag, PreprocessDialog);
 #else 
-  if (qnorm_c(intensity, &nprobes, &narrs, &lowmemflag)){
+    result = qnorm_c(intensity, &nprobes, &narrs, &lowmemflag);
+#endif
+#ifdef BUFFERED
+  }
+  intensity->SetPrefetch(false);
 #endif
+  if (result){
     wxString t=_T("Failed to allocate adequate memory in normalization step. You may need more RAM and swap space."); 
 #if RMA_GUI_APP
     wxMessageDialog
@@ -246,10 +315,54 @@ void PMProbeBatch::normalize(bool lowmem){
   
 }
 
+#ifdef BUFFERED
+
+/* When the buffer sizes are chosen automatically, resize the buffers for 
+   the coming step: arrays for background adjustment and normalization, 
+   probes for summarization. Returns true if everything is in RAM, in which 
+   case there is no need for row mode */
+
+bool PMProbeBatch::AutoSizeBuffer(bool rowmode){
+
+  int buffer_rows, buffer_cols;
+
+  if (buffer_budget <= 0.0){
+    return false;
+  }
+  buffer_inram = BufferedMatrix::ChooseBufferSize(buffer_budget, n_probes, n_arrays, rowmode, &buffer_rows, &buffer_cols);
+  intensity->ResizeBuffer(buffer_rows, buffer_cols);
+
+  return buffer_inram;
+}
+
+
+/* State shared by the background adjustment column workers */
+
+typedef struct{
+	BufferedMatrix *intensity;
+	int n_probes;
+	int n_arrays;
+} bg_work;
+
+static void background_adjust_column(int j, void *arg){
+	bg_work *work = (bg_work *)arg;
+	double param[3];
+
+	bg_parameters2(work->intensity, work->intensity, param, work->n_probes, work->n_arrays, j);
+	bg_adjust(work->intensity, work->intensity, param, work->n_probes, work->n_arrays, j);
+}
+
+#endif
+
+
 void PMProbeBatch::background_adjust(){
 
 	int j = 0;
-	double param[3];
+
+	if (streamed_steps & DATAGROUP_STREAM_BACKGROUND){
+		/* done as the arrays were read */
+		return;
+	}
 #if RMA_GUI_APP
 	PreprocessDialog->SetTitle(_T("Background Adjusting"));
 	PreprocessDialog->SetRange(n_arrays+1);
@@ -258,9 +371,28 @@ void PMProbeBatch::background_adjust(){
 #endif
 
 #ifdef BUFFERED
-	intensity->ReadOnlyMode(true);
+	/* Arrays are independent, so adjust as many at once as there are 
+	   threads, working back from the last array (which is most likely 
+	   still in the column buffer) */
+	bg_work work;
+	int nthreads = intensity->ColumnWorkers();
+	int first;
+
+	work.intensity = intensity;
+	work.n_probes = n_probes;
+	work.n_arrays = n_arrays;
+
+	intensity->SetPrefetch(true);
+	for (j = n_arrays; j > 0; j -= nthreads){
+		first = (j > nthreads) ? j - nthreads : 0;
+		RunColumnWorkers(first, j - first, nthreads, background_adjust_column, &work);
+#if RMA_GUI_APP
+		PreprocessDialog->Update(n_arrays - first);
 #endif
-
+	}
+	intensity->SetPrefetch(false);
+#else
+	double param[3];
 
 	for (j = n_arrays - 1; j >= 0; j--){
 		bg_parameters2(intensity, intensity, param, n_probes, n_arrays, j);
@@ -271,11 +403,8 @@ void PMProbeBatch::background_adjust(){
 			PreprocessDialog->Update(n_arrays - j);
 		}
 #endif
-#ifdef BUFFERED
-		intensity->ReadOnlyMode(false);
-#endif
-
 	}
+#endif
 #if RMA_GUI_APP
 	PreprocessDialog->Show(false);
 #endif
@@ -307,7 +436,12 @@ expressionGroup *PMProbeBatch::summarize(){
 #endif
 
 #ifdef BUFFERED
-	intensity->RowMode();
+	/* probesets are visited in row order, so read ahead the next block of rows */
+	intensity->ResetPrefetchCounters();
+	if (!AutoSizeBuffer(true)){
+		intensity->SetPrefetch(true);
+		intensity->RowMode();
+	}
 #endif
 
 	// ProbesetRowNames.Item(0);
@@ -352,7 +486,11 @@ expressionGroup *PMProbeBatch::summarize(){
 
  
 #ifdef BUFFERED
-  intensity->ColMode();
+  if (!buffer_inram){
+    intensity->ColMode();
+    intensity->SetPrefetch(false);
+  }
+  AutoSizeBuffer(false);
 #endif
 
 #if RMA_GUI_APP
@@ -396,7 +534,12 @@ expressionGroup *PMProbeBatch::summarize_PLM(){
 #endif
 
 #ifdef BUFFERED
-  intensity->RowMode();
+  /* probesets are visited in row order, so read ahead the next block of rows */
+  intensity->ResetPrefetchCounters();
+  if (!AutoSizeBuffer(true)){
+    intensity->SetPrefetch(true);
+    intensity->RowMode();
+  }
 #endif
 
   i = 0;     /* indexes current probeset */
@@ -454,7 +597,11 @@ expressionGroup *PMProbeBatch::summarize_PLM(){
   }
  
 #ifdef BUFFERED
-  intensity->ColMode();
+  if (!buffer_inram){
+    intensity->ColMode();
+    intensity->SetPrefetch(false);
+  }
+  AutoSizeBuffer(false);
 #endif
 
 #if RMA_GUI_APP
@@ -531,3 +678,14 @@ void  PMProbeBatch::Compute5Summary(int col, double *results){
   intensity->Compute5Summary(col,results);
 
 }
+
+
+/* How well the row buffer read-ahead did during the last summarization. 
+   Lots of misses suggests the probes buffer size is too small */
+
+void  PMProbeBatch::GetPrefetchCounts(long *hits, long *misses){
+
+  *hits = intensity->GetPrefetchHits();
+  *misses = intensity->GetPrefetchMisses();
+
+}
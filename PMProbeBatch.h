@@ -39,6 +39,7 @@ class PMProbeBatch
   long count_arrays();
 
   void Compute5Summary(int col,double *results);
+  void GetPrefetchCounts(long *hits, long *misses);
 
  private:
   long n_probes;
@@ -48,7 +49,12 @@ class PMProbeBatch
   double *intensity;
 #else
   BufferedMatrix *intensity;
+  double buffer_budget;  /* RAM for the buffers when sized automatically, otherwise 0 */
+  bool buffer_inram;     /* the whole of intensity is in the column buffer */
+  bool AutoSizeBuffer(bool rowmode);
 #endif
+  int streamed_steps;    /* DATAGROUP_STREAM_ steps already done by the DataGroup */
+  std::vector<double> quantile_target; /* quantile normalization distribution it found, if any */
   wxArrayString ProbesetRowNames;
   wxArrayString ArrayNames;
   wxArrayString ArrayTypeName;
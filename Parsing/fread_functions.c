@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include "fread_functions.h"
 
 //#define HAVE_ZLIB 1
@@ -206,6 +207,101 @@ size_t fread_double64(double *destination, int n, FILE *instream){
   return result;
 }
 
+
+/*************************************************************************
+ **
+ ** size_t fread_float32_records(double *destination, int n, int record_size, FILE *instream)
+ **
+ ** double *destination - where to store the n values
+ ** int n - number of records to read
+ ** int record_size - size in bytes of each record
+ ** FILE *instream - the open file
+ **
+ ** Reads n fixed size records, each of which starts with a little endian 
+ ** float32, and stores that first value of each record (as a double). 
+ ** The records are read in large blocks rather than with a separate
+ ** fread() for every field of every record. If the memory for a block
+ ** can't be had, smaller blocks are used.
+ **
+ ** returns the number of complete records read (0 if there was not
+ ** even the memory for one record).
+ **
+ ************************************************************************/
+
+#define FREAD_RECORDS_BLOCK 65536
+
+size_t fread_float32_records(double *destination, int n, int record_size, FILE *instream){
+
+  unsigned char *buffer;
+  const unsigned char *record;
+  size_t total = 0, wanted, result, k;
+  size_t block = FREAD_RECORDS_BLOCK;
+  float value;
+
+  while ((buffer = (unsigned char *)malloc(block*record_size)) == NULL){
+    if (block == 1){
+      return 0;
+    }
+    block /= 2;
+  }
+
+  while (total < (size_t)n){
+    wanted = (size_t)n - total;
+    if (wanted > block){
+      wanted = block;
+    }
+    result = fread(buffer,record_size,wanted,instream);
+
+    record = buffer;
+    for (k = 0; k < result; k++){
+      memcpy(&value,record,sizeof(float));
+#ifdef WORDS_BIGENDIAN
+      swap_float_4(&value);
+#endif
+      destination[total + k] = (double)value;
+      record += record_size;
+    }
+    total += result;
+
+    if (result < wanted){
+      break;
+    }
+  }
+
+  free(buffer);
+  return total;
+}
+
+/*************************************************************************
+ **
+ ** size_t buffer_float32_records(double *destination, int n, int record_size, const char *buffer, size_t length)
+ **
+ ** As fread_float32_records(), but the records are taken from the 
+ ** length bytes at buffer (a file already read into memory).
+ **
+ ** returns the number of complete records there.
+ **
+ ************************************************************************/
+
+size_t buffer_float32_records(double *destination, int n, int record_size, const char *buffer, size_t length){
+
+  size_t total = length/record_size, k;
+  float value;
+
+  if (total > (size_t)n){
+    total = (size_t)n;
+  }
+  for (k = 0; k < total; k++){
+    memcpy(&value,buffer,sizeof(float));
+#ifdef WORDS_BIGENDIAN
+    swap_float_4(&value);
+#endif
+    destination[k] = (double)value;
+    buffer += record_size;
+  }
+  return total;
+}
+
 /*************************************************************************
  **
  ** Code for big endian data reading from the binary files, doing bit flipping if
@@ -327,6 +423,51 @@ size_t fread_be_float32(float *destination, int n, FILE *instream){
 
 
 
+/*************************************************************************
+ **
+ ** size_t buffer_be_float32(double *destination, int n, const char *buffer, size_t length)
+ **
+ ** Takes n big endian float32 values from the length bytes at buffer 
+ ** and stores them as doubles. returns the number there were.
+ **
+ ************************************************************************/
+
+size_t buffer_be_float32(double *destination, int n, const char *buffer, size_t length){
+
+  return buffer_be_float32_records(destination, n, sizeof(float), buffer, length);
+}
+
+
+/*************************************************************************
+ **
+ ** size_t buffer_be_float32_records(double *destination, int n, int record_size, const char *buffer, size_t length)
+ **
+ ** As buffer_be_float32(), but the values are the first four bytes
+ ** of records of record_size bytes, the rest of each record being 
+ ** skipped. returns the number of complete records there.
+ **
+ ************************************************************************/
+
+size_t buffer_be_float32_records(double *destination, int n, int record_size, const char *buffer, size_t length){
+
+  size_t total = length/record_size, k;
+  float value;
+
+  if (total > (size_t)n){
+    total = (size_t)n;
+  }
+  for (k = 0; k < total; k++){
+    memcpy(&value,buffer,sizeof(float));
+#ifndef WORDS_BIGENDIAN
+    swap_float_4(&value);
+#endif
+    destination[k] = (double)value;
+    buffer += record_size;
+  }
+  return total;
+}
+
+
 size_t fread_be_char(char *destination, int n, FILE *instream){
 
  
@@ -713,10 +854,103 @@ size_t gzread_be_double64(double *destination, int n, gzFile instream){
 
 
 
+/*************************************************************************
+ **
+ ** char *gzread_whole_file(const char *filename, size_t *length)
+ **
+ ** const char *filename - a gzipped file
+ ** size_t *length - set to the length of the decompressed contents
+ **
+ ** Decompresses the whole of a file into memory, in large reads, so
+ ** that it may then be parsed without any further calls into zlib.
+ ** The size recorded at the end of the gzip file is used as a first
+ ** guess at the size needed, but since that may be anything in a
+ ** damaged file no more than GZREAD_WHOLE_RATIO times the compressed 
+ ** size is allocated at first. The buffer is grown as needed after
+ ** that. A file that stops short gives what could be decompressed, 
+ ** the parsers find it is truncated.
+ **
+ ** returns the contents (allocated with malloc(), with a NUL after
+ ** them) or NULL if the file could not be opened or decompressed,
+ ** or there was not enough memory.
+ **
+ ************************************************************************/
+
+#define GZREAD_WHOLE_CHUNK 1048576
+#define GZREAD_WHOLE_RATIO 16
+
+char *gzread_whole_file(const char *filename, size_t *length){
+
+  FILE *infile;
+  gzFile gzinfile;
+  unsigned char trailer[4];
+  long compressed;
+  size_t size = GZREAD_WHOLE_CHUNK, used = 0, wanted;
+  char *contents, *bigger;
+  int result;
 
+  if ((infile = fopen(filename,"rb")) == NULL){
+    return NULL;
+  }
+  /* ISIZE, the decompressed size modulo 2^32 (of the last member) */
+  if (fseek(infile,-4,SEEK_END) == 0 && fread(trailer,1,4,infile) == 4 && (compressed = ftell(infile)) > 0){
+    wanted = (size_t)trailer[0] | ((size_t)trailer[1] << 8) | ((size_t)trailer[2] << 16) | ((size_t)trailer[3] << 24);
+    if (wanted / GZREAD_WHOLE_RATIO > (size_t)compressed){
+      wanted = (size_t)compressed*GZREAD_WHOLE_RATIO;
+    }
+    if (wanted > size){
+      size = wanted;
+    }
+  }
+  fclose(infile);
 
+  if ((gzinfile = gzopen(filename,"rb")) == NULL){
+    return NULL;
+  }
+#if ZLIB_VERNUM >= 0x1240
+  gzbuffer(gzinfile,GZREAD_WHOLE_CHUNK);
+#endif
 
+  contents = (char *)malloc(size + 1);
+  while (contents != NULL){
+    if (used == size){
+      if (size > ((size_t)-1)/2 - 1){
+	free(contents);
+	contents = NULL;
+	break;
+      }
+      size *= 2;
+      bigger = (char *)realloc(contents, size + 1);
+      if (bigger == NULL){
+	free(contents);
+	contents = NULL;
+	break;
+      }
+      contents = bigger;
+    }
+    wanted = size - used;
+    if (wanted > 1073741824){
+      wanted = 1073741824;
+    }
+    result = gzread(gzinfile, contents + used, (unsigned int)wanted);
+    if (result < 0){
+      free(contents);
+      contents = NULL;
+      break;
+    }
+    if (result == 0){
+      break;
+    }
+    used += result;
+  }
+  gzclose(gzinfile);
 
+  if (contents != NULL){
+    contents[used] = '\0';
+    *length = used;
+  }
+  return contents;
+}
 
 #endif
 
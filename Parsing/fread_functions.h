@@ -20,6 +20,8 @@ size_t fread_float32(float *destination, int n, FILE *instream);
 size_t fread_char(char *destination, int n, FILE *instream);
 size_t fread_uchar(unsigned char *destination, int n, FILE *instream);
 size_t fread_double64(double *destination, int n, FILE *instream);
+size_t fread_float32_records(double *destination, int n, int record_size, FILE *instream);
+size_t buffer_float32_records(double *destination, int n, int record_size, const char *buffer, size_t length);
 
 
 size_t fread_be_int32(int *destination, int n, FILE *instream);
@@ -32,6 +34,8 @@ size_t fread_be_uchar(unsigned char *destination, int n, FILE *instream);
 size_t fread_be_double64(double *destination, int n, FILE *instream);
 
 size_t fread_be_wchar(wchar_t *destination, int n, FILE *instream);
+size_t buffer_be_float32(double *destination, int n, const char *buffer, size_t length);
+size_t buffer_be_float32_records(double *destination, int n, int record_size, const char *buffer, size_t length);
 
 #if defined(HAVE_ZLIB)
 size_t gzread_int32(int *destination, int n, gzFile instream);
@@ -52,6 +56,8 @@ size_t gzread_be_char(char *destination, int n, gzFile instream);
 size_t gzread_be_uchar(unsigned char *destination, int n, gzFile instream);
 size_t gzread_be_double64(double *destination, int n, gzFile instream);
 
+char *gzread_whole_file(const char *filename, size_t *length);
+
 #endif
 
 
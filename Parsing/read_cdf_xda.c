@@ -29,6 +29,9 @@
  ** Modification Dates
  ** Feb 4 - Initial version
  ** Feb 5 - A bunch of hacks for SNP chips.
+ ** Oct 17, 2026 - map_cdf_xda() and friends, which decode the units of a file 
+ **                mapped into memory where they lie rather than reading them all 
+ **                into a cdf_xda first
  **
  ****************************************************************/
 
@@ -39,6 +42,16 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cctype>
+#include <cstring>
+
+#if !defined(_WIN32) || defined(__CYGWIN32__) || defined(__CYGWIN__)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define CDF_XDA_HAVE_MMAP 1
+#endif
 
 #include "fread_functions.h"
 #include "read_cdf_xda.h"
@@ -395,3 +408,234 @@ int is_cdf_xda(char *filename){
   return check_cdf_xda(filename);
 
 }
+
+
+
+/*************************************************************
+ **
+ ** Reading a binary cdf file where it lies in memory. 
+ **
+ ** The header, probeset names and unit offsets are at the 
+ ** start of the file, then each unit is
+ **
+ ** unit header  20 bytes (see cdf_unit)
+ ** then for each block
+ **   block header  82 bytes (see cdf_unit_block)
+ **   cells         14 bytes each (see cdf_unit_cell)
+ **
+ ** all little endian.
+ **
+ *************************************************************/
+
+#define CDF_XDA_UNIT_HEADER_SIZE 20
+#define CDF_XDA_BLOCK_HEADER_SIZE 82
+#define CDF_XDA_CELL_SIZE 14
+
+
+static int cdf_xda_int32(const char *p){
+  const unsigned char *q = (const unsigned char *)p;
+  return (int)((unsigned int)q[0] | ((unsigned int)q[1] << 8) | ((unsigned int)q[2] << 16) | ((unsigned int)q[3] << 24));
+}
+
+static unsigned short cdf_xda_uint16(const char *p){
+  const unsigned char *q = (const unsigned char *)p;
+  return (unsigned short)(q[0] | (q[1] << 8));
+}
+
+
+
+/*************************************************************
+ **
+ ** int map_cdf_xda(const char *filename, cdf_xda_map *my_cdf)
+ **
+ ** Maps the binary cdf file filename into memory (or reads 
+ ** it in whole where that is not possible) and reads its 
+ ** header. 
+ **
+ ** Returns 1 if successful, otherwise 0, in which case there 
+ ** is nothing to unmap_cdf_xda().
+ **
+ *************************************************************/
+
+int map_cdf_xda(const char *filename, cdf_xda_map *my_cdf){
+
+  FILE *infile;
+  const char *p;
+  long file_length;
+  size_t names_start;
+
+  memset(my_cdf, 0, sizeof(cdf_xda_map));
+
+  if ((infile = fopen(filename, "rb")) == NULL){
+    return 0;
+  }
+  if (fseek(infile, 0, SEEK_END) != 0 || (file_length = ftell(infile)) < 24){
+    fclose(infile);
+    return 0;
+  }
+  my_cdf->length = (size_t)file_length;
+
+#if defined(CDF_XDA_HAVE_MMAP)
+  my_cdf->map = mmap(0, my_cdf->length, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+  if (my_cdf->map == MAP_FAILED){
+    my_cdf->map = 0;
+  } else {
+    my_cdf->map_length = my_cdf->length;
+    my_cdf->contents = (const char *)my_cdf->map;
+  }
+#endif
+  if (my_cdf->contents == 0){
+    my_cdf->buffer = (char *)malloc(my_cdf->length);
+    if (my_cdf->buffer == 0 || fseek(infile, 0, SEEK_SET) != 0 || 
+	fread(my_cdf->buffer, 1, my_cdf->length, infile) != my_cdf->length){
+      free(my_cdf->buffer);
+      fclose(infile);
+      return 0;
+    }
+    my_cdf->contents = my_cdf->buffer;
+  }
+  fclose(infile);
+
+  p = my_cdf->contents;
+  my_cdf->header.magicnumber = cdf_xda_int32(p);
+  my_cdf->header.version_number = cdf_xda_int32(p + 4);
+  my_cdf->header.cols = (short)cdf_xda_uint16(p + 8);
+  my_cdf->header.rows = (short)cdf_xda_uint16(p + 10);
+  my_cdf->header.n_units = cdf_xda_int32(p + 12);
+  my_cdf->header.n_qc_units = cdf_xda_int32(p + 16);
+  my_cdf->header.len_ref_seq = cdf_xda_int32(p + 20);
+  my_cdf->header.ref_seq = 0;
+
+  if (my_cdf->header.magicnumber != 67 || my_cdf->header.version_number != 1 ||
+      my_cdf->header.n_units < 0 || my_cdf->header.n_qc_units < 0 || my_cdf->header.len_ref_seq < 0){
+    unmap_cdf_xda(my_cdf);
+    return 0;
+  }
+
+  names_start = 24 + (size_t)my_cdf->header.len_ref_seq;
+  my_cdf->units_start = names_start + 64*(size_t)my_cdf->header.n_units + 4*(size_t)my_cdf->header.n_qc_units;
+  if (my_cdf->units_start + 4*(size_t)my_cdf->header.n_units > my_cdf->length){
+    unmap_cdf_xda(my_cdf);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+void unmap_cdf_xda(cdf_xda_map *my_cdf){
+
+#if defined(CDF_XDA_HAVE_MMAP)
+  if (my_cdf->map != 0){
+    munmap(my_cdf->map, my_cdf->map_length);
+  }
+#endif
+  free(my_cdf->buffer);
+  memset(my_cdf, 0, sizeof(cdf_xda_map));
+}
+
+
+
+/*************************************************************
+ **
+ ** int get_cdf_xda_unit(const cdf_xda_map *my_cdf, int unit, 
+ **                      unsigned short *unittype, int *nblocks, size_t *position)
+ **
+ ** Gives the type and number of blocks of unit (from 0) and
+ ** the position of its first block, for get_cdf_xda_block().
+ **
+ ** Returns 1, or 0 if the unit is not all there.
+ **
+ *************************************************************/
+
+int get_cdf_xda_unit(const cdf_xda_map *my_cdf, int unit, unsigned short *unittype, int *nblocks, size_t *position){
+
+  int start = cdf_xda_int32(my_cdf->contents + my_cdf->units_start + 4*(size_t)unit);
+  const char *p;
+
+  if (start < 0 || (size_t)start + CDF_XDA_UNIT_HEADER_SIZE > my_cdf->length){
+    return 0;
+  }
+  p = my_cdf->contents + start;
+  *unittype = cdf_xda_uint16(p);
+  *nblocks = cdf_xda_int32(p + 7);
+  *position = (size_t)start + CDF_XDA_UNIT_HEADER_SIZE;
+
+  return (*nblocks >= 0);
+}
+
+
+
+/*************************************************************
+ **
+ ** int get_cdf_xda_block(const cdf_xda_map *my_cdf, size_t *position, 
+ **                       cdf_xda_block *block)
+ **
+ ** Reads the header of the block at position, and moves 
+ ** position on to the next one. The cells are left where
+ ** they are, for decode_cdf_xda_block().
+ **
+ ** Returns 1, or 0 if the block is not all there.
+ **
+ *************************************************************/
+
+int get_cdf_xda_block(const cdf_xda_map *my_cdf, size_t *position, cdf_xda_block *block){
+
+  const char *p;
+
+  if (*position + CDF_XDA_BLOCK_HEADER_SIZE > my_cdf->length){
+    return 0;
+  }
+  p = my_cdf->contents + *position;
+  block->natoms = cdf_xda_int32(p);
+  block->ncells = cdf_xda_int32(p + 4);
+  block->blockname = p + 18;
+  block->cells = *position + CDF_XDA_BLOCK_HEADER_SIZE;
+
+  /* every atom has at least its PM cell */
+  if (block->natoms < 0 || block->ncells < block->natoms || 
+      (my_cdf->length - block->cells)/CDF_XDA_CELL_SIZE < (size_t)block->ncells){
+    return 0;
+  }
+  *position = block->cells + CDF_XDA_CELL_SIZE*(size_t)block->ncells;
+  return 1;
+}
+
+
+
+/*************************************************************
+ **
+ ** int decode_cdf_xda_block(const cdf_xda_map *my_cdf, const cdf_xda_block *block, 
+ **                          int *PM, int *MM)
+ **
+ ** Stores the location of the PM cell of each atom of block 
+ ** in PM (natoms ints) and of the MM cell in MM, which may be
+ ** NULL if MM cells are to be left out. Only block and PM, 
+ ** MM are touched, so blocks may be decoded at the same 
+ ** time in different threads.
+ **
+ ** Returns 1, or 0 if a cell has an atom number outside the
+ ** block.
+ **
+ *************************************************************/
+
+int decode_cdf_xda_block(const cdf_xda_map *my_cdf, const cdf_xda_block *block, int *PM, int *MM){
+
+  int k, atom, location;
+  int rows = (int)my_cdf->header.rows;
+  const char *p = my_cdf->contents + block->cells;
+
+  for (k = 0; k < block->ncells; k++, p += CDF_XDA_CELL_SIZE){
+    atom = cdf_xda_int32(p);
+    if (atom < 0 || atom >= block->natoms){
+      return 0;
+    }
+    location = cdf_xda_uint16(p + 4) + cdf_xda_uint16(p + 6)*rows;
+    if (isPM(p[12], p[13])){
+      PM[atom] = location;
+    } else if (MM != NULL){
+      MM[atom] = location;
+    }
+  }
+  return 1;
+}
@@ -145,9 +145,41 @@ typedef struct {
 
 
 
+/* A binary cdf file held in memory as it is (mapped where possible), so
+   that units can be decoded where they lie, several at once if need be,
+   without first reading them into a cdf_xda */
+
+typedef struct {
+  cdf_xda_header header;  /* ref_seq is not kept */
+  const char *contents;   /* the whole file */
+  size_t length;
+  size_t units_start;     /* where the offsets of the units are in contents */
+
+  void *map;              /* what contents is in */
+  size_t map_length;
+  char *buffer;
+} cdf_xda_map;
+
+
+/* A block of a unit of a cdf_xda_map */
+
+typedef struct {
+  const char *blockname;  /* 64 chars, not necessarily 0 terminated */
+  int natoms;
+  int ncells;
+  size_t cells;           /* where the cells are in contents */
+} cdf_xda_block;
+
+
 int is_cdf_xda(char *filename);
 int read_cdf_xda(char *filename,cdf_xda *my_cdf);
 void dealloc_cdf_xda(cdf_xda *my_cdf);
 int isPM(char pbase,char tbase);
 
+int map_cdf_xda(const char *filename, cdf_xda_map *my_cdf);
+void unmap_cdf_xda(cdf_xda_map *my_cdf);
+int get_cdf_xda_unit(const cdf_xda_map *my_cdf, int unit, unsigned short *unittype, int *nblocks, size_t *position);
+int get_cdf_xda_block(const cdf_xda_map *my_cdf, size_t *position, cdf_xda_block *block);
+int decode_cdf_xda_block(const cdf_xda_map *my_cdf, const cdf_xda_block *block, int *PM, int *MM);
+
 #endif
@@ -1,6 +1,23 @@
 #ifndef READ_CEL_STRUCTURES_H
 #define READ_CEL_STRUCTURES_H
 
+#include <cstring>
+
+/****************************************************************
+ **
+ ** Several CEL files may be parsed at once in different threads, 
+ ** so the parsers use cel_strtok(), which keeps its place in 
+ ** the caller's pointer rather than in a static. (The Windows
+ ** runtime strtok() already keeps its place per thread.)
+ **
+ ***************************************************************/
+
+#if defined(_WIN32)
+#define cel_strtok(str, delimiters, saveptr) strtok(str, delimiters)
+#else
+#define cel_strtok(str, delimiters, saveptr) strtok_r(str, delimiters, saveptr)
+#endif
+
 
 
 /****************************************************************
@@ -25,6 +42,37 @@ typedef struct{
 } detailed_header_info;
 
 
+
+/****************************************************************
+ **
+ ** What one look at the start of a CEL file tells us. Filled in
+ ** by probe_text_cel_file(), probe_binary_cel_file() and
+ ** probe_generic_cel_file(), which work on a file that is already
+ ** open, so that a file need only be opened once to find its
+ ** format and header.
+ **
+ ** data_offset is where the intensities start, so that they may
+ ** be read without parsing the header again (see the
+ ** read_*_intensities_at() functions). It is 0 if not known.
+ **
+ ***************************************************************/
+
+const int CEL_FORMAT_UNKNOWN = 0;
+const int CEL_FORMAT_TEXT = 1;
+const int CEL_FORMAT_XDA = 2;
+const int CEL_FORMAT_CALVIN = 3;
+const int CEL_FORMAT_RME = 4;
+
+typedef struct{
+  int format;         /* one of the CEL_FORMAT_ values */
+  char *cdfName;      /* allocated with malloc(), or NULL */
+  int dim1;           /* as returned by get_header_info() and friends */
+  int dim2;
+  long data_offset;
+  int n_cells;        /* number of intensities stored */
+} cel_descriptor;
+
+
 /****************************************************************
  **
  ** Constant values for parsing errors
@@ -41,6 +89,7 @@ typedef struct{
 
 const int CEL_NON_MATCHING_DIMENSIONS = 101;
 const int CEL_NON_MATCHING_CDFNAMES = 102;
+const int CEL_OUT_OF_MEMORY = 103;
 
 const int TEXT_HEADER_TRUNCATED=1001;
 const int TEXT_HEADER_CDF_NAME_MISSING=1002;
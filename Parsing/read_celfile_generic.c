@@ -21,6 +21,14 @@
  ** Sept 9, 2007 - fix compiler warnings
  ** Oct 11, 2007 - fix missing DatHeader problem
  ** Feb 14, 2008 - Port fixes from affyio/BioConductor related to detailed_headerinfo functions
+ ** Oct 17, 2026 - probe_generic_cel_file() and read_genericcel_file_intensities_at() so that
+ **                the headers need only be parsed once
+ ** Oct 17, 2026 - read_genericcel_buffer_intensities() for a file already in memory (a
+ **                decompressed gz file). probe_gzgeneric_cel_file()
+ ** Oct 17, 2026 - read_genericcel_file_intensities() only reads the headers, then maps 
+ **                the intensity column of the file into memory and converts it straight 
+ **                into the destination. The other columns are never read or allocated
+ ** Oct 17, 2026 - read_be_float32_column() returns CEL_OUT_OF_MEMORY if its block can't be had
  **
  *************************************************************/
 
@@ -46,11 +54,20 @@
 
 #include "read_generic.h"
 #include "read_celfile_generic.h"
+#include "fread_functions.h"
 #include "read_cel_structures.h"
 #include "../threestep_common.h"
 
 #include <wx/string.h>
 
+#if !defined(_WIN32) || defined(__CYGWIN32__) || defined(__CYGWIN__)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define GENERIC_CEL_HAVE_MMAP 1
+#endif
+
 static void error(const char *msg, const char *msg2){
   wxString Error = wxString((const char*)msg,wxConvUTF8) +_T(" ") + wxString((const char*)msg2,wxConvUTF8) + _T("\n");
   throw Error;
@@ -98,11 +115,10 @@ int isGenericCelFile(const char *filename){
 
 
 
-char *generic_get_header_info(const char *filename, int *dim1, int *dim2,int *err_code){
+/* Pulls the cdfName and dimensions out of the data header of a Calvin
+   cel file. Returns NULL, with *err_code set, if any are missing */
 
-  FILE *infile;
-  generic_file_header file_header;
-  generic_data_header data_header;
+static char *generic_header_fields(generic_data_header *data_header, int *dim1, int *dim2, int *err_code){
 
   char *cdfName = 0;
 
@@ -110,30 +126,8 @@ char *generic_get_header_info(const char *filename, int *dim1, int *dim2,int *er
   AffyMIMEtypes cur_mime_type;
 
   int size;
-  int readCode;
 
   wchar_t *wchartemp=0;
-  
-  if ((infile = fopen(filename, "rb")) == NULL)
-    {
-      error("Unable to open the file %s",filename);
-      return 0;
-    }
-  
-  readCode = read_generic_file_header(&file_header,infile);
-  if (readCode == 0){
-    *err_code = CALVIN_HEADER_FILE_HEADER_TRUNCATED;
-    fclose(infile);
-    return NULL;
-  }
-
-  read_generic_data_header(&data_header,infile);
-  if (readCode == 0){
-    *err_code = CALVIN_HEADER_DATA_HEADER_TRUNCATED;
-    Free_generic_data_header(&data_header);
-    fclose(infile);
-    return NULL;
-  }
 
   /*  affymetrix-array-type  text/plainText/plain String is HG-U133_Plus_2
       Now Trying it again. But using exposed function
@@ -144,11 +138,9 @@ char *generic_get_header_info(const char *filename, int *dim1, int *dim2,int *er
       affymetrix-cel-rows  text/x-calvin-integer-32Its a int32_t  value is 1164
   */
 
-  triplet =  find_nvt(&data_header,"affymetrix-array-type");
+  triplet =  find_nvt(data_header,"affymetrix-array-type");
   if (triplet == NULL){
     *err_code = CALVIN_HEADER_CDF_NAME_MISSING;
-    Free_generic_data_header(&data_header);
-    fclose(infile);
     return NULL;
   } 
 
@@ -160,25 +152,61 @@ char *generic_get_header_info(const char *filename, int *dim1, int *dim2,int *er
   wcstombs(cdfName, wchartemp, size);
   free(wchartemp);
 
-  triplet =  find_nvt(&data_header,"affymetrix-cel-cols");
+  triplet =  find_nvt(data_header,"affymetrix-cel-cols");
   if (triplet == NULL){
     *err_code = CALVIN_DID_NOT_FIND_COL_DIMENSION;
-    Free_generic_data_header(&data_header);
-    fclose(infile);
+    free(cdfName);
     return NULL;
   }
   cur_mime_type = determine_MIMETYPE(*triplet);
   decode_MIME_value(*triplet,cur_mime_type, dim1, &size);
   
-  triplet =  find_nvt(&data_header,"affymetrix-cel-rows");
+  triplet =  find_nvt(data_header,"affymetrix-cel-rows");
   if (triplet == NULL){
     *err_code = CALVIN_DID_NOT_FIND_ROW_DIMENSION;
-    Free_generic_data_header(&data_header);
-    fclose(infile);
+    free(cdfName);
     return NULL;
   }
   cur_mime_type = determine_MIMETYPE(*triplet);
   decode_MIME_value(*triplet,cur_mime_type, dim2, &size);
+
+  return cdfName;
+}
+
+
+
+char *generic_get_header_info(const char *filename, int *dim1, int *dim2,int *err_code){
+
+  FILE *infile;
+  generic_file_header file_header;
+  generic_data_header data_header;
+
+  char *cdfName = 0;
+
+  int readCode;
+
+  if ((infile = fopen(filename, "rb")) == NULL)
+    {
+      error("Unable to open the file %s",filename);
+      return 0;
+    }
+  
+  readCode = read_generic_file_header(&file_header,infile);
+  if (readCode == 0){
+    *err_code = CALVIN_HEADER_FILE_HEADER_TRUNCATED;
+    fclose(infile);
+    return NULL;
+  }
+
+  read_generic_data_header(&data_header,infile);
+  if (readCode == 0){
+    *err_code = CALVIN_HEADER_DATA_HEADER_TRUNCATED;
+    Free_generic_data_header(&data_header);
+    fclose(infile);
+    return NULL;
+  }
+
+  cdfName = generic_header_fields(&data_header, dim1, dim2, err_code);
   
   Free_generic_data_header(&data_header);
   fclose(infile);
@@ -189,6 +217,74 @@ char *generic_get_header_info(const char *filename, int *dim1, int *dim2,int *er
 
 
 
+/***************************************************************
+ **
+ ** int probe_generic_cel_file(FILE *infile, cel_descriptor *descriptor)
+ **
+ ** FILE *infile - a file opened in binary mode, at its start
+ ** cel_descriptor *descriptor - filled in if this is a Calvin cel file
+ **
+ ** Returns -1 if infile is not a Command Console (Calvin) cel file. 
+ ** Otherwise reads the headers and returns 0, or an error code. The 
+ ** caller frees descriptor->cdfName.
+ **
+ ** data_offset is only set when the intensity data set is the plain
+ ** single column of floats that read_genericcel_file_intensities_at()
+ ** can read directly.
+ **
+ **************************************************************/
+
+int probe_generic_cel_file(FILE *infile, cel_descriptor *descriptor){
+
+  generic_file_header file_header;
+  generic_data_header data_header;
+  generic_data_group data_group;
+  generic_data_set data_set;
+
+  int err_code = 0;
+
+  if (!read_generic_file_header(&file_header,infile)){
+    return -1;
+  }
+
+  if (!read_generic_data_header(&data_header,infile)){
+    Free_generic_data_header(&data_header);
+    return -1;
+  }
+  
+  if (strcmp(data_header.data_type_id.value, "affymetrix-calvin-intensity") !=0){
+    Free_generic_data_header(&data_header);
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_CALVIN;
+
+  descriptor->cdfName = generic_header_fields(&data_header, &descriptor->dim1, &descriptor->dim2, &err_code);
+  Free_generic_data_header(&data_header);
+  if (descriptor->cdfName == NULL){
+    return err_code;
+  }
+
+  if (!read_generic_data_group(&data_group,infile)){
+    Free_generic_data_group(&data_group);
+    return CALVIN_HEADER_DATA_GROUP_TRUNCATED;
+  }
+  Free_generic_data_group(&data_group);
+
+  if (!read_generic_data_set(&data_set,infile)){
+    Free_generic_data_set(&data_set);
+    return CALVIN_HEADER_DATA_SET_TRUNCATED;
+  }
+  descriptor->n_cells = (int)data_set.nrows;
+  if (data_set.ncols == 1 && data_set.col_name_type_value[0].type == 6){
+    descriptor->data_offset = ftell(infile);
+  }
+  Free_generic_data_set(&data_set);
+
+  return 0;
+}
+
+
+
 
 void generic_get_detailed_header_info(const char *filename, detailed_header_info *header_info, int *err_code){
   
@@ -784,6 +880,118 @@ int check_generic_cel_file(const char *filename, const char *ref_cdfName, int re
 
 
 
+/***************************************************************
+ **
+ ** static int generic_record_size(generic_data_set *data_set)
+ **
+ ** The number of bytes each row of data_set takes in the file, or
+ ** -1 if the rows are not all the same size (a column of strings).
+ **
+ **************************************************************/
+
+static int generic_record_size(generic_data_set *data_set){
+
+  int j, record_size = 0;
+
+  for (j=0; j < (int)data_set->ncols; j++){
+    switch(data_set->col_name_type_value[j].type){
+    case 0: 
+    case 1: record_size += 1;
+      break;
+    case 2: 
+    case 3: record_size += 2;
+      break;
+    case 4:
+    case 5:
+    case 6: record_size += 4;
+      break;
+    case 7: record_size += 8;
+      break;
+    default:
+      return -1;
+    }
+  }
+  return record_size;
+}
+
+
+
+/***************************************************************
+ **
+ ** static int read_be_float32_column(FILE *infile, long data_offset, int n, int record_size, double *destination)
+ **
+ ** Stores in destination the big endian float that starts each of 
+ ** the n records of record_size bytes at data_offset in infile.
+ ** Where possible the records are mapped into memory and converted 
+ ** where they lie, otherwise they are read a block at a time. Either 
+ ** way nothing else in the records is kept.
+ **
+ ** Returns 0, CALVIN_HEADER_DATA_SET_TRUNCATED if the file ends 
+ ** first or CEL_OUT_OF_MEMORY if there is no memory for a block.
+ **
+ **************************************************************/
+
+static int read_be_float32_column(FILE *infile, long data_offset, int n, int record_size, double *destination){
+
+  size_t needed = (size_t)n*record_size;
+  char *block;
+  int done, m;
+  int block_records = 65536;
+  int err_code = 0;
+
+  if (n <= 0){
+    return 0;
+  }
+
+#if defined(GENERIC_CEL_HAVE_MMAP)
+  {
+    struct stat file_info;
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t map_start = (off_t)(data_offset - data_offset % page_size);
+    size_t map_length = needed + (size_t)(data_offset - map_start);
+    void *map;
+
+    if (fstat(fileno(infile), &file_info) == 0){
+      if ((off_t)data_offset + (off_t)needed > file_info.st_size){
+	return CALVIN_HEADER_DATA_SET_TRUNCATED;
+      }
+      map = mmap(0, map_length, PROT_READ, MAP_PRIVATE, fileno(infile), map_start);
+      if (map != MAP_FAILED){
+#if defined(MADV_SEQUENTIAL)
+	madvise(map, map_length, MADV_SEQUENTIAL);
+#endif
+	buffer_be_float32_records(destination, n, record_size, (const char *)map + (data_offset - map_start), needed);
+	munmap(map, map_length);
+	return 0;
+      }
+    }
+    /* otherwise read it as below */
+  }
+#endif
+
+  if (fseek(infile, data_offset, SEEK_SET) != 0){
+    return CALVIN_HEADER_DATA_SET_TRUNCATED;
+  }
+  
+  block = (char *)malloc((size_t)block_records*record_size);
+  if (block == NULL){
+    return CEL_OUT_OF_MEMORY;
+  }
+  for (done = 0; done < n; done += m){
+    m = (n - done < block_records) ? n - done : block_records;
+    if (fread(block, record_size, m, infile) != (size_t)m){
+      err_code = CALVIN_HEADER_DATA_SET_TRUNCATED;
+      break;
+    }
+    buffer_be_float32_records(&destination[done], m, record_size, block, (size_t)m*record_size);
+  }
+  free(block);
+
+  return err_code;
+}
+
+
+
 /***************************************************************
  **
  ** static int read_binarycel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
@@ -791,6 +999,11 @@ int check_generic_cel_file(const char *filename, const char *ref_cdfName, int re
  ** 
  ** This function reads binary cel file intensities into the data matrix
  **
+ ** Only the headers are parsed. The intensities, the first column of 
+ ** the first data set, are then picked out of the file by 
+ ** read_be_float32_column() without reading the other columns 
+ ** (standard deviations, pixel counts) into memory.
+ **
  **************************************************************/
 
 int read_genericcel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
@@ -807,6 +1020,7 @@ int read_genericcel_file_intensities(const char *filename, double *intensity, in
 
   int err_code;
   int readCode;
+  int record_size;
 
 
   if ((infile = fopen(filename, "rb")) == NULL)
@@ -825,56 +1039,111 @@ int read_genericcel_file_intensities(const char *filename, double *intensity, in
   }
     
   readCode = read_generic_data_header(&my_data_header, infile);
+  Free_generic_data_header(&my_data_header);
   if (readCode == 0){
     err_code = CALVIN_HEADER_DATA_HEADER_TRUNCATED;
-    Free_generic_data_header(&my_data_header);
     fclose(infile);
     return err_code;
   }
 
   readCode = read_generic_data_group(&my_data_group,infile);
+  Free_generic_data_group(&my_data_group);
   if (readCode == 0){
     err_code = CALVIN_HEADER_DATA_GROUP_TRUNCATED;
-    Free_generic_data_group(&my_data_group);
-    Free_generic_data_header(&my_data_header);
     fclose(infile);
     return err_code;
   }
 
 
   readCode = read_generic_data_set(&my_data_set,infile);
-    if (readCode == 0){
-    err_code = CALVIN_HEADER_DATA_SET_TRUNCATED;
-    Free_generic_data_set(&my_data_set);
-    Free_generic_data_group(&my_data_group);
-    Free_generic_data_header(&my_data_header);
-    fclose(infile);
-    return err_code;
-  }
-
-  readCode = read_generic_data_set_rows(&my_data_set,infile); 
   if (readCode == 0){
     err_code = CALVIN_HEADER_DATA_SET_TRUNCATED;
     Free_generic_data_set(&my_data_set);
-    Free_generic_data_group(&my_data_group);
-    Free_generic_data_header(&my_data_header);
     fclose(infile);
     return err_code;
   }
 
-  for (i =0; i < (int)my_data_set.nrows; i++){
-    intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
+  record_size = generic_record_size(&my_data_set);
+
+  if ((int)my_data_set.nrows > rows){
+    /* more cells than the column has room for */
+    err_code = CEL_NON_MATCHING_DIMENSIONS;
+  } else if (my_data_set.ncols > 0 && my_data_set.col_name_type_value[0].type == 6 && record_size > 0){
+    err_code = read_be_float32_column(infile, ftell(infile), (int)my_data_set.nrows, record_size, &intensity[chip_num*my_data_set.nrows]);
+  } else if (!read_generic_data_set_rows(&my_data_set,infile)){
+    /* rows that are not all the same length, read the lot */
+    err_code = CALVIN_HEADER_DATA_SET_TRUNCATED;
+  } else {
+    for (i =0; i < (int)my_data_set.nrows; i++){
+      intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
+    }
+    err_code = 0;
   }
   
   fclose(infile);
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
+  return(err_code);
+}
 
 
 
-  return(0);
+/***************************************************************
+ **
+ ** int read_genericcel_file_intensities_at(const char *filename, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
+ **
+ ** As read_genericcel_file_intensities(), but the n_cells intensities 
+ ** (big endian floats) are known to start at data_offset (see 
+ ** probe_generic_cel_file()), so they are read without parsing the 
+ ** headers again.
+ **
+ **************************************************************/
+
+int read_genericcel_file_intensities_at(const char *filename, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+
+  FILE *infile;
+  int err_code;
+
+  if (n_cells > rows){
+    /* more cells than the column has room for */
+    return CEL_NON_MATCHING_DIMENSIONS;
+  }
+
+  if ((infile = fopen(filename, "rb")) == NULL)
+    {
+      error("Unable to open the file %s\n",filename);
+      return 0;
+    }
+  err_code = read_be_float32_column(infile, data_offset, n_cells, sizeof(float), &intensity[chip_num*n_cells]);
+  fclose(infile);
+
+  return err_code;
+}
+
+
+
+/***************************************************************
+ **
+ ** int read_genericcel_buffer_intensities(const char *buffer, size_t length, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
+ **
+ ** As read_genericcel_file_intensities_at(), but the whole file is 
+ ** already in memory, the length bytes at buffer (a decompressed gz
+ ** file, say).
+ **
+ **************************************************************/
+
+int read_genericcel_buffer_intensities(const char *buffer, size_t length, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+
+  if (n_cells > rows){
+    return CEL_NON_MATCHING_DIMENSIONS;
+  }
+  if (data_offset < 0 || (size_t)data_offset > length){
+    return CALVIN_HEADER_DATA_SET_TRUNCATED;
+  }
+  if ((int)buffer_be_float32(&intensity[chip_num*n_cells], n_cells, buffer + data_offset, length - data_offset) != n_cells){
+    return CALVIN_HEADER_DATA_SET_TRUNCATED;
+  }
+  return 0;
 }
 
 
@@ -1219,6 +1488,67 @@ int isgzGenericCelFile(const char *filename){
 
 
 
+/***************************************************************
+ **
+ ** int probe_gzgeneric_cel_file(gzFile infile, cel_descriptor *descriptor)
+ **
+ ** As probe_generic_cel_file(), for a gzipped Calvin cel file. 
+ ** data_offset is where the intensities start in the decompressed
+ ** file, when it is set at all.
+ **
+ **************************************************************/
+
+int probe_gzgeneric_cel_file(gzFile infile, cel_descriptor *descriptor){
+
+  generic_file_header file_header;
+  generic_data_header data_header;
+  generic_data_group data_group;
+  generic_data_set data_set;
+
+  int err_code = 0;
+
+  if (!gzread_generic_file_header(&file_header,infile)){
+    return -1;
+  }
+
+  if (!gzread_generic_data_header(&data_header,infile)){
+    Free_generic_data_header(&data_header);
+    return -1;
+  }
+  
+  if (strcmp(data_header.data_type_id.value, "affymetrix-calvin-intensity") !=0){
+    Free_generic_data_header(&data_header);
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_CALVIN;
+
+  descriptor->cdfName = generic_header_fields(&data_header, &descriptor->dim1, &descriptor->dim2, &err_code);
+  Free_generic_data_header(&data_header);
+  if (descriptor->cdfName == NULL){
+    return err_code;
+  }
+
+  if (!gzread_generic_data_group(&data_group,infile)){
+    Free_generic_data_group(&data_group);
+    return CALVIN_HEADER_DATA_GROUP_TRUNCATED;
+  }
+  Free_generic_data_group(&data_group);
+
+  if (!gzread_generic_data_set(&data_set,infile)){
+    Free_generic_data_set(&data_set);
+    return CALVIN_HEADER_DATA_SET_TRUNCATED;
+  }
+  descriptor->n_cells = (int)data_set.nrows;
+  if (data_set.ncols == 1 && data_set.col_name_type_value[0].type == 6){
+    descriptor->data_offset = gztell(infile);
+  }
+  Free_generic_data_set(&data_set);
+
+  return 0;
+}
+
+
+
 char *gzgeneric_get_header_info(const char *filename, int *dim1, int *dim2){
 
   gzFile infile;
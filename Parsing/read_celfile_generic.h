@@ -5,12 +5,16 @@
 #include <zlib.h>
 #endif
 
+#include <cstdio>
 #include "read_cel_structures.h"
 
 int isGenericCelFile(const char *filename);
+int probe_generic_cel_file(FILE *infile, cel_descriptor *descriptor);
 char *generic_get_header_info(const char *filename, int *dim1, int *dim2, int *err_code);
 void generic_get_detailed_header_info(const char *filename, detailed_header_info *header_info, int *err_code);
 int read_genericcel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_genericcel_file_intensities_at(const char *filename, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_genericcel_buffer_intensities(const char *buffer, size_t length, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
 int check_generic_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2);
 #if defined(INCLUDE_ALL_AFFYIO)
 int read_genericcel_file_stddev(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
@@ -21,6 +25,7 @@ void generic_apply_masks(const char *filename, double *intensity, int chip_num,
 
 #if defined(HAVE_ZLIB)
 int isgzGenericCelFile(const char *filename);
+int probe_gzgeneric_cel_file(gzFile infile, cel_descriptor *descriptor);
 char *gzgeneric_get_header_info(const char *filename, int *dim1, int *dim2);
 void gzgeneric_get_detailed_header_info(const char *filename, detailed_header_info *header_info);
 int gzread_genericcel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
@@ -13,6 +13,14 @@
  ** Mar 6-7 - refactor code so that rather than throwing "errors", error codes
  **           are passed back up
  ** Jun 24, 2008 - change char* to const char* where appropriate
+ ** Oct 17, 2026 - use cel_strtok() so that several files may be parsed at once
+ ** Oct 17, 2026 - read_cel_file_intensities() block reads the [INTENSITY] section
+ **                and scans it in place
+ ** Oct 17, 2026 - probe_text_cel_file() and read_cel_file_intensities_at() so that
+ **                the header need only be parsed once
+ ** Oct 17, 2026 - read_cel_buffer_intensities() parses a file already in memory (a
+ **                decompressed gz file). probe_gztext_cel_file()
+ ** Oct 17, 2026 - the block reader returns CEL_OUT_OF_MEMORY if its buffer can't be had
  **
  **
  **
@@ -95,12 +103,13 @@ static tokenset *tokenize(char *str, const char *delimiters){
   int i=0;
 
   char *current_token;
+  char *tmp_pointer;
   tokenset *my_tokenset = (tokenset *)calloc(1,sizeof(tokenset));
   my_tokenset->n=0;
   
   my_tokenset->tokens = NULL;
 
-  current_token = strtok(str,delimiters);
+  current_token = cel_strtok(str,delimiters,&tmp_pointer);
   while (current_token != NULL){
     my_tokenset->n++;
     my_tokenset->tokens = (char **)realloc(my_tokenset->tokens,(my_tokenset->n)*sizeof(char*));
@@ -108,7 +117,7 @@ static tokenset *tokenize(char *str, const char *delimiters){
     strcpy(my_tokenset->tokens[i],current_token);
     my_tokenset->tokens[i][(strlen(current_token))] = '\0';
     i++;
-    current_token = strtok(NULL,delimiters);
+    current_token = cel_strtok(NULL,delimiters,&tmp_pointer);
   }
 
   return my_tokenset; 
@@ -430,6 +439,335 @@ int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1,
   return 0;
 }
 
+/****************************************************************
+ ****************************************************************
+ **
+ ** Block reading of the [INTENSITY] section. 
+ **
+ ** Reading that section a line at a time with fgets(), strtok()
+ ** and atoi()/atof() dominated the time taken to read a text CEL
+ ** file. Instead the section is read in large blocks and each line 
+ ** is scanned in place. 
+ **
+ ***************************************************************
+ ***************************************************************/
+
+#define CEL_BLOCK_SIZE 1048576
+
+/***************************************************************
+ **
+ ** cel_block_reader
+ **
+ ** FILE *file - the open file, positioned at the first line to be returned.
+ **              NULL if the lines are all already in memory
+ ** char *buffer - holds the lines read but not yet returned
+ ** size_t size - allocated size of buffer
+ ** size_t start - start of the next line in buffer
+ ** size_t end - end of the data in buffer
+ ** int eof - true once everything in the file has been read into buffer
+ ** int out_of_memory - true if buffer could not be allocated or grown
+ **
+ **************************************************************/
+
+typedef struct{
+  FILE *file;
+  char *buffer;
+  size_t size;
+  size_t start;
+  size_t end;
+  int eof;
+  int out_of_memory;
+} cel_block_reader;
+
+
+/* returns 0, or CEL_OUT_OF_MEMORY if the buffer could not be allocated */
+
+static int init_block_reader(cel_block_reader *reader, FILE *file){
+  reader->file = file;
+  reader->size = CEL_BLOCK_SIZE;
+  reader->buffer = (char *)malloc(reader->size);
+  reader->start = 0;
+  reader->end = 0;
+  reader->eof = 0;
+  reader->out_of_memory = (reader->buffer == NULL);
+  return reader->out_of_memory ? CEL_OUT_OF_MEMORY : 0;
+}
+
+/* the lines are the length bytes at data, which are not copied (or changed) */
+
+static void init_memory_block_reader(cel_block_reader *reader, const char *data, size_t length){
+  reader->file = NULL;
+  reader->size = length;
+  reader->buffer = (char *)data;
+  reader->start = 0;
+  reader->end = length;
+  reader->eof = 1;
+  reader->out_of_memory = 0;
+}
+
+static void free_block_reader(cel_block_reader *reader){
+  if (reader->file != NULL){
+    free(reader->buffer);
+  }
+}
+
+
+/***************************************************************
+ **
+ ** int next_block_line(cel_block_reader *reader, char **line, size_t *length)
+ **
+ ** returns 0 if there are no more lines, otherwise sets line to the 
+ ** start of the next line (which is not NUL terminated) and length
+ ** to its length including the '\n' (if any) at its end. The line 
+ ** stays valid until next_block_line() is next called. If a line
+ ** is too long for the buffer and it cannot be grown, 0 is returned
+ ** and reader->out_of_memory set.
+ **
+ **************************************************************/
+
+static int next_block_line(cel_block_reader *reader, char **line, size_t *length){
+
+  char *newline, *bigger;
+  size_t searched = 0;
+  size_t n;
+
+  while (1){
+    newline = (char *)memchr(reader->buffer + reader->start + searched, '\n', reader->end - reader->start - searched);
+    if (newline != NULL){
+      *line = reader->buffer + reader->start;
+      *length = newline - *line + 1;
+      reader->start += *length;
+      return 1;
+    }
+    if (reader->eof){
+      if (reader->start == reader->end){
+	return 0;
+      }
+      /* last line of the file has no '\n' */
+      *line = reader->buffer + reader->start;
+      *length = reader->end - reader->start;
+      reader->start = reader->end;
+      return 1;
+    }
+
+    /* keep the partial line, then read some more after it */
+    searched = reader->end - reader->start;
+    memmove(reader->buffer, reader->buffer + reader->start, searched);
+    reader->start = 0;
+    reader->end = searched;
+    if (reader->end == reader->size){
+      bigger = (char *)realloc(reader->buffer, 2*reader->size);
+      if (bigger == NULL){
+	reader->out_of_memory = 1;
+	return 0;
+      }
+      reader->buffer = bigger;
+      reader->size *= 2;
+    }
+    n = fread(reader->buffer + reader->end, 1, reader->size - reader->end, reader->file);
+    reader->end += n;
+    if (n == 0){
+      reader->eof = 1;
+    }
+  }
+}
+
+
+/***************************************************************
+ **
+ ** const char *next_field(const char *p, const char *end, const char **field_end)
+ **
+ ** returns the start of the next field in [p, end) and sets field_end, 
+ ** or returns NULL if there are no more. Fields are separated by 
+ ** spaces and tabs, just as they were by strtok(buffer," \t").
+ **
+ **************************************************************/
+
+static const char *next_field(const char *p, const char *end, const char **field_end){
+  while (p < end && (*p == ' ' || *p == '\t')){
+    p++;
+  }
+  if (p == end){
+    return NULL;
+  }
+  *field_end = p;
+  while (*field_end < end && **field_end != ' ' && **field_end != '\t'){
+    (*field_end)++;
+  }
+  return p;
+}
+
+
+/***************************************************************
+ **
+ ** int scan_int(const char *p, const char *end)
+ **
+ ** value of the field [p, end) as atoi() would give it 
+ **
+ **************************************************************/
+
+static int scan_int(const char *p, const char *end){
+  
+  int negative = 0;
+  long value = 0;
+
+  while (p < end && (*p == '\r' || *p == '\n' || *p == '\v' || *p == '\f')){
+    p++;
+  }
+  if (p < end && (*p == '-' || *p == '+')){
+    negative = (*p == '-');
+    p++;
+  }
+  while (p < end && *p >= '0' && *p <= '9' && value < 100000000L){
+    value = 10*value + (*p - '0');
+    p++;
+  }
+  return (int)(negative ? -value : value);
+}
+
+
+/***************************************************************
+ **
+ ** double scan_double(const char *p, const char *end)
+ **
+ ** value of the field [p, end) as atof() would give it 
+ **
+ ** Plain decimals (what the intensity section contains) with no
+ ** more than 15 significant digits are converted directly, which 
+ ** gives the same correctly rounded result as strtod(). Anything 
+ ** else (exponents, hex, inf, nan, very long numbers) is handed to strtod().
+ **
+ **************************************************************/
+
+static const double cel_powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+static double scan_double(const char *p, const char *end){
+
+  const char *start = p;
+  int negative = 0;
+  double mantissa = 0.0;
+  int digits = 0, fraction_digits = 0;
+  char copy[64];
+  size_t length;
+
+  if (p < end && (*p == '-' || *p == '+')){
+    negative = (*p == '-');
+    p++;
+  }
+  while (p < end && *p >= '0' && *p <= '9'){
+    mantissa = 10.0*mantissa + (*p - '0');
+    digits++;
+    p++;
+  }
+  if (p < end && *p == '.'){
+    p++;
+    while (p < end && *p >= '0' && *p <= '9'){
+      mantissa = 10.0*mantissa + (*p - '0');
+      digits++;
+      fraction_digits++;
+      p++;
+    }
+  }
+  
+  if (digits > 0 && digits <= 15 && (p == end || (*p != 'e' && *p != 'E' && *p != 'x' && *p != 'X'))){
+    mantissa = mantissa/cel_powers_of_ten[fraction_digits];
+    return negative ? -mantissa : mantissa;
+  }
+  
+  length = end - start;
+  if (length >= sizeof(copy)){
+    length = sizeof(copy) - 1;
+  }
+  memcpy(copy, start, length);
+  copy[length] = '\0';
+  return atof(copy);
+}
+
+
+/************************************************************************
+ **
+ ** static int read_intensity_lines(cel_block_reader *reader, const char *filename, double *intensity, int chip_num, int rows, int chip_dim_rows)
+ **
+ ** Parses the lines of the [INTENSITY] section, which reader returns
+ ** starting with the one just after the CellHeader= line.
+ **
+ ************************************************************************/
+
+static int read_intensity_lines(cel_block_reader *reader, const char *filename, double *intensity, int chip_num, int rows, int chip_dim_rows){
+
+  int i, cur_x,cur_y,cur_index;
+  double cur_mean;
+  char *line;
+  size_t length;
+  const char *line_end, *field, *field_end;
+  
+  int errCode = 0;
+
+  for (i=0; i < rows; i++){
+    if (!next_block_line(reader, &line, &length)){
+      errCode = reader->out_of_memory ? CEL_OUT_OF_MEMORY : TEXT_INTENSITY_TRUNCATED;
+      break;
+    }
+
+    if (length <= 2){
+      wxPrintf(wxT("Warning: found an empty line where not expected in %s.\nThis means that there is a cel intensity missing from the cel file.\nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, i);
+      errCode = TEXT_INTENSITY_TRUNCATED;
+      break;
+    }
+    line_end = line + length;
+
+    field = next_field(line, line_end, &field_end);
+    if (field == NULL){
+      wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
+      errCode = TEXT_INTENSITY_TRUNCATED;
+      break;
+    }
+    cur_x = scan_int(field, field_end);
+    
+    field = next_field(field_end, line_end, &field_end);
+    if (field == NULL){
+      wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
+      errCode = TEXT_INTENSITY_TRUNCATED;
+      break;
+    }
+    cur_y = scan_int(field, field_end);
+
+    field = next_field(field_end, line_end, &field_end);
+    if (field == NULL){
+      wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
+      errCode = TEXT_INTENSITY_TRUNCATED;
+      break;
+    }
+
+    if (cur_x < 0 || cur_x >= chip_dim_rows){
+      errCode = TEXT_INTENSITY_CORRUPTED;
+      break;
+    }
+    if (cur_y < 0 || cur_y >= chip_dim_rows){
+      errCode = TEXT_INTENSITY_CORRUPTED;
+      break;
+    }
+
+    cur_mean = scan_double(field, field_end);
+
+    if (cur_mean < 0 || cur_mean > 65536){
+      errCode = TEXT_INTENSITY_CORRUPTED;
+      break;
+    }
+
+    cur_index = cur_x + chip_dim_rows*(cur_y);
+    if (cur_index >= rows){
+      /* would land outside this array's column */
+      errCode = TEXT_INTENSITY_CORRUPTED;
+      break;
+    }
+    intensity[chip_num*rows + cur_index] = cur_mean;
+  }
+
+  return errCode;
+}
+
+
 /************************************************************************
  **
  ** int read_cel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols)
@@ -445,16 +783,141 @@ int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1,
  ** This function reads from the specified file the cel intensities for that
  ** array and fills a column of the intensity matrix.
  **
+ ** The [INTENSITY] section is block read (see next_block_line()). The 
+ ** checks, and so the error codes returned, are the same as 
+ ** read_cel_file_intensities_bylines()
+ **
  ************************************************************************/
 
 int read_cel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
   
+  FILE *currentFile; 
+  char buffer[BUF_SIZE];
+  cel_block_reader reader;
+  
+  int errCode;
+
+  currentFile = open_cel_file(filename);
+  
+  errCode = AdvanceToSection(currentFile,"[INTENSITY]",buffer);
+  if (errCode){
+    fclose(currentFile);
+    return TEXT_DID_NOT_FIND_INTENSITY_SECTION;
+  }
+  
+
+  errCode = findStartsWith(currentFile,"CellHeader=",buffer);  
+  if (errCode){
+    fclose(currentFile);
+    return TEXT_DID_NOT_FIND_CELLHEADER;
+  }
+
+  errCode = init_block_reader(&reader, currentFile);
+  if (errCode == 0){
+    errCode = read_intensity_lines(&reader, filename, intensity, chip_num, rows, chip_dim_rows);
+  }
+  free_block_reader(&reader);
+  fclose(currentFile);
+
+  return errCode;
+}
+
+
+/************************************************************************
+ **
+ ** int read_cel_file_intensities_at(const char *filename, long data_offset, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
+ **
+ ** As read_cel_file_intensities(), but the lines of intensities are
+ ** known to start at data_offset (see probe_text_cel_file()), so
+ ** the header is not looked at again.
+ **
+ ************************************************************************/
+
+int read_cel_file_intensities_at(const char *filename, long data_offset, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+
+  FILE *currentFile;
+  cel_block_reader reader;
+  int errCode;
+
+  currentFile = fopen(filename,"rb");
+  if (currentFile == NULL){
+    error("Could not open file %s", filename);
+  }
+  if (fseek(currentFile, data_offset, SEEK_SET) != 0){
+    fclose(currentFile);
+    return TEXT_INTENSITY_TRUNCATED;
+  }
+
+  errCode = init_block_reader(&reader, currentFile);
+  if (errCode == 0){
+    errCode = read_intensity_lines(&reader, filename, intensity, chip_num, rows, chip_dim_rows);
+  }
+  free_block_reader(&reader);
+  fclose(currentFile);
+
+  return errCode;
+}
+
+
+/************************************************************************
+ **
+ ** int read_cel_buffer_intensities(const char *buffer, size_t length, long data_offset, const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
+ **
+ ** const char *buffer - the entire contents of a text CEL file
+ ** size_t length - its length
+ ** long data_offset - where the lines of intensities start in buffer
+ **
+ ** As read_cel_file_intensities_at(), but the file has already been
+ ** read (or decompressed) into memory. filename is only used in messages.
+ **
+ ************************************************************************/
+
+int read_cel_buffer_intensities(const char *buffer, size_t length, long data_offset, const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+
+  cel_block_reader reader;
+  int errCode;
+
+  if (data_offset < 0 || (size_t)data_offset > length){
+    return TEXT_INTENSITY_TRUNCATED;
+  }
+
+  init_memory_block_reader(&reader, buffer + data_offset, length - data_offset);
+  errCode = read_intensity_lines(&reader, filename, intensity, chip_num, rows, chip_dim_rows);
+  free_block_reader(&reader);
+
+  return errCode;
+}
+
+
+/************************************************************************
+ **
+ ** int read_cel_file_intensities_bylines(const char *filename, double *intensity, int chip_num, int rows, int cols)
+ **
+ ** const char *filename - the name of the cel file to read
+ ** double *intensity  - the intensity matrix to fill
+ ** int chip_num - the column of the intensity matrix that we will be filling
+ ** int rows - dimension of intensity matrix
+ ** int cols - dimension of intensity matrix
+ **
+ ** returns 0 if successful, non zero if unsuccessful
+ **
+ ** This function reads from the specified file the cel intensities for that
+ ** array and fills a column of the intensity matrix.
+ **
+ ** This is the original line at a time reader. It is kept for comparison
+ ** (see bench_CELParsing.cpp)
+ **
+ ************************************************************************/
+
+int read_cel_file_intensities_bylines(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+  
   int i, cur_x,cur_y,cur_index;
   double cur_mean;
   FILE *currentFile; 
   char buffer[BUF_SIZE];
   /* tokenset *cur_tokenset;*/
   char *current_token;
+  char *tmp_pointer;
 
   int errCode;
 
@@ -487,21 +950,21 @@ int read_cel_file_intensities(const char *filename, double *intensity, int chip_
       
     }
 
-    current_token = strtok(buffer," \t");
+    current_token = cel_strtok(buffer," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       return TEXT_INTENSITY_TRUNCATED;
     }
 
     cur_x = atoi(current_token);
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       return TEXT_INTENSITY_TRUNCATED;
     }
 
     cur_y = atoi(current_token);
-    current_token = strtok(NULL," \t");  
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);  
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       return TEXT_INTENSITY_TRUNCATED;
@@ -564,6 +1027,7 @@ int read_cel_file_stddev(const char *filename, double *intensity, int chip_num,
   char buffer[BUF_SIZE];
   /* tokenset *cur_tokenset;*/
   char *current_token;
+  char *tmp_pointer;
 
   currentFile = open_cel_file(filename);
   
@@ -582,28 +1046,28 @@ int read_cel_file_stddev(const char *filename, double *intensity, int chip_num,
       break;
     }
 
-    current_token = strtok(buffer," \t");
+    current_token = cel_strtok(buffer," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_x = atoi(current_token);
 
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_y = atoi(current_token);
     
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
      if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_mean = atof(current_token);
 
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
@@ -653,6 +1117,7 @@ int read_cel_file_npixels(const char *filename, double *intensity, int chip_num,
   char buffer[BUF_SIZE];
   /* tokenset *cur_tokenset;*/
   char *current_token;
+  char *tmp_pointer;
 
   currentFile = open_cel_file(filename);
   
@@ -671,34 +1136,34 @@ int read_cel_file_npixels(const char *filename, double *intensity, int chip_num,
       break;
     }
 
-    current_token = strtok(buffer," \t");
+    current_token = cel_strtok(buffer," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_x = atoi(current_token);
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     
     cur_y = atoi(current_token);
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     
     cur_mean = atof(current_token);
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_stddev = atof(current_token);
     
-    current_token = strtok(NULL," \t");  
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);  
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
@@ -908,40 +1373,31 @@ void get_masks_outliers(const char *filename, int *nmasks, short **masks_x, shor
 
 /*************************************************************************
  **
- ** char *get_header_info(const char *filename, int *dim1, int *dim2)
- **
- ** const char *filename - file to open
- ** int *dim1 - place to store Cols
- ** int *dim2 - place to store Rows
+ ** static char *read_header_info(FILE *currentFile, int *dim1, int *dim2, int *err_code)
  **
- ** returns a character string containing the CDF name.
- **
- ** gets the header information (cols, rows and cdfname)
+ ** Reads the Cols, Rows and CDF name from the [HEADER] section of an
+ ** open text CEL file. Returns the CDF name, or NULL with *err_code set.
+ ** The file is left open, just after the DatHeader line.
  **
  ************************************************************************/
 
-char *get_header_info(const char *filename, int *dim1, int *dim2, int *err_code){
+static char *read_header_info(FILE *currentFile, int *dim1, int *dim2, int *err_code){
   
   int i,endpos;
   char *cdfName = NULL;
-  FILE *currentFile; 
   char buffer[BUF_SIZE];
   tokenset *cur_tokenset;
 
   int errCode;
 
-  currentFile = open_cel_file(filename);
-
   errCode = AdvanceToSection(currentFile,"[HEADER]",buffer);
   if (errCode){
-    fclose(currentFile);
     *err_code = TEXT_DID_NOT_FIND_HEADER_SECTION;
     return NULL;
   }
   
   errCode = findStartsWith(currentFile,"Cols",buffer);
   if (errCode){
-    fclose(currentFile);
     *err_code = TEXT_DID_NOT_FIND_COL_DIMENSION;
     return NULL;
   }
@@ -951,7 +1407,6 @@ char *get_header_info(const char *filename, int *dim1, int *dim2, int *err_code)
 
   errCode = findStartsWith(currentFile,"Rows",buffer);
   if (errCode){
-    fclose(currentFile);
     *err_code = TEXT_DID_NOT_FIND_ROW_DIMENSION; 
     return NULL;
   }
@@ -962,7 +1417,6 @@ char *get_header_info(const char *filename, int *dim1, int *dim2, int *err_code)
   
   errCode = findStartsWith(currentFile,"DatHeader",buffer);
   if (errCode){
-    fclose(currentFile);
     *err_code = TEXT_DID_NOT_FIND_DAT_HEADER;
     return NULL;
   }
@@ -981,13 +1435,39 @@ char *get_header_info(const char *filename, int *dim1, int *dim2, int *err_code)
     }
     if (i == (tokenset_size(cur_tokenset) - 1)){
       delete_tokens(cur_tokenset);
-      fclose(currentFile);
       *err_code = TEXT_HEADER_CDF_NAME_MISSING;
       return NULL;
     }
   }
   delete_tokens(cur_tokenset);
+  return(cdfName);
+}
+
+
+
+/*************************************************************************
+ **
+ ** char *get_header_info(const char *filename, int *dim1, int *dim2)
+ **
+ ** const char *filename - file to open
+ ** int *dim1 - place to store Cols
+ ** int *dim2 - place to store Rows
+ **
+ ** returns a character string containing the CDF name.
+ **
+ ** gets the header information (cols, rows and cdfname)
+ **
+ ************************************************************************/
+
+char *get_header_info(const char *filename, int *dim1, int *dim2, int *err_code){
+  
+  char *cdfName;
+  FILE *currentFile; 
+
+  currentFile = open_cel_file(filename);
+  cdfName = read_header_info(currentFile, dim1, dim2, err_code);
   fclose(currentFile);
+
   return(cdfName);
 }
 
@@ -1196,6 +1676,48 @@ int isTextCelFile(const char *filename){
 }
 
 
+
+/*************************************************************
+ **
+ ** int probe_text_cel_file(FILE *currentFile, cel_descriptor *descriptor)
+ **
+ ** FILE *currentFile - a file opened in binary mode, at its start
+ ** cel_descriptor *descriptor - filled in if this is a text CEL file
+ **
+ ** Returns -1 if currentFile is not a text CEL file. Otherwise reads 
+ ** the header, finds where the intensities start and returns 0, or 
+ ** returns an error code. The caller frees descriptor->cdfName.
+ **
+ **************************************************************/
+
+int probe_text_cel_file(FILE *currentFile, cel_descriptor *descriptor){
+
+  char buffer[BUF_SIZE];
+  int errCode = 0;
+
+  if (ReadFileLine(buffer, BUF_SIZE, currentFile) || strncmp("[CEL]", buffer, 4) != 0){
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_TEXT;
+
+  descriptor->cdfName = read_header_info(currentFile, &descriptor->dim1, &descriptor->dim2, &errCode);
+  if (descriptor->cdfName == NULL){
+    return errCode;
+  }
+  descriptor->n_cells = descriptor->dim1*descriptor->dim2;
+
+  if (AdvanceToSection(currentFile,"[INTENSITY]",buffer)){
+    return TEXT_DID_NOT_FIND_INTENSITY_SECTION;
+  }
+  if (findStartsWith(currentFile,"CellHeader=",buffer)){
+    return TEXT_DID_NOT_FIND_CELLHEADER;
+  }
+  descriptor->data_offset = ftell(currentFile);
+
+  return 0;
+}
+
+
 /****************************************************************
  ****************************************************************
  **
@@ -1403,6 +1925,7 @@ int read_gzcel_file_intensities(const char *filename, double *intensity, int chi
   char buffer[BUF_SIZE];
   /* tokenset *cur_tokenset;*/
   char *current_token;
+  char *tmp_pointer;
 
   currentFile = open_gz_cel_file(filename);
   
@@ -1416,21 +1939,21 @@ int read_gzcel_file_intensities(const char *filename, double *intensity, int chi
     cur_y = atoi(get_token(cur_tokenset,1));
     cur_mean = atof(get_token(cur_tokenset,2)); */
     
-    current_token = strtok(buffer," \t"); 
+    current_token = cel_strtok(buffer," \t",&tmp_pointer); 
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
 
     cur_x = atoi(current_token);
-    current_token = strtok(NULL," \t"); 
+    current_token = cel_strtok(NULL," \t",&tmp_pointer); 
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
 
     cur_y = atoi(current_token);
-    current_token = strtok(NULL," \t"); 
+    current_token = cel_strtok(NULL," \t",&tmp_pointer); 
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
@@ -1487,6 +2010,7 @@ int read_gzcel_file_stddev(const char *filename, double *intensity, int chip_num
   char buffer[BUF_SIZE];
   /* tokenset *cur_tokenset;*/
   char *current_token;
+  char *tmp_pointer;
 
   currentFile = open_gz_cel_file(filename);
   
@@ -1500,21 +2024,21 @@ int read_gzcel_file_stddev(const char *filename, double *intensity, int chip_num
     cur_y = atoi(get_token(cur_tokenset,1));
     cur_mean = atof(get_token(cur_tokenset,2)); */
     
-    current_token = strtok(buffer," \t");
+    current_token = cel_strtok(buffer," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
 
     cur_x = atoi(current_token);
-    current_token = strtok(NULL," \t"); 
+    current_token = cel_strtok(NULL," \t",&tmp_pointer); 
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
 
     cur_y = atoi(current_token);
-    current_token = strtok(NULL," \t"); 
+    current_token = cel_strtok(NULL," \t",&tmp_pointer); 
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
@@ -1522,7 +2046,7 @@ int read_gzcel_file_stddev(const char *filename, double *intensity, int chip_num
 
     cur_mean = atof(current_token);
   
-    current_token = strtok(NULL," \t"); 
+    current_token = cel_strtok(NULL," \t",&tmp_pointer); 
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
@@ -1571,6 +2095,7 @@ int read_gzcel_file_npixels(const char *filename, double *intensity, int chip_nu
   char buffer[BUF_SIZE];
   /* tokenset *cur_tokenset;*/
   char *current_token;
+  char *tmp_pointer;
 
   currentFile = open_gz_cel_file(filename);
   
@@ -1584,33 +2109,33 @@ int read_gzcel_file_npixels(const char *filename, double *intensity, int chip_nu
     cur_y = atoi(get_token(cur_tokenset,1));
     cur_mean = atof(get_token(cur_tokenset,2)); */
     
-    current_token = strtok(buffer," \t");
+    current_token = cel_strtok(buffer," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_x = atoi(current_token);
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_y = atoi(current_token);
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_mean = atof(current_token);
   
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
     }
     cur_stddev = atof(current_token);
     
-    current_token = strtok(NULL," \t");
+    current_token = cel_strtok(NULL," \t",&tmp_pointer);
     if (current_token == NULL){
       wxPrintf(wxT("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n"), filename, i-1, rows);
       break;
@@ -1721,28 +2246,20 @@ void gz_apply_masks(const char *filename, double *intensity, int chip_num, int r
 
 /*************************************************************************
  **
- ** char *gz_get_header_info(const char *filename, int *dim1, int *dim2)
- **
- ** const char *filename - file to open
- ** int *dim1 - place to store Cols
- ** int *dim2 - place to store Rows
+ ** static char *gz_read_header_info(gzFile currentFile, const char *filename, int *dim1, int *dim2)
  **
- ** returns a character string containing the CDF name.
- **
- ** gets the header information (cols, rows and cdfname)
+ ** As read_header_info(), for an open gzipped text CEL file. 
+ ** The file is left open, just after the DatHeader line.
  **
  ************************************************************************/
 
-char *gz_get_header_info(const char *filename, int *dim1, int *dim2){
+static char *gz_read_header_info(gzFile currentFile, const char *filename, int *dim1, int *dim2){
   
   int i,endpos;
   char *cdfName = NULL;
-  gzFile currentFile; 
   char buffer[BUF_SIZE];
   tokenset *cur_tokenset;
 
-  currentFile = open_gz_cel_file(filename);
-
   gzAdvanceToSection(currentFile,"[HEADER]",buffer);
   gzfindStartsWith(currentFile,"Cols",buffer);  
   cur_tokenset = tokenize(buffer,"=");
@@ -1773,12 +2290,73 @@ char *gz_get_header_info(const char *filename, int *dim1, int *dim2){
     }
   }
   delete_tokens(cur_tokenset);
+  return(cdfName);
+}
+
+
+/*************************************************************************
+ **
+ ** char *gz_get_header_info(const char *filename, int *dim1, int *dim2)
+ **
+ ** const char *filename - file to open
+ ** int *dim1 - place to store Cols
+ ** int *dim2 - place to store Rows
+ **
+ ** returns a character string containing the CDF name.
+ **
+ ** gets the header information (cols, rows and cdfname)
+ **
+ ************************************************************************/
+
+char *gz_get_header_info(const char *filename, int *dim1, int *dim2){
+
+  char *cdfName;
+  gzFile currentFile; 
+
+  currentFile = open_gz_cel_file(filename);
+  try {
+    cdfName = gz_read_header_info(currentFile, filename, dim1, dim2);
+  } catch (wxString &Problem){
+    gzclose(currentFile);
+    throw;
+  }
   gzclose(currentFile);
   return(cdfName);
 }
 
 
 
+/*************************************************************
+ **
+ ** int probe_gztext_cel_file(gzFile currentFile, const char *filename, cel_descriptor *descriptor)
+ **
+ ** As probe_text_cel_file(), for a gzipped text CEL file. data_offset
+ ** is where the intensities start in the decompressed file. A header 
+ ** that stops short is an error(), as for the other gz functions.
+ **
+ **************************************************************/
+
+int probe_gztext_cel_file(gzFile currentFile, const char *filename, cel_descriptor *descriptor){
+
+  char buffer[BUF_SIZE];
+
+  if (gzgets(currentFile, buffer, BUF_SIZE) == NULL || strncmp("[CEL]", buffer, 4) != 0){
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_TEXT;
+
+  descriptor->cdfName = gz_read_header_info(currentFile, filename, &descriptor->dim1, &descriptor->dim2);
+  descriptor->n_cells = descriptor->dim1*descriptor->dim2;
+
+  gzAdvanceToSection(currentFile,"[INTENSITY]",buffer);
+  gzfindStartsWith(currentFile,"CellHeader=",buffer);
+  descriptor->data_offset = gztell(currentFile);
+
+  return 0;
+}
+
+
+
 
 /*************************************************************************
  **
@@ -1,12 +1,21 @@
 #ifndef READ_CELFILE_TEXT_H
 #define READ_CELFILE_TEXT_H
 
+#include <cstdio>
 #include "read_cel_structures.h"
 
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
 int isTextCelFile(const char *filename);
+int probe_text_cel_file(FILE *currentFile, cel_descriptor *descriptor);
 char *get_header_info(const char *filename, int *dim1, int *dim2, int *err_code);
 void get_detailed_header_info(const char *filename, detailed_header_info *header_info);
 int read_cel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_cel_file_intensities_at(const char *filename, long data_offset, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_cel_buffer_intensities(const char *buffer, size_t length, long data_offset, const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_cel_file_intensities_bylines(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
 int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2);
 #if defined(INCLUDE_ALL_AFFYIO)
 int read_cel_file_stddev(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
@@ -17,6 +26,7 @@ void apply_masks(const char *filename, double *intensity, int chip_num, int rows
 
 #if defined(HAVE_ZLIB)
 int isgzTextCelFile(const char *filename);
+int probe_gztext_cel_file(gzFile currentFile, const char *filename, cel_descriptor *descriptor);
 char *gz_get_header_info(const char *filename, int *dim1, int *dim2);
 void gz_get_detailed_header_info(const char *filename, detailed_header_info *header_info);
 int read_gzcel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
@@ -52,7 +52,7 @@ typedef struct{
   int n_subgrids;
   FILE *infile;
 #if defined(HAVE_ZLIB)
-  gzFile *gzinfile;
+  gzFile gzinfile;
 #endif
 } binary_header;
 
@@ -129,12 +129,13 @@ static tokenset *tokenize(char *str, const char *delimiters){
   int i=0;
 
   char *current_token;
+  char *tmp_pointer;
   tokenset *my_tokenset = (tokenset *)calloc(1,sizeof(tokenset));
   my_tokenset->n=0;
   
   my_tokenset->tokens = NULL;
 
-  current_token = strtok(str,delimiters);
+  current_token = cel_strtok(str,delimiters,&tmp_pointer);
   while (current_token != NULL){
     my_tokenset->n++;
     my_tokenset->tokens = (char **)realloc(my_tokenset->tokens,my_tokenset->n*sizeof(char*));
@@ -142,7 +143,7 @@ static tokenset *tokenize(char *str, const char *delimiters){
     strcpy(my_tokenset->tokens[i],current_token);
     my_tokenset->tokens[i][(strlen(current_token))] = '\0';
     i++;
-    current_token = strtok(NULL,delimiters);
+    current_token = cel_strtok(NULL,delimiters,&tmp_pointer);
   }
 
   return my_tokenset; 
@@ -334,49 +335,27 @@ static void delete_binary_header(binary_header *my_header){
 
 /*************************************************************
  **
- ** static binary_header *read_binary_header(const char *filename, int return_stream, FILE *infile)
+ ** static binary_header *read_binary_header_stream(FILE *infile, int *err_code)
  **
- ** const char *filename - name of binary cel file
- ** int return_stream - if 1 return the stream as part of the header, otherwise close the
- **              file at end of function.
+ ** FILE *infile - an open file, at its start
+ **
+ ** Reads the header of a binary cel file. Returns NULL if infile
+ ** does not start with the magic number and version of one. If the
+ ** header is truncated *err_code is set. The file is left open,
+ ** just after the header, where the intensities start.
  **
  *************************************************************/
 
-static binary_header *read_binary_header(const char *filename, int return_stream, int *err_code){  /* , FILE *infile){ */
+static binary_header *read_binary_header_stream(FILE *infile, int *err_code){
   
-  FILE *infile;
-
   binary_header *this_header = (binary_header *)calloc(1,sizeof(binary_header));
   
   /* Pass through all the header information */
   
-  if ((infile = fopen(filename, "rb")) == NULL)
-    {
-      error("Unable to open the file %s\n",filename);
-      return 0;
-    }
-  
-  if (!fread_int32(&(this_header->magic_number),1,infile)){
-    error("The binary file %s does not have the appropriate magic number\n",filename);
-    fclose(infile);
-    return 0;
-  }
-  
-  if (this_header->magic_number != 64){
-    error("The binary file %s does not have the appropriate magic number\n",filename);
-    fclose(infile);
-    return 0;
-  }
-  
-  if (!fread_int32(&(this_header->version_number),1,infile)){
-    fclose(infile);
-    return 0;
-  }
-
-  if (this_header->version_number != 4){
-    error("The binary file %s is not version 4. Cannot read\n",filename);
-    fclose(infile);
-    return 0;
+  if (!fread_int32(&(this_header->magic_number),1,infile) || this_header->magic_number != 64 ||
+      !fread_int32(&(this_header->version_number),1,infile) || this_header->version_number != 4){
+    delete_binary_header(this_header);
+    return NULL;
   }
 
   /*** NOTE THE DOCUMENTATION ON THE WEB IS INCONSISTENT WITH THE TRUTH IF YOU LOOK AT THE FUSION SDK */
@@ -387,7 +366,6 @@ static binary_header *read_binary_header(const char *filename, int return_stream
 
   if (!fread_int32(&(this_header->rows),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
     
   }
@@ -395,28 +373,24 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   
   if (!fread_int32(&(this_header->cols),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   }
   
 
   if (!fread_int32(&(this_header->n_cells),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
 
   }
   
   if (this_header->n_cells != (this_header->cols)*(this_header->rows)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   }
 
   
   if (!fread_int32(&(this_header->header_len),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
 
   }
@@ -425,13 +399,11 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   
   if (!fread(this_header->header,sizeof(char),this_header->header_len,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   }
   
   if (!fread_int32(&(this_header->alg_len),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   }
   
@@ -444,7 +416,6 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   
   if (!fread_int32(&(this_header->alg_param_len),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
  
   }
@@ -459,7 +430,6 @@ static binary_header *read_binary_header(const char *filename, int return_stream
     
   if (!fread_int32(&(this_header->celmargin),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   
   }
@@ -471,33 +441,99 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   
   if (!fread_uint32(&(this_header->n_masks),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   
   }
 
   if (!fread_int32(&(this_header->n_subgrids),1,infile)){
     *err_code = BINARY_HEADER_TRUNCATED;
-    fclose(infile);
     return this_header;
   
   } 
 
 
-  if (!return_stream){
+  return this_header;
+}
+
+
+
+/*************************************************************
+ **
+ ** static binary_header *read_binary_header(const char *filename, int return_stream, FILE *infile)
+ **
+ ** const char *filename - name of binary cel file
+ ** int return_stream - if 1 return the stream as part of the header, otherwise close the
+ **              file at end of function. It is also closed if *err_code is set.
+ **
+ *************************************************************/
+
+static binary_header *read_binary_header(const char *filename, int return_stream, int *err_code){  /* , FILE *infile){ */
+  
+  FILE *infile;
+
+  binary_header *this_header;
+  
+  if ((infile = fopen(filename, "rb")) == NULL)
+    {
+      error("Unable to open the file %s\n",filename);
+      return 0;
+    }
+  
+  this_header = read_binary_header_stream(infile, err_code);
+  if (this_header == NULL){
+    fclose(infile);
+    error("The binary file %s is not a version 4 binary CEL file\n",filename);
+    return 0;
+  }
+
+  if (!return_stream || *err_code){
     fclose(infile);
   } else {
     this_header->infile = infile;
   }
   
-  
   return this_header;
+}
+
+/*************************************************************
+ **
+ ** static char *binary_header_cdfName(binary_header *my_header, int *err_code)
+ **
+ ** pulls the cdfname out of the DatHeader of a binary cel file
+ **
+ *************************************************************/
 
+static char *binary_header_cdfName(binary_header *my_header, int *err_code){
 
+  char *cdfName =0;
+  tokenset *my_tokenset;
 
+  int i = 0,endpos;
 
+  my_tokenset = tokenize(my_header->header," ");
+    
+  for (i =0; i < tokenset_size(my_tokenset);i++){
+    /* look for a token ending in ".1sq" */
+    endpos=token_ends_with(get_token(my_tokenset,i),".1sq");
+    if(endpos > 0){
+      /* Found the likely CDF name, now chop of .1sq and store it */      
+      cdfName= (char *)calloc(endpos+1,sizeof(char));
+      strncpy(cdfName,get_token(my_tokenset,i),endpos);
+      cdfName[endpos] = '\0';
+      
+      break;
+    }
+    if (i == (tokenset_size(my_tokenset) - 1)){
+      *err_code= BINARY_HEADER_CDF_NAME_MISSING;
+      break;
+    }
+  }
+  
+  delete_tokens(my_tokenset);
+  return(cdfName);
 }
 
+
 /*************************************************************
  **
  ** static char *binary_get_header_info(const char *filename, int *dim1, int *dim2)
@@ -509,11 +545,7 @@ static binary_header *read_binary_header(const char *filename, int return_stream
 
 char *binary_get_header_info(const char *filename, int *dim1, int *dim2, int *err_code){
   
-
   char *cdfName =0;
-  tokenset *my_tokenset;
-
-  int i = 0,endpos;
   
   binary_header *my_header;
 
@@ -529,33 +561,56 @@ char *binary_get_header_info(const char *filename, int *dim1, int *dim2, int *er
   *dim1 = my_header->cols;
   *dim2 = my_header->rows;
 
-  my_tokenset = tokenize(my_header->header," ");
-    
-  for (i =0; i < tokenset_size(my_tokenset);i++){
-    /* look for a token ending in ".1sq" */
-    endpos=token_ends_with(get_token(my_tokenset,i),".1sq");
-    if(endpos > 0){
-      /* Found the likely CDF name, now chop of .1sq and store it */      
-      cdfName= (char *)calloc(endpos+1,sizeof(char));
-      strncpy(cdfName,get_token(my_tokenset,i),endpos);
-      cdfName[endpos] = '\0';
-      
-      break;
-    }
-    if (i == (tokenset_size(my_tokenset) - 1)){
-      *err_code= BINARY_HEADER_CDF_NAME_MISSING;
-      break;
-    }
-  }
+  cdfName = binary_header_cdfName(my_header, err_code);
   
   delete_binary_header(my_header);
-  delete_tokens(my_tokenset);
   return(cdfName);
   
 }
 
 
 
+/*************************************************************
+ **
+ ** int probe_binary_cel_file(FILE *infile, cel_descriptor *descriptor)
+ **
+ ** FILE *infile - a file opened in binary mode, at its start
+ ** cel_descriptor *descriptor - filled in if this is a binary cel file
+ **
+ ** Returns -1 if infile is not a binary cel file. Otherwise reads 
+ ** the header and returns 0, or an error code. The caller frees
+ ** descriptor->cdfName.
+ **
+ *************************************************************/
+
+int probe_binary_cel_file(FILE *infile, cel_descriptor *descriptor){
+
+  binary_header *my_header;
+  int err_code = 0;
+
+  my_header = read_binary_header_stream(infile, &err_code);
+  if (my_header == NULL){
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_XDA;
+
+  if (err_code){
+    delete_binary_header(my_header);
+    return err_code;
+  }
+
+  descriptor->dim1 = my_header->cols;
+  descriptor->dim2 = my_header->rows;
+  descriptor->n_cells = my_header->n_cells;
+  descriptor->data_offset = ftell(infile);
+  descriptor->cdfName = binary_header_cdfName(my_header, &err_code);
+
+  delete_binary_header(my_header);
+  return err_code;
+}
+
+
+
 
 
 /*************************************************************************
@@ -776,6 +831,60 @@ int check_binary_cel_file(const char *filename, const char *ref_cdfName, int ref
 
 
 
+/***************************************************************
+ **
+ ** static int check_binary_intensities(const double *destination, int n_read, int n_cells)
+ **
+ ** checks the n_read intensities read when n_cells were expected
+ **
+ **************************************************************/
+
+static int check_binary_intensities(const double *destination, int n_read, int n_cells){
+
+  int i;
+  int valid;
+
+  /* NaN fails both comparisons */
+  valid = 1;
+  for (i = 0; i < n_read; i++){
+    valid &= (destination[i] >= 0) & (destination[i] <= 65536);
+  }
+  if (!valid){
+    return BINARY_INTENSITY_CORRUPTED;
+  }
+
+  if (n_read < n_cells){
+    return BINARY_INTENSITY_TRUNCATED;
+  }
+  return(0);
+}
+
+
+/***************************************************************
+ **
+ ** static int read_binary_intensities(FILE *infile, int n_cells, double *intensity, int chip_num, int rows)
+ **
+ ** reads and checks the n_cells intensities of the records starting
+ ** at the current position of infile, which is left open.
+ **
+ **************************************************************/
+
+static int read_binary_intensities(FILE *infile, int n_cells, double *intensity, int chip_num, int rows){
+
+  int n_read;
+  double *destination;
+
+  if (n_cells > rows){
+    /* more cells than the column has room for */
+    return CEL_NON_MATCHING_DIMENSIONS;
+  }
+  destination = &intensity[chip_num*n_cells];
+  n_read = (int)fread_float32_records(destination, n_cells, 10, infile);
+
+  return check_binary_intensities(destination, n_read, n_cells);
+}
+
+
 /***************************************************************
  **
  ** static int read_binarycel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
@@ -783,17 +892,17 @@ int check_binary_cel_file(const char *filename, const char *ref_cdfName, int ref
  ** 
  ** This function reads binary cel file intensities into the data matrix
  **
+ ** The intensity section is a table of 10 byte records (intensity, 
+ ** stddev, npixels), stored a row of the chip at a time, so the 
+ ** intensities are pulled out in one pass with fread_float32_records() 
+ ** and then all checked at once. 
+ **
  **************************************************************/
 
 int read_binarycel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
 
-  int i=0, j=0;
-  int cur_index;
+  int n_cells;
   
-  int fread_err=0;
-
-
-  celintens_record *cur_intensity = (celintens_record *)calloc(1,sizeof(celintens_record));
   binary_header *my_header;
 
   int err_code = 0;
@@ -805,34 +914,73 @@ int read_binarycel_file_intensities(const char *filename, double *intensity, int
     return err_code;
   }
 
-  for (i = 0; i < my_header->rows; i++){
-    for (j =0; j < my_header->cols; j++){
-      cur_index = j + my_header->cols*i; /* i + my_header->rows*j; */
-      fread_err = fread_float32(&(cur_intensity->cur_intens),1,my_header->infile);
-      fread_err+= fread_float32(&(cur_intensity->cur_sd),1,my_header->infile);
-      fread_err+=fread_int16(&(cur_intensity->npixels),1,my_header->infile);
-      if (fread_err < 3){
-	fclose(my_header->infile);
-	delete_binary_header(my_header);
-	free(cur_intensity);
-	return BINARY_INTENSITY_TRUNCATED;
-      }   
-      if (cur_intensity->cur_intens < 0 || cur_intensity->cur_intens > 65536 || isnan(cur_intensity->cur_intens)){
-        fclose(my_header->infile);
-        delete_binary_header(my_header);
-        free(cur_intensity);
-        return BINARY_INTENSITY_CORRUPTED;
-      }
- 
-      fread_err=0;
-      intensity[chip_num*my_header->n_cells + cur_index] = (double )cur_intensity->cur_intens;
-    }
-  }
+  n_cells = my_header->n_cells;
+  err_code = read_binary_intensities(my_header->infile, n_cells, intensity, chip_num, rows);
   
   fclose(my_header->infile);
   delete_binary_header(my_header);
-  free(cur_intensity);
-  return(0);
+
+  return err_code;
+}
+
+
+/***************************************************************
+ **
+ ** int read_binarycel_file_intensities_at(const char *filename, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
+ **
+ ** As read_binarycel_file_intensities(), but the n_cells intensity 
+ ** records are known to start at data_offset (see probe_binary_cel_file())
+ ** so the header is not read again.
+ **
+ **************************************************************/
+
+int read_binarycel_file_intensities_at(const char *filename, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+
+  FILE *infile;
+  int err_code;
+
+  if ((infile = fopen(filename, "rb")) == NULL)
+    {
+      error("Unable to open the file %s\n",filename);
+      return 0;
+    }
+  if (fseek(infile, data_offset, SEEK_SET) != 0){
+    fclose(infile);
+    return BINARY_INTENSITY_TRUNCATED;
+  }
+
+  err_code = read_binary_intensities(infile, n_cells, intensity, chip_num, rows);
+  fclose(infile);
+
+  return err_code;
+}
+
+
+/***************************************************************
+ **
+ ** int read_binarycel_buffer_intensities(const char *buffer, size_t length, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
+ **
+ ** As read_binarycel_file_intensities_at(), but the whole file is
+ ** already in memory, the length bytes at buffer (a decompressed 
+ ** gz file, say).
+ **
+ **************************************************************/
+
+int read_binarycel_buffer_intensities(const char *buffer, size_t length, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows){
+
+  int n_read;
+  double *destination;
+
+  if (n_cells > rows){
+    return CEL_NON_MATCHING_DIMENSIONS;
+  }
+  if (data_offset < 0 || (size_t)data_offset > length){
+    return BINARY_INTENSITY_TRUNCATED;
+  }
+  destination = &intensity[chip_num*n_cells];
+  n_read = (int)buffer_float32_records(destination, n_cells, 10, buffer + data_offset, length - data_offset);
+
+  return check_binary_intensities(destination, n_read, n_cells);
 }
 
 
@@ -1268,7 +1416,7 @@ static binary_header *gzread_binary_header(const char *filename, int return_stre
   if (!return_stream){
     gzclose(infile);
   } else {
-    this_header->gzinfile = &infile;
+    this_header->gzinfile = infile;
   }
   
   
@@ -1281,6 +1429,102 @@ static binary_header *gzread_binary_header(const char *filename, int return_stre
 
 
 
+/*************************************************************
+ **
+ ** static binary_header *gzread_binary_header_stream(gzFile infile, int *err_code)
+ **
+ ** As read_binary_header_stream(), for an open gzipped binary cel file.
+ ** The file is left just after the header, where the intensities start.
+ **
+ *************************************************************/
+
+static binary_header *gzread_binary_header_stream(gzFile infile, int *err_code){
+
+  binary_header *this_header = (binary_header *)calloc(1,sizeof(binary_header));
+
+  if (!gzread_int32(&(this_header->magic_number),1,infile) || this_header->magic_number != 64 ||
+      !gzread_int32(&(this_header->version_number),1,infile) || this_header->version_number != 4){
+    delete_binary_header(this_header);
+    return NULL;
+  }
+
+  /** rows then cols, as FUSION (see read_binary_header_stream()) **/
+
+  if (!gzread_int32(&(this_header->rows),1,infile) ||
+      !gzread_int32(&(this_header->cols),1,infile) ||
+      !gzread_int32(&(this_header->n_cells),1,infile) ||
+      this_header->n_cells != (this_header->cols)*(this_header->rows) ||
+      !gzread_int32(&(this_header->header_len),1,infile) || this_header->header_len < 0){
+    *err_code = BINARY_HEADER_TRUNCATED;
+    return this_header;
+  }
+
+  this_header->header = (char *)calloc(this_header->header_len+1,sizeof(char));
+  if (gzread(infile,this_header->header,this_header->header_len) != this_header->header_len ||
+      !gzread_int32(&(this_header->alg_len),1,infile) || this_header->alg_len < 0){
+    *err_code = BINARY_HEADER_TRUNCATED;
+    return this_header;
+  }
+
+  this_header->algorithm = (char *)calloc(this_header->alg_len+1,sizeof(char));
+  if (gzread(infile,this_header->algorithm,this_header->alg_len) != this_header->alg_len ||
+      !gzread_int32(&(this_header->alg_param_len),1,infile) || this_header->alg_param_len < 0){
+    *err_code = BINARY_HEADER_TRUNCATED;
+    return this_header;
+  }
+
+  this_header->alg_param = (char *)calloc(this_header->alg_param_len+1,sizeof(char));
+  if (gzread(infile,this_header->alg_param,this_header->alg_param_len) != this_header->alg_param_len ||
+      !gzread_int32(&(this_header->celmargin),1,infile) ||
+      !gzread_uint32(&(this_header->n_outliers),1,infile) ||
+      !gzread_uint32(&(this_header->n_masks),1,infile) ||
+      !gzread_int32(&(this_header->n_subgrids),1,infile)){
+    *err_code = BINARY_HEADER_TRUNCATED;
+    return this_header;
+  }
+
+  return this_header;
+}
+
+
+
+/*************************************************************
+ **
+ ** int probe_gzbinary_cel_file(gzFile infile, cel_descriptor *descriptor)
+ **
+ ** As probe_binary_cel_file(), for a gzipped binary cel file. 
+ ** data_offset is where the intensities start in the decompressed file.
+ **
+ *************************************************************/
+
+int probe_gzbinary_cel_file(gzFile infile, cel_descriptor *descriptor){
+
+  binary_header *my_header;
+  int err_code = 0;
+
+  my_header = gzread_binary_header_stream(infile, &err_code);
+  if (my_header == NULL){
+    return -1;
+  }
+  descriptor->format = CEL_FORMAT_XDA;
+
+  if (err_code){
+    delete_binary_header(my_header);
+    return err_code;
+  }
+
+  descriptor->dim1 = my_header->cols;
+  descriptor->dim2 = my_header->rows;
+  descriptor->n_cells = my_header->n_cells;
+  descriptor->data_offset = gztell(infile);
+  descriptor->cdfName = binary_header_cdfName(my_header, &err_code);
+
+  delete_binary_header(my_header);
+  return err_code;
+}
+
+
+
 /*************************************************************
  **
  ** static char *binary_get_header_info(const char *filename, int *dim1, int *dim2)
@@ -1572,7 +1816,7 @@ int gzread_binarycel_file_intensities(const char *filename, double *intensity, i
 	return 1;
       } 
       if (cur_intensity->cur_intens < 0 || cur_intensity->cur_intens > 65536 || isnan(cur_intensity->cur_intens)){
-        gzclose(my_header->infile);
+        gzclose(my_header->gzinfile);
         delete_binary_header(my_header);
         free(cur_intensity);
         return 1;
@@ -1667,7 +1911,7 @@ int gzread_binarycel_file_npixels(const char *filename, double *intensity, int c
       fread_err+= gzread_float32(&(cur_intensity->cur_sd),1,my_header->gzinfile);
       fread_err+= gzread_int16(&(cur_intensity->npixels),1,my_header->gzinfile);  
       if (fread_err < 3){
-	gzclose(my_header->infile);
+	gzclose(my_header->gzinfile);
 	delete_binary_header(my_header);
 	free(cur_intensity);
 	return 1;
@@ -1710,7 +1954,7 @@ void gz_binary_apply_masks(const char *filename, double *intensity, int chip_num
   sizeofrecords = 2*sizeof(float) + sizeof(short); /* sizeof(celintens_record) */
   
   //fseek(my_header->infile,my_header->n_cells*sizeofrecords,SEEK_CUR);
-  gzseek(my_header->infile,my_header->n_cells*sizeofrecords,SEEK_CUR);
+  gzseek(my_header->gzinfile,my_header->n_cells*sizeofrecords,SEEK_CUR);
   if (rm_mask){
     for (i =0; i < my_header->n_masks; i++){
       gzread_int16(&(cur_loc->x),1,my_header->gzinfile);
@@ -1,6 +1,7 @@
 #ifndef READ_CELFILE_XDA_H
 #define READ_CELFILE_XDA_H
 
+#include <cstdio>
 #include "read_cel_structures.h"
 
 #if defined(HAVE_ZLIB)
@@ -8,9 +9,12 @@
 #endif
 
 int isBinaryCelFile(const char *filename);
+int probe_binary_cel_file(FILE *infile, cel_descriptor *descriptor);
 char *binary_get_header_info(const char *filename, int *dim1, int *dim2, int *err_code);
 void binary_get_detailed_header_info(const char *filename, detailed_header_info *header_info, int *err_code);
 int read_binarycel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_binarycel_file_intensities_at(const char *filename, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
+int read_binarycel_buffer_intensities(const char *buffer, size_t length, long data_offset, int n_cells, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
 int check_binary_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2);
 #if defined(INCLUDE_ALL_AFFYIO)
 int read_binarycel_file_stddev(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
@@ -20,6 +24,7 @@ void binary_apply_masks(const char *filename, double *intensity, int chip_num, i
 #endif
 #if defined(HAVE_ZLIB)
 int isgzBinaryCelFile(const char *filename);
+int probe_gzbinary_cel_file(gzFile infile, cel_descriptor *descriptor);
 char *gzbinary_get_header_info(const char *filename, int *dim1, int *dim2);
 void gzbinary_get_detailed_header_info(const char *filename, detailed_header_info *header_info);
 int gzread_binarycel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows);
@@ -22,6 +22,9 @@
  ** Feb 14, 2008 - Bring some patches over from Bioconductor/affyio (fixes for incorrect usage of bitwise rather than
  **                logical or, addition of decode_MIME_value_toASCII)
  ** Jun 24, 2008 - change char * to comst char * where appropriate
+ ** Oct 17, 2026 - the columns of a data set are allocated by read_generic_data_set_rows()
+ **                rather than read_generic_data_set(), so reading a header allocates nothing
+ **                for the rows
  **
  *************************************************************/
 
@@ -145,10 +148,12 @@ void Free_generic_data_set(generic_data_set *data_set){
   }
   free(data_set->col_name_type_value);
 
-  for (i= 0; i < (int)data_set->ncols; i++){
-    free(data_set->Data[i]);
+  if (data_set->Data != 0){
+    for (i= 0; i < (int)data_set->ncols; i++){
+      free(data_set->Data[i]);
+    }
+    free(data_set->Data);
   }
-  free(data_set->Data);
 
   
 }
@@ -693,6 +698,47 @@ int read_generic_data_group(generic_data_group *data_group, FILE *instream){
 
 
 
+/* The columns of a data set are only allocated when its rows are 
+   read, so that looking at a data set's header, or picking out one 
+   column from the file, costs nothing for the other columns */
+
+static void allocate_generic_data_set_rows(generic_data_set *data_set){
+
+  int i;
+
+  if (data_set->Data != 0){
+    return;
+  }
+
+  data_set->Data = (void **)calloc(data_set->ncols, sizeof(void *));
+
+  for (i=0; i < (int)data_set->ncols; i++){
+    switch(data_set->col_name_type_value[i].type){
+    case 0: data_set->Data[i] = calloc(data_set->nrows,sizeof(char));
+      break;
+    case 1: data_set->Data[i] = calloc(data_set->nrows,sizeof(unsigned char));
+      break;
+    case 2: data_set->Data[i] = calloc(data_set->nrows,sizeof(short));
+      break;
+    case 3: data_set->Data[i] = calloc(data_set->nrows,sizeof(unsigned short));
+      break;
+    case 4: data_set->Data[i] = calloc(data_set->nrows,sizeof(int));
+      break;
+    case 5: data_set->Data[i] = calloc(data_set->nrows,sizeof(unsigned int));
+      break;
+    case 6: data_set->Data[i] = calloc(data_set->nrows,sizeof(float));
+      break;
+    case 7: data_set->Data[i] = calloc(data_set->nrows,sizeof(double));
+      break;
+    case 8: data_set->Data[i] = calloc(data_set->nrows,sizeof(ASTRING));
+      break;
+    case 9: data_set->Data[i] = calloc(data_set->nrows,sizeof(AWSTRING));
+      break;
+    }
+  }
+}
+
+
 int read_generic_data_set(generic_data_set *data_set, FILE *instream){
 
   int i;
@@ -732,33 +778,6 @@ int read_generic_data_set(generic_data_set *data_set, FILE *instream){
     return 0;
   }
 
-  data_set->Data = (void **)calloc(data_set->ncols, sizeof(void *));
-
-  for (i=0; i < (int)data_set->ncols; i++){
-    switch(data_set->col_name_type_value[i].type){
-    case 0: data_set->Data[i] = calloc(data_set->nrows,sizeof(char));
-      break;
-    case 1: data_set->Data[i] = calloc(data_set->nrows,sizeof(unsigned char));
-      break;
-    case 2: data_set->Data[i] = calloc(data_set->nrows,sizeof(short));
-      break;
-    case 3: data_set->Data[i] = calloc(data_set->nrows,sizeof(unsigned short));
-      break;
-    case 4: data_set->Data[i] = calloc(data_set->nrows,sizeof(int));
-      break;
-    case 5: data_set->Data[i] = calloc(data_set->nrows,sizeof(unsigned int));
-      break;
-    case 6: data_set->Data[i] = calloc(data_set->nrows,sizeof(float));
-      break;
-    case 7: data_set->Data[i] = calloc(data_set->nrows,sizeof(double));
-      break;
-    case 8: data_set->Data[i] = calloc(data_set->nrows,sizeof(ASTRING));
-      break;
-    case 9: data_set->Data[i] = calloc(data_set->nrows,sizeof(AWSTRING));
-      break;
-    }
-    
-  }
   return 1;
 }
 
@@ -766,6 +785,8 @@ int read_generic_data_set(generic_data_set *data_set, FILE *instream){
 int read_generic_data_set_rows(generic_data_set *data_set, FILE *instream){
 
   int i,j;
+
+  allocate_generic_data_set_rows(data_set);
   
   for (i=0; i < (int)data_set->nrows; i++){
     for (j=0; j < (int)data_set->ncols; j++){
@@ -990,6 +1011,8 @@ int gzread_generic_data_set(generic_data_set *data_set, gzFile instream){
 
   int i;
 
+  initialize_generic_data_set(data_set);
+
   if (!gzread_be_uint32(&(data_set->file_pos_first),1,instream) ||
       !gzread_be_uint32(&(data_set->file_pos_last),1,instream) ||
       !gzread_AWSTRING(&(data_set->data_set_name), instream) ||
@@ -1022,33 +1045,6 @@ int gzread_generic_data_set(generic_data_set *data_set, gzFile instream){
     return 0;
   }
 
-  data_set->Data = (void **)calloc(data_set->ncols, sizeof(void *));
-
-  for (i=0; i < data_set->ncols; i++){
-    switch(data_set->col_name_type_value[i].type){
-    case 0: data_set->Data[i] = calloc(data_set->nrows, sizeof(char));
-      break;
-    case 1: data_set->Data[i] = calloc(data_set->nrows, sizeof(unsigned char));
-      break;
-    case 2: data_set->Data[i] = calloc(data_set->nrows, sizeof(short));
-      break;
-    case 3: data_set->Data[i] = calloc(data_set->nrows, sizeof(unsigned short));
-      break;
-    case 4: data_set->Data[i] = calloc(data_set->nrows, sizeof(int));
-      break;
-    case 5: data_set->Data[i] = calloc(data_set->nrows, sizeof(unsigned int));
-      break;
-    case 6: data_set->Data[i] = calloc(data_set->nrows, sizeof(float));
-      break;
-    case 7: data_set->Data[i] = calloc(data_set->nrows, sizeof(double));
-      break;
-    case 8: data_set->Data[i] = calloc(data_set->nrows, sizeof(ASTRING));
-      break;
-    case 9: data_set->Data[i] = calloc(data_set->nrows, sizeof(AWSTRING));
-      break;
-    }
-    
-  }
   return 1;
 }
 
@@ -1058,6 +1054,8 @@ int gzread_generic_data_set(generic_data_set *data_set, gzFile instream){
 int gzread_generic_data_set_rows(generic_data_set *data_set, gzFile instream){
 
   int i,j;
+
+  allocate_generic_data_set_rows(data_set);
   
   for (i=0; i < data_set->nrows; i++){
     for (j=0; j < data_set->ncols; j++){
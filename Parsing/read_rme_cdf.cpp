@@ -26,6 +26,11 @@
  **
  ** History
  ** Dec 15, 2007 - Transfer relevant code from out of DataGroup.cpp
+ ** Oct 17, 2026 - Read each probeset's locations into reused buffers, which
+ **                CDFLocMapTree::Insert() copies
+ ** Oct 17, 2026 - Version 4, whose locations and names are memory mapped and used
+ **                where they lie rather than parsed
+ ** Oct 17, 2026 - Check that the version 4 locations are all cells of the array
  **
  **
  *****************************************************/
@@ -38,10 +43,188 @@
 #include <wx/tokenzr.h>
 #include <wx/datstrm.h>
 
+#include <vector>
+
+#if !defined(_WIN32) || defined(__CYGWIN32__) || defined(__CYGWIN__)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define RME_CDF_HAVE_MMAP 1
+#endif
+
 #include "../CDFLocMapTree.h"
 #include "read_rme_cdf.h"
 
 
+/* The blocks of a version 4 file, mapped or read into memory, 
+   kept for as long as the CDFLocMapTree uses them */
+
+typedef struct{
+  void *map;
+  size_t map_length;
+  char *buffer;
+} RME_CDF_Blocks;
+
+
+static void release_rme_cdf_blocks(void *storage){
+
+  RME_CDF_Blocks *blocks = (RME_CDF_Blocks *)storage;
+
+#if defined(RME_CDF_HAVE_MMAP)
+  if (blocks->map != NULL){
+    munmap(blocks->map, blocks->map_length);
+  }
+#endif
+  delete [] blocks->buffer;
+  delete blocks;
+}
+
+
+/* Checks that offsets (n+1 of them) go from 0 to total without going back */
+
+static bool rme_cdf_offsets_ok(const wxUint32 *offsets, int n, wxUint32 total){
+
+  int i;
+
+  if (offsets[0] != 0 || offsets[n] != total){
+    return false;
+  }
+  for (i = 0; i < n; i++){
+    if (offsets[i] > offsets[i+1]){
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/* Checks that each of the count cell indices lies on an array_rows by array_cols array */
+
+static bool rme_cdf_locations_ok(const int *locations, wxUint32 count, int array_rows, int array_cols){
+
+  wxUint32 k;
+  size_t n_cells;
+
+  if (array_rows < 0 || array_cols < 0){
+    return false;
+  }
+  n_cells = (size_t)array_rows*(size_t)array_cols;
+  for (k = 0; k < count; k++){
+    if (locations[k] < 0 || (size_t)locations[k] >= n_cells){
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/************************************************
+ **
+ ** static void ReadRMECDFBlocks(const wxString cdf_path, wxFFileInputStream &input,
+ **                              wxDataInputStream &store, CDFLocMapTree *cdflocs,
+ **                              RME_CDF_Header *header)
+ **
+ ** Reads the rest of a version 4 file, from after the number
+ ** of probesets. The blocks of locations and names (see 
+ ** DataGroup::WriteBinaryCDF() for the layout) are mapped 
+ ** into memory where possible, or otherwise read in whole, 
+ ** and attached to cdflocs as they are. Only the names are
+ ** made into wxStrings. Every PM and MM location is checked
+ ** to be a cell of the array, since they index the intensities
+ ** unchecked from then on.
+ **
+ ************************************************/
+
+static void ReadRMECDFBlocks(const wxString cdf_path, wxFFileInputStream &input, wxDataInputStream &store,
+			     CDFLocMapTree *cdflocs, RME_CDF_Header *header){
+
+  int i;
+  int n = header->n_probesets;
+  wxUint32 n_pm = store.Read32();
+  wxUint32 n_mm = store.Read32();
+  wxUint32 name_bytes = store.Read32();
+  wxUint32 data_offset = store.Read32();
+  size_t offsets_length = ((size_t)n + 1)*sizeof(wxUint32);
+  size_t length = 3*offsets_length + ((size_t)n_pm + (size_t)n_mm)*sizeof(wxUint32) + name_bytes;
+  const char *base = NULL;
+  RME_CDF_Blocks *blocks;
+  wxString Error = _T("Problem with RME (CDF format). Not correct file format or otherwise malformed?");
+
+  if (n < 0 || data_offset % sizeof(wxUint32) != 0 || input.Eof() ||
+      (input.GetLength() != wxInvalidOffset && (wxFileOffset)data_offset + (wxFileOffset)length > input.GetLength())){
+    throw Error;
+  }
+
+  blocks = new RME_CDF_Blocks;
+  blocks->map = NULL;
+  blocks->map_length = 0;
+  blocks->buffer = NULL;
+
+#if defined(RME_CDF_HAVE_MMAP) && !defined(WORDS_BIGENDIAN)
+  int fd = open(cdf_path.fn_str(), O_RDONLY);
+  if (fd >= 0){
+    struct stat file_info;
+    
+    if (fstat(fd, &file_info) == 0 && (off_t)data_offset + (off_t)length <= file_info.st_size){
+      void *map = mmap(0, (size_t)data_offset + length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED){
+	blocks->map = map;
+	blocks->map_length = (size_t)data_offset + length;
+	base = (const char *)map + data_offset;
+      }
+    }
+    close(fd);
+  }
+#endif
+
+  if (base == NULL){
+    /* read it in instead */
+    blocks->buffer = new char[length];
+    if (input.SeekI(data_offset) == wxInvalidOffset || input.Read(blocks->buffer, length).LastRead() != length){
+      release_rme_cdf_blocks(blocks);
+      throw Error;
+    }
+#if defined(WORDS_BIGENDIAN)
+    wxUint32 *values = (wxUint32 *)blocks->buffer;
+    for (size_t k = 0; k < (length - name_bytes)/sizeof(wxUint32); k++){
+      values[k] = wxUINT32_SWAP_ALWAYS(values[k]);
+    }
+#endif
+    base = blocks->buffer;
+  }
+
+  const wxUint32 *PM_start = (const wxUint32 *)base;
+  const wxUint32 *MM_start = PM_start + n + 1;
+  const wxUint32 *name_start = MM_start + n + 1;
+  const int *PMLoc = (const int *)(name_start + n + 1);
+  const int *MMLoc = PMLoc + n_pm;
+  const char *names = (const char *)(MMLoc + n_mm);
+  
+  if (!rme_cdf_offsets_ok(PM_start, n, n_pm) || !rme_cdf_offsets_ok(MM_start, n, n_mm) || !rme_cdf_offsets_ok(name_start, n, name_bytes)){
+    release_rme_cdf_blocks(blocks);
+    throw Error;
+  }
+  if (!rme_cdf_locations_ok(PMLoc, n_pm, header->array_rows, header->array_cols) || !rme_cdf_locations_ok(MMLoc, n_mm, header->array_rows, header->array_cols)){
+    release_rme_cdf_blocks(blocks);
+    throw Error;
+  }
+
+  header->probeset_names.Alloc(n);
+  for (i = 0; i < n; i++){
+    if (name_start[i+1] == name_start[i] || names[name_start[i+1] - 1] != 0){
+      release_rme_cdf_blocks(blocks);
+      throw Error;
+    }
+    header->probeset_names.Add(wxString(names + name_start[i], wxConvUTF8));
+  }
+  header->n_probes = (int)n_pm;
+
+  cdflocs->Attach(header->probeset_names, (const int *)PM_start, (const int *)MM_start, PMLoc, MMLoc, blocks, release_rme_cdf_blocks);
+}
+
+
 void ReadRMECDF(const wxString cdf_path,
 		CDFLocMapTree *cdflocs,
 		RME_CDF_Header *header){
@@ -52,8 +235,7 @@ void ReadRMECDF(const wxString cdf_path,
   int current_n_probes_pm;
   int current_n_probes_mm;
   
-  int *PMLoc, *MMLoc;
-  LocMapItem *currentitem;
+  std::vector<int> PMLoc, MMLoc;
 
   
   wxFFileInputStream input(cdf_path);
@@ -66,7 +248,7 @@ void ReadRMECDF(const wxString cdf_path,
   
   filetype = store.ReadString();
   
-  /* Version 1 and 2 start with CDF. Version 3 starts with RMECDF */
+  /* Version 1 and 2 start with CDF. Version 3 and 4 start with RMECDF */
 
   if (filetype.Cmp(_T("CDF"))!=0 && (filetype.Cmp(_T("RMECDF")) != 0)){
     Error=_T("Problem with RME (CDF format). Not correct file format or otherwise malformed?");
@@ -81,7 +263,7 @@ void ReadRMECDF(const wxString cdf_path,
     header->array_rows = store.Read32();
     header->array_cols = store.Read32();
     header->n_probesets = store.Read32();
-  } else if (versionnumber == 3){
+  } else if (versionnumber == 3 || versionnumber == 4){
     int n_ArrayTypes = store.Read32();
     for (i =0; i < n_ArrayTypes; i++){
       header->ArrayTypeName.Add(store.ReadString());
@@ -93,8 +275,16 @@ void ReadRMECDF(const wxString cdf_path,
     header->array_rows = store.Read32();
     header->array_cols = store.Read32();
     header->n_probesets = store.Read32();
+  } else {
+    Error=_T("Problem with RME (CDF format). Version is later than this program can read.");
+    throw Error;
   }
   header->n_probes = 0;
+  if (versionnumber == 4){
+    ReadRMECDFBlocks(cdf_path, input, store, cdflocs, header);
+    return;
+  }
+  cdflocs->Reserve(header->n_probesets, 0);
   if (versionnumber == 1){
     header->probeset_names.Alloc(header->n_probesets);
     for (i =0; i < header->n_probesets; i++){
@@ -103,8 +293,8 @@ void ReadRMECDF(const wxString cdf_path,
       current_n_probes = store.Read32(); // number of probe pairs
       header->n_probes+= current_n_probes;
       
-      PMLoc = new int[current_n_probes];
-      MMLoc = new int[current_n_probes];
+      PMLoc.resize(current_n_probes);
+      MMLoc.resize(current_n_probes);
       
       for (j = 0; j < current_n_probes; j++){
 		PMLoc[j] = store.Read32();
@@ -113,8 +303,7 @@ void ReadRMECDF(const wxString cdf_path,
 		MMLoc[j] = store.Read32();
       }
       
-      currentitem = new LocMapItem(current_probeset_name,current_n_probes,current_n_probes,PMLoc,MMLoc); 
-      cdflocs->Insert(currentitem);
+      cdflocs->Insert(current_probeset_name,current_n_probes,current_n_probes,(current_n_probes > 0) ? &PMLoc[0] : NULL,(current_n_probes > 0) ? &MMLoc[0] : NULL);
     }
   } else if (versionnumber ==2){
     header->probeset_names.Alloc(header->n_probesets);
@@ -126,24 +315,19 @@ void ReadRMECDF(const wxString cdf_path,
       header->n_probes+= current_n_probes_pm;
       //    wxPrintf(_T("%s %d\n"),current_probeset_name.c_str(),current_n_probes_pm); 
       if (current_n_probes_pm > 0){
-		PMLoc = new int[current_n_probes_pm];
+		PMLoc.resize(current_n_probes_pm);
 		for (j = 0; j < current_n_probes_pm; j++){
 			PMLoc[j] = store.Read32();
 		}
-      } else {
-		PMLoc = NULL;
-	  }
+      }
       current_n_probes_mm = store.Read32();
       if (current_n_probes_mm > 0){
-		MMLoc = new int[current_n_probes_mm];
+		MMLoc.resize(current_n_probes_mm);
 		for (j = 0; j < current_n_probes_mm; j++){
 			MMLoc[j] = store.Read32();
 		}
-      } else {
-		MMLoc = NULL;
       }
-      currentitem = new LocMapItem(current_probeset_name,current_n_probes_pm,current_n_probes_mm,PMLoc,MMLoc); 
-      cdflocs->Insert(currentitem);
+      cdflocs->Insert(current_probeset_name,current_n_probes_pm,current_n_probes_mm,(current_n_probes_pm > 0) ? &PMLoc[0] : NULL,(current_n_probes_mm > 0) ? &MMLoc[0] : NULL);
     }
   } else if (versionnumber ==3){
 	header->probeset_names.Alloc(header->n_probesets);
@@ -155,24 +339,19 @@ void ReadRMECDF(const wxString cdf_path,
       header->n_probes+= current_n_probes_pm;
       //    wxPrintf(_T("%s %d\n"),current_probeset_name.c_str(),current_n_probes_pm); 
       if (current_n_probes_pm > 0){
-		PMLoc = new int[current_n_probes_pm];
+		PMLoc.resize(current_n_probes_pm);
 		for (j = 0; j < current_n_probes_pm; j++){
 			PMLoc[j] = store.Read32();
 		}
-      } else {
-		PMLoc = NULL;
       }
       current_n_probes_mm = store.Read32();
       if (current_n_probes_mm > 0){
-		MMLoc = new int[current_n_probes_mm];
+		MMLoc.resize(current_n_probes_mm);
 		for (j = 0; j < current_n_probes_mm; j++){
 			MMLoc[j] = store.Read32();
 		}
-      } else {
-		MMLoc = NULL;
       }
-      currentitem = new LocMapItem(current_probeset_name,current_n_probes_pm,current_n_probes_mm,PMLoc,MMLoc); 
-      cdflocs->Insert(currentitem);
+      cdflocs->Insert(current_probeset_name,current_n_probes_pm,current_n_probes_mm,(current_n_probes_pm > 0) ? &PMLoc[0] : NULL,(current_n_probes_mm > 0) ? &MMLoc[0] : NULL);
     }
   }
 }
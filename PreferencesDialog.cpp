@@ -36,6 +36,14 @@
  **               and a test to see if a small file can be written there.
  ** Sept 16, 2006 - fix compile problems with unicode builds of wxWidgets
  ** Feb 5, 2008 - allow minimum of 1 array in Buffer.
+ ** Oct 17, 2026 - Temporary storage mode (per array files or a memory mapped file)
+ ** Oct 17, 2026 - Add tiled single file temporary storage choice
+ ** Oct 17, 2026 - Add single precision temporary storage option
+ ** Oct 17, 2026 - Add compressed per array files temporary storage choice (zlib builds only)
+ ** Oct 17, 2026 - Option to choose the buffer sizes automatically from the available memory
+ ** Oct 17, 2026 - Number of gzipped CEL files to decompress ahead (no dialog control)
+ ** Oct 17, 2026 - Directory to keep preprocessed arrays in (no dialog control)
+ ** Oct 17, 2026 - Directory to keep compiled CDF files in (no dialog control)
  **
  *****************************************************/
 
@@ -46,6 +54,9 @@
 #include <wx/filename.h>
 #include <wx/file.h>
 #include <wx/utils.h>
+#include <wx/choice.h>
+#include <wx/checkbox.h>
+#include "Storage/BufferedMatrix.h"
 
 #define ID_ARRAYSBUFFERED 10101
 #define ID_PROBESBUFFERED 10102
@@ -53,6 +64,9 @@
 #define ID_NAME 10104
 #define ID_NAME_VAL 10105
 #define ID_CHOOSEDIR 10106
+#define ID_STORAGEMODE 10107
+#define ID_SINGLEPRECISION 10108
+#define ID_AUTOBUFSIZE 10109
 
 #if _WIN32
 static wxString fullname =_T("");
@@ -81,6 +95,11 @@ PreferencesDialog::PreferencesDialog(wxWindow *parent,
   wxBoxSizer *item0 = new wxBoxSizer( wxVERTICAL ); 
   
 
+  wxCheckBox *item7 = new wxCheckBox(this, ID_AUTOBUFSIZE, _T("Choose buffer sizes automatically from available memory"));
+  item7->SetValue(false);
+
+  AutoBufSizeCheck = item7;
+
   wxBoxSizer *item1 = new wxBoxSizer(wxHORIZONTAL);
   wxStaticText *item1a = new wxStaticText(this, ID_NAME, wxString(_T("Arrays in Buffer:")), wxDefaultPosition, wxDefaultSize,wxALIGN_CENTER| wxALIGN_CENTER_VERTICAL);
   wxSlider *item1b = new wxSlider(this, ID_ARRAYSBUFFERED, 40 , 1, 150,wxDefaultPosition, wxSize(210,25)); //,wxALIGN_CENTER| wxALIGN_CENTER_VERTICAL);
@@ -121,14 +140,37 @@ PreferencesDialog::PreferencesDialog(wxWindow *parent,
   
   tempfilepath = item3b;
 
+  wxBoxSizer *item5 = new wxBoxSizer(wxHORIZONTAL);
+  wxStaticText *item5a = new wxStaticText(this, ID_NAME, wxString(_T("Temporary Storage:")), wxDefaultPosition, wxDefaultSize,wxALIGN_CENTER| wxALIGN_CENTER_VERTICAL);
+  wxChoice *item5b = new wxChoice(this, ID_STORAGEMODE, wxDefaultPosition, wxDefaultSize);
+  item5b->Append(_T("One file per array"));       // BUFFEREDMATRIX_STORAGE_FILES
+  item5b->Append(_T("Single memory mapped file")); // BUFFEREDMATRIX_STORAGE_MMAP
+  item5b->Append(_T("Single tiled file"));         // BUFFEREDMATRIX_STORAGE_TILED
+#if defined(HAVE_ZLIB)
+  item5b->Append(_T("Compressed file per array")); // BUFFEREDMATRIX_STORAGE_COMPRESSED
+#endif
+  item5b->SetSelection(BUFFEREDMATRIX_STORAGE_FILES);
+  item5->Add(item5a, 1, wxALIGN_LEFT | wxALIGN_CENTER_VERTICAL, 5 );
+  item5->Add(item5b, 2, wxALIGN_LEFT | wxALIGN_CENTER_VERTICAL, 5 );
+
+  StorageChoice = item5b;
+
+  wxCheckBox *item6 = new wxCheckBox(this, ID_SINGLEPRECISION, _T("Store temporary data in single precision (half the disk space)"));
+  item6->SetValue(false);
+
+  SinglePrecisionCheck = item6;
+
   wxButton *item4 = new wxButton(this, wxID_OK, wxT("OK"), wxDefaultPosition, wxDefaultSize, 0 );
 
   //  wxStaticText * item5 = new wxStaticText(this, ID_NAME, wxString("Blah"), wxDefaultPosition, wxDefaultSize);
   //  wxString *item5 = new wxString("Blah"); 
 
+  item0->Add( item7, 0, wxALIGN_CENTER|wxALL, 5 );
   item0->Add( item1, 1, wxALIGN_CENTER|wxALL, 5 );
   item0->Add( item2, 1, wxALIGN_CENTER|wxALL, 5 );
   item0->Add( item3, 1, wxALIGN_CENTER|wxALL, 5 );
+  item0->Add( item5, 1, wxALIGN_CENTER|wxALL, 5 );
+  item0->Add( item6, 0, wxALIGN_CENTER|wxALL, 5 );
   item0->Add( item4, 0, wxALIGN_CENTER|wxALL, 5 );
   this->SetAutoLayout( TRUE );
   this->SetSizer( item0 );
@@ -206,6 +248,7 @@ BEGIN_EVENT_TABLE(PreferencesDialog, wxDialog)
   EVT_BUTTON(ID_CHOOSEDIR,PreferencesDialog::OnChooseDir)
   EVT_COMMAND_SCROLL(ID_ARRAYSBUFFERED, PreferencesDialog::MovedArraysSlider)
   EVT_COMMAND_SCROLL(ID_PROBESBUFFERED, PreferencesDialog::MovedProbesSlider)
+  EVT_CHECKBOX(ID_AUTOBUFSIZE, PreferencesDialog::ToggledAutoBufSize)
 END_EVENT_TABLE()
 
   void PreferencesDialog::MovedArraysSlider(wxScrollEvent &event){ // wxUpdateUIEvent &event){
@@ -227,6 +270,16 @@ void PreferencesDialog::MovedProbesSlider(wxScrollEvent &event){ // wxUpdateUIEv
 }
 
 
+/* the sliders are only used when the sizes are not chosen automatically */
+
+void PreferencesDialog::ToggledAutoBufSize(wxCommandEvent &event){
+
+  ArraysSlider->Enable(!AutoBufSizeCheck->GetValue());
+  ProbesSlider->Enable(!AutoBufSizeCheck->GetValue());
+
+}
+
+
 int PreferencesDialog::GetArraysBufSize(){
   
   return ArraysSlider->GetValue();
@@ -248,6 +301,27 @@ wxString PreferencesDialog::GetTempFileLoc(){
 
 }
 
+
+int PreferencesDialog::GetStorageMode(){
+
+  return StorageChoice->GetSelection();
+
+}
+
+
+bool PreferencesDialog::GetSinglePrecisionStorage(){
+
+  return SinglePrecisionCheck->GetValue();
+
+}
+
+
+bool PreferencesDialog::GetAutoBufSize(){
+
+  return AutoBufSizeCheck->GetValue();
+
+}
+
 void PreferencesDialog::SetPreferences(Preferences *mypref){
   
   wxString curval,curval2;
@@ -260,6 +334,18 @@ void PreferencesDialog::SetPreferences(Preferences *mypref){
   ArraysSliderMsg->SetLabel(curval2);
   
   tempfilepath->SetValue( mypref->GetFilePath());
+
+  if (mypref->GetStorageMode() < (int)StorageChoice->GetCount()){
+    StorageChoice->SetSelection(mypref->GetStorageMode());
+  } else {
+    /* eg compressed storage saved by a build with zlib */
+    StorageChoice->SetSelection(BUFFEREDMATRIX_STORAGE_FILES);
+  }
+  SinglePrecisionCheck->SetValue(mypref->GetSinglePrecisionStorage());
+
+  AutoBufSizeCheck->SetValue(mypref->GetAutoBufSize());
+  ArraysSlider->Enable(!mypref->GetAutoBufSize());
+  ProbesSlider->Enable(!mypref->GetAutoBufSize());
   
 }
 
@@ -274,6 +360,12 @@ void PreferencesDialog::SetPreferences(Preferences *mypref){
 
 Preferences::Preferences(){
 
+  this->StorageMode = BUFFEREDMATRIX_STORAGE_FILES;
+  this->SinglePrecisionStorage = false;
+  this->AutoBufSize = false;
+  this->InflateDepth = 2;
+  this->PreprocessedCachePath = wxEmptyString;
+  this->AnnotationCachePath = wxEmptyString;
 
 }
 
@@ -283,7 +375,12 @@ Preferences::Preferences(int ProbesBufSize, int ArraysBufSize, wxString filepath
   this->filepath = filepath;
   this->ArraysBufSize = ArraysBufSize;
   this->ProbesBufSize = ProbesBufSize;
-
+  this->StorageMode = BUFFEREDMATRIX_STORAGE_FILES;
+  this->SinglePrecisionStorage = false;
+  this->AutoBufSize = false;
+  this->InflateDepth = 2;
+  this->PreprocessedCachePath = wxEmptyString;
+  this->AnnotationCachePath = wxEmptyString;
 
 }
 
@@ -310,6 +407,57 @@ void Preferences::SetProbesBufSize(int value){
 
 }
 
+int Preferences::GetStorageMode(){
+  return StorageMode;
+}
+
+
+
+void Preferences::SetStorageMode(int value){
+  StorageMode = value;
+
+}
+
+bool Preferences::GetSinglePrecisionStorage(){
+  return SinglePrecisionStorage;
+}
+
+void Preferences::SetSinglePrecisionStorage(bool value){
+  SinglePrecisionStorage = value;
+}
+
+bool Preferences::GetAutoBufSize(){
+  return AutoBufSize;
+}
+
+void Preferences::SetAutoBufSize(bool value){
+  AutoBufSize = value;
+}
+
+int Preferences::GetInflateDepth(){
+  return InflateDepth;
+}
+
+void Preferences::SetInflateDepth(int value){
+  InflateDepth = value;
+}
+
+wxString &Preferences::GetPreprocessedCachePath(){
+  return PreprocessedCachePath;
+}
+
+void Preferences::SetPreprocessedCachePath(wxString value){
+  PreprocessedCachePath = value;
+}
+
+wxString &Preferences::GetAnnotationCachePath(){
+  return AnnotationCachePath;
+}
+
+void Preferences::SetAnnotationCachePath(wxString value){
+  AnnotationCachePath = value;
+}
+
 void Preferences::SetFilePath(wxString value){
   filepath = value;
 
@@ -18,6 +18,23 @@ class Preferences{
   int GetProbesBufSize();
   void SetProbesBufSize(int value);
 
+  int GetStorageMode();
+  void SetStorageMode(int value);
+
+  bool GetSinglePrecisionStorage();
+  void SetSinglePrecisionStorage(bool value);
+
+  bool GetAutoBufSize();
+  void SetAutoBufSize(bool value);
+
+  int GetInflateDepth();
+  void SetInflateDepth(int value);
+
+  wxString &GetPreprocessedCachePath();
+  void SetPreprocessedCachePath(wxString value);
+
+  wxString &GetAnnotationCachePath();
+  void SetAnnotationCachePath(wxString value);
 
   void SetFilePath(wxString value);
   wxString &GetFilePath();
@@ -29,6 +46,12 @@ class Preferences{
   wxString filepath;
   int ArraysBufSize;  // ie number of columns 
   int ProbesBufSize;  // ie number of rows;
+  int StorageMode;    // one of the BUFFEREDMATRIX_STORAGE_ values
+  bool SinglePrecisionStorage; // store temporary data as float rather than double
+  bool AutoBufSize;   // choose buffer sizes from the available RAM rather than the two above
+  int InflateDepth;   // gzipped CEL files decompressed ahead of being parsed
+  wxString PreprocessedCachePath; // where preprocessed arrays are kept between runs, empty for nowhere
+  wxString AnnotationCachePath;   // where CDF files are kept compiled between runs, empty for nowhere
 };
 
 #if RMA_GUI_APP
@@ -46,6 +69,9 @@ class PreferencesDialog: public wxDialog
   int GetArraysBufSize();
   int GetProbesBufSize();
   wxString GetTempFileLoc();
+  int GetStorageMode();
+  bool GetSinglePrecisionStorage();
+  bool GetAutoBufSize();
   void SetPreferences(Preferences *mypref);
 
   
@@ -54,6 +80,7 @@ class PreferencesDialog: public wxDialog
   void OnChooseDir(wxCommandEvent &event );
   void MovedArraysSlider(wxScrollEvent &event); //wxUpdateUIEvent &event);
   void MovedProbesSlider(wxScrollEvent &event); //xUpdateUIEvent &event);
+  void ToggledAutoBufSize(wxCommandEvent &event);
 
 
   wxSlider *ArraysSlider;
@@ -61,6 +88,9 @@ class PreferencesDialog: public wxDialog
   wxSlider *ProbesSlider;
   wxStaticText *ProbesSliderMsg;
   wxTextCtrl *tempfilepath;
+  wxChoice *StorageChoice;
+  wxCheckBox *SinglePrecisionCheck;
+  wxCheckBox *AutoBufSizeCheck;
   
 
 
@@ -40,6 +40,8 @@
  ** Apr 21, 2003 - Changes to get it to work with RMAExpress
  ** Mar 24, 2005 - BufferedMatrix support
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
+ ** Oct 17, 2026 - When the probeset occupies adjacent rows, read and write them 
+ **                with single GetRowSpan/SetRowSpan calls
  **
  ************************************************************************/
 
@@ -284,12 +286,28 @@ void median_polish(double *data, int rows, int cols, int *cur_rows, double *resu
   double *r = (double *)calloc(nprobes,sizeof(double));
   double *c = (double *)calloc(cols,sizeof(double));
   double *z = (double *)calloc(nprobes*cols,sizeof(double));
+#ifdef BUFFERED
+  int contiguous = (nprobes > 0);
+
+  for (i =1; i < nprobes && contiguous; i++){
+    contiguous = (cur_rows[i] == cur_rows[0] + i);
+  }
 
+  if (contiguous){
+    data->GetRowSpan(cur_rows[0], nprobes, z);
+    for (i =0; i < nprobes*cols; i++){
+      z[i] = log(z[i])/log(2.0);
+    }
+  } else {
+#endif
   for (j = 0; j < cols; j++){
     for (i =0; i < nprobes; i++){
       z[j*nprobes + i] = log((*data)(cur_rows[i],j))/log(2.0);  
     }
   } 
+#ifdef BUFFERED
+  }
+#endif
   
   
   for (iter = 1; iter <= maxiter; iter++){
@@ -319,11 +337,19 @@ void median_polish(double *data, int rows, int cols, int *cur_rows, double *resu
     results[j] =  t + c[j]; 
   }
    
+#ifdef BUFFERED
+  if (contiguous){
+    data->SetRowSpan(cur_rows[0], nprobes, z);
+  } else {
+#endif
   for (j = 0; j < cols; j++){
     for (i =0; i < nprobes; i++){
       (*data)(cur_rows[i],j) = z[j*nprobes + i];  
     }
   } 
+#ifdef BUFFERED
+  }
+#endif
   
   free(rdelta);
   free(cdelta);
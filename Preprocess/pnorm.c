@@ -153,9 +153,9 @@ void pnorm_both(double x, double *cum, double *ccum, int i_tail, int log_p){
     static double eps = 1.11e-16;
 
 
-    /* Local variables */
-    static int i,lower,upper;
-    static double y, del, xsq, xden, xnum, temp;
+    /* Local variables (not static, background adjustment calls this from several threads) */
+    int i,lower,upper;
+    double y, del, xsq, xden, xnum, temp;
     lower = i_tail != 1;
     upper = i_tail != 0;
     
@@ -59,6 +59,13 @@
  **               sorting to STL::sort style sorting
  **               Also remove older !low_mem code
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
+ ** Oct 17, 2026 - BufferedMatrix version reads whole columns at a time and 
+ **                assigns back through a pinned column
+ ** Oct 17, 2026 - BufferedMatrix version works on several columns at once in 
+ **                separate threads
+ ** Oct 17, 2026 - qnorm_sort_copy() and qnorm_add_sorted() so that the normalizing 
+ **                distribution can be built up one array at a time as the arrays are
+ **                read, and qnorm_c_target() to normalize to it
  **
  ***********************************************************/
 
@@ -167,6 +174,122 @@ void get_ranks(double *rank, itemVect x,int n){
 
 
 
+/*********************************************************
+ **
+ ** void qnorm_sort_copy(const double *column, double *sorted, int rows)
+ **
+ ** puts a sorted copy of the rows values in column into sorted
+ **
+ ** void qnorm_add_sorted(double *row_mean, const double *sorted, int rows, int cols)
+ **
+ ** adds one of cols arrays, sorted by qnorm_sort_copy(), into the 
+ ** normalizing distribution row_mean (which starts as zeros). Adding 
+ ** the arrays in the same order always gives the same row_mean.
+ **
+ ********************************************************/
+
+void qnorm_sort_copy(const double *column, double *sorted, int rows){
+
+  copy(column, column + rows, sorted);
+  sort(sorted, sorted + rows);
+}
+
+
+void qnorm_add_sorted(double *row_mean, const double *sorted, int rows, int cols){
+  
+  int i;
+
+  for (i =0; i < rows; i++){
+    row_mean[i] += sorted[i]/((double)cols);
+  }
+}
+
+
+
+#ifdef BUFFERED
+
+/* State shared by the column workers (see RunColumnWorkers()) */
+
+typedef struct{
+  BufferedMatrix *data;
+  int rows;
+  int first;             /* first column of the current batch */
+  double *sorted;        /* sorted copies of the columns in the batch, column first-j at (j - first)*rows */
+  const double *row_mean;
+} qnorm_work;
+
+
+/* sort a copy of column j into its place in the batch */
+
+static void qnorm_sort_column(int j, void *arg){
+  qnorm_work *work = (qnorm_work *)arg;
+  double *dest = &work->sorted[(size_t)(j - work->first)*work->rows];
+  double *column = work->data->PinColumn(j);
+
+  copy(column, column + work->rows, dest);
+  work->data->UnpinColumn(j);
+  sort(dest, dest + work->rows);
+}
+
+
+/* replace column j by the normalizing distribution, in the same rank order */
+
+static void qnorm_assign_column(int j, void *arg){
+  qnorm_work *work = (qnorm_work *)arg;
+  const double *row_mean = work->row_mean;
+  int rows = work->rows;
+  int i,ind;
+  vector<double> ranks(rows);
+  itemVect iv(rows);
+  double *column = work->data->PinColumn(j);
+
+  for (i =0; i < rows; i++){  
+    iv[i].data = column[i];
+    iv[i].rank = i;
+  }
+  sort(iv.begin(), iv.end(), itemComp);
+    
+  get_ranks(&ranks[0],iv,rows);
+  for (i =0; i < rows; i++){
+    ind = iv[i].rank;
+    if (ranks[i] - floor(ranks[i]) > 0.4){
+      column[ind] = 0.5*(row_mean[(int)floor(ranks[i])-1] + row_mean[(int)floor(ranks[i])]);
+    } else { 
+      column[ind] = row_mean[(int)floor(ranks[i])-1];
+    }
+  }
+  work->data->UnpinColumn(j);
+}
+
+
+/* the second half of quantile normalization, replace each column by row_mean 
+   in the same rank order. Progress is shown from progress_start */
+
+#if RMA_GUI_APP
+static void qnorm_assign_target(BufferedMatrix *data, int rows, int cols, const double *row_mean, wxProgressDialog *NormalizeProgress, int progress_start){
+#else
+static void qnorm_assign_target(BufferedMatrix *data, int rows, int cols, const double *row_mean){
+#endif
+  int j;
+  int nthreads = data->ColumnWorkers();
+  int batch;
+  qnorm_work work;
+
+  work.data = data;
+  work.rows = rows;
+  work.sorted = 0;
+  work.row_mean = row_mean;
+     
+  for (j = 0; j < cols; j += nthreads){
+    batch = min(nthreads, cols - j);
+    RunColumnWorkers(j, batch, nthreads, qnorm_assign_column, &work);
+#if RMA_GUI_APP
+    NormalizeProgress->Update(progress_start + j + batch);
+#endif
+  }
+}
+
+
 /*********************************************************
  **
  ** void qnorm_c(double *data, int *rows, int *cols)
@@ -177,19 +300,18 @@ void get_ranks(double *rank, itemVect x,int n){
  ** returns 1 if there is a problem, 0 otherwise
  **
  ********************************************************/
-#ifdef BUFFERED
 #if RMA_GUI_APP
 int qnorm_c(BufferedMatrix *data, int *rows, int *cols, int *lowmem, wxProgressDialog *NormalizeProgress){
 #else
   int qnorm_c(BufferedMatrix *data, int *rows, int *cols, int *lowmem){
 #endif
-	int i,j,ind;
+	int j,k;
+	int nthreads = data->ColumnWorkers();
+	int batch;
+	qnorm_work work;
   
   vector<double> row_mean(*rows);
-  vector<double> ranks(*rows);
-  DoubleArray datvec;
-  itemVect iv;
-  dataitem di;
+  DoubleArray sorted((size_t)nthreads*(*rows));
 
  
 #if RMA_GUI_APP
@@ -205,54 +327,73 @@ int qnorm_c(BufferedMatrix *data, int *rows, int *cols, int *lowmem, wxProgressD
    
 	memset(&row_mean[0], 0, *rows*sizeof(double));
 
+	work.data = data;
+	work.rows = *rows;
+	work.sorted = &sorted[0];
+	work.row_mean = &row_mean[0];
     
-    /* first find the normalizing distribution */
-    for (j = 0; j < *cols; j++){
-      datvec.reserve(*rows);
-      for (i =0; i < *rows; i++){
-		datvec.push_back((*data)(i,j));
-      }
-      sort(datvec.begin(), datvec.end());
-
-      for (i =0; i < *rows; i++){
-		row_mean[i] += datvec[i]/((double)*cols);
+    /* first find the normalizing distribution. Columns are sorted nthreads at a
+       time in parallel, then added into row_mean in column order, so the result does 
+       not depend on the number of threads */
+    for (j = 0; j < *cols; j += nthreads){
+      batch = min(nthreads, *cols - j);
+      work.first = j;
+      RunColumnWorkers(j, batch, nthreads, qnorm_sort_column, &work);
+
+      for (k = 0; k < batch; k++){
+	qnorm_add_sorted(&row_mean[0], &sorted[(size_t)k*(*rows)], *rows, *cols);
       }
-      datvec.clear();
 #if RMA_GUI_APP
-      NormalizeProgress->Update(j);
+      NormalizeProgress->Update(j + batch);
 #endif
     }
     
     /* now assign back distribution */
      
-    for (j = 0; j < *cols; j++){
-      iv.reserve(*rows);
-      for (i =0; i < *rows; i++){  
-		di.data = (*data)(i,j);
-		di.rank = i;
-		iv.push_back(di);
-      }
-      sort(iv.begin(), iv.end(), itemComp);
-    
-      get_ranks(&ranks[0],iv,*rows);
-      for (i =0; i < *rows; i++){
-		ind = iv[i].rank;
-		if (ranks[i] - floor(ranks[i]) > 0.4){
-			(*data)(ind,j) = 0.5*(row_mean[(int)floor(ranks[i])-1] + row_mean[(int)floor(ranks[i])]);
-		} else { 
-			(*data)(ind,j) = row_mean[(int)floor(ranks[i])-1];
-		}
-      }
-      iv.clear();
 #if RMA_GUI_APP
-  NormalizeProgress->Update(*cols+j);
+    qnorm_assign_target(data, *rows, *cols, &row_mean[0], NormalizeProgress, *cols);
+#else
+    qnorm_assign_target(data, *rows, *cols, &row_mean[0]);
 #endif
-    }
     
     return 0;
 
 }
 
+
+/*********************************************************
+ **
+ ** int qnorm_c_target(BufferedMatrix *data, int *rows, int *cols, const double *row_mean)
+ **
+ ** as qnorm_c(), but the normalizing distribution row_mean has 
+ ** already been found (with qnorm_sort_copy() and qnorm_add_sorted() 
+ ** as the arrays were read), so only the second pass over the 
+ ** data is needed.
+ **
+ ** returns 1 if there is a problem, 0 otherwise
+ **
+ ********************************************************/
+
+#if RMA_GUI_APP
+int qnorm_c_target(BufferedMatrix *data, int *rows, int *cols, const double *row_mean, wxProgressDialog *NormalizeProgress){
+#else
+int qnorm_c_target(BufferedMatrix *data, int *rows, int *cols, const double *row_mean){
+#endif
+
+#if RMA_GUI_APP
+  NormalizeProgress->SetTitle(_T("Normalizing"));
+  NormalizeProgress->SetRange(*cols + 1);
+  NormalizeProgress->Update(0, _T("Normalizing"));
+  NormalizeProgress->Show(true);
+  NormalizeProgress->Update(1);
+  qnorm_assign_target(data, *rows, *cols, row_mean, NormalizeProgress, 1);
+#else
+  qnorm_assign_target(data, *rows, *cols, row_mean);
+#endif
+
+  return 0;
+}
+
 #else
 
 int qnorm_c(double *data, int *rows, int *cols, int *lowmem){
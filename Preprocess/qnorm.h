@@ -1,12 +1,17 @@
 #ifndef QNORM_H
 #define QNORM_H 1
 
+void qnorm_sort_copy(const double *column, double *sorted, int rows);
+void qnorm_add_sorted(double *row_mean, const double *sorted, int rows, int cols);
+
 #ifdef BUFFERED
 #include "../Storage/BufferedMatrix.h"
 #if RMA_GUI_APP
 int qnorm_c(BufferedMatrix *data, int *rows, int *cols, int *lowmem, wxProgressDialog *NormalizeProgress);
+int qnorm_c_target(BufferedMatrix *data, int *rows, int *cols, const double *row_mean, wxProgressDialog *NormalizeProgress);
 #else
 int qnorm_c(BufferedMatrix *data, int *rows, int *cols, int *lowmem);
+int qnorm_c_target(BufferedMatrix *data, int *rows, int *cols, const double *row_mean);
 #endif
 #else
 int qnorm_c(double *data, int *rows, int *cols, int *lowmem);
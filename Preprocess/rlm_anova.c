@@ -19,6 +19,8 @@
  ** Jan 25, 2007 - adapt code from affyPLM to work with RMAExpress
  ** Jan 28, 2007 - add PLM_summarize which wraps rlm_anova 
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
+ ** Oct 17, 2026 - PLM_summarize reads and writes adjacent probeset rows with 
+ **                GetRowSpan/SetRowSpan
  **
  *********************************************************************/
 
@@ -892,12 +894,24 @@ void PLM_summarize(BufferedMatrix *data, int rows, int cols, int *cur_rows, doub
 
   double residSE;
 
+  int contiguous = (nprobes > 0);
 
-  for (j = 0; j < cols; j++){
-    for (i =0; i < nprobes; i++){
-      z[j*nprobes + i] = log((*data)(cur_rows[i],j))/log(2.0);  
+  for (i =1; i < nprobes && contiguous; i++){
+    contiguous = (cur_rows[i] == cur_rows[0] + i);
+  }
+
+  if (contiguous){
+    data->GetRowSpan(cur_rows[0], nprobes, z);
+    for (i =0; i < nprobes*cols; i++){
+      z[i] = log(z[i])/log(2.0);
     }
-  } 
+  } else {
+    for (j = 0; j < cols; j++){
+      for (i =0; i < nprobes; i++){
+	z[j*nprobes + i] = log((*data)(cur_rows[i],j))/log(2.0);  
+      }
+    } 
+  }
   
 
   rlm_fit_anova(z, nprobes, cols, beta, resids, weights,&psi_huber, 1.345,20, 0);
@@ -911,9 +925,13 @@ void PLM_summarize(BufferedMatrix *data, int rows, int cols, int *cur_rows, doub
 
 
 
-  for (j = 0; j < cols; j++){
-    for (i =0; i < nprobes; i++){
-      (*data)(cur_rows[i],j) = resids[j*nprobes + i];  
+  if (contiguous){
+    data->SetRowSpan(cur_rows[0], nprobes, resids);
+  } else {
+    for (j = 0; j < cols; j++){
+      for (i =0; i < nprobes; i++){
+	(*data)(cur_rows[i],j) = resids[j*nprobes + i];  
+      }
     }
   }
   
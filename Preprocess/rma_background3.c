@@ -51,6 +51,9 @@
  ** Mar 24, 2005 - Add Support for BufferedMatrix
  ** Feb 6, 2008 - max find_max use an STL based sort operation
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
+ ** Oct 17, 2026 - BufferedMatrix versions work on a pinned column rather than 
+ **                going through operator() for every value. This also makes them
+ **                safe to run on different columns from several threads at once
  **
  *****************************************************/
 
@@ -145,14 +148,15 @@ double get_sd(BufferedMatrix *MM, double MMmax, int rows, int cols, int column){
   double tmpsum = 0.0;
   int numtop=0;
   int i;
- 
+  double *x = MM->PinColumn(column);
  
   for (i=0; i < rows; i++){
-    if ((*MM)(i,column) < MMmax){
-      tmpsum = tmpsum + ((*MM)(i,column) - MMmax)*((*MM)(i,column) - MMmax);
+    if (x[i] < MMmax){
+      tmpsum = tmpsum + (x[i] - MMmax)*(x[i] - MMmax);
       numtop++;
     }
   }
+  MM->UnpinColumn(column);
   sigma = sqrt(tmpsum/(numtop -1))*sqrt(2.0)/0.85;
   return sigma;
    
@@ -200,13 +204,15 @@ double get_alpha(BufferedMatrix *PM,double PMmax, int rows,int cols,int column){
   double tmpsum = 0.0;
   int numtop=0;
   int i;
+  double *x = PM->PinColumn(column);
  
   for (i=0; i < rows; i++){
-    if ((*PM)(i,column) > PMmax){
-      tmpsum = tmpsum + ((*PM)(i,column) - PMmax);
+    if (x[i] > PMmax){
+      tmpsum = tmpsum + (x[i] - PMmax);
       numtop++;
     }
   }
+  PM->UnpinColumn(column);
   alpha = numtop/tmpsum;
   return alpha ;
    
@@ -255,8 +261,10 @@ double max_density2(BufferedMatrix *z,int rows,int cols,int column){
   vector<double> dens_y(npts);
 
   double max_y,max_x;
+  double *zcolumn = z->PinColumn(column);
    
-  z->GetFullColumn(column, &x[0]);
+  copy(zcolumn, zcolumn + rows, x.begin());
+  z->UnpinColumn(column);
   
   KernelDensity_lowmem(&x[0],&rows,&dens_y[0],&dens_x[0],&npts);
 
@@ -416,11 +424,13 @@ double phi(double x){
 
   int i;
   double a;
+  double *x = PM->PinColumn(column);
    
   for (i=0; i < rows; i++){
-    a = (*PM)(i,column) - param[1] - param[0]*param[2]*param[2];
-    (*PM)(i,column) = a + param[2] * phi(a/param[2])/Phi(a/param[2]);
+    a = x[i] - param[1] - param[0]*param[2]*param[2];
+    x[i] = a + param[2] * phi(a/param[2])/Phi(a/param[2]);
   }
+  PM->UnpinColumn(column);
  }
 #else
 void bg_adjust(double *PM,double *MM, double *param, int rows, int cols, int column){
@@ -487,11 +497,14 @@ void bg_parameters2(BufferedMatrix *PM,BufferedMatrix *MM, double *param, int ro
   vector<double> tmp_less(rows); 
   vector<double> tmp_more(rows); 
   double tmp;
+  double *x;
 
   PMmax = max_density2(PM,rows, cols, column);
 
+  x = PM->PinColumn(column);
+
   for (i=0; i < rows; i++){
-    tmp = (*PM)(i,column);
+    tmp = x[i];
     if (tmp < PMmax){ 
       tmp_less[n_less] = tmp; 
       n_less++;
@@ -503,12 +516,14 @@ void bg_parameters2(BufferedMatrix *PM,BufferedMatrix *MM, double *param, int ro
   sd = get_sd(PM,PMmax,rows,cols,column)*0.85;
  
   for (i=0; i < rows; i++){
-    tmp = (*PM)(i,column);
+    tmp = x[i];
     if  (tmp > PMmax){
       tmp_more[n_more] = tmp;
       n_more++;
     }
   }
+
+  PM->UnpinColumn(column);
  
   /* the 0.85 is to fix up constant in above */
   alpha = get_alpha2(&tmp_more[0],PMmax,n_more);
@@ -51,6 +51,7 @@
  ** Feb 8, 2008   - Add PS ability to PGF/CLF functionality
  ** Mar 17, 2008  - Add MPS ability to PGF/CLF functionality
  ** Jun 26, 2008  - Add About Dialog box
+ ** Oct 17, 2026  - Option to write memory mapped (version 4) RME CDF files
  **
  *****************************************************/
 
@@ -63,6 +64,7 @@
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
 #include <wx/aboutdlg.h>
+#include <wx/checkbox.h>
 
 #include "RMADataConv.h"
 
@@ -150,6 +152,12 @@ RMADataConvDlg::RMADataConvDlg(const wxString& title, const wxPoint& pos, const
   cdfControls->Add( item13, 0, wxGROW|wxALIGN_CENTER_VERTICAL|wxALL, 5 );
   
 
+  /* Write the CDF in the memory mapped (version 4) format */
+  wxCheckBox *item16 = new wxCheckBox( this, ID_TEXT, wxT("Write memory mappable CDF (version 4)"), wxDefaultPosition, wxDefaultSize, 0 );
+  MappedCDFBox = item16;
+  cdfControls->Add( item16, 0, wxGROW|wxALIGN_CENTER_VERTICAL|wxALL, 5 );
+  
+
   /* PGF File */
   wxBoxSizer *item25 = new wxBoxSizer( wxHORIZONTAL );
   wxStaticText *item26 = new wxStaticText( this, ID_TEXT, wxT("PGF File"), wxDefaultPosition, wxSize(125,-1), 0 );
@@ -590,6 +598,7 @@ void RMADataConvDlg::OnConvert(wxCommandEvent& WXUNUSED(event)){
       // Now see if restrict and Force exist at all (NOTE these are optional)
       wxString restrictFile = RestrictFile->GetValue();
       wxString forceName = ForceBox->GetValue();
+      int cdf_version = MappedCDFBox->GetValue() ? 4 : 3;
       
       
       if (!restrictFile.IsEmpty()){
@@ -639,9 +648,9 @@ void RMADataConvDlg::OnConvert(wxCommandEvent& WXUNUSED(event)){
 	  }
 	  
 	  if (restrictFile.IsEmpty()){
-	    mydata.WriteBinaryCDF(outputlocation);
+	    mydata.WriteBinaryCDF(outputlocation, cdf_version);
 	  } else {
-	    mydata.WriteBinaryCDF(outputlocation, restrictFile, restrict_names);
+	    mydata.WriteBinaryCDF(outputlocation, restrictFile, restrict_names, cdf_version);
 	  }
 	} else if (CdfLocation.IsEmpty() & !CelLocation.IsEmpty()){
 	  // Only CEL information
@@ -681,9 +690,9 @@ void RMADataConvDlg::OnConvert(wxCommandEvent& WXUNUSED(event)){
 	  }
 	  
 	  if (restrictFile.IsEmpty()){
-	    mydata.WriteBinaryCDF(outputlocation);
+	    mydata.WriteBinaryCDF(outputlocation, cdf_version);
 	  } else {
-	    mydata.WriteBinaryCDF(outputlocation,restrictFile, restrict_names);
+	    mydata.WriteBinaryCDF(outputlocation,restrictFile, restrict_names, cdf_version);
 	  }
 	  mydata.WriteBinaryCEL(outputlocation);
 
@@ -85,6 +85,7 @@ class RMADataConvDlg : public wxDialog
   wxTextCtrl *RestrictFile;
   wxTextCtrl *OutputDirectory;
   wxTextCtrl *ForceBox;  
+  wxCheckBox *MappedCDFBox;
   wxTextCtrl *PGFFile;
   wxTextCtrl *CLFFile;
   wxTextCtrl *PSFile;
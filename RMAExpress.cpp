@@ -84,6 +84,10 @@
  ** Jan 8, 2008 - Rename Processed File Menu options more clearly 
  ** Feb 5, 2008 - Allow a minimum of 1 array in Buffer (Previous minimum was 5) 
  ** June 26, 2008 - modify about dialog box
+ ** Oct 17, 2026 - Temporary storage mode added to stored preferences
+ ** Oct 17, 2026 - Single precision temporary storage added to stored preferences
+ ** Oct 17, 2026 - Automatic buffer sizes added to stored preferences (on unless turned off)
+ ** Oct 17, 2026 - Number of gzipped CEL files decompressed ahead added to stored preferences
  ** 
  *****************************************************/
 
@@ -319,6 +323,10 @@ bool RMAExpress::OnInit()
 
   int xpos,ypos,width,height;
   int buffer_narrays=1,buffer_nprobes=10000;
+  int buffer_storagemode=0;
+  bool buffer_singleprecision=false;
+  bool buffer_auto=true;
+  int buffer_inflatedepth=2;
 
   wxString buffer_temppath;
 
@@ -391,6 +399,22 @@ bool RMAExpress::OnInit()
     mysettings->Read(wxT("temporaryfiles.location"),&buffer_temppath);
   }
 
+  if (mysettings->Exists(wxT("temporaryfiles.storagemode"))){
+    mysettings->Read(wxT("temporaryfiles.storagemode"),&buffer_storagemode);
+  }
+
+  if (mysettings->Exists(wxT("temporaryfiles.singleprecision"))){
+    mysettings->Read(wxT("temporaryfiles.singleprecision"),&buffer_singleprecision);
+  }
+
+  if (mysettings->Exists(wxT("BufferSize.auto"))){
+    mysettings->Read(wxT("BufferSize.auto"),&buffer_auto);
+  }
+
+  if (mysettings->Exists(wxT("CELFiles.inflatedepth"))){
+    mysettings->Read(wxT("CELFiles.inflatedepth"),&buffer_inflatedepth);
+  }
+
 
 
   
@@ -399,7 +423,10 @@ bool RMAExpress::OnInit()
   frame->SetSettings(mysettings);
   
   frame->SetPreferences( buffer_narrays, buffer_nprobes,buffer_temppath);
-
+  frame->myprefs->SetStorageMode(buffer_storagemode);
+  frame->myprefs->SetSinglePrecisionStorage(buffer_singleprecision);
+  frame->myprefs->SetAutoBufSize(buffer_auto);
+  frame->myprefs->SetInflateDepth(buffer_inflatedepth);
   
   // The following code checks to make sure that the temporary directory exists
 
@@ -433,6 +460,9 @@ bool RMAExpress::OnInit()
     frame->myprefs->SetProbesBufSize(myPreferenceDialog.GetProbesBufSize());
     frame->myprefs->SetArrayBufSize(myPreferenceDialog.GetArraysBufSize());
     frame->myprefs->SetFilePath(myPreferenceDialog.GetTempFileLoc()); 
+    frame->myprefs->SetStorageMode(myPreferenceDialog.GetStorageMode());
+    frame->myprefs->SetSinglePrecisionStorage(myPreferenceDialog.GetSinglePrecisionStorage());
+    frame->myprefs->SetAutoBufSize(myPreferenceDialog.GetAutoBufSize());
     mysettings->Write(wxT("temporaryfiles.location"),myPreferenceDialog.GetTempFileLoc());
     mysettings->Flush();
   }
@@ -568,6 +598,10 @@ RMAExpressFrame::~RMAExpressFrame()
   mysettings->Write(wxT("BufferSize.n.arrays"),myprefs->GetArrayBufSize()); 
   mysettings->Write(wxT("BufferSize.n.probes"),myprefs->GetProbesBufSize());
   mysettings->Write(wxT("temporaryfiles.location"),myprefs->GetFilePath());
+  mysettings->Write(wxT("temporaryfiles.storagemode"),myprefs->GetStorageMode());
+  mysettings->Write(wxT("temporaryfiles.singleprecision"),myprefs->GetSinglePrecisionStorage());
+  mysettings->Write(wxT("BufferSize.auto"),myprefs->GetAutoBufSize());
+  mysettings->Write(wxT("CELFiles.inflatedepth"),myprefs->GetInflateDepth());
   mysettings->Flush();
   delete myprefs;
 }
@@ -1256,10 +1290,13 @@ void RMAExpressFrame::OnShowPreferencesDialog(wxCommandEvent & event){
     myprefs->SetArrayBufSize(myPreferenceDialog.GetArraysBufSize());
     myprefs->SetFilePath(myPreferenceDialog.GetTempFileLoc());
   }
+  myprefs->SetStorageMode(myPreferenceDialog.GetStorageMode());
+  myprefs->SetSinglePrecisionStorage(myPreferenceDialog.GetSinglePrecisionStorage());
+  myprefs->SetAutoBufSize(myPreferenceDialog.GetAutoBufSize());
 
 
 #ifdef _WIN32
-  if (myprefs->GetArrayBufSize() >1){
+  if (myprefs->GetArrayBufSize() >1 && !myprefs->GetAutoBufSize()){
 	  *Messages << _T("WARNING: Buffer setting is greater than 1 array. This is not recommended on Windows\n");
 	  *Messages << _T("Current Buffer settings are as follows\n");
 	  *Messages << _T("Arrays in Buffer:  ") << myprefs->GetArrayBufSize() << _T("\n");
@@ -1271,12 +1308,13 @@ void RMAExpressFrame::OnShowPreferencesDialog(wxCommandEvent & event){
 #ifdef DEBUG
   wxPrintf(_T("%d %d %s %s\n"), myprefs->GetProbesBufSize(),myprefs->GetArrayBufSize(),myprefs->GetFilePath().c_str(),myprefs->GetFullFilePath().c_str());
 #endif
-  if (myresids != NULL){
+  /* automatically sized buffers are left as they were chosen when the data was loaded */
+  if (myresids != NULL && !myprefs->GetAutoBufSize()){
     myresids->ResizeBuffer(myprefs->GetProbesBufSize(),myprefs->GetArrayBufSize());
 
   }
   
-  if (currentexperiment!= NULL){
+  if (currentexperiment!= NULL && !myprefs->GetAutoBufSize()){
     currentexperiment->ResizeBuffer(myprefs->GetProbesBufSize(),myprefs->GetArrayBufSize());
   }
 
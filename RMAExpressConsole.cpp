@@ -49,6 +49,22 @@
  ** Sep 16, 2006 - fix compile problems on unicode builds of wxWidgets
  ** Mar 6-9, 2007 - add PLM summarize and output NUSE/RLE summary statistics
  ** Feb 7, 2008 - Add version 4 output format file
+ ** Oct 17, 2026 - "storage_mmap" option line for memory mapped temporary storage
+ ** Oct 17, 2026 - "storage_tiled" option line for tiled temporary storage
+ ** Oct 17, 2026 - Report row buffer read-ahead hits and misses after summarization (DEBUG builds only)
+ ** Oct 17, 2026 - "storage_float" option line for single precision temporary storage
+ ** Oct 17, 2026 - "storage_compressed" option line for compressed temporary storage
+ ** Oct 17, 2026 - "buffer_auto" option line to size the buffers from the available memory.
+ **                This is also the default for settings files before version 4
+ ** Oct 17, 2026 - Only the PM probes of each CEL file are kept
+ ** Oct 17, 2026 - "inflate_depth N" option line, the number of gzipped CEL files
+ **                decompressed ahead of being parsed
+ ** Oct 17, 2026 - Background adjust each array, and add it into the quantile
+ **                normalization distribution, as it is read
+ ** Oct 17, 2026 - "preprocessed_cache DIRECTORY" option line, where the arrays are
+ **                kept after that to be read back on later runs
+ ** Oct 17, 2026 - "annotation_cache DIRECTORY" option line, where the CDF file is kept
+ **                compiled (memory mappable) for later runs
  **
  *****************************************************/
 
@@ -129,7 +145,7 @@ static void parseinput(const wxString &inputfile, wxString& cdfName, wxArrayStri
   wxPrintf(_T("\n\n"));
 }
 
-static int parseoutput(const wxString &inputfile, long int *version, wxString& outputname, wxString& temppath,int *normalize, int *background, wxString& typeofresiduals, int *outputtype, int *plm_summarize, long int *bufferrows, long int *buffercols){
+static int parseoutput(const wxString &inputfile, long int *version, wxString& outputname, wxString& temppath,int *normalize, int *background, wxString& typeofresiduals, int *outputtype, int *plm_summarize, long int *bufferrows, long int *buffercols, int *storagemode, bool *singleprecision, bool *autobuffer, long int *inflatedepth, wxString& preprocessedcache, wxString& annotationcache){
   
   wxTextFile InputFile;
   wxString buffer;
@@ -200,9 +216,11 @@ static int parseoutput(const wxString &inputfile, long int *version, wxString& o
       *buffercols = 150;
     }
   } else {
-    /* These were the default settings before version 4 */
+    /* These were the default settings before version 4, now only used
+       if the available memory can't be found out */
     *bufferrows = 25000;
     *buffercols = 30;
+    *autobuffer = true;
   }
   
   while (!InputFile.Eof())
@@ -214,6 +232,29 @@ static int parseoutput(const wxString &inputfile, long int *version, wxString& o
 	*normalize = 0;
       } else if (!buffer.Cmp(_T("plm_summarize"))){
 	*plm_summarize = 1;
+      } else if (!buffer.Cmp(_T("storage_mmap"))){
+	*storagemode = BUFFEREDMATRIX_STORAGE_MMAP;
+      } else if (!buffer.Cmp(_T("storage_tiled"))){
+	*storagemode = BUFFEREDMATRIX_STORAGE_TILED;
+      } else if (!buffer.Cmp(_T("storage_compressed"))){
+#if defined(HAVE_ZLIB)
+	*storagemode = BUFFEREDMATRIX_STORAGE_COMPRESSED;
+#else
+	wxPrintf(_T("WARNING: storage_compressed needs a build with zlib. Using one file per array.\n"));
+#endif
+      } else if (!buffer.Cmp(_T("storage_float"))){
+	*singleprecision = true;
+      } else if (!buffer.Cmp(_T("buffer_auto"))){
+	*autobuffer = true;
+      } else if (buffer.StartsWith(_T("inflate_depth "))){
+	if (!buffer.Mid(14).ToLong(inflatedepth) || *inflatedepth < 0){
+	  wxPrintf(_T("WARNING: ") + buffer + _T(" not understood. Decompressing 2 files ahead.\n"));
+	  *inflatedepth = 2;
+	}
+      } else if (buffer.StartsWith(_T("preprocessed_cache "))){
+	preprocessedcache = buffer.Mid(19).Strip(wxString::both);
+      } else if (buffer.StartsWith(_T("annotation_cache "))){
+	annotationcache = buffer.Mid(17).Strip(wxString::both);
       } else if (buffer.empty()){
 
       } else {
@@ -236,8 +277,33 @@ static int parseoutput(const wxString &inputfile, long int *version, wxString& o
   wxPrintf(_T("Temporary files stored in: %s\n"),temppath.c_str());
 
 
-  wxPrintf(_T("Buffer Settings (rows): %d\n"),  *bufferrows);
-  wxPrintf(_T("Buffer Settings (cols): %d\n"),  *buffercols);
+  if (*autobuffer){
+    wxPrintf(_T("Buffer Settings: chosen from available memory\n"));
+  } else {
+    wxPrintf(_T("Buffer Settings (rows): %d\n"),  *bufferrows);
+    wxPrintf(_T("Buffer Settings (cols): %d\n"),  *buffercols);
+  }
+  if (*storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    wxPrintf(_T("Temporary Storage: memory mapped file\n"));
+  } else if (*storagemode == BUFFEREDMATRIX_STORAGE_TILED){
+    wxPrintf(_T("Temporary Storage: tiled file\n"));
+  } else if (*storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    wxPrintf(_T("Temporary Storage: compressed file per array\n"));
+  } else {
+    wxPrintf(_T("Temporary Storage: one file per array\n"));
+  }
+  if (*singleprecision){
+    wxPrintf(_T("Temporary Storage Precision: single\n"));
+  }
+#if defined(HAVE_ZLIB)
+  wxPrintf(_T("Gzipped CEL files decompressed ahead: %ld\n"), *inflatedepth);
+#endif
+  if (!preprocessedcache.IsEmpty()){
+    wxPrintf(_T("Preprocessed arrays kept in: %s\n"),preprocessedcache.c_str());
+  }
+  if (!annotationcache.IsEmpty()){
+    wxPrintf(_T("Compiled CDF files kept in: %s\n"),annotationcache.c_str());
+  }
   
   wxPrintf(_T("Residual Images: %s\n"),typeofresiduals.c_str());
   wxPrintf(_T("Preprocessing Options\n"));
@@ -382,7 +448,12 @@ int not_main(int argc, char **argv)
 
   int background=1,normalize=1;
   int plm_summarize = 0;
-  wxString outputname,temppath;
+  int storagemode = BUFFEREDMATRIX_STORAGE_FILES;
+  bool singleprecision = false;
+  bool autobuffer = false;
+  long int inflatedepth = 2;
+  long prefetch_hits=0, prefetch_misses=0;
+  wxString outputname,temppath,preprocessedcache,annotationcache;
 
   wxString typeofresiduals;
 
@@ -422,7 +493,7 @@ int not_main(int argc, char **argv)
 
   // Parse output settings file
   if (wxFileExists(wxString(argv[2], wxConvUTF8))){
-    if (parseoutput(wxString(argv[2], wxConvUTF8),&OutputVersion,outputname,temppath,&normalize,&background,typeofresiduals,&outputtype,&plm_summarize, &bufferrows, &buffercols)){
+    if (parseoutput(wxString(argv[2], wxConvUTF8),&OutputVersion,outputname,temppath,&normalize,&background,typeofresiduals,&outputtype,&plm_summarize, &bufferrows, &buffercols, &storagemode, &singleprecision, &autobuffer, &inflatedepth, preprocessedcache, annotationcache)){
       return 1;
     }
   } else {
@@ -486,8 +557,18 @@ int not_main(int argc, char **argv)
 
 
 #endif
-
-    currentexperiment = new DataGroup(NULL,cdfFileName.GetFullName(),cdfFileName.GetFullPath(),celfileNames,celfilePaths,myprefs); 
+    myprefs->SetStorageMode(storagemode);
+    myprefs->SetSinglePrecisionStorage(singleprecision);
+    myprefs->SetAutoBufSize(autobuffer);
+    myprefs->SetInflateDepth((int)inflatedepth);
+    myprefs->SetPreprocessedCachePath(preprocessedcache);
+    myprefs->SetAnnotationCachePath(annotationcache);
+
+    /* nothing here looks at the raw data, so only PM probes need be kept, and 
+       the background adjustment (and finding the quantile normalization 
+       distribution) can be done to each array as it is read */
+    int stream_steps = (background ? DATAGROUP_STREAM_BACKGROUND : 0) | (normalize ? DATAGROUP_STREAM_QUANTILES : 0);
+    currentexperiment = new DataGroup(NULL,cdfFileName.GetFullName(),cdfFileName.GetFullPath(),celfileNames,celfilePaths,myprefs,true,stream_steps); 
     wxPrintf(_T("Computing Expression values\n")); 
     
     currentexperiment->ReadOnlyMode(true);
@@ -505,9 +586,11 @@ int not_main(int argc, char **argv)
     if (!plm_summarize){
       wxPrintf(_T("Summarizing\n"));
       myexprs = PMSet.summarize(); 
+      PMSet.GetPrefetchCounts(&prefetch_hits, &prefetch_misses);
     } else {
       wxPrintf(_T("Summarizing using PLM\n"));
       myexprs = PMSet.summarize_PLM(); 
+      PMSet.GetPrefetchCounts(&prefetch_hits, &prefetch_misses);
 
       
       QCStatsVisualizeFrame *frame = new QCStatsVisualizeFrame(myexprs);
@@ -523,6 +606,9 @@ int not_main(int argc, char **argv)
 
 
     }
+#ifdef DEBUG
+    wxPrintf(_T("Row buffer read-ahead: %ld hits, %ld misses\n"),prefetch_hits,prefetch_misses);
+#endif
 
     if (typeofresiduals.Cmp(_T("none")) != 0){ 
       wxPrintf(_T("Writing Images in ")+outputFileName.GetPath() + _T("\n")); 
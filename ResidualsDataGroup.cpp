@@ -30,6 +30,7 @@
  ** Mar 21, 2005 - change intensitydata to be a pointer. Added a ResizeBuffer method
  ** Sept 16, 2006 - Fix possible compile problems with Unicode wxWidget builds
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
+ ** Oct 17, 2026 - Probeset locations are taken by index from the CDFLocMapTree
  **
  *****************************************************************************/
 
@@ -56,10 +57,10 @@ ResidualsDataGroup::ResidualsDataGroup(PMProbeBatch *residuals, DataGroup *origi
   int i,j,k,l;
   wxArrayString ProbeNames;
   wxString CurrentName;
-  LocMapItem *CurrentLocMapItem;
+  int CurrentItem;
 
-  int *CurrentMMLocs;
-  int *CurrentPMLocs;
+  const int *CurrentMMLocs;
+  const int *CurrentPMLocs;
 
   array_rows = originaldata->nrows();
   array_cols = originaldata->ncols();
@@ -80,6 +81,8 @@ ResidualsDataGroup::ResidualsDataGroup(PMProbeBatch *residuals, DataGroup *origi
   const char *tmp_str = (const char*) tmp_buf;
   
   intensitydata = new BufferedMatrix(preferences->GetProbesBufSize(),preferences->GetArrayBufSize(),(char *)tmp_str);
+  intensitydata->SetStorageMode(preferences->GetStorageMode());
+  intensitydata->SetSinglePrecisionStorage(preferences->GetSinglePrecisionStorage());
 #else
   intensitydata = new Matrix();
 #endif
@@ -113,12 +116,12 @@ ResidualsDataGroup::ResidualsDataGroup(PMProbeBatch *residuals, DataGroup *origi
     
   
 
-    CurrentLocMapItem = cdflocs->Find(CurrentName);
+    CurrentItem = cdflocs->Find(CurrentName);
     
-    CurrentPMLocs = CurrentLocMapItem->GetPMLocs();
-    CurrentMMLocs = CurrentLocMapItem->GetMMLocs();
+    CurrentPMLocs = cdflocs->GetPMLocs(CurrentItem);
+    CurrentMMLocs = cdflocs->GetMMLocs(CurrentItem);
 
-    for (j =0; j < CurrentLocMapItem->GetSize(); j++){
+    for (j =0; j < cdflocs->GetPMSize(CurrentItem); j++){
       residuals->GetRow(buffer,i+j);
       for (k = 0; k <  n_arrays; k++){
 	(*intensitydata)[k*(array_rows*array_cols) + CurrentPMLocs[j]] = buffer[k];
@@ -128,7 +131,7 @@ ResidualsDataGroup::ResidualsDataGroup(PMProbeBatch *residuals, DataGroup *origi
       }
     } 
 
-    i = i+ CurrentLocMapItem->GetSize();
+    i = i+ cdflocs->GetPMSize(CurrentItem);
     if (i >= n_probes)
       done = true;
   }
@@ -140,27 +143,27 @@ ResidualsDataGroup::ResidualsDataGroup(PMProbeBatch *residuals, DataGroup *origi
   vector<int> PMLocations(n_probes);
   vector<int> MMLocations(n_probes);
   
+  // cdflocs holds the probesets in probeset_names order
   l=0;
   for (i=0; i < n_probesets; i++){
-    CurrentLocMapItem = cdflocs->Find(probeset_names[i]);
-    CurrentPMLocs = CurrentLocMapItem->GetPMLocs();
-    CurrentMMLocs = CurrentLocMapItem->GetMMLocs();
-    for (j =0; j < CurrentLocMapItem->GetPMSize(); j++){
+    CurrentPMLocs = cdflocs->GetPMLocs(i);
+    CurrentMMLocs = cdflocs->GetMMLocs(i);
+    for (j =0; j < cdflocs->GetPMSize(i); j++){
       PMLocations[l+j] =  CurrentPMLocs[j];
     }
     
 
-    if (CurrentLocMapItem->GetMMSize() == CurrentLocMapItem->GetPMSize()){
-      for (j =0; j < CurrentLocMapItem->GetMMSize(); j++){
+    if (cdflocs->GetMMSize(i) == cdflocs->GetPMSize(i)){
+      for (j =0; j < cdflocs->GetMMSize(i); j++){
 		MMLocations[l+j] =  CurrentMMLocs[j];
       }
     } else {
-      for (j =0; j < CurrentLocMapItem->GetPMSize(); j++){
+      for (j =0; j < cdflocs->GetPMSize(i); j++){
 		MMLocations[l+j] = -1;
       }
     }
 
-    l = l + CurrentLocMapItem->GetPMSize();
+    l = l + cdflocs->GetPMSize(i);
 
   }
 
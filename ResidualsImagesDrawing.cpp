@@ -45,6 +45,7 @@
  ** Jan 30, 2006 - Add additional functionality for only redrawing part of the image
  ** Sep 16, 2006 - fix compile problems on unicode builds of wxWidgets
  ** Feb 28, 2008 - BufferedMatrix indexing is now via() operator rather than []
+ ** Oct 17, 2026 - fetch the residuals a whole image row at a time (getImageRow)
  **
  ***************************************************************************/
 
@@ -53,6 +54,25 @@
 #include "ResidualsDataGroup.h"
 
 #include <wx/image.h>
+#include <vector>
+
+
+/* copies the ncols residuals in row i of the image for array whichchip into dest */
+
+#ifndef BUFFERED
+static void getImageRow(Matrix *thedata, int whichchip, int i, int ncols, double *dest){
+  int j;
+
+  for (j=0; j < ncols; j++){
+    dest[j] = (*thedata)[(unsigned long)whichchip*thedata->Rows() + i*ncols + j];
+  }
+}
+#else
+static void getImageRow(BufferedMatrix *thedata, int whichchip, int i, int ncols, double *dest){
+  thedata->GetColumnSpan(whichchip, i*ncols, ncols, dest);
+}
+#endif
+
 
 unsigned char getBlue(double x){
 
@@ -109,6 +129,7 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
   
   dc->DrawRectangle(19,19,resids->ncols()+2,resids->nrows()+2);
   thedata = resids->GetIntensities();
+  std::vector<double> rowvals(resids->ncols());
   
 
   whichchip = (resids->GetArrayNames()).Index(name);
@@ -117,11 +138,12 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
   
   if (type.Cmp(_T("Positive")) == 0){
     for (int i =0; i < resids->nrows(); i++){
+      getImageRow(thedata, whichchip, i, resids->ncols(), &rowvals[0]);
       for (int j=0; j < resids->ncols(); j++){  
-		if ((*thedata)(i*resids->ncols() + j,whichchip) > 0){         
-			red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-	  		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-	  		green =getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		if (rowvals[j] > 0){         
+			red = getRed(rowvals[j]);
+	  		blue = getBlue(rowvals[j]);
+	  		green =getGreen(rowvals[j]);
 		} else {
 	  		red = 255;
 	  		blue = 255;
@@ -133,11 +155,12 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
     }
   } else if (type.Cmp(_T("Negative")) ==0){
     for (int i =0; i < resids->nrows(); i++){
+      getImageRow(thedata, whichchip, i, resids->ncols(), &rowvals[0]);
       for (int j=0; j < resids->ncols(); j++){  
-		if ((*thedata)(i*resids->ncols() + j,whichchip) < 0){
-	  		red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-	  		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-	  		green = getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		if (rowvals[j] < 0){
+	  		red = getRed(rowvals[j]);
+	  		blue = getBlue(rowvals[j]);
+	  		green = getGreen(rowvals[j]);
 		} else {
 	  		red = 255;
 	  		blue = 255;
@@ -149,12 +172,13 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
     }	
   } else if (type.Cmp(_T("Sign")) ==0){
     for (int i =0; i < resids->nrows(); i++){
+      getImageRow(thedata, whichchip, i, resids->ncols(), &rowvals[0]);
       for (int j=0; j < resids->ncols(); j++){  
-		if ((*thedata)(i*resids->ncols() + j,whichchip) > 0){
+		if (rowvals[j] > 0){
 	  		red = 255;
 	  		blue = 0;
 	  		green = 0;
-		} else if ((*thedata)(i*resids->ncols() + j,whichchip) < 0) {
+		} else if (rowvals[j] < 0) {
 	  		red = 0;
 	  		blue = 255;
 	  		green = 0;
@@ -169,10 +193,11 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
     }
   } else {
     for (int i =0; i < resids->nrows(); i++){
+      getImageRow(thedata, whichchip, i, resids->ncols(), &rowvals[0]);
       for (int j=0; j < resids->ncols(); j++){  
-			red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-			blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-			green = getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+			red = getRed(rowvals[j]);
+			blue = getBlue(rowvals[j]);
+			green = getGreen(rowvals[j]);
 			dc->SetPen(wxPen(wxColor(red,green,blue) ,1,wxSOLID));
 			dc->DrawPoint(20+j,20+i);
       	}
@@ -207,6 +232,7 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
   dc->DrawRectangle(19,19,resids->ncols()+2,resids->nrows()+2);
 
   thedata = resids->GetIntensities();
+  std::vector<double> rowvals(resids->ncols());
   
 
   // Check which chip we are drawing residuals image for
@@ -241,33 +267,34 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
 
   // Note the flip for orientation purposes
   for (int i =(wherestartx); i < wherestopx; i++){
+    getImageRow(thedata, whichchip, i, resids->ncols(), &rowvals[0]);
     for (int j=(wherestarty); j < wherestopy; j++){  
       if (type.Cmp(_T("Positive")) == 0){
-		if ((*thedata)(i*resids->ncols() + j,whichchip) > 0){
-	  		red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-	  		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-	  		green =getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		if (rowvals[j] > 0){
+	  		red = getRed(rowvals[j]);
+	  		blue = getBlue(rowvals[j]);
+	  		green =getGreen(rowvals[j]);
 		} else {
 	  		red = 255;
 	  		blue = 255;
 	  		green = 255;
 		}
       } else if (type.Cmp(_T("Negative")) ==0){
-		if ((*thedata)(i*resids->ncols() + j,whichchip) < 0){
-	  		red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-	  		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-	  		green = getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		if (rowvals[j] < 0){
+	  		red = getRed(rowvals[j]);
+	  		blue = getBlue(rowvals[j]);
+	  		green = getGreen(rowvals[j]);
 		} else {
 	  		red = 255;
 	  		blue = 255;
 	  		green = 255;
 		}
       } else if (type.Cmp(_T("Sign")) ==0){
-		if ((*thedata)(i*resids->ncols() + j,whichchip) > 0){
+		if (rowvals[j] > 0){
 	  		red = 255;
 	  		blue = 0;
 	  		green = 0;
-		} else if ((*thedata)(i*resids->ncols() + j,whichchip) < 0){
+		} else if (rowvals[j] < 0){
 	  		red = 0;
 	  		blue = 255;
 	  		green = 0;
@@ -277,9 +304,9 @@ void drawPseudoChipImage(wxDC *dc,wxString name, wxString type, ResidualsDataGro
 	  		green = 255;
 		}
       } else {
-		red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-		green = getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		red = getRed(rowvals[j]);
+		blue = getBlue(rowvals[j]);
+		green = getGreen(rowvals[j]);
       }
       dc->SetPen(wxPen(wxColor(red,green,blue) ,1,wxSOLID));
       dc->DrawPoint(20+j,20+i);
@@ -331,6 +358,7 @@ void drawPseudoChipImage( wxImage *Image, wxString name, wxString type, Residual
   //  whichchip = whichchip*(resids->ncols()*resids->nrows());
 
   thedata = resids->GetIntensities();
+  std::vector<double> rowvals(resids->ncols());
 
   imagedata =  Image->GetData();
 
@@ -349,33 +377,34 @@ void drawPseudoChipImage( wxImage *Image, wxString name, wxString type, Residual
 
   // Note the flip for orientation purposes
   for (int i =0; i < resids->nrows(); i++){
+    getImageRow(thedata, whichchip, i, resids->ncols(), &rowvals[0]);
     for (int j=0; j < resids->ncols(); j++){  
       if (type.Cmp(_T("Positive")) == 0){
-		if ((*thedata)(i*resids->ncols() + j,whichchip) > 0){
-	  		red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-	  		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-	  		green =getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		if (rowvals[j] > 0){
+	  		red = getRed(rowvals[j]);
+	  		blue = getBlue(rowvals[j]);
+	  		green =getGreen(rowvals[j]);
 		} else {
 	  		red = 255;
 	  		blue = 255;
 	  		green = 255;
 		}
       } else if (type.Cmp(_T("Negative")) ==0){
-		if ((*thedata)(i*resids->ncols() + j,whichchip) < 0){
-	  			red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-	  			blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-	  			green = getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		if (rowvals[j] < 0){
+	  			red = getRed(rowvals[j]);
+	  			blue = getBlue(rowvals[j]);
+	  			green = getGreen(rowvals[j]);
 		} else {
 	  		red = 255;
 	  		blue = 255;
 	  		green = 255;
 		}
       } else if (type.Cmp(_T("Sign")) ==0){
-		if ((*thedata)(i*resids->ncols() + j,whichchip) > 0){
+		if (rowvals[j] > 0){
 	  		red = 255;
 	  		blue = 0;
 	  		green = 0;
-		} else if ((*thedata)(i*resids->ncols() + j,whichchip) < 0){
+		} else if (rowvals[j] < 0){
 	  		red = 0;
 	  		blue = 255;
 	  		green = 0;
@@ -385,9 +414,9 @@ void drawPseudoChipImage( wxImage *Image, wxString name, wxString type, Residual
 	  		green = 255;
 		}
       } else {
-		red = getRed((*thedata)(i*resids->ncols() + j,whichchip));
-		blue = getBlue((*thedata)(i*resids->ncols() + j,whichchip));
-		green = getGreen((*thedata)(i*resids->ncols() + j,whichchip));
+		red = getRed(rowvals[j]);
+		blue = getBlue(rowvals[j]);
+		green = getGreen(rowvals[j]);
       }
       //  dc->SetPen(wxPen(wxColor(red,green,blue) ,1,wxSOLID));
       //dc->DrawPoint(20+j,20+i);
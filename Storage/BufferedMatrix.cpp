@@ -43,6 +43,30 @@
  ** Jan 6, 2007 - add Commpute5Summary
  ** Feb 6, 2008 - Add GetFullColumn
  ** Feb 28, 2008 - minor fix to resize buffer. Revise operator()
+ ** Oct 17, 2026 - Add a memory mapped storage mode. The whole matrix is
+ **                kept in a single mapped temporary file rather than one file per column
+ ** Oct 17, 2026 - All file access now goes through a small set of storage primitives.
+ **                Add a tiled single file storage mode, so that loading the row buffer
+ **                is one read per tile rather than an open/seek/close per column
+ ** Oct 17, 2026 - Add optional row buffer read-ahead on a background thread
+ ** Oct 17, 2026 - Optional single precision (float) temporary storage
+ ** Oct 17, 2026 - Column buffer lookup is now a direct column to slot index and
+ **                the replacement policy is CLOCK rather than shifting FIFO. Fix 
+ **                overflow when growing the column buffer and ClearClash() when the
+ **                clashing column has been evicted
+ ** Oct 17, 2026 - Add bulk span accessors (GetColumnSpan, SetColumnSpan, GetRowSpan,
+ **                SetRowSpan) and pinned column views (PinColumn, UnpinColumn)
+ ** Oct 17, 2026 - Fix GetFullColumn in row mode, which was returning the column index
+ **                rather than the data
+ ** Oct 17, 2026 - PinColumn()/UnpinColumn() may be used from several threads at once.
+ **                Add ColumnWorkers() and RunColumnWorkers() for processing columns in parallel
+ ** Oct 17, 2026 - Add a compressed per column storage mode (zlib builds). Read-ahead now
+ **                also works in column mode. Row buffer placement no longer bounces 
+ **                between two tiles, and row spans move the row buffer at most once
+ ** Oct 17, 2026 - Add MemoryBudget() and ChooseBufferSize() for sizing the buffers
+ **                automatically from the available RAM
+ ** Oct 17, 2026 - Add PinnableColumns()
+ ** Oct 17, 2026 - Add RemoveLastColumn() and Cols()
  **
  *****************************************************/
 
@@ -64,8 +88,30 @@ using namespace std;
 #include <winbase.h>
 #endif
 
+#if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__) && defined(UNICODE)
+#include <windows.h>
+#endif
+
+#if !defined(_WIN32) || defined(__CYGWIN32__) || defined(__CYGWIN__)
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define BUFFEREDMATRIX_HAVE_MMAP 1
+#endif
+
+#include <wx/thread.h>
+
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
 #include "BufferedMatrix.h"
 
+/* values of prefetch_state */
+#define BUFFEREDMATRIX_PREFETCH_IDLE 0       /* nothing in prefetchdata */
+#define BUFFEREDMATRIX_PREFETCH_REQUESTED 1  /* thread is reading rows into prefetchdata (or a column into prefetchcol) */
+#define BUFFEREDMATRIX_PREFETCH_READY 2      /* prefetchdata holds rows prefetch_first onwards (or prefetchcol holds column prefetch_col) */
+
 #include "../rma_common.h"
 #include "../threestep_common.h"
 
@@ -183,6 +229,42 @@ int MyGetFileName(wchar_t const *temppath, wchar_t *templat)
  **              Remove oldest row data from buffer
  **              Add new column to end of column buffer
  **
+ **            Which column is "oldest" is decided by a CLOCK policy
+ **            (see VictimSlot()) rather than strictly first in first out,
+ **            so columns that keep being used stay in the buffer. Whether a
+ **            column is in the buffer, and where, is a direct lookup in
+ **            col_slot.
+ **
+ **            Memory mapped storage (BUFFEREDMATRIX_STORAGE_MMAP)
+ **            
+ **            Instead of one file per column, the entire matrix is
+ **            stored (column major) in a single temporary file that
+ **            is mapped into memory. There are no row or column buffers
+ **            in this mode, every access goes straight to the mapping
+ **            and the operating system decides which pages stay in RAM
+ **            and which are written back to disk. Row mode, column mode
+ **            and buffer sizes are still accepted but have no real effect.
+ **            
+ **            Adding a column grows the file (doubling its capacity
+ **            when it is full) and remaps it. This mode is not available
+ **            on Windows, where the per column files are always used.
+ **            The storage mode must be set before any columns are added.
+ **
+ **            Tiled storage (BUFFEREDMATRIX_STORAGE_TILED)
+ **
+ **            Buffers work exactly as described above, but the
+ **            data on disk is in one file, kept open, and arranged
+ **            in tiles of rows (see the storage primitives below)
+ **            so that both row buffer and column buffer refills 
+ **            are a few large sequential reads.
+ **
+ **            Compressed storage (BUFFEREDMATRIX_STORAGE_COMPRESSED)
+ **
+ **            As for the default one file per column, but each file
+ **            holds the column as separately compressed chunks of rows.
+ **            Less data goes to and from disk at the cost of CPU time.
+ **            Only available when built with zlib (HAVE_ZLIB).
+ **
  *****************************************************/
 
 
@@ -203,6 +285,16 @@ BufferedMatrix::BufferedMatrix(int max_rows,int max_cols,const char *prefix){
   this->rowdata = 0;
   
   this->which_cols = 0;
+  this->col_slot = 0;
+  this->slot_ref = 0;
+  this->clock_hand = 0;
+  this->slot_pins = 0;
+  this->pinned = 0;
+#if wxUSE_THREADS
+  this->pin_lock = new wxMutex();
+#else
+  this->pin_lock = 0;
+#endif
 
   this->filenames = 0;
   
@@ -229,6 +321,39 @@ BufferedMatrix::BufferedMatrix(int max_rows,int max_cols,const char *prefix){
   this->colmode = true;
 
   this->readonly=false;
+
+  this->storagemode = BUFFEREDMATRIX_STORAGE_FILES;
+  this->mapdata = 0;
+  this->map_capacity = 0;
+  this->map_fd = -1;
+  this->mapfilename = 0;
+
+  this->singleprecision = false;
+  this->elementsize = sizeof(double);
+
+  this->tile_rows = 0;
+  this->tile_capacity = 0;
+  this->tilefile = 0;
+  this->tilefilename = 0;
+
+  this->chunk_offset = 0;
+  this->chunk_length = 0;
+  this->chunk_space = 0;
+  this->chunk_end = 0;
+
+  this->prefetch = false;
+  this->prefetcher = 0;
+  this->prefetchdata = 0;
+  this->prefetchcol = 0;
+  this->prefetch_first = 0;
+  this->prefetch_col = -1;
+  this->prefetch_previous = -1;
+  this->prefetch_state = BUFFEREDMATRIX_PREFETCH_IDLE;
+  this->prefetch_quit = false;
+  this->prefetch_lock = 0;
+  this->prefetch_cond = 0;
+  this->prefetch_hits = 0;
+  this->prefetch_misses = 0;
  
 }
 
@@ -274,127 +399,211 @@ void BufferedMatrix::SetPrefix(char *prefix){
 }
 
 
+/******************************************************
+ **
+ ** void BufferedMatrix::SetStorageMode(int mode)
+ **
+ ** int mode - one of BUFFEREDMATRIX_STORAGE_FILES,
+ **            BUFFEREDMATRIX_STORAGE_MMAP,
+ **            BUFFEREDMATRIX_STORAGE_TILED or
+ **            BUFFEREDMATRIX_STORAGE_COMPRESSED
+ **
+ ** Must be called before any columns are added. Where 
+ ** memory mapping (or zlib, for compression) is unavailable 
+ ** the per column files are used regardless.
+ **
+ ******************************************************/
 
+void BufferedMatrix::SetStorageMode(int mode){
 
+  if (cols > 0){
+    throw "Can't change storage mode after columns have been added\n";
+  }
 
+#ifdef BUFFEREDMATRIX_HAVE_MMAP
+  if (mode == BUFFEREDMATRIX_STORAGE_MMAP){
+    this->storagemode = BUFFEREDMATRIX_STORAGE_MMAP;
+    return;
+  }
+#endif
+  if (mode == BUFFEREDMATRIX_STORAGE_TILED){
+    this->storagemode = BUFFEREDMATRIX_STORAGE_TILED;
+    return;
+  }
+#if defined(HAVE_ZLIB)
+  if (mode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    this->storagemode = BUFFEREDMATRIX_STORAGE_COMPRESSED;
+    return;
+  }
+#endif
+  this->storagemode = BUFFEREDMATRIX_STORAGE_FILES;
 
+}
 
 
+int BufferedMatrix::GetStorageMode(){
 
+  return storagemode;
 
+}
 
 
+/******************************************************
+ **
+ ** void BufferedMatrix::SetTileRows(int tilerows)
+ **
+ ** int tilerows - number of rows in each tile of the
+ **                BUFFEREDMATRIX_STORAGE_TILED layout
+ **                (or each compressed chunk with 
+ **                BUFFEREDMATRIX_STORAGE_COMPRESSED). 
+ **                0 (the default) means use the number of 
+ **                rows in the row buffer (a quarter of that
+ **                for compressed chunks) at the time the
+ **                first column is added.
+ **
+ ** Must be called before any columns are added. 
+ **
+ ******************************************************/
 
+void BufferedMatrix::SetTileRows(int tilerows){
 
-void BufferedMatrix::AddColumn(){
-  FILE *myfile;
-  int j,i;
-  int which_col_num;
-  int fd;
+  if (cols > 0){
+    throw "Can't change tile size after columns have been added\n";
+  }
+  if (tilerows < 0){
+    throw "Can't have negative rows in a tile\n";
+  }
+  this->tile_rows = tilerows;
 
-  
-  /* Handle the housekeeping of indices, clearing buffer if needed etc */
-  if (cols < max_cols){
-    /* No need to clear out column buffer */
-    int *temp_indices = new int[cols +1];
-    int *temp_old_indices = which_cols;
-    double **temp_ptr = new double *[cols +1];
-    double **old_temp_ptr = coldata;
+}
 
-    for (j =0; j < cols; j++){
-      temp_indices[j] = which_cols[j];
-      temp_ptr[j] = coldata[j];
-    }
-    temp_indices[cols] =cols;
-    temp_ptr[cols] = new double[this->rows];
 
-    coldata = temp_ptr;
-    
-    for (i =0; i < this->rows; i++){
-      coldata[cols][i] = 0.0;  //(cols)*rows + i; 
-    }
-    which_col_num = cols;
-    which_cols = temp_indices;
-    delete [] temp_old_indices;
-    delete [] old_temp_ptr;
+int BufferedMatrix::GetTileRows(){
+  
+  return tile_rows;
 
-    if (!colmode){
-      /* Now handle the row buffer */
-      old_temp_ptr = rowdata;
-      temp_ptr = new double *[cols +1];
-      
-      for (j =0; j < cols; j++){
-	temp_ptr[j] = rowdata[j];
-      }
-      temp_ptr[cols] = new double[this->max_rows];
-      
-      for (i=0; i < max_rows; i++){
-	temp_ptr[cols][i] = 0.0;   // (cols)*rows + i; 
-      }
+}
 
 
-      rowdata = temp_ptr;
-      delete [] old_temp_ptr;
-    }
+/******************************************************
+ **
+ ** void BufferedMatrix::SetSinglePrecisionStorage(bool setting)
+ **
+ ** bool setting - if true values are stored in the temporary
+ **                file(s) as float rather than double. This 
+ **                halves the disk space and I/O. The RAM buffers
+ **                are still double, so values only lose precision
+ **                when they are written out of the buffers. Raw
+ **                CEL file intensities are floats to begin with
+ **                so are stored exactly.
+ **
+ ** Must be called before any columns are added. Has no effect 
+ ** with BUFFEREDMATRIX_STORAGE_MMAP, where the mapped data is 
+ ** used directly as double.
+ **
+ ******************************************************/
+
+void BufferedMatrix::SetSinglePrecisionStorage(bool setting){
 
+  if (cols > 0){
+    throw "Can't change storage precision after columns have been added\n";
+  }
+  this->singleprecision = setting;
+  if (setting){
+    this->elementsize = sizeof(float);
   } else {
-    /* Need to remove oldest column from buffer */
-    double **temp_ptr;
-    double *temp_col = coldata[0];
-    double **old_temp_ptr = rowdata;
- 
-    /* Before we deallocate, better empty the column buffer */
-    myfile = fopen(filenames[which_cols[0]],"rb+");
-    fwrite(&temp_col[0],sizeof(double),rows,myfile);
-    fclose(myfile); 
-    
-    for (j =1; j < max_cols; j++){
-      which_cols[j-1] = which_cols[j];
-      coldata[j-1] = coldata[j];
+    this->elementsize = sizeof(double);
+  }
+}
+
+
+bool BufferedMatrix::GetSinglePrecisionStorage(){
+
+  return singleprecision;
+
+}
+
+
+
+
+/******************************************************
+ **
+ ** void BufferedMatrix::AddMappedColumn()
+ **
+ ** AddColumn() for the memory mapped storage mode. 
+ ** The file is created on the first call. When it is
+ ** full its capacity is doubled and it is remapped.
+ ** Newly allocated space in the file is zero filled
+ ** by ftruncate().
+ **
+ ******************************************************/
+
+void BufferedMatrix::AddMappedColumn(){
+#ifdef BUFFEREDMATRIX_HAVE_MMAP
+  int new_capacity;
+  void *new_map;
+  size_t old_length, new_length;
+
+  if (map_fd < 0){
+    mapfilename = new char[strlen(fileprefix)+1];
+    strcpy(mapfilename,fileprefix);
+    map_fd = mkstemp(mapfilename);
+    if (map_fd < 0){
+      throw "Can't open/create temporary file.\n";
     }
-    which_cols[max_cols-1] = cols;
-    coldata[max_cols-1] = temp_col; //new double[this->rows];
-    for (i =0; i < this->rows; i++){
-      coldata[max_cols-1][i] = 0.0; // (cols)*rows +i;
+  }
+
+  if (cols == map_capacity){
+    if (map_capacity == 0){
+      new_capacity = (max_cols > 0) ? max_cols : 1;
+    } else {
+      new_capacity = 2*map_capacity;
     }
-   
-    
-    which_col_num = max_cols-1;
 
-   
-    
+    old_length = (size_t)map_capacity*rows*sizeof(double);
+    new_length = (size_t)new_capacity*rows*sizeof(double);
 
-    //delete [] temp_col;
-    if (!colmode){
-      old_temp_ptr = rowdata;
-      temp_ptr = new double *[cols +1];
-      
-      for (j =0; j < cols; j++){
-	temp_ptr[j] = rowdata[j];
+    if (new_length > 0){
+      if (ftruncate(map_fd, (off_t)new_length) != 0){
+	throw "Can't extend temporary file. Is there enough disk space?\n";
       }
-      temp_ptr[cols] = new double[this->max_rows];
       
-      for (i=0; i < max_rows; i++){
-	temp_ptr[cols][i] = 0.0;      //(cols)*rows + i;
+      if (mapdata != 0){
+	munmap(mapdata, old_length);
+	mapdata = 0;
       }
       
-      
-      rowdata = temp_ptr;
-      delete [] old_temp_ptr;
+      new_map = mmap(0, new_length, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+      if (new_map == MAP_FAILED){
+	throw "Can't memory map temporary file.\n";
+      }
+      mapdata = (double *)new_map;
     }
+    map_capacity = new_capacity;
+  }
 
+  this->cols++;
+#endif
+}
 
-  }
-  /* now do the file stuff */
 
-  char **temp_filenames = new char *[cols+1];
-  //  char *temp_name;
-  char **temp_names_ptr = filenames;
 
+/******************************************************
+ **
+ ** FILE *BufferedMatrix::CreateTempFile(char **name, const char *mode)
+ **
+ ** char **name - on return the (newly allocated) name of the file
+ ** const char *mode - mode to open the file with
+ **
+ ** Create and open a new temporary file using fileprefix
+ **
+ ******************************************************/
+
+FILE *BufferedMatrix::CreateTempFile(char **name, const char *mode){
+
+  FILE *myfile;
+  int fd;
 
-  for (j =0; j < cols; j++){
-    temp_filenames[j] = filenames[j];
-  }
 #if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__) && !defined(_UNICODE)
   char *tmp = new char[500];
 #elif defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__) && defined(_UNICODE)
@@ -421,111 +630,1008 @@ void BufferedMatrix::AddColumn(){
 #endif
 
 #if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__) && defined(_UNICODE)
-  temp_filenames[cols] = new char[wcslen(tmp)+1];
-  wcstombs (temp_filenames[cols], tmp, wcslen(tmp)+1);
-  //temp_filenames[cols] = strcpy(temp_filenawmes[cols],tmp);
+  *name = new char[wcslen(tmp)+1];
+  wcstombs (*name, tmp, wcslen(tmp)+1);
 #else
-  temp_filenames[cols] = new char[strlen(tmp)+1];
-  temp_filenames[cols] = strcpy(temp_filenames[cols],tmp);
+  *name = new char[strlen(tmp)+1];
+  *name = strcpy(*name,tmp);
 #endif
 
-  filenames = temp_filenames;
-
-  delete [] temp_names_ptr;
   delete [] tmp;
 
-
-  /* Finally lets write it all out to a file */
-
-  const char *mode = "wb";
-  //printf("%s\n", filenames[cols]);
+  //printf("%s\n", *name);
 #if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__)
-  myfile = fopen(temp_filenames[cols],mode);
+  myfile = fopen(*name,mode);
 #else
   myfile = fdopen(fd,mode);
 #endif
   if (!myfile){
     throw "Can't open/create temporary file.\n";
   }
-  fwrite(coldata[which_col_num],sizeof(double),  rows, myfile);
-  fclose(myfile);
-  this->cols++;
-  
+  return myfile;
 }
 
 
 
-BufferedMatrix::~BufferedMatrix(){
+/******************************************************
+ **
+ ** Storage primitives
+ **
+ ** Every transfer between the RAM buffers and the temporary
+ ** files goes through one of the following. They know how
+ ** the data is laid out on disk for the current storage mode.
+ **
+ ** BUFFEREDMATRIX_STORAGE_FILES: column j is in its own file
+ ** filenames[j]. Each file is opened and closed on every 
+ ** transfer. Reading a block of rows costs one open/seek/close
+ ** per column.
+ **
+ ** BUFFEREDMATRIX_STORAGE_TILED: a single file kept open for
+ ** the life of the matrix. The rows are divided into tiles of
+ ** tile_rows rows. Each tile holds those rows for every column,
+ ** column by column, with room for tile_capacity columns:
+ **
+ **     tile 0: col 0 rows 0..T-1, col 1 rows 0..T-1, .... 
+ **     tile 1: col 0 rows T..2T-1, col 1 rows T..2T-1, ....
+ **
+ ** so a block of rows is one contiguous read per tile and a
+ ** column is one contiguous read of tile_rows values per tile.
+ ** The last tile is padded out to a full tile_rows. When
+ ** tile_capacity is exhausted it is doubled and the tiles are 
+ ** spread out within the file.
+ **
+ ** BUFFEREDMATRIX_STORAGE_COMPRESSED: one file per column, as
+ ** for BUFFEREDMATRIX_STORAGE_FILES, but the rows are divided
+ ** into chunks of tile_rows rows and each chunk is compressed
+ ** on its own. The bytes of the values are shuffled (all the
+ ** first bytes, then all the second bytes, ...) which brings
+ ** together the exponent bytes, then deflated by zlib at its
+ ** fastest setting. A chunk that does not compress is stored as
+ ** it is. Since the compressed size of a chunk depends on what 
+ ** is in it, each chunk is given a little more room than it needs
+ ** (chunk_space). A rewritten chunk that no longer fits is appended 
+ ** to the file, and chunk_offset/chunk_length record where the 
+ ** current copy of each chunk is. Writing a whole column starts its
+ ** file again from the beginning. A file that has become mostly 
+ ** stale chunks is rewritten in the same way. Reading a block of rows
+ ** only decompresses the chunks that overlap it. Only available
+ ** when built with HAVE_ZLIB.
+ **
+ ** In any of these modes values may be stored as float rather than 
+ ** double (see SetSinglePrecisionStorage()). All offsets are
+ ** then in units of elementsize and values are converted as 
+ ** they are read and written.
+ **
+ ******************************************************/
+
+static int bm_fseek(FILE *myfile, bm_offset offset){
+#if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__)
+  return _fseeki64(myfile, offset, SEEK_SET);
+#else
+  return fseeko(myfile, offset, SEEK_SET);
+#endif
+}
+
+
+bm_offset BufferedMatrix::TileOffset(int row, int col){
   
-  int i;
-  int lastcol;
+  int tile = row/tile_rows;
   
-  if (cols < max_cols){
-    lastcol = cols;
+  return ((bm_offset)tile*tile_rows*tile_capacity + (bm_offset)col*tile_rows + row%tile_rows)*elementsize;
+
+}
+
+
+/* read n values, stored as float if single is true, anything past the current end of file is zero */
+static void bm_fread(double *dest, size_t n, FILE *myfile, bool single){
+  size_t nread, i, chunk, got;
+  float buffer[4096];
+
+  if (!single){
+    nread = fread(dest, sizeof(double), n, myfile);
   } else {
-    lastcol = max_cols;
+    nread = 0;
+    while (nread < n){
+      chunk = (n - nread < 4096) ? n - nread : 4096;
+      got = fread(buffer, sizeof(float), chunk, myfile);
+      for (i = 0; i < got; i++){
+	dest[nread + i] = (double)buffer[i];
+      }
+      nread += got;
+      if (got < chunk){
+	break;
+      }
+    }
   }
-
-  for (i=0; i < cols; i++){
-    //printf("%s\n",filenames[i]);
-    remove(filenames[i]);
+  if (nread < n){
+    memset(&dest[nread], 0, (n - nread)*sizeof(double));
   }
+}
 
-  delete [] which_cols;
 
-  for (i = 0; i < cols; i++){
-    delete [] filenames[i];
+/* write n values, narrowing to float if single is true. returns number written */
+static size_t bm_fwrite(double *src, size_t n, FILE *myfile, bool single){
+  size_t nwritten, i, chunk, put;
+  float buffer[4096];
+
+  if (!single){
+    return fwrite(src, sizeof(double), n, myfile);
+  } 
+  
+  nwritten = 0;
+  while (nwritten < n){
+    chunk = (n - nwritten < 4096) ? n - nwritten : 4096;
+    for (i = 0; i < chunk; i++){
+      buffer[i] = (float)src[nwritten + i];
+    }
+    put = fwrite(buffer, sizeof(float), chunk, myfile);
+    nwritten += put;
+    if (put < chunk){
+      break;
+    }
   }
-  delete [] filenames;
+  return nwritten;
+}
 
-  if (!colmode){
-    for (i=0; i < cols; i++){
-      delete [] rowdata[i];
+
+#if defined(HAVE_ZLIB)
+
+/* shuffle the bytes of n values (narrowed to float if single is true) then deflate them 
+   into out, which has room for outlen bytes. returns the compressed length, 0 on failure */
+static unsigned long bm_compress(double *src, int n, bool single, unsigned char *out, unsigned long outlen){
+  int i, k;
+  int size = single ? sizeof(float) : sizeof(double);
+  unsigned char *shuffled = new unsigned char[(size_t)n*size];
+  unsigned char *value;
+  float narrowed;
+  uLongf length = outlen;
+  int result;
+
+  for (i = 0; i < n; i++){
+    if (single){
+      narrowed = (float)src[i];
+      value = (unsigned char *)&narrowed;
+    } else {
+      value = (unsigned char *)&src[i];
     }
-    delete [] rowdata;
+    for (k = 0; k < size; k++){
+      shuffled[(size_t)k*n + i] = value[k];
+    }
+  }
+  result = compress2(out, &length, shuffled, (uLong)n*size, Z_BEST_SPEED);
+  delete [] shuffled;
+  
+  if (result != Z_OK){
+    return 0;
   }
+  return length;
+}
 
 
-  for (i=0; i < lastcol; i++){
-    delete [] coldata[i];
+/* undo bm_compress(). returns false if in does not hold exactly n values */
+static bool bm_decompress(unsigned char *in, unsigned long inlen, double *dest, int n, bool single){
+  int i, k;
+  int size = single ? sizeof(float) : sizeof(double);
+  unsigned char *shuffled = new unsigned char[(size_t)n*size];
+  unsigned char *value;
+  float narrowed;
+  uLongf length = (uLongf)n*size;
+  
+  if (uncompress(shuffled, &length, in, inlen) != Z_OK || length != (uLongf)n*size){
+    delete [] shuffled;
+    return false;
   }
-  delete [] coldata;
   
+  for (i = 0; i < n; i++){
+    value = single ? (unsigned char *)&narrowed : (unsigned char *)&dest[i];
+    for (k = 0; k < size; k++){
+      value[k] = shuffled[(size_t)k*n + i];
+    }
+    if (single){
+      dest[i] = (double)narrowed;
+    }
+  }
+  delete [] shuffled;
+  return true;
+}
 
-  delete [] fileprefix;
+#endif
+
+
+/* Compressed chunks are read and written whole, buffering would only read more than is needed */
+
+static FILE *bm_chunkfile(FILE *myfile){
 
+  if (myfile != 0){
+    setvbuf(myfile, 0, _IONBF, 0);
+  }
+  return myfile;
 }
 
 
-double &BufferedMatrix::operator[](unsigned long i)
-{
-  
-  int whichcol = i/rows;
-  int whichrow = i % rows;
+/* number of rows in chunk (or tile) number chunk, only the last may be short */
 
-  int curcol;
+int BufferedMatrix::ChunkRows(int chunk){
 
-  if (!colmode){
-    /* Fix up any potential clashes */
-    if (rowcolclash){
-      ClearClash();
-    }
-    
-    /* check to see if this cell is in row buffer, then column buffer, then read from files */
-    
-    if (InRowBuffer(whichrow,whichcol)){
-      /* In row buffer so return */
-      if (InColBuffer(whichrow,whichcol,&curcol)){
-	SetClash(whichrow,whichcol);
-      }
-      
-      return rowdata[whichcol][whichrow - first_rowdata];
-    } else if (InColBuffer(whichrow,whichcol,&curcol)){
-      return coldata[curcol][whichrow];
-    } else {
-      
-      /* looks like we are going to have to go to files */
-      //printf("Couldn't find in buffers\n");
+  int first = chunk*tile_rows;
+
+  return (rows - first < tile_rows) ? rows - first : tile_rows;
+
+}
+
+
+/* decompress a chunk of column col, from its file myfile, into dest */
+
+void BufferedMatrix::ChunkRead(FILE *myfile, int col, int chunk, double *dest){
+#if defined(HAVE_ZLIB)
+  int n = ChunkRows(chunk);
+  int length = chunk_length[col][chunk];
+  unsigned char *buffer;
+
+  if (length == 0){
+    memset(dest, 0, n*sizeof(double));
+    return;
+  }
+
+  bm_fseek(myfile, chunk_offset[col][chunk]);
+  if (length == n*elementsize){
+    /* stored as is */
+    bm_fread(dest, n, myfile, singleprecision);
+    return;
+  }
+
+  buffer = new unsigned char[length];
+  if (fread(buffer, 1, length, myfile) != (size_t)length || !bm_decompress(buffer, length, dest, n, singleprecision)){
+    delete [] buffer;
+    throw "Can't read back compressed temporary file.\n";
+  }
+  delete [] buffer;
+#endif
+}
+
+
+/* compress a chunk of column col from src and write it to the column's file myfile. 
+   It goes back where it was if it still fits, otherwise on the end of the file */
+
+void BufferedMatrix::ChunkWrite(FILE *myfile, int col, int chunk, double *src){
+#if defined(HAVE_ZLIB)
+  int n = ChunkRows(chunk);
+  unsigned long rawlength = (unsigned long)n*elementsize;
+  unsigned long length = compressBound(rawlength);
+  unsigned char *buffer = new unsigned char[length];
+  unsigned long written;
+  bm_offset where;
+
+  length = bm_compress(src, n, singleprecision, buffer, length);
+  if (length == 0 || length >= rawlength){
+    /* does not compress, so store it as is */
+    length = rawlength;
+  }
+
+  if ((int)length <= chunk_space[col][chunk]){
+    where = chunk_offset[col][chunk];
+  } else {
+    /* leave some room so that it can usually be rewritten in place */
+    where = chunk_end[col];
+    chunk_space[col][chunk] = (int)(length + length/8);
+    chunk_end[col] += chunk_space[col][chunk];
+  }
+
+  bm_fseek(myfile, where);
+  if (length == rawlength){
+    written = bm_fwrite(src, n, myfile, singleprecision)*elementsize;
+  } else {
+    written = fwrite(buffer, 1, length, myfile);
+  }
+  delete [] buffer;
+  if (written != length){
+    throw "Can't write compressed temporary file. Is there enough disk space?\n";
+  }
+  
+  chunk_offset[col][chunk] = where;
+  chunk_length[col][chunk] = (int)length;
+#endif
+}
+
+
+
+void BufferedMatrix::StorageAddColumn(double *src){
+
+  int t, ntiles;
+  double *tilebuffer;
+  int new_capacity;
+  int j;
+
+  if (cols == 0 && storagemode != BUFFEREDMATRIX_STORAGE_FILES){
+    if (tile_rows <= 0 && storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+      /* several chunks to a row buffer, so that it can be moved back a 
+	 little without decompressing and recompressing partial chunks */
+      tile_rows = max_rows/4;
+    } else if (tile_rows <= 0){
+      tile_rows = max_rows;
+    }
+    if (tile_rows > rows){
+      tile_rows = rows;
+    }
+    if (tile_rows < 1){
+      tile_rows = 1;
+    }
+  }
+  
+  if (storagemode != BUFFEREDMATRIX_STORAGE_TILED){
+    char **temp_filenames = new char *[cols+1];
+    char **temp_names_ptr = filenames;
+    FILE *myfile;
+
+    for (j =0; j < cols; j++){
+      temp_filenames[j] = filenames[j];
+    }
+    myfile = CreateTempFile(&temp_filenames[cols], "wb");
+    filenames = temp_filenames;
+    delete [] temp_names_ptr;
+    
+    if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+      bm_chunkfile(myfile);
+
+      /* room for the new column's chunk index */
+      bm_offset **temp_offset = new bm_offset *[cols+1];
+      int **temp_length = new int *[cols+1];
+      int **temp_space = new int *[cols+1];
+      bm_offset *temp_end = new bm_offset[cols+1];
+      
+      ntiles = (rows + tile_rows - 1)/tile_rows;
+      for (j =0; j < cols; j++){
+	temp_offset[j] = chunk_offset[j];
+	temp_length[j] = chunk_length[j];
+	temp_space[j] = chunk_space[j];
+	temp_end[j] = chunk_end[j];
+      }
+      temp_offset[cols] = new bm_offset[ntiles];
+      temp_length[cols] = new int[ntiles];
+      temp_space[cols] = new int[ntiles];
+      memset(temp_length[cols], 0, ntiles*sizeof(int));
+      memset(temp_space[cols], 0, ntiles*sizeof(int));
+      temp_end[cols] = 0;
+      delete [] chunk_offset;
+      delete [] chunk_length;
+      delete [] chunk_space;
+      delete [] chunk_end;
+      chunk_offset = temp_offset;
+      chunk_length = temp_length;
+      chunk_space = temp_space;
+      chunk_end = temp_end;
+      
+      for (t = 0; t < ntiles; t++){
+	ChunkWrite(myfile, cols, t, &src[(size_t)t*tile_rows]);
+      }
+      fclose(myfile);
+      return;
+    }
+
+    /* Finally lets write it all out to a file */
+    bm_fwrite(src, rows, myfile, singleprecision);
+    fclose(myfile);
+    return;
+  }
+
+  if (tilefile == 0){
+    tile_capacity = (max_cols > 0) ? max_cols : 1;
+    tilefile = CreateTempFile(&tilefilename, "wb+");
+  }
+
+  if (cols == tile_capacity){
+    /* Out of room. Double capacity and move each tile to its new location,
+       starting at the end of the file so nothing is overwritten before it is read */
+    new_capacity = 2*tile_capacity;
+    ntiles = (rows + tile_rows - 1)/tile_rows;
+    tilebuffer = new double[(size_t)tile_rows*cols];
+    for (t = ntiles-1; t > 0; t--){
+      bm_fseek(tilefile, (bm_offset)t*tile_rows*tile_capacity*elementsize);
+      bm_fread(tilebuffer, (size_t)tile_rows*cols, tilefile, singleprecision);
+      bm_fseek(tilefile, (bm_offset)t*tile_rows*new_capacity*elementsize);
+      if (bm_fwrite(tilebuffer, (size_t)tile_rows*cols, tilefile, singleprecision) != (size_t)tile_rows*cols){
+	delete [] tilebuffer;
+	throw "Can't extend temporary file. Is there enough disk space?\n";
+      }
+    }
+    delete [] tilebuffer;
+    tile_capacity = new_capacity;
+  }
+
+  StorageWriteColumn(cols, src);
+
+}
+
+
+
+void BufferedMatrix::StorageReadColumn(int col, double *dest){
+
+  int t, n;
+  FILE *myfile;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    myfile = bm_chunkfile(fopen(filenames[col],"rb"));
+    for (t = 0; t < rows; t+= tile_rows){
+      ChunkRead(myfile, col, t/tile_rows, &dest[t]);
+    }
+    fclose(myfile);
+    return;
+  }
+
+  if (storagemode != BUFFEREDMATRIX_STORAGE_TILED){
+    myfile = fopen(filenames[col],"rb");
+    fseek(myfile,0,SEEK_SET);
+    bm_fread(dest, rows, myfile, singleprecision);
+    fclose(myfile);
+    return;
+  }
+  
+  for (t = 0; t < rows; t+= tile_rows){
+    n = (rows - t < tile_rows) ? rows - t : tile_rows;
+    bm_fseek(tilefile, TileOffset(t, col));
+    bm_fread(&dest[t], n, tilefile, singleprecision);
+  }
+
+}
+
+
+
+void BufferedMatrix::StorageWriteColumn(int col, double *src){
+
+  int t, n = tile_rows;
+  FILE *myfile;
+  double zero = 0.0;
+  
+  if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    /* everything is rewritten so start from the beginning of the file */
+    myfile = bm_chunkfile(fopen(filenames[col],"rb+"));
+    chunk_end[col] = 0;
+    memset(chunk_space[col], 0, ((rows + tile_rows - 1)/tile_rows)*sizeof(int));
+    for (t = 0; t < rows; t+= tile_rows){
+      ChunkWrite(myfile, col, t/tile_rows, &src[t]);
+    }
+    fclose(myfile);
+    return;
+  }
+
+  if (storagemode != BUFFEREDMATRIX_STORAGE_TILED){
+    myfile = fopen(filenames[col],"rb+");
+    fseek(myfile,0,SEEK_SET); 
+    bm_fwrite(src, rows, myfile, singleprecision);
+    fclose(myfile);  
+    return;
+  }
+
+  for (t = 0; t < rows; t+= tile_rows){
+    n = (rows - t < tile_rows) ? rows - t : tile_rows;
+    bm_fseek(tilefile, TileOffset(t, col));
+    bm_fwrite(&src[t], n, tilefile, singleprecision);
+  }
+  if (n < tile_rows){
+    /* pad the last tile so that it is always full length */
+    bm_fseek(tilefile, TileOffset(t - tile_rows, col) + (bm_offset)(tile_rows-1)*elementsize);
+    bm_fwrite(&zero, 1, tilefile, singleprecision);
+  }
+
+}
+
+
+
+void BufferedMatrix::StorageReadRows(int first, int n, double **dest){
+
+  int j, t, lo, hi;
+  FILE *myfile;
+  double *tilebuffer;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    tilebuffer = new double[tile_rows];
+    for (j =0; j < cols; j++){
+      myfile = bm_chunkfile(fopen(filenames[j],"rb"));
+      for (t = first - first%tile_rows; t < first + n; t+= tile_rows){
+	lo = (t < first) ? first : t;
+	hi = (t + tile_rows < first + n) ? t + tile_rows : first + n;
+	if (lo == t && hi == t + ChunkRows(t/tile_rows)){
+	  ChunkRead(myfile, j, t/tile_rows, &dest[j][t - first]);
+	} else {
+	  ChunkRead(myfile, j, t/tile_rows, tilebuffer);
+	  memcpy(&dest[j][lo - first], &tilebuffer[lo - t], (hi - lo)*sizeof(double));
+	}
+      }
+      fclose(myfile);
+    }
+    delete [] tilebuffer;
+    return;
+  }
+
+  if (storagemode != BUFFEREDMATRIX_STORAGE_TILED){
+    for (j =0; j < cols; j++){
+      myfile = fopen(filenames[j],"rb");
+      fseek(myfile,first*elementsize,SEEK_SET);
+      bm_fread(&dest[j][0], n, myfile, singleprecision);
+      fclose(myfile);  
+    }
+    return;
+  }
+
+  tilebuffer = new double[(size_t)tile_rows*cols];
+  for (t = first - first%tile_rows; t < first + n; t+= tile_rows){
+    lo = (t < first) ? first : t;
+    hi = (t + tile_rows < first + n) ? t + tile_rows : first + n;
+    bm_fseek(tilefile, TileOffset(t, 0));
+    bm_fread(tilebuffer, (size_t)tile_rows*cols, tilefile, singleprecision);
+    for (j =0; j < cols; j++){
+      memcpy(&dest[j][lo - first], &tilebuffer[(size_t)j*tile_rows + lo - t], (hi - lo)*sizeof(double));
+    }
+  }
+  delete [] tilebuffer;
+
+}
+
+
+
+void BufferedMatrix::StorageWriteRows(int first, int n, double **src){
+
+  int j, t, lo, hi;
+  FILE *myfile;
+  double *tilebuffer;
+  double *colbuffer = 0;
+  bm_offset live;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    tilebuffer = new double[tile_rows];
+    for (j =0; j < cols; j++){
+      myfile = bm_chunkfile(fopen(filenames[j],"rb+"));
+      for (t = first - first%tile_rows; t < first + n; t+= tile_rows){
+	lo = (t < first) ? first : t;
+	hi = (t + tile_rows < first + n) ? t + tile_rows : first + n;
+	if (lo == t && hi == t + ChunkRows(t/tile_rows)){
+	  ChunkWrite(myfile, j, t/tile_rows, &src[j][t - first]);
+	} else {
+	  /* only part of this chunk is in the buffer, fetch the rest */
+	  ChunkRead(myfile, j, t/tile_rows, tilebuffer);
+	  memcpy(&tilebuffer[lo - t], &src[j][lo - first], (hi - lo)*sizeof(double));
+	  ChunkWrite(myfile, j, t/tile_rows, tilebuffer);
+	}
+      }
+      
+      /* Once more than half the file is stale chunks, rewrite it from the start */
+      live = 0;
+      for (t = 0; t < rows; t+= tile_rows){
+	live += chunk_space[j][t/tile_rows];
+      }
+      if (chunk_end[j] > 2*live){
+	if (colbuffer == 0){
+	  colbuffer = new double[rows];
+	}
+	for (t = 0; t < rows; t+= tile_rows){
+	  ChunkRead(myfile, j, t/tile_rows, &colbuffer[t]);
+	}
+	chunk_end[j] = 0;
+	memset(chunk_space[j], 0, ((rows + tile_rows - 1)/tile_rows)*sizeof(int));
+	for (t = 0; t < rows; t+= tile_rows){
+	  ChunkWrite(myfile, j, t/tile_rows, &colbuffer[t]);
+	}
+      }
+      fclose(myfile);
+    }
+    delete [] colbuffer;
+    delete [] tilebuffer;
+    return;
+  }
+
+  if (storagemode != BUFFEREDMATRIX_STORAGE_TILED){
+    for (j =0; j < cols; j++){
+      myfile = fopen(filenames[j],"rb+");
+      fseek(myfile,first*elementsize,SEEK_SET);
+      bm_fwrite(&src[j][0], n, myfile, singleprecision);
+      fclose(myfile);
+    } 
+    return;
+  }
+
+  tilebuffer = new double[(size_t)tile_rows*cols];
+  memset(tilebuffer, 0, (size_t)tile_rows*cols*sizeof(double));
+  for (t = first - first%tile_rows; t < first + n; t+= tile_rows){
+    lo = (t < first) ? first : t;
+    hi = (t + tile_rows < first + n) ? t + tile_rows : first + n;
+    if (lo != t || (hi != t + tile_rows && hi != rows)){
+      /* only part of this tile is in the buffer, fetch the rest */
+      bm_fseek(tilefile, TileOffset(t, 0));
+      bm_fread(tilebuffer, (size_t)tile_rows*cols, tilefile, singleprecision);
+    }
+    for (j =0; j < cols; j++){
+      memcpy(&tilebuffer[(size_t)j*tile_rows + lo - t], &src[j][lo - first], (hi - lo)*sizeof(double));
+    }
+    bm_fseek(tilefile, TileOffset(t, 0));
+    bm_fwrite(tilebuffer, (size_t)tile_rows*cols, tilefile, singleprecision);
+  }
+  delete [] tilebuffer;
+
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+void BufferedMatrix::AddColumn(){
+  int j,i;
+  int which_col_num;
+
+  if (pinned > 0){
+    throw "Can't add a column while a column is pinned\n";
+  }
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    AddMappedColumn();
+    return;
+  }
+
+  /* The prefetch buffer would be the wrong shape after this */
+  StopPrefetcher();
+  
+  /* Make sure the column buffer is up to date before anything is evicted */
+  if (!colmode && rowcolclash){
+    ClearClash();
+  }
+
+  /* Room for the new column in the column to slot index */
+  int *temp_slots = new int[cols +1];
+  for (j =0; j < cols; j++){
+    temp_slots[j] = col_slot[j];
+  }
+  delete [] col_slot;
+  col_slot = temp_slots;
+  
+  /* Handle the housekeeping of indices, clearing buffer if needed etc */
+  if (cols < max_cols){
+    /* No need to clear out column buffer */
+    int *temp_indices = new int[cols +1];
+    int *temp_old_indices = which_cols;
+    double **temp_ptr = new double *[cols +1];
+    double **old_temp_ptr = coldata;
+    char *temp_ref = new char[cols +1];
+    int *temp_pins = new int[cols +1];
+
+    for (j =0; j < cols; j++){
+      temp_indices[j] = which_cols[j];
+      temp_ptr[j] = coldata[j];
+      temp_ref[j] = slot_ref[j];
+      temp_pins[j] = 0;
+    }
+    temp_indices[cols] =cols;
+    temp_ptr[cols] = new double[this->rows];
+    temp_ref[cols] = 1;
+    temp_pins[cols] = 0;
+
+    coldata = temp_ptr;
+    
+    for (i =0; i < this->rows; i++){
+      coldata[cols][i] = 0.0;  //(cols)*rows + i; 
+    }
+    which_col_num = cols;
+    which_cols = temp_indices;
+    col_slot[cols] = cols;
+    delete [] temp_old_indices;
+    delete [] old_temp_ptr;
+    delete [] slot_ref;
+    slot_ref = temp_ref;
+    delete [] slot_pins;
+    slot_pins = temp_pins;
+
+    if (!colmode){
+      /* Now handle the row buffer */
+      old_temp_ptr = rowdata;
+      temp_ptr = new double *[cols +1];
+      
+      for (j =0; j < cols; j++){
+	temp_ptr[j] = rowdata[j];
+      }
+      temp_ptr[cols] = new double[this->max_rows];
+      
+      for (i=0; i < max_rows; i++){
+	temp_ptr[cols][i] = 0.0;   // (cols)*rows + i; 
+      }
+
+
+      rowdata = temp_ptr;
+      delete [] old_temp_ptr;
+    }
+
+  } else {
+    /* Need to remove a column from buffer to make room */
+    double **temp_ptr;
+    double **old_temp_ptr = rowdata;
+    
+    which_col_num = VictimSlot();
+ 
+    /* Before we reuse it, better empty the column buffer */
+    StorageWriteColumn(which_cols[which_col_num], coldata[which_col_num]);
+    
+    col_slot[which_cols[which_col_num]] = -1;
+    which_cols[which_col_num] = cols;
+    col_slot[cols] = which_col_num;
+    slot_ref[which_col_num] = 1;
+    clock_hand = (which_col_num + 1) % max_cols;
+    for (i =0; i < this->rows; i++){
+      coldata[which_col_num][i] = 0.0; // (cols)*rows +i;
+    }
+
+   
+    
+
+    //delete [] temp_col;
+    if (!colmode){
+      old_temp_ptr = rowdata;
+      temp_ptr = new double *[cols +1];
+      
+      for (j =0; j < cols; j++){
+	temp_ptr[j] = rowdata[j];
+      }
+      temp_ptr[cols] = new double[this->max_rows];
+      
+      for (i=0; i < max_rows; i++){
+	temp_ptr[cols][i] = 0.0;      //(cols)*rows + i;
+      }
+      
+      
+      rowdata = temp_ptr;
+      delete [] old_temp_ptr;
+    }
+
+
+  }
+  /* now do the file stuff */
+  StorageAddColumn(coldata[which_col_num]);
+  this->cols++;
+
+  if (prefetch){
+    StartPrefetcher();
+  }
+  
+}
+
+
+
+/******************************************************
+ **
+ ** void BufferedMatrix::RemoveLastColumn()
+ **
+ ** Undoes AddColumn(). The last column, and its temporary
+ ** storage, are thrown away without being written out. If it
+ ** was in the column buffer when others were not, another column
+ ** takes its slot. Like AddColumn() this can't be done while a
+ ** column is pinned.
+ **
+ ******************************************************/
+
+void BufferedMatrix::RemoveLastColumn(){
+  int j;
+  int last = cols - 1;
+  int curcol;
+
+  if (cols == 0){
+    return;
+  }
+  
+  if (pinned > 0){
+    throw "Can't remove a column while a column is pinned\n";
+  }
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+#ifdef BUFFEREDMATRIX_HAVE_MMAP
+    /* AddMappedColumn() expects the space it reuses to be zero */
+    if (mapdata != 0){
+      memset(&mapdata[(size_t)last*rows], 0, (size_t)rows*sizeof(double));
+    }
+#endif
+    this->cols--;
+    return;
+  }
+
+  StopPrefetcher();
+
+  if (!colmode && rowcolclash){
+    ClearClash();
+  }
+
+  curcol = col_slot[last];
+  if (cols <= max_cols){
+    /* every column is buffered, one to a slot. Move the last slot into the hole */
+    delete [] coldata[curcol];
+    if (curcol != last){
+      coldata[curcol] = coldata[last];
+      which_cols[curcol] = which_cols[last];
+      slot_ref[curcol] = slot_ref[last];
+      slot_pins[curcol] = slot_pins[last];
+      col_slot[which_cols[curcol]] = curcol;
+    }
+    clock_hand = 0;
+  } else if (curcol >= 0){
+    /* refill its slot with a column that is not buffered */
+    j = 0;
+    while (col_slot[j] >= 0){
+      j++;
+    }
+    which_cols[curcol] = j;
+    col_slot[j] = curcol;
+    slot_ref[curcol] = 0;
+    StorageReadColumn(j, coldata[curcol]);
+    if (!colmode){
+      /* The row buffer may be newer than what is in storage */
+      memcpy(&coldata[curcol][first_rowdata], rowdata[j], max_rows*sizeof(double));
+    }
+  }
+  col_slot[last] = -1;
+
+  if (!colmode){
+    delete [] rowdata[last];
+  }
+
+  if (storagemode != BUFFEREDMATRIX_STORAGE_TILED){
+    /* the tiled file just keeps the space for when a column is added again */
+    remove(filenames[last]);
+    delete [] filenames[last];
+  }
+  if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    delete [] chunk_offset[last];
+    delete [] chunk_length[last];
+    delete [] chunk_space[last];
+  }
+
+  this->cols--;
+
+  if (prefetch){
+    StartPrefetcher();
+  }
+}
+
+
+/******************************************************
+ **
+ ** int BufferedMatrix::Cols()
+ **
+ ** number of columns in the matrix
+ **
+ ******************************************************/
+
+int BufferedMatrix::Cols(){
+  return cols;
+}
+
+
+
+BufferedMatrix::~BufferedMatrix(){
+  
+  int i;
+  int lastcol;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+#ifdef BUFFEREDMATRIX_HAVE_MMAP
+    if (mapdata != 0){
+      munmap(mapdata, (size_t)map_capacity*rows*sizeof(double));
+    }
+    if (map_fd >= 0){
+      close(map_fd);
+      remove(mapfilename);
+    }
+#endif
+    delete [] mapfilename;
+    delete [] fileprefix;
+#if wxUSE_THREADS
+    delete pin_lock;
+#endif
+    return;
+  }
+
+  /* Make sure nothing is still reading from storage */
+  StopPrefetcher();
+  
+  if (cols < max_cols){
+    lastcol = cols;
+  } else {
+    lastcol = max_cols;
+  }
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_TILED){
+    if (tilefile != 0){
+      fclose(tilefile);
+      remove(tilefilename);
+    }
+    delete [] tilefilename;
+  } else {
+    for (i=0; i < cols; i++){
+      //printf("%s\n",filenames[i]);
+      remove(filenames[i]);
+    }
+    
+    for (i = 0; i < cols; i++){
+      delete [] filenames[i];
+    }
+    delete [] filenames;
+  }
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED){
+    for (i = 0; i < cols; i++){
+      delete [] chunk_offset[i];
+      delete [] chunk_length[i];
+      delete [] chunk_space[i];
+    }
+    delete [] chunk_offset;
+    delete [] chunk_length;
+    delete [] chunk_space;
+    delete [] chunk_end;
+  }
+
+  delete [] which_cols;
+  delete [] col_slot;
+  delete [] slot_ref;
+  delete [] slot_pins;
+
+  if (!colmode){
+    for (i=0; i < cols; i++){
+      delete [] rowdata[i];
+    }
+    delete [] rowdata;
+  }
+
+
+  for (i=0; i < lastcol; i++){
+    delete [] coldata[i];
+  }
+  delete [] coldata;
+  
+
+  delete [] fileprefix;
+#if wxUSE_THREADS
+  delete pin_lock;
+#endif
+
+}
+
+
+double &BufferedMatrix::operator[](unsigned long i)
+{
+  
+  int whichcol = i/rows;
+  int whichrow = i % rows;
+
+  int curcol;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    return mapdata[i];
+  }
+
+  if (!colmode){
+    /* Fix up any potential clashes */
+    if (rowcolclash){
+      ClearClash();
+    }
+    
+    /* check to see if this cell is in row buffer, then column buffer, then read from files */
+    
+    if (InRowBuffer(whichrow,whichcol)){
+      /* In row buffer so return */
+      if (InColBuffer(whichrow,whichcol,&curcol)){
+	SetClash(whichrow,whichcol);
+      }
+      
+      return rowdata[whichcol][whichrow - first_rowdata];
+    } else if (InColBuffer(whichrow,whichcol,&curcol)){
+      return coldata[curcol][whichrow];
+    } else {
+      
+      /* looks like we are going to have to go to files */
+      //printf("Couldn't find in buffers\n");
 
       if (!readonly){
 	/* Flush buffers */ 
@@ -533,16 +1639,24 @@ double &BufferedMatrix::operator[](unsigned long i)
 	FlushRowBuffer();
       
 	/* Now flush the column buffer (for oldest column) */
-	FlushOldestColumn();
+	if (storagemode != BUFFEREDMATRIX_STORAGE_COMPRESSED){
+	  FlushOldestColumn();
+	}
       }
       
       /* Now fill up the buffer */
       /* read in this row and surrounding rows into row buffer */
       LoadRowBuffer(whichrow);
       
-      /* read in this column into column buffer */
-      LoadNewColumn(whichcol);
+      /* read in this column into column buffer. Not worth it with compressed 
+         storage, where a whole column costs far more to read and write back 
+         than the rows that are wanted */
+      if (storagemode != BUFFEREDMATRIX_STORAGE_COMPRESSED){
+	LoadNewColumn(whichcol);
+      }
       
+      /* read ahead while the caller works on these rows */
+      PrefetchFollowingRows();
       
       SetClash(whichrow,whichcol);
       return rowdata[whichcol][whichrow - first_rowdata];
@@ -554,8 +1668,8 @@ double &BufferedMatrix::operator[](unsigned long i)
     } else {
       if (!readonly)
 	FlushOldestColumn(); 
-      LoadNewColumn(whichcol);
-      return coldata[max_cols -1][whichrow];
+      curcol = LoadNewColumn(whichcol);
+      return coldata[curcol][whichrow];
     }
   }
 }
@@ -578,281 +1692,604 @@ void BufferedMatrix::SetClash(int row, int col){
 void  BufferedMatrix::ClearClash(){
 
   // Should mean that row buffer is up to date and column buffer is potentially not
-  int curcol,lastcol;
+  int curcol;
+
+  curcol = col_slot[clash_col];
+
+  /* If the column has since left the column buffer there is nothing to fix up */
+  if (curcol >= 0 && rowdata[clash_col][clash_row - first_rowdata] != coldata[curcol][clash_row]){
+    /* there is a clash, update coldata with current version in rowdata */
+    coldata[curcol][clash_row] = rowdata[clash_col][clash_row - first_rowdata];
+  } 
+
+  rowcolclash=false;
+}
+
+
+
+
+bool BufferedMatrix::InRowBuffer(int row, int col){
+  if ((first_rowdata <= row) && (row < first_rowdata + max_rows)){
+    return true;
+  } else {
+    return false;
+  }
+}
 
+bool BufferedMatrix::InColBuffer(int row, int col, int *which_col_index){
+  int curcol;
 
+  curcol = col_slot[col];
+  if (curcol < 0){
+    return false;
+  }
   
-  curcol = 0;
+  slot_ref[curcol] = 1;
+  *which_col_index = curcol;
+  return true;
+}
+
+
+
+/******************************************************
+ **
+ ** int BufferedMatrix::VictimSlot()
+ **
+ ** Column buffer replacement policy (CLOCK). Each slot
+ ** has a reference bit that is set whenever that column
+ ** is used. The clock hand sweeps round the slots clearing
+ ** reference bits until it finds a slot whose bit is already
+ ** clear. That slot holds the column to be replaced next.
+ ** The hand is left pointing at it, so calling this again
+ ** before the slot is reused gives the same answer.
+ **
+ ** Slots holding a pinned column are passed over.
+ **
+ ******************************************************/
+
+int BufferedMatrix::VictimSlot(){
+
+  int lastcol;
+  int steps = 0;
+
+  if (cols < max_cols){
+    lastcol = cols;
+  } else {
+    lastcol = max_cols;
+  }
+
+  if (clock_hand >= lastcol){
+    clock_hand = 0;
+  }
+
+  while (slot_ref[clock_hand] || slot_pins[clock_hand] > 0){
+    slot_ref[clock_hand] = 0;
+    clock_hand = (clock_hand + 1) % lastcol;
+    /* two full sweeps clear every reference bit, so only pins can stop us */
+    if (++steps > 2*lastcol){
+      throw "Every column in the column buffer is pinned\n";
+    }
+  }
+
+  return clock_hand;
+}
+
+
+
+
+void BufferedMatrix::FlushRowBuffer(){
+
+  //printf("flushing rows %d through %d\n",first_rowdata, first_rowdata+max_rows);
+  WaitForPrefetch();
+  PatchPrefetchRows(first_rowdata, max_rows, rowdata);
+  StorageWriteRows(first_rowdata, max_rows, rowdata);
+
+}
+
+/**
+ ** writes all columns out to files to keep buffer-file coherency.
+ **
+ **/
+
+void BufferedMatrix::FlushAllColumns(){
+
+  int k,lastcol;
+ 
   if (cols < max_cols){
     lastcol = cols;
   } else {
     lastcol = max_cols;
   }
+    
   
-  while (curcol < lastcol){
-    if (which_cols[curcol] == clash_col){
-      break;
+  WaitForPrefetch();
+  for (k=0; k < lastcol; k++){
+    PatchPrefetchColumn(which_cols[k], coldata[k]);
+    StorageWriteColumn(which_cols[k], coldata[k]);
+  }
+
+
+}
+
+
+/* writes out the column that is next to be replaced (see VictimSlot()) */
+
+void BufferedMatrix::FlushOldestColumn(){
+  
+  int victim = VictimSlot();
+
+  //printf("flushing column %d \n",which_cols[victim]);
+  WaitForPrefetch();
+  PatchPrefetchColumn(which_cols[victim], coldata[victim]);
+  StorageWriteColumn(which_cols[victim], coldata[victim]);
+  
+}
+
+
+
+/* replaces the column in the victim slot with col. Returns the slot */
+
+int BufferedMatrix::LoadNewColumn(int col)
+{
+  int victim;
+  int lastcol;
+
+  if (cols < max_cols){
+    lastcol = cols;
+  } else {
+    lastcol = max_cols;
+  }
+  
+  victim = VictimSlot();
+
+  col_slot[which_cols[victim]] = -1;
+  which_cols[victim] = col;
+  col_slot[col] = victim;
+  slot_ref[victim] = 1;
+  clock_hand = (victim + 1) % lastcol;
+  
+  //printf("loading column %d \n",whichcol);
+  WaitForPrefetch();
+  if (prefetcher != 0 && prefetch_state == BUFFEREDMATRIX_PREFETCH_READY && prefetch_col == col){
+    /* the prefetch thread has already read this column. Swap buffers */
+    double *tmpptr = coldata[victim];
+    coldata[victim] = prefetchcol;
+    prefetchcol = tmpptr;
+    DiscardPrefetch();
+    prefetch_hits++;
+  } else {
+    StorageReadColumn(col, coldata[victim]);
+    if (prefetcher != 0 && colmode){
+      prefetch_misses++;
     }
-    curcol++;
   }
+  if (colmode){
+    PrefetchFollowingColumn(col);
+  }
+  
+  return victim;
+}
 
 
 
-  if (rowdata[clash_col][clash_row - first_rowdata] != coldata[curcol][clash_row]){
-    /* there is a clash, update coldata with current version in rowdata */
-    coldata[curcol][clash_row] = rowdata[clash_col][clash_row - first_rowdata];
-  } 
+void BufferedMatrix::LoadAdditionalColumn(int col, int where)
+{
+  //  double *tmpptr;
+  //int lastcol;
+  //int j;
 
-  rowcolclash=false;
+
+  //  if (cols < max_cols){
+  //    lastcol = cols;
+  //  } else {
+  //    lastcol = max_cols;
+  //  }
+  
+  //  tmpptr = coldata[0];
+
+  //  for (j=1; j < lastcol; j++){
+  //    coldata[j-1] = coldata[j];
+  //     which_cols[j-1] = which_cols[j];
+  //   }
+  
+  coldata[where] = new double[rows];
+  which_cols[where] = col;
+  col_slot[col] = where;
+  slot_ref[where] = 0;
+  //printf("loading column %d \n",whichcol);
+  WaitForPrefetch();
+  StorageReadColumn(col, coldata[where]);
+
+  if (!colmode){
+    /* The row buffer may be newer than what is in storage */
+    memcpy(&coldata[where][first_rowdata], rowdata[col], max_rows*sizeof(double));
+  }
+  
+}
+
+
+
+
+
+void BufferedMatrix::LoadRowBuffer(int row){
+  
+  int j,k;
+  int lastcol;
+  int curcol;
+
+
+  if (cols < max_cols){
+    lastcol = cols;
+  } else {
+    lastcol = max_cols;
+  }
+  
+  this->first_rowdata = RowBufferStart(row);
+    
+  //   printf("loading rows %d through %d\n",first_rowdata, first_rowdata+max_rows);
+  WaitForPrefetch();
+  if (prefetcher != 0 && prefetch_state == BUFFEREDMATRIX_PREFETCH_READY && prefetch_col < 0 && prefetch_first == first_rowdata){
+    /* the prefetch thread has already read these rows. Swap buffers */
+    double **tmpptr = rowdata;
+    rowdata = prefetchdata;
+    prefetchdata = tmpptr;
+    prefetch_hits++;
+  } else {
+    StorageReadRows(first_rowdata, max_rows, rowdata);
+    if (prefetcher != 0){
+      prefetch_misses++;
+    }
+  }
+  DiscardPrefetch();
+  
+  for (curcol =0; curcol < lastcol; curcol++){
+    j = which_cols[curcol];
+    //	printf("curcol is %d j is %d\n",curcol,j);
+    for (k= first_rowdata; k < first_rowdata + max_rows; k++){
+      //printf("at %d %d in row buffer %f and at %d %d in column buffer %f\n",j,k,rowdata[j][k- first_rowdata],which_cols[curcol],k,coldata[curcol][k]);
+      rowdata[j][k- first_rowdata] = coldata[curcol][k];
+    }	
+  }
+}
+
+
+
+/******************************************************
+ **
+ ** int BufferedMatrix::RowBufferStart(int row)
+ **
+ ** returns the first row of the row buffer that would be
+ ** loaded to contain row.
+ **
+ ** With tiled or compressed storage the buffer starts on a
+ ** tile (or chunk) boundary, so that it spans as few as 
+ ** possible. Except when stepping back to just before the 
+ ** current buffer (eg a probeset that straddles a tile 
+ ** boundary) and the aligned buffer would not reach the rows
+ ** just left. Then the buffer would swap between the two 
+ ** for every column, so it starts at row instead.
+ **
+ ******************************************************/
+
+int BufferedMatrix::RowBufferStart(int row){
+
+  int aligned;
+
+  if ((storagemode == BUFFEREDMATRIX_STORAGE_TILED || storagemode == BUFFEREDMATRIX_STORAGE_COMPRESSED) && max_rows > row % tile_rows){
+    aligned = row - row % tile_rows;
+    if (row >= first_rowdata || aligned + max_rows > first_rowdata){
+      row = aligned;
+    }
+  }
+
+  if (row > rows - max_rows){
+    return rows - max_rows;
+  } else {
+    return row;
+  }
+}
+
+
+
+/******************************************************
+ **
+ ** Row buffer (and column) read-ahead
+ **
+ ** Most row mode access (eg summarization) walks down the
+ ** matrix a block of rows at a time. When prefetching is
+ ** turned on (SetPrefetch(true)) and the matrix is in row
+ ** mode, a background thread reads the block of rows following 
+ ** the current row buffer into prefetchdata. When the next 
+ ** LoadRowBuffer() wants exactly that block, the two buffers 
+ ** are swapped rather than going to disk.
+ **
+ ** Column mode access (background correction, normalization)
+ ** mostly goes through the columns in order, forwards or 
+ ** backwards. In column mode the thread instead reads the 
+ ** column following the one just loaded into the column buffer
+ ** (if it is not there already) into prefetchcol, which is swapped into the column
+ ** buffer when that column is wanted. So disk reads and, with
+ ** BUFFEREDMATRIX_STORAGE_COMPRESSED, decompression happen
+ ** while the previous column is being worked on.
+ **
+ ** Only the prefetch thread touches the storage while a
+ ** prefetch is in progress. Everything on the main thread
+ ** that goes to storage calls WaitForPrefetch() first. Anything
+ ** written out after the prefetch finished is also copied
+ ** into prefetchdata (or prefetchcol) so it can not go stale. 
+ ** Values in the column buffer are copied over the swapped in 
+ ** rows, exactly as when they are read from disk.
+ **
+ ** Matrix shape changes (adding columns, resizing the row buffer)
+ ** and switching between row and column mode throw away any 
+ ** prefetched data.
+ **
+ ** Not used in BUFFEREDMATRIX_STORAGE_MMAP mode (there are no
+ ** buffers) or when built without thread support.
+ **
+ ******************************************************/
+
+#if wxUSE_THREADS
+class BufferedMatrixPrefetcher : public wxThread
+{
+ public:
+  BufferedMatrixPrefetcher(BufferedMatrix *m) : wxThread(wxTHREAD_JOINABLE), matrix(m) {}
+
+ protected:
+  ExitCode Entry(){
+    matrix->PrefetchLoop();
+    return 0;
+  }
+
+ private:
+  BufferedMatrix *matrix;
+};
+#endif
+
+
+void BufferedMatrix::SetPrefetch(bool setting){
+  
+  prefetch = setting;
+  
+  if (prefetch){
+    StartPrefetcher();
+  } else {
+    StopPrefetcher();
+  }
+}
+
+
+long BufferedMatrix::GetPrefetchHits(){
+  return prefetch_hits;
 }
 
 
+long BufferedMatrix::GetPrefetchMisses(){
+  return prefetch_misses;
+}
 
 
-bool BufferedMatrix::InRowBuffer(int row, int col){
-  if ((first_rowdata <= row) && (row < first_rowdata + max_rows)){
-    return true;
-  } else {
-    return false;
-  }
+void BufferedMatrix::ResetPrefetchCounters(){
+  prefetch_hits = 0;
+  prefetch_misses = 0;
 }
 
-bool BufferedMatrix::InColBuffer(int row, int col, int *which_col_index){
-  int curcol, lastcol;
 
-  /*curcol = 0;
-  if (cols < max_cols){
-    lastcol = cols;
-  } else {
-    lastcol = max_cols;
-  }
-  
-  while (curcol < lastcol){
-  if (which_cols[curcol] == col){
-  *which_col_index = curcol;
-  return true;
+void BufferedMatrix::StartPrefetcher(){
+#if wxUSE_THREADS
+  int j;
+
+  if (prefetcher != 0 || storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    return;
   }
-  curcol++;
-  } */
-  
 
-  
-  
-  if (cols < max_cols){
-    lastcol = cols;
+  if (colmode){
+    prefetchcol = new double[rows];
   } else {
-    lastcol = max_cols;
-  }
-    
-    
-  curcol = lastcol-1;
-  while (curcol >= 0){
-    if (which_cols[curcol] == col){
-      *which_col_index = curcol;
-      return true;
+    prefetchdata = new double *[cols +1];
+    for (j =0; j < cols; j++){
+      prefetchdata[j] = new double[this->max_rows];
     }
-    curcol--;
-  } 
-  
-  return false;
+  }
+  prefetch_col = -1;
+  prefetch_state = BUFFEREDMATRIX_PREFETCH_IDLE;
+  prefetch_quit = false;
+  prefetch_lock = new wxMutex();
+  prefetch_cond = new wxCondition(*prefetch_lock);
+
+  prefetcher = new BufferedMatrixPrefetcher(this);
+  if (prefetcher->Create() != wxTHREAD_NO_ERROR || prefetcher->Run() != wxTHREAD_NO_ERROR){
+    /* No thread, so carry on without read-ahead */
+    delete prefetcher;
+    prefetcher = 0;
+    StopPrefetcher();
+  }
+#endif
 }
 
 
-
-
-void BufferedMatrix::FlushRowBuffer(){
+void BufferedMatrix::StopPrefetcher(){
+#if wxUSE_THREADS
   int j;
-  const char *mode2 ="rb+";
-  FILE *myfile;
 
-  //printf("flushing rows %d through %d\n",first_rowdata, first_rowdata+max_rows);
-  for (j =0; j < cols; j++){
-    myfile = fopen(filenames[j],mode2);
-    //for (k= first_rowdata; k < first_rowdata + max_rows; k++){
-    fseek(myfile,first_rowdata*sizeof(double),SEEK_SET);
-    //printf("Writing %f at %d %d to %s\n",rowdata[j][k- first_rowdata],j,k- first_rowdata,filenames[j]);
-	                                                          //fwrite(&rowdata[j][k- first_rowdata],sizeof(double),1,myfile);
-	                                                          //}
-    fwrite(&rowdata[j][0],sizeof(double),max_rows,myfile);
-    /* for (k=0; k < max_rows; k++){
-      printf("row writing %d %d with value %f\n",j,first_rowdata+k, rowdata[j][k]);
-      } */
-    
-    
-      
-    fclose(myfile);
-  } 
+  if (prefetcher != 0){
+    prefetch_lock->Lock();
+    prefetch_quit = true;
+    prefetch_cond->Broadcast();
+    prefetch_lock->Unlock();
+    prefetcher->Wait();
+    delete prefetcher;
+    prefetcher = 0;
+  }
 
+  if (prefetchdata != 0){
+    for (j =0; j < cols; j++){
+      delete [] prefetchdata[j];
+    }
+    delete [] prefetchdata;
+    prefetchdata = 0;
+  }
+  delete [] prefetchcol;
+  prefetchcol = 0;
+  prefetch_col = -1;
+  delete prefetch_cond;
+  delete prefetch_lock;
+  prefetch_cond = 0;
+  prefetch_lock = 0;
+  prefetch_state = BUFFEREDMATRIX_PREFETCH_IDLE;
+#endif
 }
 
-/**
- ** writes all columns out to files to keep buffer-file coherency.
- **
- **/
 
-void BufferedMatrix::FlushAllColumns(){
+/* Body of the prefetch thread */
 
-  int k,lastcol;
-  const char *mode2 ="rb+";
-  FILE *myfile;
- 
-  if (cols < max_cols){
-    lastcol = cols;
-  } else {
-    lastcol = max_cols;
-  }
-    
-  
-  for (k=0; k < lastcol; k++){
-    myfile = fopen(filenames[which_cols[k]],mode2);
-    fseek(myfile,0,SEEK_SET); 
-    fwrite(coldata[k],sizeof(double),rows,myfile);
-    fclose(myfile);  
-  }
+void BufferedMatrix::PrefetchLoop(){
+#if wxUSE_THREADS
+  int first, col;
+
+  prefetch_lock->Lock();
+  while (true){
+    while (prefetch_state != BUFFEREDMATRIX_PREFETCH_REQUESTED && !prefetch_quit){
+      prefetch_cond->Wait();
+    }
+    if (prefetch_quit){
+      break;
+    }
+    first = prefetch_first;
+    col = prefetch_col;
+    prefetch_lock->Unlock();
 
+    if (col >= 0){
+      StorageReadColumn(col, prefetchcol);
+    } else {
+      StorageReadRows(first, max_rows, prefetchdata);
+    }
 
+    prefetch_lock->Lock();
+    prefetch_state = BUFFEREDMATRIX_PREFETCH_READY;
+    prefetch_cond->Broadcast();
+  }
+  prefetch_lock->Unlock();
+#endif
 }
 
 
-void BufferedMatrix::FlushOldestColumn(){
-  
-  const char *mode2 ="rb+";
-  FILE *myfile;
-  
-  //printf("flushing column %d \n",which_cols[0]);
-  myfile = fopen(filenames[which_cols[0]],mode2);
-  fseek(myfile,0,SEEK_SET); 
-  fwrite(coldata[0],sizeof(double),rows,myfile);
-  fclose(myfile);  
-  /* for (j=0; j < rows; j++){
-    printf("writing %d %d with value %f\n",which_cols[0], j, coldata[0][j]);
-    } */
+void BufferedMatrix::RequestPrefetch(int first){
+#if wxUSE_THREADS
+  wxMutexLocker lock(*prefetch_lock);
   
+  prefetch_first = first;
+  prefetch_col = -1;
+  prefetch_state = BUFFEREDMATRIX_PREFETCH_REQUESTED;
+  prefetch_cond->Broadcast();
+#endif
 }
 
 
+void BufferedMatrix::RequestColumnPrefetch(int col){
+#if wxUSE_THREADS
+  wxMutexLocker lock(*prefetch_lock);
+  
+  prefetch_col = col;
+  prefetch_state = BUFFEREDMATRIX_PREFETCH_REQUESTED;
+  prefetch_cond->Broadcast();
+#endif
+}
 
-void BufferedMatrix::LoadNewColumn(int col)
-{
-  const char *mode = "rb";
-  FILE *myfile;
-  double *tmpptr;
-  int lastcol;
-  int j;
 
+/* Forget whatever the prefetch thread last read. Only call after WaitForPrefetch() */
 
-  if (cols < max_cols){
-    lastcol = cols;
-  } else {
-    lastcol = max_cols;
+void BufferedMatrix::DiscardPrefetch(){
+#if wxUSE_THREADS
+  if (prefetcher == 0){
+    return;
   }
   
-  tmpptr = coldata[0];
+  wxMutexLocker lock(*prefetch_lock);
+  prefetch_state = BUFFEREDMATRIX_PREFETCH_IDLE;
+#endif
+}
+
 
-  for (j=1; j < lastcol; j++){
-    coldata[j-1] = coldata[j];
-    which_cols[j-1] = which_cols[j];
+/* Returns once the prefetch thread is no longer reading from storage */
+
+void BufferedMatrix::WaitForPrefetch(){
+#if wxUSE_THREADS
+  if (prefetcher == 0){
+    return;
   }
   
-  which_cols[lastcol -1] = col;
-  coldata[lastcol -1] = tmpptr;
-  
-  //printf("loading column %d \n",whichcol);
-  myfile = fopen(filenames[col],mode);
-  fseek(myfile,0,SEEK_SET);
-  fread(coldata[lastcol -1],sizeof(double),rows,myfile);
-  fclose(myfile);
-  
+  wxMutexLocker lock(*prefetch_lock);
+  while (prefetch_state == BUFFEREDMATRIX_PREFETCH_REQUESTED){
+    prefetch_cond->Wait();
+  }
+#endif
 }
 
 
+/* Start reading the block of rows that follows the current row buffer */
 
-void BufferedMatrix::LoadAdditionalColumn(int col, int where)
-{
-  const char *mode = "rb";
-  FILE *myfile;
-  //  double *tmpptr;
-  //int lastcol;
-  //int j;
+void BufferedMatrix::PrefetchFollowingRows(){
 
+  if (prefetcher != 0 && first_rowdata + max_rows < rows){
+    RequestPrefetch(RowBufferStart(first_rowdata + max_rows));
+  }
 
-  //  if (cols < max_cols){
-  //    lastcol = cols;
-  //  } else {
-  //    lastcol = max_cols;
-  //  }
-  
-  //  tmpptr = coldata[0];
+}
 
-  //  for (j=1; j < lastcol; j++){
-  //    coldata[j-1] = coldata[j];
-  //     which_cols[j-1] = which_cols[j];
-  //   }
-  
-  coldata[where] = new double[rows];
-  which_cols[where] = col;
-  //printf("loading column %d \n",whichcol);
-  myfile = fopen(filenames[col],mode);
-  fseek(myfile,0,SEEK_SET);
-  fread(coldata[where],sizeof(double),rows,myfile);
-  fclose(myfile);
+
+/* Column mode only. Start reading the column after col (or before it if the columns 
+   are being walked backwards) unless it is already buffered */
+
+void BufferedMatrix::PrefetchFollowingColumn(int col){
+
+  int next = (col < prefetch_previous) ? col - 1 : col + 1;
   
+  prefetch_previous = col;
+  if (prefetcher != 0 && next >= 0 && next < cols && col_slot[next] < 0){
+    RequestColumnPrefetch(next);
+  }
+
 }
 
 
+/* col is about to be written to storage from src, keep prefetchdata in step */
 
+void BufferedMatrix::PatchPrefetchColumn(int col, double *src){
 
+  if (prefetcher != 0 && prefetch_state == BUFFEREDMATRIX_PREFETCH_READY){
+    if (prefetch_col < 0){
+      memcpy(prefetchdata[col], &src[prefetch_first], max_rows*sizeof(double));
+    } else if (prefetch_col == col){
+      memcpy(prefetchcol, src, rows*sizeof(double));
+    }
+  }
 
-void BufferedMatrix::LoadRowBuffer(int row){
-  
-  const char *mode = "rb";
-  FILE *myfile;
-  int j,k;
-  int lastcol;
-  int curcol;
+}
 
 
-  if (cols < max_cols){
-    lastcol = cols;
-  } else {
-    lastcol = max_cols;
-  }
-  
-  if (row > rows - max_rows){
-    this->first_rowdata = rows - max_rows;
-  } else {
-    this->first_rowdata = row;
-  }
-    
-  //   printf("loading rows %d through %d\n",first_rowdata, first_rowdata+max_rows);
-  for (j =0; j < cols; j++){
-    
-    myfile = fopen(filenames[j],mode);
-    //for (k= first_rowdata; k < first_rowdata + max_rows; k++){
-    //  fseek(myfile,k*sizeof(double),SEEK_SET);
-    //  fread(&rowdata[j][k- first_rowdata],sizeof(double),1,myfile);
-    //}
-    fseek(myfile,first_rowdata*sizeof(double),SEEK_SET);
-    fread(&rowdata[j][0],sizeof(double),max_rows,myfile);
+/* rows first to first+n-1 are about to be written to storage from src, keep prefetchdata in step */
 
-    fclose(myfile);  
-  }
-  
-  for (j =0; j < cols; j++){
-    curcol =0;
-    while (curcol < lastcol){
-      if (which_cols[curcol] == j){
-	//	printf("curcol is %d j is %d\n",curcol,j);
-	for (k= first_rowdata; k < first_rowdata + max_rows; k++){
-	  //printf("at %d %d in row buffer %f and at %d %d in column buffer %f\n",j,k,rowdata[j][k- first_rowdata],which_cols[curcol],k,coldata[curcol][k]);
-	  rowdata[j][k- first_rowdata] = coldata[curcol][k];
-	}	
+void BufferedMatrix::PatchPrefetchRows(int first, int n, double **src){
+
+  int j, lo, hi;
+
+  if (prefetcher != 0 && prefetch_state == BUFFEREDMATRIX_PREFETCH_READY && prefetch_col >= 0){
+    memcpy(&prefetchcol[first], src[prefetch_col], n*sizeof(double));
+  } else if (prefetcher != 0 && prefetch_state == BUFFEREDMATRIX_PREFETCH_READY){
+    lo = (first > prefetch_first) ? first : prefetch_first;
+    hi = (first + n < prefetch_first + max_rows) ? first + n : prefetch_first + max_rows;
+    if (lo < hi){
+      for (j =0; j < cols; j++){
+	memcpy(&prefetchdata[j][lo - prefetch_first], &src[j][lo - first], (hi - lo)*sizeof(double));
       }
-      curcol++;
     }
   }
+
 }
 
+
+
 void BufferedMatrix::ResizeRowBuffer(int new_maxrow){
 
   int i, j;
@@ -867,7 +2304,7 @@ void BufferedMatrix::ResizeRowBuffer(int new_maxrow){
     new_maxrow =rows;
   }
 
-  if (colmode){
+  if (colmode || storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
     max_rows =new_maxrow;
     return;
   }
@@ -881,7 +2318,12 @@ void BufferedMatrix::ResizeRowBuffer(int new_maxrow){
   if (max_rows == new_maxrow){
     // No need to do anything.
     return;
-  } else if (max_rows > new_maxrow){
+  }
+
+  /* The prefetch buffer would be the wrong size after this */
+  StopPrefetcher();
+
+  if (max_rows > new_maxrow){
     // Remove rows from the rows buffer
     // Empty out row buffer (at least resync with files)
     FlushRowBuffer();
@@ -923,23 +2365,21 @@ void BufferedMatrix::ResizeRowBuffer(int new_maxrow){
     
   }
 
+  if (prefetch){
+    StartPrefetcher();
+  }
 }
 
 
 void BufferedMatrix::ResizeColBuffer(int new_maxcol){
 
   int i,j;
-  int lastcol;
-  int n_cols_remove=0;
-  int n_cols_add=0; 
-  double *tmpptr;
+  int lastcol, new_lastcol;
+  int victim;
   double **tmpptr2;
   int *tmpptr3;
-
-  int *whichadd;
-
-  int curcol;
-  int min_j;
+  char *tmpptr4;
+  int *tmpptr5;
 
 
     /* Fix up any potential clashes */
@@ -952,105 +2392,85 @@ void BufferedMatrix::ResizeColBuffer(int new_maxcol){
     throw "Can't have 0 or negative columns in buffer\n";
   }
 
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    // No column buffer when memory mapped
+    max_cols = new_maxcol;
+    return;
+  }
+
   if (cols < max_cols){
     lastcol = cols;
   } else {
     lastcol = max_cols;
   }
+
+  if (cols < new_maxcol){
+    new_lastcol = cols;
+  } else {
+    new_lastcol = new_maxcol;
+  }
   
 
   if (max_cols == new_maxcol){
     // No need to do anything.
     return;
-  } else if (max_cols > new_maxcol){
+  } else if (new_lastcol < lastcol){
     // Remove columns from the column buffer
-    // Will remove max_col - new_maxcol oldest columns
-    if (new_maxcol < cols){
-      if (max_cols < cols){
-	n_cols_remove = max_cols - new_maxcol;
-      } else{
-	n_cols_remove = cols - new_maxcol;
-      }
-
-
-      for (i=0; i < n_cols_remove; i++){
-	FlushOldestColumn();
-	tmpptr = coldata[0];
-	for (j=1; j < lastcol; j++){
-	  coldata[j-1] = coldata[j];
-	  which_cols[j-1] = which_cols[j];
-	}
-	delete [] tmpptr;
-      }
-      
-      tmpptr2 = coldata;
-      tmpptr3 = which_cols;
-      
-      coldata = new double *[new_maxcol];
-      which_cols = new int[new_maxcol];
+    // Will remove the lastcol - new_lastcol columns the replacement policy picks
+    for (i=lastcol; i > new_lastcol; i--){
+      FlushOldestColumn();
+      victim = VictimSlot();
+      delete [] coldata[victim];
+      col_slot[which_cols[victim]] = -1;
       
-      for (j=0; j < new_maxcol; j++){
-	coldata[j] = tmpptr2[j];
-	which_cols[j] = tmpptr3[j];
+      // Move the last slot into the hole
+      if (victim != i-1){
+	coldata[victim] = coldata[i-1];
+	which_cols[victim] = which_cols[i-1];
+	slot_ref[victim] = slot_ref[i-1];
+	slot_pins[victim] = slot_pins[i-1];
+	col_slot[which_cols[victim]] = victim;
       }
-      delete [] tmpptr2;
-      delete [] tmpptr3;
+      max_cols = i-1;
     }
-    max_cols = new_maxcol;
-
-  } else {
+    clock_hand = 0;
+  } else if (new_lastcol > lastcol){
     // Need to add columns to the column buffer
-    
-    if (new_maxcol < cols){
-      n_cols_add = new_maxcol - max_cols;
-    } else if (max_cols < cols){
-      n_cols_add = cols - max_cols;
-    } else {
-      // there are no more columns to add, everything is already in the buffer
-      n_cols_add = 0;
-      max_cols = new_maxcol;
-      return;
-    }
-    
-    // Figure out which columns to add
     // rule will be to add columns in numerical order (ie column 0 if not it, then 1 if not in and so on)
     
-    whichadd = new int[n_cols_add];
-    
-    min_j=0;
-    for (i=0; i < n_cols_add; i++){
-      for (j=min_j; j < cols; j++){
-	//	printf("j is %d %d ",j, min_j);
-	if(!InColBuffer(0,j,&curcol)){
-	  whichadd[i] = j;
-	  //printf("Adding %d\n",j);
-	  break;
-	}
-      }
-      min_j = j+1;
-    }
-    
-    // Add columns to end of buffer
     tmpptr2 = coldata;
     tmpptr3 = which_cols;
+    tmpptr4 = slot_ref;
+    tmpptr5 = slot_pins;
     
-    coldata = new double *[max_cols+ n_cols_add];
-    which_cols = new int[new_maxcol+ n_cols_add];  
-    for (j=0; j < max_cols; j++){
+    coldata = new double *[new_lastcol];
+    which_cols = new int[new_lastcol];  
+    slot_ref = new char[new_lastcol];
+    slot_pins = new int[new_lastcol];
+    for (j=0; j < lastcol; j++){
       coldata[j] = tmpptr2[j];
       which_cols[j] = tmpptr3[j];
+      slot_ref[j] = tmpptr4[j];
+      slot_pins[j] = tmpptr5[j];
     }
-    
-    for (i=0; i < n_cols_add; i++){
-      LoadAdditionalColumn(whichadd[i], max_cols + i);
+    for (j=lastcol; j < new_lastcol; j++){
+      slot_pins[j] = 0;
     }
     delete [] tmpptr2;
     delete [] tmpptr3;
-    delete [] whichadd;
-
-    max_cols = new_maxcol;
+    delete [] tmpptr4;
+    delete [] tmpptr5;
+    
+    i = lastcol;
+    for (j=0; j < cols && i < new_lastcol; j++){
+      if (col_slot[j] < 0){
+	LoadAdditionalColumn(j, i);
+	i++;
+      }
+    }
   }
 
+  max_cols = new_maxcol;
 
 }
 
@@ -1060,7 +2480,7 @@ void BufferedMatrix::ResizeBuffer(int new_maxrow, int new_maxcol){
 
 
   ResizeColBuffer(new_maxcol);
-  if (!colmode){
+  if (!colmode && storagemode != BUFFEREDMATRIX_STORAGE_MMAP){
     ResizeRowBuffer(new_maxrow);
   } else {
     /* No actual row buffer active. So just increase potential size.
@@ -1081,10 +2501,132 @@ void BufferedMatrix::ResizeBuffer(int new_maxrow, int new_maxcol){
 
 
 
+/******************************************************
+ **
+ ** Automatic buffer sizes
+ **
+ ** MemoryBudget() is the number of bytes of RAM a matrix 
+ ** may use for its buffers: half of the physical memory that
+ ** is currently available (the other half is left for 
+ ** everything else, including any other matrix that is 
+ ** created later). It returns 0 if the available memory 
+ ** can't be found out.
+ **
+ ** ChooseBufferSize() picks buffer sizes for a rows by cols
+ ** matrix within a budget. If the whole matrix fits, every 
+ ** column is kept in the column buffer and true is returned;
+ ** there is then no point in using row mode. Otherwise for 
+ ** column at a time work (rowmode false) the budget goes on
+ ** columns, and for row at a time work (rowmode true) it goes 
+ ** on the row buffer, leaving a single column in the column 
+ ** buffer. Room is left for the read-ahead copy of a column 
+ ** or of the row buffer, and for a few columns worth of sort
+ ** buffers per processor (as used by quantile normalization).
+ ** The results are meant to be passed to the constructor or
+ ** to ResizeBuffer().
+ **
+ ******************************************************/
+
+double BufferedMatrix::MemoryBudget(){
+
+  double avail = 0.0;
+
+#if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__)
+  MEMORYSTATUSEX status;
+  
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status)){
+    avail = (double)status.ullAvailPhys;
+  }
+#else
+  /* MemAvailable counts reclaimable cache, which the free page count does not */
+  FILE *meminfo = fopen("/proc/meminfo","r");
+  char line[128];
+  double kb;
+
+  if (meminfo != 0){
+    while (fgets(line, sizeof(line), meminfo) != 0){
+      if (sscanf(line, "MemAvailable: %lf kB", &kb) == 1){
+	avail = kb*1024.0;
+	break;
+      }
+    }
+    fclose(meminfo);
+  }
+#if defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+  if (avail <= 0.0){
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pagesize > 0){
+      avail = (double)pages*(double)pagesize;
+    }
+  }
+#endif
+#endif
+
+  avail = avail/2.0;
+
+  /* a 32 bit process runs out of address space long before RAM */
+  if (sizeof(void *) < 8 && avail > 1.0e9){
+    avail = 1.0e9;
+  }
+
+  return avail;
+}
+
+
+bool BufferedMatrix::ChooseBufferSize(double budget, int rows, int cols, bool rowmode, int *new_maxrow, int *new_maxcol){
+
+  double column = (double)rows*sizeof(double);  /* bytes in one column */
+  double working;
+  double n;
+  int ncpu = 1;
+
+#if wxUSE_THREADS
+  ncpu = wxThread::GetCPUCount();
+  if (ncpu < 1){
+    ncpu = 1;
+  }
+#endif
+  working = (1 + 3*ncpu)*column;
+
+  if (rows < 1 || cols < 1 || (double)cols*column + working <= budget){
+    *new_maxcol = (cols < 1) ? 1 : cols;
+    *new_maxrow = (rows < 1) ? 1 : rows;
+    return true;
+  }
+
+  /* columns, less one for the read-ahead copy */
+  n = (budget - working)/column - 1;
+  if (n > cols){
+    n = cols;
+  }
+  *new_maxcol = (n < 1) ? 1 : (int)n;
+
+  /* the row buffer and its read-ahead copy, beside a single column */
+  n = (budget - working)/(2.0*cols*sizeof(double));
+  if (n > rows){
+    n = rows;
+  }
+  *new_maxrow = (n < 1000) ? ((rows < 1000) ? rows : 1000) : (int)n;
+
+  if (rowmode){
+    *new_maxcol = 1;
+  }
+
+  return false;
+}
+
+
+
 double &BufferedMatrix::operator()(int row, int col){
   
   int curcol;
 
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    return mapdata[(size_t)col*rows + row];
+  }
+
   if (!colmode){
     /* Fix up any potential clashes */
     if (rowcolclash){
@@ -1113,16 +2655,24 @@ double &BufferedMatrix::operator()(int row, int col){
 	FlushRowBuffer();
       
 	/* Now flush the column buffer (for oldest column) */
-	FlushOldestColumn();
+	if (storagemode != BUFFEREDMATRIX_STORAGE_COMPRESSED){
+	  FlushOldestColumn();
+	}
       }
       
       /* Now fill up the buffer */
       /* read in this row and surrounding rows into row buffer */
       LoadRowBuffer(row);
       
-      /* read in this column into column buffer */
-      LoadNewColumn(col);
+      /* read in this column into column buffer. Not worth it with compressed 
+         storage, where a whole column costs far more to read and write back 
+         than the rows that are wanted */
+      if (storagemode != BUFFEREDMATRIX_STORAGE_COMPRESSED){
+	LoadNewColumn(col);
+      }
       
+      /* read ahead while the caller works on these rows */
+      PrefetchFollowingRows();
       
       SetClash(row,col);
       return rowdata[col][row - first_rowdata];
@@ -1134,8 +2684,8 @@ double &BufferedMatrix::operator()(int row, int col){
     } else {
       if (!readonly)
 	FlushOldestColumn(); 
-      LoadNewColumn(col);
-      return coldata[max_cols -1][row];
+      curcol = LoadNewColumn(col);
+      return coldata[curcol][row];
     }
   }
 
@@ -1168,12 +2718,27 @@ void BufferedMatrix::RowMode(){
  **             - copy across relevant data that is in column buffer
  **             - set colmode flag to false
  */
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    colmode = false;
+    return;
+  }
+  if (pinned > 0){
+    /* writes through the pinned pointer would not be seen in the row buffer */
+    throw "Can't switch to row mode while a column is pinned\n";
+  }
   rowdata = new double *[cols +1];
   for (j =0; j < cols; j++){
     rowdata[j] = new double[this->max_rows];
   }
+  /* any column read-ahead is of no further use */
+  StopPrefetcher();
   LoadRowBuffer(0); /* this both fills the row buffer and copys across anything in the current column buffer */
   colmode =false;
+  
+  if (prefetch){
+    StartPrefetcher();
+    PrefetchFollowingRows();
+  }
 
 }
 
@@ -1187,6 +2752,13 @@ void BufferedMatrix::ColMode(){
  **            - set colmode flag to true
  ** */
 
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    colmode = true;
+    return;
+  }
+
+  StopPrefetcher();
+
   if (rowcolclash){
     ClearClash();
   }
@@ -1197,6 +2769,10 @@ void BufferedMatrix::ColMode(){
   }
   delete [] rowdata;
   colmode = true;
+
+  if (prefetch){
+    StartPrefetcher();
+  }
 }
 
 
@@ -1213,7 +2789,7 @@ void BufferedMatrix::ReadOnlyMode(bool setting=false){
   */
 
 
-  if (!readonly && setting){
+  if (!readonly && setting && storagemode != BUFFEREDMATRIX_STORAGE_MMAP){
     if (!colmode){
       if (rowcolclash){
 	ClearClash();
@@ -1264,8 +2840,10 @@ void BufferedMatrix::GetFullColumn(int col, double *dest){
   int row = 0;
   int curcol;
 
-  int i;
-
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    memcpy(dest,&mapdata[(size_t)col*rows],rows*sizeof(double));
+    return;
+  }
 
   if (colmode){
     /* In column mode all we need to do is see if column is in buffer
@@ -1278,8 +2856,8 @@ void BufferedMatrix::GetFullColumn(int col, double *dest){
 	FlushOldestColumn();
       }
       /* read in this column into column buffer */
-      LoadNewColumn(col);
-      memcpy(dest,&coldata[max_cols -1][0],rows*sizeof(double));
+      curcol = LoadNewColumn(col);
+      memcpy(dest,&coldata[curcol][0],rows*sizeof(double));
     } else {
       memcpy(dest,&coldata[curcol][0],rows*sizeof(double));
     }
@@ -1287,11 +2865,476 @@ void BufferedMatrix::GetFullColumn(int col, double *dest){
     /* we are in row mode */
     /* Need to copy out the data */
 
-    for (i =0; i < rows; i++){
-      dest[i] = (true,i,col);
+    if (rowcolclash){
+      ClearClash();
+    }
+
+    if (InColBuffer(row,col,&curcol)){
+      /* with clashes cleared the column buffer agrees with the row buffer */
+      memcpy(dest,&coldata[curcol][0],rows*sizeof(double));
+    } else {
+      /* Read the column straight from storage without disturbing the column buffer,
+	 then lay the (possibly newer) rows from the row buffer over the top */
+      WaitForPrefetch();
+      StorageReadColumn(col, dest);
+      memcpy(&dest[first_rowdata],rowdata[col],max_rows*sizeof(double));
+    }
+  }
+
+}
+
+
+
+/******************************************************
+ **
+ ** Bulk access
+ **
+ ** Going through operator() costs a clash check and 
+ ** buffer lookups for every single value. The following
+ ** move a whole range of values between the matrix and a
+ ** caller supplied buffer at once:
+ **
+ ** GetColumnSpan/SetColumnSpan - rows first_row to 
+ **          first_row+n-1 of a single column.
+ ** GetRowSpan/SetRowSpan - rows first_row to first_row+n-1
+ **          of every column. The caller buffer is n by cols
+ **          in column major order (ie column j starts at j*n).
+ **          These are meant for row mode.
+ **
+ ** PinColumn() makes sure a column is in the column buffer 
+ ** and returns a pointer to it. The column will not be replaced
+ ** until UnpinColumn() is called, so the pointer may be used to 
+ ** read or write the column directly in the mean time. Columns 
+ ** may only be pinned in column mode, and no columns may be added
+ ** while a column is pinned.
+ **
+ ** PinColumn() and UnpinColumn() (but nothing else) may be called
+ ** from several threads at once, so long as each thread works on
+ ** different columns and holds at most one pin when it asks for
+ ** another column. No more than ColumnWorkers() threads should do
+ ** this at a time, see RunColumnWorkers().
+ **
+ ******************************************************/
+
+
+/* make sure col is in the column buffer, returns its slot */
+
+int BufferedMatrix::ColumnSlot(int col){
+
+  int curcol;
+
+  if (InColBuffer(0,col,&curcol)){
+    return curcol;
+  }
+
+  if (!readonly){
+    FlushOldestColumn();
+  }
+  curcol = LoadNewColumn(col);
+
+  if (!colmode){
+    /* The row buffer may be newer than what is in storage */
+    memcpy(&coldata[curcol][first_rowdata], rowdata[col], max_rows*sizeof(double));
+  }
+
+  return curcol;
+}
+
+
+/* row mode only, refill the row buffer so that it contains row */
+
+void BufferedMatrix::MoveRowBuffer(int row){
+
+  if (!readonly){
+    FlushRowBuffer();
+  }
+  LoadRowBuffer(row);
+  PrefetchFollowingRows();
+
+}
+
+
+
+void BufferedMatrix::GetColumnSpan(int col, int first_row, int n, double *dest){
+
+  int curcol;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    memcpy(dest,&mapdata[(size_t)col*rows + first_row],n*sizeof(double));
+    return;
+  }
+
+  if (!colmode){
+    if (rowcolclash){
+      ClearClash();
+    }
+    if (first_row >= first_rowdata && first_row + n <= first_rowdata + max_rows){
+      memcpy(dest,&rowdata[col][first_row - first_rowdata],n*sizeof(double));
+      return;
+    }
+  }
+
+  /* In row mode the column buffer agrees with the row buffer once clashes are cleared */
+  curcol = ColumnSlot(col);
+  memcpy(dest,&coldata[curcol][first_row],n*sizeof(double));
+
+}
+
+
+
+void BufferedMatrix::SetColumnSpan(int col, int first_row, int n, const double *src){
+
+  int curcol;
+  int lo, hi;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    memcpy(&mapdata[(size_t)col*rows + first_row],src,n*sizeof(double));
+    return;
+  }
+
+  if (!colmode){
+    if (rowcolclash){
+      ClearClash();
+    }
+    if (first_row >= first_rowdata && first_row + n <= first_rowdata + max_rows && col_slot[col] < 0){
+      memcpy(&rowdata[col][first_row - first_rowdata],src,n*sizeof(double));
+      return;
+    }
+  }
+
+  curcol = ColumnSlot(col);
+  memcpy(&coldata[curcol][first_row],src,n*sizeof(double));
+
+  if (!colmode){
+    /* keep the overlapping part of the row buffer in step */
+    lo = (first_row > first_rowdata) ? first_row : first_rowdata;
+    hi = (first_row + n < first_rowdata + max_rows) ? first_row + n : first_rowdata + max_rows;
+    if (lo < hi){
+      memcpy(&rowdata[col][lo - first_rowdata],&src[lo - first_row],(hi - lo)*sizeof(double));
+    }
+  }
+
+}
+
+
+
+void BufferedMatrix::GetRowSpan(int first_row, int n, double *dest){
+
+  int j, curcol;
+  int row, len;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP || colmode){
+    for (j=0; j < cols; j++){
+      GetColumnSpan(j, first_row, n, &dest[(size_t)j*n]);
+    }
+    return;
+  }
+
+  if (rowcolclash){
+    ClearClash();
+  }
+
+  if (n <= max_rows && !(InRowBuffer(first_row,0) && InRowBuffer(first_row + n - 1,0))){
+    /* move the buffer once, to hold the whole span if it can, rather than picking up the rest part way through */
+    MoveRowBuffer(first_row);
+  }
+
+  row = first_row;
+  while (row < first_row + n){
+    if (!InRowBuffer(row,0)){
+      MoveRowBuffer(row);
+    }
+    len = first_rowdata + max_rows - row;
+    if (len > first_row + n - row){
+      len = first_row + n - row;
+    }
+    for (j=0; j < cols; j++){
+      memcpy(&dest[(size_t)j*n + row - first_row],&rowdata[j][row - first_rowdata],len*sizeof(double));
+    }
+    row += len;
+  }
+
+  /* note the columns used, as operator() would */
+  for (j=0; j < cols; j++){
+    curcol = col_slot[j];
+    if (curcol >= 0){
+      slot_ref[curcol] = 1;
+    }
+  }
+
+}
+
+
+
+void BufferedMatrix::SetRowSpan(int first_row, int n, const double *src){
+
+  int j, curcol;
+  int row, len;
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP || colmode){
+    for (j=0; j < cols; j++){
+      SetColumnSpan(j, first_row, n, &src[(size_t)j*n]);
+    }
+    return;
+  }
+
+  if (rowcolclash){
+    ClearClash();
+  }
+
+  /* columns that are also in the column buffer are written there too, so there is nothing 
+     to clash. This is done first since moving the row buffer copies from the column buffer */
+  for (j=0; j < cols; j++){
+    curcol = col_slot[j];
+    if (curcol >= 0){
+      memcpy(&coldata[curcol][first_row],&src[(size_t)j*n],n*sizeof(double));
+      slot_ref[curcol] = 1;
+    }
+  }
+
+  if (n <= max_rows && !(InRowBuffer(first_row,0) && InRowBuffer(first_row + n - 1,0))){
+    /* move the buffer once, to hold the whole span if it can, rather than picking up the rest part way through */
+    MoveRowBuffer(first_row);
+  }
+
+  row = first_row;
+  while (row < first_row + n){
+    if (!InRowBuffer(row,0)){
+      MoveRowBuffer(row);
+    }
+    len = first_rowdata + max_rows - row;
+    if (len > first_row + n - row){
+      len = first_row + n - row;
+    }
+    for (j=0; j < cols; j++){
+      memcpy(&rowdata[j][row - first_rowdata],&src[(size_t)j*n + row - first_row],len*sizeof(double));
+    }
+    row += len;
+  }
+
+}
+
+
+
+double *BufferedMatrix::PinColumn(int col){
+
+  int curcol;
+
+#if wxUSE_THREADS
+  wxMutexLocker lock(*pin_lock);
+#endif
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    pinned++;
+    return &mapdata[(size_t)col*rows];
+  }
+
+  if (!colmode){
+    throw "Can't pin a column while in row mode\n";
+  }
+
+  curcol = ColumnSlot(col);
+  slot_pins[curcol]++;
+  pinned++;
+  
+  return coldata[curcol];
+}
+
+
+
+void BufferedMatrix::UnpinColumn(int col){
+
+  int curcol;
+
+#if wxUSE_THREADS
+  wxMutexLocker lock(*pin_lock);
+#endif
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    pinned--;
+    return;
+  }
+
+  curcol = col_slot[col];
+  if (curcol < 0 || slot_pins[curcol] == 0){
+    throw "Unpinning a column that is not pinned\n";
+  }
+  slot_pins[curcol]--;
+  pinned--;
+
+}
+
+
+
+/******************************************************
+ **
+ ** int BufferedMatrix::ColumnWorkers()
+ **
+ ** How many threads may usefully work on their own pinned
+ ** column at once. This is the number of processors, but
+ ** (unless every column is already buffered) no more than the 
+ ** number of columns in the column buffer. That guarantees there
+ ** is always an unpinned slot for a thread that is about to pin 
+ ** its next column.
+ **
+ ******************************************************/
+
+int BufferedMatrix::ColumnWorkers(){
+
+  int n = 1;
+
+#if wxUSE_THREADS
+  n = wxThread::GetCPUCount();
+  if (n < 1){
+    n = 1;
+  }
+  if (storagemode != BUFFEREDMATRIX_STORAGE_MMAP && cols > max_cols && n > max_cols){
+    n = max_cols;
+  }
+#endif
+
+  return n;
+}
+
+
+
+/******************************************************
+ **
+ ** int BufferedMatrix::PinnableColumns()
+ **
+ ** The most columns that may be pinned at once, or 0
+ ** if there is no limit (memory mapped storage). Pinning
+ ** this many leaves no slot for any other column, so code
+ ** that also uses other columns at the same time should
+ ** pin at least one fewer.
+ **
+ ******************************************************/
+
+int BufferedMatrix::PinnableColumns(){
+
+  if (storagemode == BUFFEREDMATRIX_STORAGE_MMAP){
+    return 0;
+  }
+  return max_cols;
+}
+
+
+
+/******************************************************
+ **
+ ** Column workers
+ **
+ ** RunColumnWorkers() hands out the columns first to 
+ ** first+n-1, one at a time, to the threads as they become free.
+ ** If work() throws (a const char *, as everything here does) 
+ ** no further columns are started and the message is thrown 
+ ** again in the calling thread once all the threads have finished.
+ **
+ ******************************************************/
+
+class BufferedMatrixColumnQueue
+{
+ public:
+  int next;          /* next column to be handed out */
+  int last;          /* one past the final column */
+  void (*work)(int col, void *arg);
+  void *arg;
+  const char *error; /* first message thrown by work(), 0 if none */
+#if wxUSE_THREADS
+  wxMutex lock;      /* protects next and error */
+#endif
+
+  void Run(){
+    int col;
+    
+    while (true){
+#if wxUSE_THREADS
+      lock.Lock();
+#endif
+      if (error != 0 || next >= last){
+#if wxUSE_THREADS
+	lock.Unlock();
+#endif
+	return;
+      }
+      col = next++;
+#if wxUSE_THREADS
+      lock.Unlock();
+#endif
+      try {
+	work(col, arg);
+      } catch (const char *e){
+#if wxUSE_THREADS
+	wxMutexLocker locker(lock);
+#endif
+	if (error == 0){
+	  error = e;
+	}
+      }
+    }
+  }
+};
+
+
+#if wxUSE_THREADS
+class BufferedMatrixColumnWorker : public wxThread
+{
+ public:
+  BufferedMatrixColumnWorker(BufferedMatrixColumnQueue *q) : wxThread(wxTHREAD_JOINABLE), queue(q) {}
+
+ protected:
+  ExitCode Entry(){
+    queue->Run();
+    return 0;
+  }
+
+ private:
+  BufferedMatrixColumnQueue *queue;
+};
+#endif
+
+
+void RunColumnWorkers(int first, int n, int nthreads, void (*work)(int col, void *arg), void *arg){
+
+  BufferedMatrixColumnQueue queue;
+
+  queue.next = first;
+  queue.last = first + n;
+  queue.work = work;
+  queue.arg = arg;
+  queue.error = 0;
+
+  if (nthreads > n){
+    nthreads = n;
+  }
+
+#if wxUSE_THREADS
+  std::vector<BufferedMatrixColumnWorker *> workers;
+  int i;
+
+  for (i=1; i < nthreads; i++){
+    BufferedMatrixColumnWorker *worker = new BufferedMatrixColumnWorker(&queue);
+    if (worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR){
+      /* carry on with the threads we have */
+      delete worker;
+      break;
     }
+    workers.push_back(worker);
+  }
+#endif
+
+  queue.Run();
+
+#if wxUSE_THREADS
+  for (i=0; i < (int)workers.size(); i++){
+    workers[i]->Wait();
+    delete workers[i];
   }
+#endif
 
+  if (queue.error != 0){
+    throw queue.error;
+  }
 }
 
 
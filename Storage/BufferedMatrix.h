@@ -2,13 +2,39 @@
 #define BUFFERED_MATRIX_H
 
 #include <wx/wx.h>
+#include <cstdio>
+
+#if defined(_WIN32) && !defined(__CYGWIN32__) && !defined(__CYGWIN__)
+typedef __int64 bm_offset;   /* file offsets, may exceed 2GB */
+#else
+#include <sys/types.h>
+typedef off_t bm_offset;
+#endif
+
+/* Ways in which the data not currently held in the RAM buffers may be stored */
+#define BUFFEREDMATRIX_STORAGE_FILES 0   /* one temporary file per column (the default) */
+#define BUFFEREDMATRIX_STORAGE_MMAP 1    /* whole matrix in a single memory mapped temporary file */
+#define BUFFEREDMATRIX_STORAGE_TILED 2   /* single temporary file arranged in tiles of rows */
+#define BUFFEREDMATRIX_STORAGE_COMPRESSED 3 /* one temporary file per column, compressed in chunks of rows (needs zlib) */
+
+class BufferedMatrixPrefetcher;
+class wxMutex;
+class wxCondition;
 
 class BufferedMatrix
 {
+  friend class BufferedMatrixPrefetcher;
+
  public:
   BufferedMatrix(int max_cols=40, int max_rows=1000, const char *prefix="bufmat");
   void SetRows(int);
   void SetPrefix(char *prefix);
+  void SetStorageMode(int mode);
+  int GetStorageMode();
+  void SetTileRows(int tilerows);
+  int GetTileRows();
+  void SetSinglePrecisionStorage(bool setting);
+  bool GetSinglePrecisionStorage();
   double &operator[](unsigned long i);
   double &operator()(int row, int col);
   
@@ -16,6 +42,8 @@ class BufferedMatrix
   
   void AddColumn();
   //void AddColumn(double *x);
+  void RemoveLastColumn();
+  int Cols();
   ~BufferedMatrix();
   void ResizeColBuffer(int new_maxcol);
   void ResizeRowBuffer(int new_maxrow);
@@ -28,6 +56,24 @@ class BufferedMatrix
 
   void GetFullColumn(int col, double *dest);
 
+  void GetColumnSpan(int col, int first_row, int n, double *dest);
+  void SetColumnSpan(int col, int first_row, int n, const double *src);
+  void GetRowSpan(int first_row, int n, double *dest);
+  void SetRowSpan(int first_row, int n, const double *src);
+
+  double *PinColumn(int col);
+  void UnpinColumn(int col);
+  int ColumnWorkers();
+  int PinnableColumns();
+
+  void SetPrefetch(bool setting);
+  long GetPrefetchHits();
+  long GetPrefetchMisses();
+  void ResetPrefetchCounters();
+
+  static double MemoryBudget();
+  static bool ChooseBufferSize(double budget, int rows, int cols, bool rowmode, int *new_maxrow, int *new_maxcol);
+
  private:
   void SetClash(int row, int col);
   void ClearClash();
@@ -38,10 +84,39 @@ class BufferedMatrix
   void FlushOldestColumn();
   void FlushAllColumns();
 
-  void LoadNewColumn(int col);
+  int LoadNewColumn(int col);
+  int VictimSlot();
   void LoadRowBuffer(int row);
 
   void LoadAdditionalColumn(int col, int where);
+  int ColumnSlot(int col);
+  void MoveRowBuffer(int row);
+  int RowBufferStart(int row);
+
+  void StartPrefetcher();
+  void StopPrefetcher();
+  void PrefetchLoop();
+  void RequestPrefetch(int first);
+  void RequestColumnPrefetch(int col);
+  void PrefetchFollowingRows();
+  void PrefetchFollowingColumn(int col);
+  void WaitForPrefetch();
+  void DiscardPrefetch();
+  void PatchPrefetchColumn(int col, double *src);
+  void PatchPrefetchRows(int first, int n, double **src);
+
+  void AddMappedColumn();
+
+  FILE *CreateTempFile(char **name, const char *mode);
+  bm_offset TileOffset(int row, int col);
+  void StorageAddColumn(double *src);
+  void StorageReadColumn(int col, double *dest);
+  void StorageWriteColumn(int col, double *src);
+  void StorageReadRows(int first, int n, double **dest);
+  void StorageWriteRows(int first, int n, double **src);
+  void ChunkRead(FILE *myfile, int col, int chunk, double *dest);
+  void ChunkWrite(FILE *myfile, int col, int chunk, double *src);
+  int ChunkRows(int chunk);
 
   int rows;  // number of rows in matrix
   int cols;  // number of cols in matrix
@@ -67,10 +142,26 @@ class BufferedMatrix
   
   int first_rowdata; /* matrix index of first row stored in rowdata  should be from 0 to rows */
 
-  int *which_cols; /* vector containing indices of columns currently in col data. The 
-                      "oldest" indice is first indice. Newest indicit is last indice. 
+  int *which_cols; /* vector containing indices of columns currently in col data. 
+                      coldata[k] holds column which_cols[k] 
                        Note that the length this will be is min(cols, max_cols) */
 
+  int *col_slot;   /* for each column of the matrix, where it is in coldata or -1 if 
+                      it is not in the column buffer. Length is cols */
+
+  char *slot_ref;  /* CLOCK reference bits, one for each slot in coldata. Set when 
+                      the column in that slot is used */
+  
+  int clock_hand;  /* next slot the CLOCK replacement policy will consider */
+
+  int *slot_pins;  /* number of times the column in each slot of coldata is pinned
+                      (see PinColumn()). Pinned slots are never replaced */
+
+  int pinned;      /* total number of outstanding pins */
+
+  wxMutex *pin_lock; /* held by PinColumn() and UnpinColumn() so that several threads 
+                        may each work on their own pinned column */
+
 
   char **filenames; /* contains names of temporary files where data is stored  */
 
@@ -94,11 +185,67 @@ class BufferedMatrix
 			going to occur.
 			
 			If false then flush as normal (this is the default situation) */
+
+  int storagemode;   /* One of the BUFFEREDMATRIX_STORAGE_ values. */
+
+  bool singleprecision; /* If true values are stored in the temporary file(s) as float */
+  int elementsize;      /* sizeof(float) or sizeof(double) to match */
+
+  /* The following are only used when storagemode is BUFFEREDMATRIX_STORAGE_MMAP.
+     In that case coldata, rowdata and filenames are not used. Instead the entire
+     matrix (column major order) is kept in a single temporary file which is
+     mapped into memory. The kernel's page cache then decides what is 
+     actually resident in RAM */
+
+  double *mapdata;   /* start of mapping, column j starts at mapdata[j*rows] */
+  int map_capacity;  /* number of columns the mapped file currently has room for */
+  int map_fd;        /* file descriptor for the mapped file */
+  char *mapfilename; /* name of the mapped temporary file */
+
+  /* The following are only used when storagemode is BUFFEREDMATRIX_STORAGE_TILED.
+     Then filenames is not used. */
+
+  int tile_rows;     /* number of rows in each tile (also each compressed chunk) */
+  int tile_capacity; /* number of columns each tile currently has room for */
+  FILE *tilefile;    /* the (always open) tiled temporary file */
+  char *tilefilename; /* its name */
+
+  /* The following are only used when storagemode is BUFFEREDMATRIX_STORAGE_COMPRESSED.
+     There is still one file per column (filenames), but it holds the column as 
+     independently compressed chunks of tile_rows rows, in whatever order they 
+     were last written. */
+
+  bm_offset **chunk_offset; /* chunk_offset[j][c] is where chunk c of column j starts in its file */
+  int **chunk_length;       /* and its compressed length in bytes. 0 if never written (all zero) */
+  int **chunk_space;        /* and the room it has there, at least chunk_length */
+  bm_offset *chunk_end;     /* end of the last chunk written to each column's file */
+
+  /* Read-ahead. In row mode a background thread reads the next block of rows 
+     into prefetchdata while the current block is being worked on. In column mode 
+     it reads the column after the one last loaded into prefetchcol.
+     prefetch_state, prefetch_first, prefetch_col and prefetch_quit are protected 
+     by prefetch_lock */
+
+  bool prefetch;            /* If true then use the prefetch thread */
+  BufferedMatrixPrefetcher *prefetcher; /* the thread, 0 if not running */
+  double **prefetchdata;    /* second row buffer, same shape as rowdata (row mode only) */
+  double *prefetchcol;      /* one spare column (column mode only) */
+  int prefetch_first;       /* matrix index of first row in prefetchdata */
+  int prefetch_col;         /* column being read into prefetchcol, -1 when reading rows */
+  int prefetch_previous;    /* last column loaded in column mode, gives the direction to read ahead */
+  int prefetch_state;       /* idle, requested (being read) or ready */
+  bool prefetch_quit;       /* tells the thread to finish */
+  wxMutex *prefetch_lock;
+  wxCondition *prefetch_cond; /* signalled when prefetch_state changes */
+  long prefetch_hits;       /* row buffer (or column) loads satisfied by read-ahead */
+  long prefetch_misses;     /* row buffer (or column) loads that had to read from disk */
   
 };
 
 
-
+/* Calls work(col, arg) for col = first, ..., first+n-1 using up to nthreads threads
+   (one of which is the calling thread). Returns once every call has finished */
+void RunColumnWorkers(int first, int n, int nthreads, void (*work)(int col, void *arg), void *arg);
 
 
 
@@ -32,6 +32,7 @@
  ** History
  ** Aug 11, 2003 - Initial version
  ** Oct 18, 2004 - small memory problem fixed
+ ** Oct 17, 2026 - Add RemoveLastColumn()
  **
  **
  *****************************************************/
@@ -173,6 +174,15 @@ void Matrix::AddColumn(double *x){
 }
 
 
+void Matrix::RemoveLastColumn(){
+
+  if (cols > 0){
+    cols--;
+    delete [] data[cols];
+  }
+}
+
+
 Matrix::~Matrix(){
   int i;
 
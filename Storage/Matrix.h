@@ -11,6 +11,7 @@ class Matrix
   double &operator[](unsigned long i);
   void AddColumn();
   void AddColumn(double *x);
+  void RemoveLastColumn();
   int Rows();
   int Cols();
   ~Matrix();
@@ -0,0 +1,144 @@
+/*****************************************************
+ **
+ ** file: bench_BufferedMatrix.cpp
+ **
+ ** aim: Time a BufferedMatrix on the access pattern of an RMA run.
+ **      background (column at a time), quantile normalization
+ **      (every column read then written) then median polish
+ **      style summarization (row mode, a small block of rows at a
+ **      time across every column, values written back)
+ **
+ ** Only the long standing public interface is used, so this will
+ ** build against older versions of BufferedMatrix for comparison.
+ ** (The storage mode argument is ignored by versions without 
+ ** SetStorageMode())
+ **
+ ** usage: bench_BufferedMatrix rows cols bufrows bufcols [prefix [storagemode]]
+ **
+ ** History
+ ** Oct 17, 2026 - Initial version
+ ** Oct 17, 2026 - Optional storage mode argument
+ **
+ *****************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+
+#include <wx/stopwatch.h>
+
+#include "Storage/BufferedMatrix.h"
+
+
+static double checksum(BufferedMatrix &x, int rows, int cols){
+
+  double sum = 0.0;
+  std::vector<double> buffer(rows);
+  int i, j;
+
+  for (j = 0; j < cols; j++){
+    x.GetFullColumn(j, &buffer[0]);
+    for (i = 0; i < rows; i++){
+      sum += buffer[i];
+    }
+  }
+  return sum;
+}
+
+
+int main(int argc, char **argv){
+
+  int rows, cols, bufrows, bufcols;
+  int i, j, k, first;
+  int probeset_size = 11;
+  const char *prefix = "/tmp/bench_BufferedMatrix";
+  int storagemode = 0;
+  wxStopWatch timer;
+  long t_fill, t_bg, t_qnorm, t_summarize;
+
+  if (argc < 5){
+    printf("usage: %s rows cols bufrows bufcols [prefix [storagemode]]\n", argv[0]);
+    return 1;
+  }
+  rows = atoi(argv[1]);
+  cols = atoi(argv[2]);
+  bufrows = atoi(argv[3]);
+  bufcols = atoi(argv[4]);
+  if (argc > 5){
+    prefix = argv[5];
+  }
+  if (argc > 6){
+    storagemode = atoi(argv[6]);
+  }
+
+  BufferedMatrix x(bufrows, bufcols, prefix);
+#ifdef BUFFEREDMATRIX_STORAGE_FILES
+  x.SetStorageMode(storagemode);
+#endif
+  x.SetRows(rows);
+
+  std::vector<double> buffer(rows);
+  std::vector<double> row_mean(rows, 0.0);
+
+  srand(1);
+  timer.Start();
+  for (j = 0; j < cols; j++){
+    x.AddColumn();
+    for (i = 0; i < rows; i++){
+      x(i, j) = 64.0 + rand()%10000;
+    }
+  }
+  t_fill = timer.Time();
+
+  /* background: each column in turn */
+  timer.Start();
+  for (j = 0; j < cols; j++){
+    for (i = 0; i < rows; i++){
+      x(i, j) = x(i, j) - 32.0;
+    }
+  }
+  t_bg = timer.Time();
+
+  /* quantile normalization: sort every column to form the mean, then
+     write back the values in order. (Ranks are not tracked here, just the access pattern) */
+  timer.Start();
+  for (j = 0; j < cols; j++){
+    x.GetFullColumn(j, &buffer[0]);
+    std::sort(buffer.begin(), buffer.end());
+    for (i = 0; i < rows; i++){
+      row_mean[i] += buffer[i]/cols;
+    }
+  }
+  for (j = 0; j < cols; j++){
+    for (i = 0; i < rows; i++){
+      x(i, j) = row_mean[i];
+    }
+  }
+  t_qnorm = timer.Time();
+
+  /* summarization: probesets are blocks of adjacent rows */
+  timer.Start();
+  x.RowMode();
+  for (first = 0; first < rows; first += probeset_size){
+    for (j = 0; j < cols; j++){
+      for (k = first; k < first + probeset_size && k < rows; k++){
+	x(k, j) = log(x(k, j))/log(2.0);
+      }
+    }
+  }
+  x.ColMode();
+  t_summarize = timer.Time();
+
+  printf("rows %d cols %d buffer rows %d buffer cols %d storage mode %d\n", rows, cols, bufrows, bufcols, storagemode);
+  printf("fill        %8ld ms\n", t_fill);
+  printf("background  %8ld ms\n", t_bg);
+  printf("qnorm       %8ld ms\n", t_qnorm);
+  printf("summarize   %8ld ms\n", t_summarize);
+  printf("total       %8ld ms\n", t_bg + t_qnorm + t_summarize);
+  printf("checksum %.6g\n", checksum(x, rows, cols));
+
+  return 0;
+}
@@ -0,0 +1,148 @@
+/*****************************************************
+ **
+ ** file: bench_CELParsing.cpp
+ **
+ ** aim: Time reading the intensities of a text CEL file, using
+ **      the block reader read_cel_file_intensities() and the original
+ **      line at a time read_cel_file_intensities_bylines(), and check
+ **      that they agree.
+ **
+ ** If no CEL file is given a synthetic one of the given dimensions
+ ** (by default those of an HG-U133 Plus 2 array) is written first.
+ ** Times are the best of the repeats.
+ **
+ ** usage: bench_CELParsing [celfile [repeats]]
+ **        bench_CELParsing -synthetic [dim [repeats [filename]]]
+ **
+ ** History
+ ** Oct 17, 2026 - Initial version
+ **
+ *****************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <wx/stopwatch.h>
+#include <wx/string.h>
+
+#include "Parsing/read_celfile_text.h"
+
+
+static void write_synthetic_cel(const char *filename, int dim){
+
+  FILE *out = fopen(filename, "wb");
+  int x, y;
+  double mean;
+
+  if (out == NULL){
+    printf("Could not write %s\n", filename);
+    exit(1);
+  }
+
+  srand(1);
+  fprintf(out, "[CEL]\r\nVersion=3\r\n\r\n[HEADER]\r\n");
+  fprintf(out, "Cols=%d\r\nRows=%d\r\nTotalX=%d\r\nTotalY=%d\r\n", dim, dim, dim, dim);
+  fprintf(out, "DatHeader=[0..46101]  Synthetic:CLS=%d RWS=%d XIN=1  YIN=1  VE=30        2.0 01/01/26 00:00:00       \024  \024 HG-U133_Plus_2.1sq \024  \024  \024  \024  \024  \024  \024  \024  \024 6\r\n", dim, dim);
+  fprintf(out, "Algorithm=Percentile\r\nAlgorithmParameters=Percentile:75;CellMargin:2\r\n\r\n");
+  fprintf(out, "[INTENSITY]\r\nNumberCells=%d\r\nCellHeader=X\tY\tMEAN\tSTDV\tNPIXELS\r\n", dim*dim);
+  for (y = 0; y < dim; y++){
+    for (x = 0; x < dim; x++){
+      mean = 20.0 + (rand()%200000)/10.0;
+      fprintf(out, "%3d\t%3d\t%.1f\t%.1f\t%3d\r\n", x, y, mean, mean/8.0, 16);
+    }
+  }
+  fprintf(out, "\r\n[MASKS]\r\nNumberCells=0\r\nCellHeader=X\tY\r\n\r\n[OUTLIERS]\r\nNumberCells=0\r\nCellHeader=X\tY\r\n");
+  fclose(out);
+}
+
+
+static long best_time(int (*reader)(const char *, double *, int, int, int, int), const char *filename, double *intensity, int length, int dim1, int repeats, int *err){
+
+  wxStopWatch timer;
+  long t, best = -1;
+  int r;
+
+  for (r = 0; r < repeats; r++){
+    timer.Start();
+    *err = reader(filename, intensity, 0, length, 1, dim1);
+    t = timer.Time();
+    if (best < 0 || t < best){
+      best = t;
+    }
+  }
+  return best;
+}
+
+
+int main(int argc, char **argv){
+
+  const char *filename = "/tmp/bench_CELParsing.CEL";
+  int dim = 1164;
+  int repeats = 5;
+  int dim1, dim2, err_code = 0, err_block, err_lines;
+  int length, i, differences;
+  char *cdfName;
+  long t_block, t_lines;
+  double megabytes;
+  FILE *in;
+
+  if (argc > 1 && strcmp(argv[1], "-synthetic") == 0){
+    if (argc > 2){
+      dim = atoi(argv[2]);
+    }
+    if (argc > 3){
+      repeats = atoi(argv[3]);
+    }
+    if (argc > 4){
+      filename = argv[4];
+    }
+    write_synthetic_cel(filename, dim);
+  } else if (argc > 1){
+    filename = argv[1];
+    if (argc > 2){
+      repeats = atoi(argv[2]);
+    }
+  } else {
+    write_synthetic_cel(filename, dim);
+  }
+
+  try {
+    cdfName = get_header_info(filename, &dim1, &dim2, &err_code);
+  } catch (wxString &Error){
+    printf("%s", (const char *)Error.mb_str());
+    return 1;
+  }
+  if (cdfName == NULL){
+    printf("Could not read the header of %s (error %d)\n", filename, err_code);
+    return 1;
+  }
+  free(cdfName);
+  length = dim1*dim2;
+
+  in = fopen(filename, "rb");
+  fseek(in, 0, SEEK_END);
+  megabytes = ftell(in)/1048576.0;
+  fclose(in);
+
+  std::vector<double> block(length, -1.0);
+  std::vector<double> lines(length, -2.0);
+
+  t_lines = best_time(read_cel_file_intensities_bylines, filename, &lines[0], length, dim1, repeats, &err_lines);
+  t_block = best_time(read_cel_file_intensities, filename, &block[0], length, dim1, repeats, &err_block);
+
+  differences = 0;
+  for (i = 0; i < length; i++){
+    if (block[i] != lines[i]){
+      differences++;
+    }
+  }
+
+  printf("%s: %d x %d, %.1f MB, best of %d\n", filename, dim1, dim2, megabytes, repeats);
+  printf("line at a time  %6ld ms  %8.1f MB/s  (returned %d)\n", t_lines, megabytes/(t_lines > 0 ? t_lines : 1)*1000.0, err_lines);
+  printf("block read      %6ld ms  %8.1f MB/s  (returned %d)\n", t_block, megabytes/(t_block > 0 ? t_block : 1)*1000.0, err_block);
+  printf("intensities differing: %d\n", differences);
+
+  return (differences != 0 || err_block != err_lines);
+}
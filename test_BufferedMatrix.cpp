@@ -1,5 +1,115 @@
-#include "BufferedMatrix.h"
-#include <iostream.h>
+#include "Storage/BufferedMatrix.h"
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+
+/* Fills a rows by cols matrix a column at a time, as the arrays are
+   read in, then reads and rewrites it all over the place in column mode
+   and in row mode, so that the column and row buffers keep being
+   written out and read back. Everything is compared with a plain copy.
+   The values are whole numbers so that they are stored exactly in 
+   single precision too. Returns how many values were wrong */
+
+static int check_matrix(BufferedMatrix &m, int rows, int cols){
+
+  int i, j, n;
+  unsigned int k;
+  int failures = 0;
+  vector<double> expected((size_t)rows*cols);
+  vector<double> column(rows);
+
+  m.SetRows(rows);
+  for (j=0; j < cols; j++){
+    m.AddColumn();
+    for (i=0; i < rows; i++){
+      expected[j*rows + i] = j*rows + i;
+      m(i,j) = expected[j*rows + i];
+    }
+  }
+
+  /* down the columns backwards */
+  for (j=cols-1; j >= 0; j--){
+    for (i=0; i < rows; i++){
+      if (m(i,j) != expected[j*rows + i]){
+	failures++;
+      }
+    }
+  }
+
+  /* scattered reads and writes, in column mode and then in row mode */
+  k = 1;
+  for (n=0; n < 8*rows*cols; n++){
+    if (n == 4*rows*cols){
+      m.RowMode();
+    }
+    k = k*1103515245 + 12345;
+    i = (k >> 8) % rows;
+    j = (k >> 20) % cols;
+    if (n % 3 == 0){
+      expected[j*rows + i] = -n;
+      m(i,j) = -n;
+    } else if (m(i,j) != expected[j*rows + i]){
+      failures++;
+    }
+  }
+
+  /* across the rows */
+  for (i=0; i < rows; i++){
+    for (j=0; j < cols; j++){
+      if (m(i,j) != expected[j*rows + i]){
+	failures++;
+      }
+    }
+  }
+
+  for (j=0; j < cols; j++){
+    m.GetFullColumn(j, &column[0]);
+    for (i=0; i < rows; i++){
+      if (column[i] != expected[j*rows + i]){
+	failures++;
+      }
+    }
+  }
+
+  m.ColMode();
+  for (j=0; j < cols; j++){
+    m.GetFullColumn(j, &column[0]);
+    for (i=0; i < rows; i++){
+      if (column[i] != expected[j*rows + i]){
+	failures++;
+      }
+    }
+  }
+
+  return failures;
+}
+
+
+/* RunColumnWorkers() work: scale a pinned column by one more than its index */
+
+static void scale_column(int col, void *arg){
+
+  BufferedMatrix *m = (BufferedMatrix *)arg;
+  double *column = m->PinColumn(col);
+
+  for (int i=0; i < 23; i++){
+    column[i] *= col + 1;
+  }
+  m->UnpinColumn(col);
+}
+
+
+/* and work that fails on one column */
+
+static void refuse_column(int col, void *arg){
+
+  if (col == 5){
+    throw "Column 5 refused\n";
+  }
+}
+
 
 
 
@@ -142,6 +252,440 @@ int main(){
   // Testing ReadOnlyMode
   
   test.ReadOnlyMode(true);
+  test.ReadOnlyMode(false);
+
+
+  // GetFullColumn in row mode. This used to give back the column index
+  // rather than the data. Some columns are in the column buffer and some 
+  // are not, and some rows in the row buffer have been changed but not 
+  // yet written out.
+
+  int failures = 0;
+  int j, k, n;
+  double *column = new double[rows];
+  BufferedMatrix rowtest(4,3);
+
+  rowtest.SetPrefix("/tmp/BHMMAMA");
+  rowtest.SetRows(rows);
+  for (j=0; j < 6; j++){
+    rowtest.AddColumn();
+    for (i=0; i < rows; i++){
+      rowtest(i,j) = j*rows + i;
+    }
+  }
+
+  rowtest.RowMode();
+  for (j=0; j < 6; j++){
+    rowtest(1,j) = -(j*rows + 1);
+  }
+
+  for (j=0; j < 6; j++){
+    rowtest.GetFullColumn(j,column);
+    for (i=0; i < rows; i++){
+      if (column[i] != ((i == 1) ? -(j*rows + i) : j*rows + i)){
+	cout << "GetFullColumn in row mode wrong at " << i << " " << j << " " << column[i] << endl;
+	failures++;
+      }
+    }
+  }
+
+  /* and again with a buffer that has moved away from the changed rows */
+  rowtest(rows-1,5) = 1000.0;
+  for (j=0; j < 6; j++){
+    rowtest.GetFullColumn(j,column);
+    if (column[1] != -(j*rows + 1) || column[rows-1] != ((j == 5) ? 1000.0 : j*rows + rows-1)){
+      cout << "GetFullColumn in row mode wrong after moving the row buffer " << j << endl;
+      failures++;
+    }
+  }
+  rowtest.ColMode();
+  delete [] column;
+
+  if (failures){
+    cout << "GetFullColumn in row mode FAILED" << endl;
+    return 1;
+  }
+  cout << "GetFullColumn in row mode OK" << endl;
+
+
+  /* Automatic buffer sizes: everything in RAM when it fits, otherwise
+     within the budget for each kind of access */
+  int newrows, newcols;
+  double budget = 100*1000*sizeof(double);
+
+  if (!BufferedMatrix::ChooseBufferSize(1.0e12, 1000, 10, false, &newrows, &newcols) || newcols != 10){
+    cout << "ChooseBufferSize did not keep everything in RAM" << endl;
+    failures++;
+  }
+  if (BufferedMatrix::ChooseBufferSize(budget, 1000, 500, false, &newrows, &newcols) ||
+      newcols < 1 || newcols >= 100){
+    cout << "ChooseBufferSize columns wrong " << newcols << endl;
+    failures++;
+  }
+  if (BufferedMatrix::ChooseBufferSize(budget, 100000, 50, true, &newrows, &newcols) ||
+      newcols != 1 || newrows < 1000 || (double)newrows*50*sizeof(double) > budget){
+    cout << "ChooseBufferSize rows wrong " << newrows << " " << newcols << endl;
+    failures++;
+  }
+  if (failures){
+    cout << "ChooseBufferSize FAILED" << endl;
+    return 1;
+  }
+  cout << "ChooseBufferSize OK" << endl;
+
+
+  /* The whole matrix in one memory mapped file, which is grown (and 
+     remapped) as columns are added */
+  BufferedMatrix maptest(5,3);
+
+  maptest.SetPrefix("/tmp/BHMMAMA");
+  maptest.SetStorageMode(BUFFEREDMATRIX_STORAGE_MMAP);
+  failures = check_matrix(maptest, 23, 8);
+  if (failures){
+    cout << "MMAP storage FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "MMAP storage OK" << endl;
+
+
+  /* One file of tiles of rows. 23 rows leaves a short last tile, and 
+     the file is rearranged twice as the columns outgrow it */
+  BufferedMatrix tiletest(5,3);
+
+  tiletest.SetPrefix("/tmp/BHMMAMA");
+  tiletest.SetStorageMode(BUFFEREDMATRIX_STORAGE_TILED);
+  tiletest.SetTileRows(4);
+  failures = check_matrix(tiletest, 23, 8);
+  if (tiletest.GetStorageMode() != BUFFEREDMATRIX_STORAGE_TILED || tiletest.GetTileRows() != 4){
+    cout << "TILED storage mode not kept" << endl;
+    failures++;
+  }
+  if (failures){
+    cout << "TILED storage FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "TILED storage OK" << endl;
+
+
+  /* Read-ahead on a background thread. Walking down the rows (or along
+     the columns) in order should find the next block already read */
+  BufferedMatrix prefetchtest(5,3);
+
+  prefetchtest.SetPrefix("/tmp/BHMMAMA");
+  prefetchtest.SetPrefetch(true);
+  failures = check_matrix(prefetchtest, 23, 8);
+
+  vector<double> before(23*8), after(23*8);
+  for (j=0; j < 8; j++){
+    prefetchtest.GetFullColumn(j, &before[j*23]);
+  }
+  prefetchtest.RowMode();
+  prefetchtest.ResetPrefetchCounters();
+  for (i=0; i < 23; i++){
+    for (j=0; j < 8; j++){
+      prefetchtest(i,j) = prefetchtest(i,j) + 1.0;
+    }
+  }
+  prefetchtest.ColMode();
+  for (j=0; j < 8; j++){
+    prefetchtest.GetFullColumn(j, &after[j*23]);
+  }
+  for (i=0; i < 23*8; i++){
+    if (after[i] != before[i] + 1.0){
+      failures++;
+    }
+  }
+#if wxUSE_THREADS
+  if (prefetchtest.GetPrefetchHits() == 0){
+    cout << "Row buffer read-ahead never used" << endl;
+    failures++;
+  }
+#endif
+  prefetchtest.SetPrefetch(false);
+  if (failures){
+    cout << "Prefetch FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "Prefetch OK" << endl;
+
+
+  /* Column buffer replacement (CLOCK). One and two slot buffers, then a 
+     buffer that shrinks and grows while one column is used over and over
+     between the others */
+  failures = 0;
+  for (k=1; k <= 2; k++){
+    BufferedMatrix clocktest(5,k);
+    clocktest.SetPrefix("/tmp/BHMMAMA");
+    failures += check_matrix(clocktest, 23, 8);
+  }
+
+  BufferedMatrix resizetest(5,4);
+  resizetest.SetPrefix("/tmp/BHMMAMA");
+  failures += check_matrix(resizetest, 23, 8);
+  for (j=0; j < 8; j++){
+    resizetest.GetFullColumn(j, &before[j*23]);
+  }
+  for (n=0; n < 3; n++){
+    resizetest.ResizeColBuffer((n == 1) ? 6 : 2);
+    if (n == 2){
+      resizetest.RowMode();
+    }
+    for (j=7; j > 0; j--){
+      for (i=0; i < 23; i++){
+	resizetest(i,0) = resizetest(i,0) + 1.0;
+	resizetest(i,j) = resizetest(i,j) + 1.0;
+	before[i] += 1.0;
+	before[j*23 + i] += 1.0;
+      }
+    }
+  }
+  resizetest.ColMode();
+  resizetest.ResizeColBuffer(3);
+  for (j=0; j < 8; j++){
+    resizetest.GetFullColumn(j, &after[j*23]);
+  }
+  for (i=0; i < 23*8; i++){
+    if (after[i] != before[i]){
+      failures++;
+    }
+  }
+  if (failures){
+    cout << "Column buffer replacement FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "Column buffer replacement OK" << endl;
+
+
+  /* Single precision storage. Whole numbers come back exactly. Anything 
+     else comes back as the nearest float once it has left the buffers,
+     except when memory mapped, where the doubles are used directly */
+  failures = 0;
+  for (k=0; k < 3; k++){
+    BufferedMatrix floattest(5,2);
+    int mode = (k == 0) ? BUFFEREDMATRIX_STORAGE_FILES : ((k == 1) ? BUFFEREDMATRIX_STORAGE_TILED : BUFFEREDMATRIX_STORAGE_MMAP);
+
+    floattest.SetPrefix("/tmp/BHMMAMA");
+    floattest.SetStorageMode(mode);
+    floattest.SetSinglePrecisionStorage(true);
+    failures += check_matrix(floattest, 23, 8);
+
+    floattest(3,0) = 0.1;
+    for (j=1; j < 8; j++){
+      floattest(3,j) = floattest(3,j) + 0.5;
+    }
+    if (floattest.GetStorageMode() == BUFFEREDMATRIX_STORAGE_MMAP){
+      if (floattest(3,0) != 0.1){
+	failures++;
+      }
+    } else if (floattest(3,0) != (double)(float)0.1){
+      cout << "Single precision storage kept " << floattest(3,0) << endl;
+      failures++;
+    }
+  }
+  if (failures){
+    cout << "Single precision storage FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "Single precision storage OK" << endl;
+
+
+  /* Column and row spans, in column and row mode, and pinned columns */
+  BufferedMatrix spantest(5,3);
+  vector<double> span(23*8);
+  double *pinned;
+
+  spantest.SetPrefix("/tmp/BHMMAMA");
+  failures = check_matrix(spantest, 23, 8);
+  for (j=0; j < 8; j++){
+    spantest.GetFullColumn(j, &before[j*23]);
+  }
+
+  for (n=0; n < 2; n++){
+    if (n == 1){
+      spantest.RowMode();
+    }
+    /* a span either side of the row buffer, then one inside it */
+    for (j=0; j < 8; j++){
+      for (i=0; i < 9; i++){
+	span[i] = 1000*(n+1) + j*23 + i + 2;
+	before[j*23 + i + 2] = span[i];
+      }
+      spantest.SetColumnSpan(j, 2, 9, &span[0]);
+      spantest.GetColumnSpan(j, 0, 23, &span[0]);
+      for (i=0; i < 23; i++){
+	if (span[i] != before[j*23 + i]){
+	  failures++;
+	}
+      }
+    }
+    for (j=0; j < 8; j++){
+      for (i=0; i < 3; i++){
+	span[j*3 + i] = -1000*(n+1) - j*23 - i - 15;
+	before[j*23 + i + 15] = span[j*3 + i];
+      }
+    }
+    spantest.SetRowSpan(15, 3, &span[0]);
+    spantest.GetRowSpan(0, 23, &span[0]);
+    for (i=0; i < 23*8; i++){
+      if (span[i] != before[i]){
+	failures++;
+      }
+    }
+  }
+  spantest.ColMode();
+
+  /* changes made through a pinned column outlast its eviction */
+  pinned = spantest.PinColumn(6);
+  try {
+    spantest.AddColumn();
+    cout << "Added a column while one was pinned" << endl;
+    failures++;
+  } catch (const char *){
+  }
+  for (j=0; j < 8; j++){
+    spantest.GetFullColumn(j, &after[j*23]);
+  }
+  for (i=0; i < 23; i++){
+    pinned[i] = 2.0*after[6*23 + i];
+    before[6*23 + i] = pinned[i];
+  }
+  spantest.UnpinColumn(6);
+  for (j=0; j < 8; j++){
+    spantest.GetFullColumn(j, &after[j*23]);
+  }
+  for (i=0; i < 23*8; i++){
+    if (after[i] != before[i]){
+      failures++;
+    }
+  }
+  if (failures){
+    cout << "Spans and pinned columns FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "Spans and pinned columns OK" << endl;
+
+
+  /* Several columns worked on at once, each pinned by its own thread. 
+     With a three column buffer there is room for three such threads */
+  BufferedMatrix workertest(5,3);
+
+  workertest.SetPrefix("/tmp/BHMMAMA");
+  failures = check_matrix(workertest, 23, 8);
+  for (j=0; j < 8; j++){
+    workertest.GetFullColumn(j, &before[j*23]);
+  }
+  if (workertest.ColumnWorkers() < 1 || workertest.ColumnWorkers() > 3){
+    cout << "ColumnWorkers() gave " << workertest.ColumnWorkers() << endl;
+    failures++;
+  }
+  RunColumnWorkers(0, 8, 3, scale_column, &workertest);
+  for (j=0; j < 8; j++){
+    workertest.GetFullColumn(j, &after[j*23]);
+    for (i=0; i < 23; i++){
+      if (after[j*23 + i] != (j+1)*before[j*23 + i]){
+	failures++;
+      }
+    }
+  }
+  try {
+    RunColumnWorkers(0, 8, 3, refuse_column, &workertest);
+    cout << "RunColumnWorkers lost an error" << endl;
+    failures++;
+  } catch (const char *){
+  }
+  if (failures){
+    cout << "RunColumnWorkers FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "RunColumnWorkers OK" << endl;
+
+
+  /* Compressed chunks of rows in per column files (per column files 
+     without them when built without zlib). A chunk rewritten after it 
+     has grown no longer fits where it was. Then walking along the 
+     columns with read-ahead should find the next one already read */
+  failures = 0;
+  for (k=0; k < 2; k++){
+    BufferedMatrix ztest(5,3);
+    
+    ztest.SetPrefix("/tmp/BHMMAMA");
+    ztest.SetStorageMode(BUFFEREDMATRIX_STORAGE_COMPRESSED);
+    ztest.SetTileRows(4);
+    ztest.SetSinglePrecisionStorage(k == 1);
+    failures += check_matrix(ztest, 23, 8);
+
+    for (j=0; j < 8; j++){
+      for (i=0; i < 23; i++){
+	before[j*23 + i] = (i*7919 + j*104729) % 1000003 + 0.25;
+	ztest(i,j) = before[j*23 + i];
+      }
+    }
+    ztest.SetPrefetch(true);
+    ztest.ResetPrefetchCounters();
+    for (j=0; j < 8; j++){
+      ztest.GetFullColumn(j, &after[j*23]);
+    }
+    for (i=0; i < 23*8; i++){
+      if (after[i] != before[i]){
+	failures++;
+      }
+    }
+#if wxUSE_THREADS
+    if (ztest.GetPrefetchHits() == 0){
+      cout << "Column read-ahead never used" << endl;
+      failures++;
+    }
+#endif
+  }
+  if (failures){
+    cout << "COMPRESSED storage FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "COMPRESSED storage OK" << endl;
+
+
+  /* Removing the last columns, whether or not they are buffered, in 
+     each storage mode. Columns added afterwards start out as zeros */
+  failures = 0;
+  for (k=0; k < 4; k++){
+    BufferedMatrix removetest(5,3);
+    
+    removetest.SetPrefix("/tmp/BHMMAMA");
+    removetest.SetStorageMode(k);
+    failures += check_matrix(removetest, 23, 8);
+    for (j=0; j < 8; j++){
+      removetest.GetFullColumn(j, &before[j*23]);
+    }
+    
+    removetest.GetFullColumn(7, &after[0]);   /* buffered */
+    removetest.RemoveLastColumn();
+    removetest.GetFullColumn(0, &after[0]);   
+    removetest.GetFullColumn(1, &after[0]);   
+    removetest.GetFullColumn(2, &after[0]);   /* 6 is not */
+    removetest.RemoveLastColumn();
+    removetest.RowMode();
+    removetest.RemoveLastColumn();
+    removetest.AddColumn();
+    removetest.ColMode();
+    removetest.AddColumn();
+    if (removetest.Cols() != 7){
+      cout << "Removing columns left " << removetest.Cols() << endl;
+      failures++;
+    }
+    for (j=0; j < 7; j++){
+      removetest.GetFullColumn(j, &after[j*23]);
+      for (i=0; i < 23; i++){
+	if (after[j*23 + i] != ((j < 5) ? before[j*23 + i] : 0.0)){
+	  failures++;
+	}
+      }
+    }
+  }
+  if (failures){
+    cout << "RemoveLastColumn FAILED " << failures << endl;
+    return 1;
+  }
+  cout << "RemoveLastColumn OK" << endl;
 
 
 
@@ -0,0 +1,209 @@
+/*****************************************************
+ **
+ ** file: test_CELParsing.cpp
+ **
+ ** aim: Check that the text CEL readers return exactly the
+ **      intensities that were written to a file. Small and large
+ **      (bigger than one read block, see next_block_line()) files
+ **      are written with lines in a scrambled order, with both
+ **      "\r\n" and "\n" line endings, and read with
+ **      read_cel_file_intensities(), read_cel_file_intensities_at(),
+ **      read_cel_buffer_intensities() and
+ **      read_cel_file_intensities_bylines().
+ **
+ ** History
+ ** Oct 17, 2026 - Initial version
+ **
+ *****************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <wx/string.h>
+
+#include "Parsing/read_celfile_text.h"
+
+using namespace std;
+
+
+static double known_intensity(int index){
+  /* a mix of whole numbers and one or two decimal places, each
+     computed with a single rounding so it is what strtod() gives */
+  if (index % 7 == 0){
+    return (double)((index*37) % 46000);
+  } else if (index % 3 == 0){
+    return ((index*131) % 6500000)/100.0;
+  }
+  return (200 + (index*17) % 650000)/10.0;
+}
+
+
+/* writes a dim by dim text CEL file, ending lines with eol. If
+   n_lines is less than dim*dim only that many intensity lines are written */
+
+static void write_test_cel(const char *filename, int dim, const char *eol, int n_lines){
+
+  FILE *out = fopen(filename, "wb");
+  int i, index, x, y;
+  double mean;
+
+  if (out == NULL){
+    printf("Could not write %s\n", filename);
+    exit(1);
+  }
+
+  fprintf(out, "[CEL]%sVersion=3%s%s[HEADER]%s", eol, eol, eol, eol);
+  fprintf(out, "Cols=%d%sRows=%d%sTotalX=%d%sTotalY=%d%s", dim, eol, dim, eol, dim, eol, dim, eol);
+  fprintf(out, "DatHeader=[0..46101]  Test:CLS=%d RWS=%d XIN=1  YIN=1  VE=30        2.0 01/01/26 00:00:00       \024  \024 Test.1sq \024  \024  \024  \024  \024  \024  \024  \024  \024 6%s", dim, dim, eol);
+  fprintf(out, "Algorithm=Percentile%sAlgorithmParameters=Percentile:75;CellMargin:2%s%s", eol, eol, eol);
+  fprintf(out, "[INTENSITY]%sNumberCells=%d%sCellHeader=X\tY\tMEAN\tSTDV\tNPIXELS%s", eol, dim*dim, eol, eol);
+  for (i = 0; i < n_lines; i++){
+    /* 7919 is prime, so this visits every cell once */
+    index = (int)(((long)i*7919) % (dim*dim));
+    x = index % dim;
+    y = index / dim;
+    mean = known_intensity(index);
+    if (index % 7 == 0){
+      fprintf(out, "%3d\t%3d\t%.0f\t%.1f\t%3d%s", x, y, mean, mean/8.0, 16, eol);
+    } else if (index % 3 == 0){
+      fprintf(out, "%3d %3d  %.2f\t%.1f\t%3d%s", x, y, mean, mean/8.0, 16, eol);
+    } else {
+      fprintf(out, "%3d\t%3d\t%.1f\t%.1f\t%3d%s", x, y, mean, mean/8.0, 16, eol);
+    }
+  }
+  fprintf(out, "%s[MASKS]%sNumberCells=0%sCellHeader=X\tY%s%s[OUTLIERS]%sNumberCells=0%sCellHeader=X\tY%s", eol, eol, eol, eol, eol, eol, eol, eol);
+  fclose(out);
+}
+
+
+/* number of the length intensities in column chip_num of intensity that are not the known ones */
+
+static int count_differences(const vector<double> &intensity, int chip_num, int length){
+
+  int i, differences = 0;
+
+  for (i = 0; i < length; i++){
+    if (intensity[chip_num*length + i] != known_intensity(i)){
+      differences++;
+    }
+  }
+  return differences;
+}
+
+
+static int check_cel_file_readers(const char *filename, int dim){
+
+  int dim1, dim2, err_code = 0;
+  int length = dim*dim;
+  int failures = 0;
+  char *cdfName;
+  cel_descriptor descriptor;
+  FILE *in;
+  size_t size;
+
+  cdfName = get_header_info(filename, &dim1, &dim2, &err_code);
+  if (cdfName == NULL || dim1 != dim || dim2 != dim || strcmp(cdfName, "Test") != 0){
+    printf("%s: header not read back\n", filename);
+    free(cdfName);
+    return 1;
+  }
+  free(cdfName);
+
+  in = fopen(filename, "rb");
+  memset(&descriptor, 0, sizeof(descriptor));
+  if (probe_text_cel_file(in, &descriptor) != 0 || descriptor.n_cells != length){
+    printf("%s: probe_text_cel_file failed\n", filename);
+    fclose(in);
+    free(descriptor.cdfName);
+    return 1;
+  }
+  free(descriptor.cdfName);
+  fseek(in, 0, SEEK_END);
+  size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  vector<char> contents(size);
+  if (fread(&contents[0], 1, size, in) != size){
+    printf("%s: could not read back\n", filename);
+    fclose(in);
+    return 1;
+  }
+  fclose(in);
+
+  /* fill the second of two columns, so that chip_num is checked too */
+  vector<double> block(2*length, -1.0);
+  vector<double> at(2*length, -1.0);
+  vector<double> memory(2*length, -1.0);
+  vector<double> lines(2*length, -1.0);
+
+  if (read_cel_file_intensities(filename, &block[0], 1, length, 2, dim) != 0 || count_differences(block, 1, length) != 0 || block[0] != -1.0){
+    printf("%s: read_cel_file_intensities differs\n", filename);
+    failures++;
+  }
+  if (read_cel_file_intensities_at(filename, descriptor.data_offset, &at[0], 1, length, 2, dim) != 0 || count_differences(at, 1, length) != 0){
+    printf("%s: read_cel_file_intensities_at differs\n", filename);
+    failures++;
+  }
+  if (read_cel_buffer_intensities(&contents[0], size, descriptor.data_offset, filename, &memory[0], 1, length, 2, dim) != 0 || count_differences(memory, 1, length) != 0){
+    printf("%s: read_cel_buffer_intensities differs\n", filename);
+    failures++;
+  }
+  if (read_cel_file_intensities_bylines(filename, &lines[0], 1, length, 2, dim) != 0 || count_differences(lines, 1, length) != 0){
+    printf("%s: read_cel_file_intensities_bylines differs\n", filename);
+    failures++;
+  }
+
+  return failures;
+}
+
+
+int main(int argc, char **argv){
+
+  const char *filename = "/tmp/test_CELParsing.CEL";
+  int dims[2] = {5, 300};   /* 300 by 300 is well over one read block */
+  const char *eols[2] = {"\r\n", "\n"};
+  int d, e, errCode;
+
+  try {
+    for (d = 0; d < 2; d++){
+      for (e = 0; e < 2; e++){
+	write_test_cel(filename, dims[d], eols[e], dims[d]*dims[d]);
+	if (check_cel_file_readers(filename, dims[d])){
+	  printf("Text CEL round trip FAILED %d %d\n", d, e);
+	  remove(filename);
+	  return 1;
+	}
+      }
+    }
+    printf("Text CEL round trip OK\n");
+
+    /* the intensities stop short */
+    write_test_cel(filename, 300, "\r\n", 300*300 - 10);
+    vector<double> intensity(300*300);
+    errCode = read_cel_file_intensities(filename, &intensity[0], 0, 300*300, 1, 300);
+    if (errCode != TEXT_INTENSITY_TRUNCATED || errCode != read_cel_file_intensities_bylines(filename, &intensity[0], 0, 300*300, 1, 300)){
+      printf("Truncated text CEL FAILED %d\n", errCode);
+      remove(filename);
+      return 1;
+    }
+    printf("Truncated text CEL OK\n");
+
+    /* cells outside the array */
+    write_test_cel(filename, 300, "\n", 300*300);
+    errCode = read_cel_file_intensities(filename, &intensity[0], 0, 200*200, 1, 200);
+    if (errCode != TEXT_INTENSITY_CORRUPTED || errCode != read_cel_file_intensities_bylines(filename, &intensity[0], 0, 200*200, 1, 200)){
+      printf("Corrupted text CEL FAILED %d\n", errCode);
+      remove(filename);
+      return 1;
+    }
+    printf("Corrupted text CEL OK\n");
+  } catch (wxString &Error){
+    printf("%s", (const char *)Error.mb_str());
+    remove(filename);
+    return 1;
+  }
+
+  remove(filename);
+  return 0;
+}